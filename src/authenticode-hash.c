@@ -0,0 +1,300 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <dirent.h>
+
+#include "authenticode.h"
+#include "bufparser.h"
+#include "digest.h"
+#include "compdb.h"
+#include "workers.h"
+#include "util.h"
+
+/*
+ * Compute authenticode digests for a whole tree of EFI applications,
+ * for instance the payload of a shim, grub or kernel package. The
+ * output is a manifest or component database as used by --component-db.
+ */
+
+static void
+__authenticode_hash_scan(struct authenticode_hash *ah, const char *path, bool toplevel)
+{
+	struct dirent *de;
+	struct stat stb;
+	DIR *dir;
+
+	/* Paths given on the command line may be symlinks, for instance
+	 * /boot/efi pointing elsewhere. Inside the tree, we do not follow
+	 * symlinks to directories, so that loops cannot make us recurse
+	 * forever. Symlinks to files are hashed like the files themselves. */
+	if (lstat(path, &stb) < 0) {
+		error("Cannot stat %s: %m\n", path);
+		return;
+	}
+
+	if (S_ISLNK(stb.st_mode)) {
+		if (stat(path, &stb) < 0) {
+			debug("Ignoring dangling symlink %s\n", path);
+			return;
+		}
+		if (S_ISDIR(stb.st_mode) && !toplevel) {
+			debug("Not following symlink to directory %s\n", path);
+			return;
+		}
+	}
+
+	if (S_ISREG(stb.st_mode)) {
+		if ((ah->num_files % 64) == 0) {
+			char **tmp;
+
+			tmp = realloc(ah->files, (ah->num_files + 64) * sizeof(ah->files[0]));
+			if (tmp == NULL)
+				fatal("Out of memory\n");
+			ah->files = tmp;
+		}
+		ah->files[ah->num_files++] = strdup(path);
+		return;
+	}
+
+	if (!S_ISDIR(stb.st_mode))
+		return;
+
+	if (!(dir = opendir(path))) {
+		error("Unable to open directory %s: %m\n", path);
+		return;
+	}
+
+	while ((de = readdir(dir)) != NULL) {
+		char child[PATH_MAX];
+
+		if (de->d_name[0] == '.')
+			continue;
+
+		if (snprintf(child, sizeof(child), "%s/%s", path, de->d_name) >= (int) sizeof(child)) {
+			error("Path name too long: %s/%s\n", path, de->d_name);
+			continue;
+		}
+		__authenticode_hash_scan(ah, child, false);
+	}
+	closedir(dir);
+}
+
+void
+authenticode_hash_scan(struct authenticode_hash *ah, const char *path)
+{
+	__authenticode_hash_scan(ah, path, true);
+}
+
+static void
+authenticode_hash_emit(const struct authenticode_hash *ah, FILE *out, const char *name, const char *arch,
+		int kind, const tpm_evdigest_t *md)
+{
+	fprintf(out, "%s %s %s %s %s %s\n", name,
+			ah->version, arch,
+			compdb_digest_kind_name(kind),
+			md->algo->openssl_name,
+			digest_print_value(md));
+}
+
+/*
+ * Hash one file. Anything that is not a PE/COFF image is silently skipped.
+ * For images, we record both the authenticode digest (for BSA events) and the
+ * digest of the whole file (for boot loaders that measure the file they load).
+ */
+static bool
+authenticode_hash_one(const struct authenticode_hash *ah, const char *path, FILE *out)
+{
+	tpm_evdigest_t file_md[AUTHENTICODE_HASH_ALGOS_MAX];
+	pecoff_image_info_t *img;
+	const char *name, *arch;
+	buffer_t *img_data;
+	unsigned int i;
+
+	name = strrchr(path, '/');
+	name = name? name + 1 : path;
+	if (strpbrk(name, " \t\n")) {
+		warning("Skipping %s: white space in file name\n", path);
+		return true;
+	}
+
+	img_data = buffer_read_file(path, 0);
+	if (buffer_available(img_data) < 2 || memcmp(buffer_read_pointer(img_data), "MZ", 2)) {
+		debug("Skipping %s: not a PE/COFF image\n", path);
+		buffer_free(img_data);
+		return true;
+	}
+
+	for (i = 0; i < ah->num_algos; ++i)
+		file_md[i] = *digest_buffer(ah->algos[i], img_data);
+
+	/* if successful, this takes ownership of img_data */
+	if (!(img = pecoff_inspect(img_data, path))) {
+		error("Unable to parse PE/COFF image %s\n", path);
+		buffer_free(img_data);
+		return false;
+	}
+
+	arch = ah->arch? : pecoff_get_arch(img);
+	for (i = 0; i < ah->num_algos; ++i)
+		authenticode_hash_emit(ah, out, name, arch, COMPDB_DIGEST_FILE, &file_md[i]);
+
+	for (i = 0; i < ah->num_algos; ++i) {
+		const tpm_evdigest_t *md;
+		digest_ctx_t *digest;
+
+		digest = digest_ctx_new(ah->algos[i]);
+		md = authenticode_get_digest(img, digest);
+		if (md != NULL)
+			authenticode_hash_emit(ah, out, name, arch, COMPDB_DIGEST_AUTHENTICODE, md);
+		digest_ctx_free(digest);
+
+		if (md == NULL) {
+			error("Unable to compute authenticode digest of %s\n", path);
+			pecoff_image_info_free(img);
+			return false;
+		}
+	}
+
+	pecoff_image_info_free(img);
+	return true;
+}
+
+static int
+authenticode_hash_worker(const struct authenticode_hash *ah, unsigned int worker, FILE *out)
+{
+	unsigned int i;
+	int rv = 0;
+
+	for (i = worker; i < ah->num_files; i += ah->max_jobs) {
+		if (!authenticode_hash_one(ah, ah->files[i], out))
+			rv = 1;
+	}
+
+	if (fflush(out) != 0)
+		rv = 1;
+	return rv;
+}
+
+static void
+authenticode_hash_done(void *data, int wstatus)
+{
+	bool *okay = data;
+
+	if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0)
+		*okay = false;
+}
+
+int
+authenticode_hash(struct authenticode_hash *ah, const char *output_format, const char *output_path)
+{
+	compdb_builder_t *builder = NULL;
+	worker_pool_t *pool;
+	FILE **outputs;
+	unsigned int i;
+	bool okay = true;
+	double t0;
+
+	if (ah->num_files == 0) {
+		error("No files to hash\n");
+		return 1;
+	}
+
+	if (ah->max_jobs > ah->num_files)
+		ah->max_jobs = ah->num_files;
+
+	infomsg("Hashing %u files using up to %u workers\n", ah->num_files, ah->max_jobs);
+
+	outputs = calloc(ah->max_jobs, sizeof(outputs[0]));
+
+	t0 = timing_begin();
+	pool = worker_pool_new(ah->max_jobs);
+	for (i = 0; i < ah->max_jobs; ++i) {
+		pid_t pid;
+
+		if (!(outputs[i] = tmpfile())) {
+			error("Unable to create output file for worker: %m\n");
+			okay = false;
+			break;
+		}
+
+		if ((pid = worker_pool_fork(pool, authenticode_hash_done, &okay)) < 0) {
+			okay = false;
+			break;
+		}
+
+		if (pid == 0)
+			exit(authenticode_hash_worker(ah, i, outputs[i]));
+	}
+	worker_pool_free(pool);
+
+	if (!okay) {
+		error("Failed to hash all files\n");
+		goto out;
+	}
+
+	debug("Hashed %u files in %.3fs\n", ah->num_files, timing_since(t0));
+
+	builder = compdb_builder_new();
+	for (i = 0; i < ah->max_jobs && okay; ++i) {
+		rewind(outputs[i]);
+		okay = compdb_builder_parse_manifest(builder, outputs[i], "worker output");
+	}
+
+	if (!okay)
+		goto out;
+
+	if (output_format && !strcmp(output_format, "db")) {
+		if (output_path == NULL) {
+			error("Writing a component database requires --output\n");
+			okay = false;
+		} else {
+			okay = compdb_builder_write(builder, output_path);
+		}
+	} else if (output_path == NULL) {
+		okay = compdb_builder_write_manifest(builder, stdout);
+	} else {
+		FILE *fp;
+
+		if (!(fp = fopen(output_path, "w"))) {
+			error("Unable to open %s: %m\n", output_path);
+			okay = false;
+		} else {
+			okay = compdb_builder_write_manifest(builder, fp);
+			if (fclose(fp) != 0)
+				okay = false;
+		}
+	}
+
+out:
+	for (i = 0; i < ah->max_jobs; ++i) {
+		if (outputs[i])
+			fclose(outputs[i]);
+	}
+	free(outputs);
+	if (builder)
+		compdb_builder_free(builder);
+
+	return okay? 0 : 1;
+}
@@ -710,6 +710,12 @@ authenticode_get_digest(pecoff_image_info_t *img, digest_ctx_t *digest)
 	return authenticode_compute(&img->auth_info, img->data, digest);
 }
 
+const char *
+pecoff_get_arch(const pecoff_image_info_t *img)
+{
+	return __pecoff_get_machine(img);
+}
+
 cert_table_t *
 authenticode_get_certificate_table(const pecoff_image_info_t *img)
 {
@@ -25,9 +25,28 @@
 
 extern pecoff_image_info_t *pecoff_inspect(buffer_t *img_data, const char *display_name);
 extern void		pecoff_image_info_free(pecoff_image_info_t *);
+extern const char *	pecoff_get_arch(const pecoff_image_info_t *);
 extern tpm_evdigest_t *	authenticode_get_digest(pecoff_image_info_t *, digest_ctx_t *);
 extern cert_table_t *	authenticode_get_certificate_table(const pecoff_image_info_t *img);
 extern parsed_cert_t *	authenticode_get_signer(const pecoff_image_info_t *);
 
+/* Computing the digests of whole trees of EFI applications */
+#define AUTHENTICODE_HASH_ALGOS_MAX	8
+
+struct authenticode_hash {
+	unsigned int		num_algos;
+	const tpm_algo_info_t *	algos[AUTHENTICODE_HASH_ALGOS_MAX];
+	const char *		version;
+	const char *		arch;
+	unsigned int		max_jobs;
+
+	unsigned int		num_files;
+	char **			files;
+};
+
+extern void		authenticode_hash_scan(struct authenticode_hash *, const char *path);
+extern int		authenticode_hash(struct authenticode_hash *, const char *output_format,
+				const char *output_path);
+
 #endif /* AUTHENTICODE_H */
 
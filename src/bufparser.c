@@ -22,6 +22,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
+#include <limits.h>
 #include <errno.h>
 
 #include "bufparser.h"
@@ -104,3 +105,95 @@ buffer_write_file(const char *filename, buffer_t *bp)
 	debug2("Wrote %u bytes to %s\n", written, filename);
 	return true;
 }
+
+/*
+ * Write the buffer to a temporary file next to the destination, and rename
+ * it into place. Readers of the file will see either the old or the new
+ * content, but never a partially written file.
+ *
+ * If the destination exists, the new file gets its mode and ownership, and
+ * if it is a symlink, we replace the file it points to rather than the link.
+ * New files are created with mode 0600.
+ */
+bool
+buffer_write_file_atomic(const char *filename, buffer_t *bp)
+{
+	char real_path[PATH_MAX], temp_path[PATH_MAX];
+	struct stat stb;
+	bool exists = false;
+	int fd, n;
+
+	if (filename == NULL || !strcmp(filename, "-"))
+		return buffer_write_file(filename, bp);
+
+	if (lstat(filename, &stb) == 0) {
+		if (S_ISLNK(stb.st_mode)) {
+			if (realpath(filename, real_path) == NULL) {
+				error("Unable to resolve symlink %s: %m\n", filename);
+				return false;
+			}
+			filename = real_path;
+			if (stat(filename, &stb) < 0) {
+				error("Cannot stat %s: %m\n", filename);
+				return false;
+			}
+		}
+		exists = true;
+	} else if (errno != ENOENT) {
+		error("Cannot stat %s: %m\n", filename);
+		return false;
+	}
+
+	if (snprintf(temp_path, sizeof(temp_path), "%s.XXXXXX", filename) >= sizeof(temp_path)) {
+		error("%s: path name too long\n", filename);
+		return false;
+	}
+
+	/* mkstemp creates the file with mode 0600 */
+	if ((fd = mkstemp(temp_path)) < 0) {
+		error("Unable to create temporary file for %s: %m\n", filename);
+		return false;
+	}
+
+	if (exists) {
+		if ((stb.st_uid != geteuid() || stb.st_gid != getegid())
+		 && fchown(fd, stb.st_uid, stb.st_gid) < 0) {
+			error("Unable to preserve ownership of %s: %m\n", filename);
+			goto failed;
+		}
+		if (fchmod(fd, stb.st_mode & 07777) < 0) {
+			error("Unable to preserve mode of %s: %m\n", filename);
+			goto failed;
+		}
+	}
+
+	while ((n = buffer_available(bp)) != 0) {
+		n = write(fd, buffer_read_pointer(bp), n);
+		if (n < 0) {
+			error("write error on %s: %m\n", temp_path);
+			goto failed;
+		}
+
+		buffer_skip(bp, n);
+	}
+
+	if (fsync(fd) < 0) {
+		error("Unable to sync %s: %m\n", temp_path);
+		goto failed;
+	}
+	close(fd);
+
+	if (rename(temp_path, filename) < 0) {
+		error("Unable to rename %s to %s: %m\n", temp_path, filename);
+		unlink(temp_path);
+		return false;
+	}
+
+	debug2("Atomically replaced %s\n", filename);
+	return true;
+
+failed:
+	close(fd);
+	unlink(temp_path);
+	return false;
+}
@@ -328,5 +328,6 @@ buffer_copy(buffer_t *src, unsigned int count, buffer_t *dst)
 
 extern buffer_t *		buffer_read_file(const char *filename, int flags);
 extern bool			buffer_write_file(const char *filename, buffer_t *bp);
+extern bool			buffer_write_file_atomic(const char *filename, buffer_t *bp);
 
 #endif /* BUFPARSER_H */
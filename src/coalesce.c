@@ -0,0 +1,309 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+
+#include "coalesce.h"
+#include "digest.h"
+#include "workers.h"
+#include "util.h"
+
+struct coalesce {
+	char *			pending_path;
+	char *			lock_path;
+	char *			log_path;
+
+	int			lock_fd;
+};
+
+static char *
+__coalesce_path(const char *spool_dir, const char *key, const char *suffix)
+{
+	char path[PATH_MAX];
+
+	if (snprintf(path, sizeof(path), "%s/%s.%s", spool_dir, key, suffix) >= (int) sizeof(path)) {
+		error("Spool directory name %s is too long\n", spool_dir);
+		return NULL;
+	}
+	return strdup(path);
+}
+
+/*
+ * Requests are identified by a digest of the command line. Hooks that
+ * invoke pcr-oracle with different options do not get merged.
+ */
+static const char *
+__coalesce_key(int argc, char **argv)
+{
+	static char key[17];
+	const tpm_evdigest_t *md;
+	digest_ctx_t *ctx;
+	int i;
+
+	if (!(ctx = digest_ctx_new(digest_by_name("sha256"))))
+		return NULL;
+
+	for (i = 0; i < argc; ++i)
+		digest_ctx_update(ctx, argv[i], strlen(argv[i]) + 1);
+	md = digest_ctx_final(ctx, NULL);
+
+	snprintf(key, sizeof(key), "%.16s", digest_print_value(md));
+	digest_ctx_free(ctx);
+	return key;
+}
+
+coalesce_t *
+coalesce_open(const char *spool_dir, int argc, char **argv)
+{
+	coalesce_t *co;
+	const char *key;
+
+	if (mkdir(spool_dir, 0700) < 0 && errno != EEXIST) {
+		error("Unable to create spool directory %s: %m\n", spool_dir);
+		return NULL;
+	}
+
+	if (!(key = __coalesce_key(argc, argv)))
+		return NULL;
+
+	co = calloc(1, sizeof(*co));
+	co->pending_path = __coalesce_path(spool_dir, key, "pending");
+	co->lock_path = __coalesce_path(spool_dir, key, "lock");
+	co->log_path = __coalesce_path(spool_dir, key, "log");
+	co->lock_fd = -1;
+
+	if (!co->pending_path || !co->lock_path || !co->log_path) {
+		coalesce_close(co);
+		return NULL;
+	}
+	return co;
+}
+
+void
+coalesce_close(coalesce_t *co)
+{
+	coalesce_unlock(co);
+	drop_string(&co->pending_path);
+	drop_string(&co->lock_path);
+	drop_string(&co->log_path);
+	free(co);
+}
+
+/*
+ * Queue a request. Every new request pushes back the point in time at which
+ * the queue is considered settled.
+ */
+bool
+coalesce_enqueue(coalesce_t *co)
+{
+	int fd;
+
+	if ((fd = open(co->pending_path, O_WRONLY | O_CREAT | O_CLOEXEC, 0600)) < 0) {
+		error("Unable to create %s: %m\n", co->pending_path);
+		return false;
+	}
+
+	if (futimens(fd, NULL) < 0) {
+		error("Unable to update %s: %m\n", co->pending_path);
+		close(fd);
+		return false;
+	}
+
+	close(fd);
+	return true;
+}
+
+bool
+coalesce_is_pending(const coalesce_t *co)
+{
+	return access(co->pending_path, F_OK) == 0;
+}
+
+/*
+ * Try to become the process that executes queued requests.
+ * Returns false if somebody else already is.
+ */
+bool
+coalesce_lock(coalesce_t *co)
+{
+	if (co->lock_fd >= 0)
+		return true;
+
+	if ((co->lock_fd = open(co->lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) < 0) {
+		error("Unable to open %s: %m\n", co->lock_path);
+		return false;
+	}
+
+	if (flock(co->lock_fd, LOCK_EX | LOCK_NB) < 0) {
+		if (errno != EWOULDBLOCK)
+			error("Unable to lock %s: %m\n", co->lock_path);
+		close(co->lock_fd);
+		co->lock_fd = -1;
+		return false;
+	}
+
+	return true;
+}
+
+void
+coalesce_unlock(coalesce_t *co)
+{
+	if (co->lock_fd < 0)
+		return;
+
+	close(co->lock_fd);
+	co->lock_fd = -1;
+}
+
+/*
+ * Wait until no new request has been queued for settle_time seconds, and
+ * dequeue all requests. Returns false if there was nothing to do.
+ */
+bool
+coalesce_wait(coalesce_t *co, unsigned int settle_time)
+{
+	while (true) {
+		struct timespec now;
+		struct stat stb;
+		long age;
+
+		if (stat(co->pending_path, &stb) < 0) {
+			if (errno != ENOENT)
+				error("Unable to stat %s: %m\n", co->pending_path);
+			return false;
+		}
+
+		clock_gettime(CLOCK_REALTIME, &now);
+		age = now.tv_sec - stb.st_mtim.tv_sec;
+		if (age >= (long) settle_time || age < 0)
+			break;
+
+		sleep(settle_time - age);
+	}
+
+	/* Requests queued from now on will be handled by the next round */
+	if (unlink(co->pending_path) < 0 && errno != ENOENT) {
+		error("Unable to remove %s: %m\n", co->pending_path);
+		return false;
+	}
+
+	return true;
+}
+
+const char *
+coalesce_log_path(const coalesce_t *co)
+{
+	return co->log_path;
+}
+
+/*
+ * Coalescing of requests. Every invocation queues a request. The first one
+ * to take the lock detaches from its caller, so that the package manager can
+ * go on running the other hooks of the transaction, and waits until no new
+ * requests have been queued for settle_time seconds. It then runs the
+ * prediction in a child process, which returns from here and signs or seals
+ * as usual. Requests queued while the child runs trigger another round.
+ */
+int
+coalesce_run(const char *spool_dir, int argc, char **argv, unsigned int settle_time)
+{
+	coalesce_t *co;
+	int exit_code = 0;
+	int fd;
+	pid_t pid;
+
+	if (!(co = coalesce_open(spool_dir, argc, argv)))
+		return 1;
+
+	if (!coalesce_enqueue(co)) {
+		coalesce_close(co);
+		return 1;
+	}
+
+	if (!coalesce_lock(co)) {
+		infomsg("Request queued, will be handled by the running worker\n");
+		coalesce_close(co);
+		return 0;
+	}
+
+	if ((pid = worker_fork()) < 0) {
+		coalesce_close(co);
+		return 1;
+	}
+	if (pid > 0) {
+		infomsg("Request queued, worker %d logs to %s\n", (int) pid, coalesce_log_path(co));
+		coalesce_close(co);
+		return 0;
+	}
+
+	/* The worker inherits the lock, and must not hold on to the caller's terminal or pipes */
+	setsid();
+	if ((fd = open("/dev/null", O_RDONLY)) >= 0) {
+		dup2(fd, 0);
+		close(fd);
+	}
+	if ((fd = open(coalesce_log_path(co), O_WRONLY | O_CREAT | O_APPEND, 0600)) >= 0) {
+		dup2(fd, 1);
+		dup2(fd, 2);
+		close(fd);
+	}
+
+	while (true) {
+		while (coalesce_wait(co, settle_time)) {
+			int status;
+
+			infomsg("Executing queued request\n");
+			if ((pid = worker_fork()) < 0) {
+				exit_code = 1;
+				goto out;
+			}
+			if (pid == 0) {
+				coalesce_close(co);
+				return -1;
+			}
+
+			if (!worker_wait(pid, &status)) {
+				exit_code = 1;
+				goto out;
+			}
+
+			exit_code = WIFEXITED(status)? WEXITSTATUS(status) : 1;
+			infomsg("Queued request completed with exit status %d\n", exit_code);
+		}
+
+		/* A request queued just before we released the lock would
+		 * otherwise be left behind. */
+		coalesce_unlock(co);
+		if (!coalesce_is_pending(co) || !coalesce_lock(co))
+			break;
+	}
+
+out:
+	coalesce_close(co);
+	return exit_code;
+}
@@ -0,0 +1,48 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef COALESCE_H
+#define COALESCE_H
+
+#include <stdbool.h>
+
+/*
+ * Coalescing of requests, eg from the package hooks of a single
+ * transaction. Requests are queued in a spool directory, keyed by the
+ * command line, so that only identical requests are merged:
+ *
+ *   <key>.pending	exists while a request is queued; touched by
+ *			every new request
+ *   <key>.lock		locked by the one process that executes requests
+ *   <key>.log		output of that process
+ */
+typedef struct coalesce		coalesce_t;
+
+extern coalesce_t *		coalesce_open(const char *spool_dir, int argc, char **argv);
+extern void			coalesce_close(coalesce_t *);
+extern bool			coalesce_enqueue(coalesce_t *);
+extern bool			coalesce_is_pending(const coalesce_t *);
+extern bool			coalesce_lock(coalesce_t *);
+extern void			coalesce_unlock(coalesce_t *);
+extern bool			coalesce_wait(coalesce_t *, unsigned int settle_time);
+extern const char *		coalesce_log_path(const coalesce_t *);
+
+extern int			coalesce_run(const char *spool_dir, int argc, char **argv,
+					unsigned int settle_time);
+
+#endif /* COALESCE_H */
@@ -0,0 +1,724 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <endian.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "compdb.h"
+#include "digest.h"
+#include "bufparser.h"
+#include "util.h"
+
+#define COMPDB_DIGEST_SIZE_MAX	64
+
+struct compdb_header {
+	char			magic[8];
+	uint32_t		version;
+	uint32_t		num_entries;
+	uint32_t		num_digests;
+	uint32_t		strings_offset;
+	uint32_t		strings_size;
+	uint32_t		reserved;
+};
+
+struct compdb_entry {
+	uint32_t		name;
+	uint32_t		version;
+	uint32_t		arch;
+	uint32_t		first_digest;
+	uint32_t		num_digests;
+	uint32_t		reserved;
+};
+
+struct compdb_digest {
+	uint16_t		algo;
+	uint8_t			kind;
+	uint8_t			size;
+	uint32_t		reserved;
+	unsigned char		data[COMPDB_DIGEST_SIZE_MAX];
+};
+
+struct compdb_pin {
+	char *			name;
+	char *			version;
+};
+
+struct compdb {
+	char *			path;
+	void *			map;
+	size_t			map_size;
+
+	const struct compdb_header *header;
+	const struct compdb_entry *entries;
+	const struct compdb_digest *digests;
+	const char *		strings;
+	unsigned int		num_entries;
+	unsigned int		num_digests;
+	unsigned int		strings_size;
+
+	/* Selection criteria */
+	char *			arch;
+	unsigned int		num_pins;
+	struct compdb_pin *	pins;
+};
+
+struct compdb_record {
+	char *			name;
+	char *			version;
+	char *			arch;
+	int			kind;
+	tpm_evdigest_t		digest;
+};
+
+struct compdb_builder {
+	unsigned int		count;
+	struct compdb_record *	records;
+};
+
+static const char *
+__compdb_string(const compdb_t *db, uint32_t offset)
+{
+	return db->strings + le32toh(offset);
+}
+
+/*
+ * Convert a path name into a component name: strip the directory,
+ * and fold to lower case (EFI file systems are case insensitive).
+ */
+static const char *
+__compdb_component_name(const char *path)
+{
+	static char namebuf[PATH_MAX];
+	const char *base;
+	unsigned int i;
+
+	if ((base = strrchr(path, '/')) != NULL)
+		path = base + 1;
+	if ((base = strrchr(path, '\\')) != NULL)
+		path = base + 1;
+
+	for (i = 0; path[i] && i + 1 < sizeof(namebuf); ++i)
+		namebuf[i] = tolower((unsigned char) path[i]);
+	namebuf[i] = '\0';
+
+	return namebuf;
+}
+
+static bool
+__compdb_valid_string(const compdb_t *db, uint32_t offset)
+{
+	offset = le32toh(offset);
+	return offset < db->strings_size
+	    && memchr(db->strings + offset, '\0', db->strings_size - offset) != NULL;
+}
+
+static bool
+__compdb_validate(compdb_t *db)
+{
+	const struct compdb_header *hdr = db->map;
+	size_t offset;
+	unsigned int i;
+
+	if (db->map_size < sizeof(*hdr) || memcmp(hdr->magic, COMPDB_MAGIC, sizeof(hdr->magic))) {
+		error("%s: not a component database\n", db->path);
+		return false;
+	}
+
+	if (le32toh(hdr->version) != COMPDB_VERSION) {
+		error("%s: unsupported component database version %u\n", db->path, le32toh(hdr->version));
+		return false;
+	}
+
+	db->header = hdr;
+	db->num_entries = le32toh(hdr->num_entries);
+	db->num_digests = le32toh(hdr->num_digests);
+	db->strings_size = le32toh(hdr->strings_size);
+
+	offset = sizeof(*hdr);
+	db->entries = (const struct compdb_entry *) ((const char *) db->map + offset);
+
+	offset += (size_t) db->num_entries * sizeof(struct compdb_entry);
+	db->digests = (const struct compdb_digest *) ((const char *) db->map + offset);
+
+	offset += (size_t) db->num_digests * sizeof(struct compdb_digest);
+	if (offset != le32toh(hdr->strings_offset)
+	 || offset + db->strings_size != db->map_size) {
+		error("%s: inconsistent component database layout\n", db->path);
+		return false;
+	}
+	db->strings = (const char *) db->map + offset;
+
+	/* Check all entries once, so that lookups do not have to */
+	for (i = 0; i < db->num_entries; ++i) {
+		const struct compdb_entry *entry = &db->entries[i];
+		uint32_t first = le32toh(entry->first_digest);
+		uint32_t count = le32toh(entry->num_digests);
+
+		if (!__compdb_valid_string(db, entry->name)
+		 || !__compdb_valid_string(db, entry->version)
+		 || !__compdb_valid_string(db, entry->arch)
+		 || first > db->num_digests || count > db->num_digests - first)
+			goto bad_entry;
+
+		if (i && strcmp(__compdb_string(db, entry[-1].name), __compdb_string(db, entry->name)) > 0)
+			goto bad_entry;
+	}
+
+	for (i = 0; i < db->num_digests; ++i) {
+		const struct compdb_digest *dig = &db->digests[i];
+		const tpm_algo_info_t *algo_info;
+
+		if (!(algo_info = digest_by_tpm_alg(le16toh(dig->algo)))
+		 || algo_info->digest_size != dig->size) {
+			error("%s: bad digest %u\n", db->path, i);
+			return false;
+		}
+	}
+
+	return true;
+
+bad_entry:
+	error("%s: bad component entry %u\n", db->path, i);
+	return false;
+}
+
+compdb_t *
+compdb_open(const char *path)
+{
+	compdb_t *db;
+	struct stat stb;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		error("Unable to open component database %s: %m\n", path);
+		return NULL;
+	}
+
+	db = calloc(1, sizeof(*db));
+	db->path = strdup(path);
+
+	if (fstat(fd, &stb) < 0) {
+		error("Cannot stat %s: %m\n", path);
+		goto failed;
+	}
+
+	db->map_size = stb.st_size;
+	db->map = mmap(NULL, db->map_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (db->map == MAP_FAILED) {
+		error("Unable to map component database %s: %m\n", path);
+		db->map = NULL;
+		goto failed;
+	}
+
+	if (!__compdb_validate(db))
+		goto failed;
+
+	close(fd);
+	debug("Loaded component database %s with %u entries\n", path, db->num_entries);
+	return db;
+
+failed:
+	close(fd);
+	compdb_close(db);
+	return NULL;
+}
+
+void
+compdb_close(compdb_t *db)
+{
+	unsigned int i;
+
+	if (db->map)
+		munmap(db->map, db->map_size);
+
+	for (i = 0; i < db->num_pins; ++i) {
+		free(db->pins[i].name);
+		free(db->pins[i].version);
+	}
+	free(db->pins);
+
+	drop_string(&db->arch);
+	drop_string(&db->path);
+	free(db);
+}
+
+void
+compdb_set_arch(compdb_t *db, const char *arch)
+{
+	assign_string(&db->arch, arch);
+}
+
+/*
+ * Select a specific version of a component, given as "name=version".
+ * Without a pin, a component must be unique for the selected arch.
+ */
+bool
+compdb_pin_version(compdb_t *db, const char *name_version)
+{
+	struct compdb_pin *pin;
+	const char *eq;
+	char *name;
+
+	if (!(eq = strchr(name_version, '=')) || eq == name_version || eq[1] == '\0') {
+		error("Invalid component version \"%s\"; expected name=version\n", name_version);
+		return false;
+	}
+
+	name = strndup(name_version, eq - name_version);
+
+	db->pins = realloc(db->pins, (db->num_pins + 1) * sizeof(db->pins[0]));
+	pin = &db->pins[db->num_pins++];
+	pin->name = strdup(__compdb_component_name(name));
+	pin->version = strdup(eq + 1);
+
+	free(name);
+	return true;
+}
+
+static const char *
+__compdb_pinned_version(const compdb_t *db, const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < db->num_pins; ++i) {
+		if (!strcmp(db->pins[i].name, name))
+			return db->pins[i].version;
+	}
+	return NULL;
+}
+
+/*
+ * Locate the entry for the component referenced by path. Entries are
+ * sorted by name, so we do a binary search for the first entry with this
+ * name, and then apply the arch and version selection.
+ */
+static int
+__compdb_find(const compdb_t *db, const char *path, const struct compdb_entry **entry_ret)
+{
+	const struct compdb_entry *found = NULL;
+	const char *name, *version;
+	unsigned int lo = 0, hi = db->num_entries;
+
+	name = __compdb_component_name(path);
+
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+
+		if (strcmp(__compdb_string(db, db->entries[mid].name), name) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	version = __compdb_pinned_version(db, name);
+	for (; lo < db->num_entries; ++lo) {
+		const struct compdb_entry *entry = &db->entries[lo];
+
+		if (strcmp(__compdb_string(db, entry->name), name))
+			break;
+
+		if (db->arch && strcmp(__compdb_string(db, entry->arch), db->arch))
+			continue;
+		if (version && strcmp(__compdb_string(db, entry->version), version))
+			continue;
+
+		if (found != NULL)
+			return COMPDB_AMBIGUOUS;
+		found = entry;
+	}
+
+	*entry_ret = found;
+	return found? COMPDB_FOUND : COMPDB_NOT_FOUND;
+}
+
+bool
+compdb_contains(const compdb_t *db, const char *path)
+{
+	const struct compdb_entry *entry;
+
+	return __compdb_find(db, path, &entry) != COMPDB_NOT_FOUND;
+}
+
+/*
+ * Look up the digest of a component. If the database has several versions
+ * of the component, and the user did not tell us which one to use, we must
+ * not fall back to hashing the file on disk; that would silently predict
+ * for whatever happens to be installed.
+ */
+int
+compdb_lookup(const compdb_t *db, const char *path, const tpm_algo_info_t *algo, int kind,
+		const tpm_evdigest_t **md_ret)
+{
+	static tpm_evdigest_t md;
+	const struct compdb_entry *entry;
+	unsigned int i, first, count;
+	int result;
+
+	*md_ret = NULL;
+
+	result = __compdb_find(db, path, &entry);
+	if (result == COMPDB_AMBIGUOUS) {
+		error("Component database has several candidates for %s; "
+		      "please select one using --component-version or --component-arch\n",
+		      __compdb_component_name(path));
+		return COMPDB_AMBIGUOUS;
+	}
+	if (result == COMPDB_NOT_FOUND)
+		return COMPDB_NOT_FOUND;
+
+	first = le32toh(entry->first_digest);
+	count = le32toh(entry->num_digests);
+	for (i = first; i < first + count; ++i) {
+		const struct compdb_digest *dig = &db->digests[i];
+
+		if (le16toh(dig->algo) != algo->tcg_id || dig->kind != kind)
+			continue;
+
+		digest_set(&md, algo, dig->size, dig->data);
+		debug("  using %s digest of %s %s (%s) from component database\n",
+				compdb_digest_kind_name(kind),
+				__compdb_string(db, entry->name),
+				__compdb_string(db, entry->version),
+				__compdb_string(db, entry->arch));
+		*md_ret = &md;
+		return COMPDB_FOUND;
+	}
+
+	debug("  component database has no %s %s digest for %s\n",
+			algo->openssl_name, compdb_digest_kind_name(kind),
+			__compdb_string(db, entry->name));
+	return COMPDB_NOT_FOUND;
+}
+
+const char *
+compdb_digest_kind_name(int kind)
+{
+	switch (kind) {
+	case COMPDB_DIGEST_AUTHENTICODE:
+		return "authenticode";
+	case COMPDB_DIGEST_FILE:
+		return "file";
+	}
+	return "unknown";
+}
+
+int
+compdb_digest_kind_by_name(const char *name)
+{
+	if (!strcmp(name, "authenticode"))
+		return COMPDB_DIGEST_AUTHENTICODE;
+	if (!strcmp(name, "file"))
+		return COMPDB_DIGEST_FILE;
+	return -1;
+}
+
+/*
+ * Building a component database
+ */
+compdb_builder_t *
+compdb_builder_new(void)
+{
+	return calloc(1, sizeof(compdb_builder_t));
+}
+
+void
+compdb_builder_free(compdb_builder_t *builder)
+{
+	unsigned int i;
+
+	for (i = 0; i < builder->count; ++i) {
+		struct compdb_record *rec = &builder->records[i];
+
+		free(rec->name);
+		free(rec->version);
+		free(rec->arch);
+	}
+	free(builder->records);
+	free(builder);
+}
+
+bool
+compdb_builder_add(compdb_builder_t *builder, const char *name, const char *version, const char *arch,
+		int kind, const tpm_evdigest_t *md)
+{
+	struct compdb_record *rec;
+
+	if (md->size > COMPDB_DIGEST_SIZE_MAX)
+		return false;
+
+	if ((builder->count % 64) == 0)
+		builder->records = realloc(builder->records, (builder->count + 64) * sizeof(builder->records[0]));
+
+	rec = &builder->records[builder->count++];
+	rec->name = strdup(__compdb_component_name(name));
+	rec->version = strdup(version);
+	rec->arch = strdup(arch);
+	rec->kind = kind;
+	rec->digest = *md;
+	return true;
+}
+
+/*
+ * The manifest is a text file with one digest per line:
+ *
+ *   name version arch kind algo digest
+ *
+ * where kind is either "authenticode" or "file", and digest is a hex string.
+ */
+bool
+compdb_builder_read_manifest(compdb_builder_t *builder, const char *path)
+{
+	bool okay;
+	FILE *fp;
+
+	if (!(fp = fopen(path, "r"))) {
+		error("Unable to open %s: %m\n", path);
+		return false;
+	}
+
+	okay = compdb_builder_parse_manifest(builder, fp, path);
+	fclose(fp);
+	return okay;
+}
+
+bool
+compdb_builder_parse_manifest(compdb_builder_t *builder, FILE *fp, const char *path)
+{
+	char linebuf[1024];
+	unsigned int lineno = 0;
+
+	while (fgets(linebuf, sizeof(linebuf), fp) != NULL) {
+		char *w[6], *s;
+		const tpm_evdigest_t *md;
+		unsigned int n = 0;
+		int kind;
+
+		lineno++;
+		if ((s = strchr(linebuf, '#')) != NULL)
+			*s = '\0';
+
+		for (s = strtok(linebuf, " \t\n"); s && n < 6; s = strtok(NULL, " \t\n"))
+			w[n++] = s;
+
+		if (n == 0)
+			continue;
+
+		if (n != 6 || strtok(NULL, " \t\n") != NULL) {
+			error("%s:%u: wrong number of fields\n", path, lineno);
+			return false;
+		}
+
+		if ((kind = compdb_digest_kind_by_name(w[3])) < 0) {
+			error("%s:%u: unknown digest kind \"%s\"\n", path, lineno, w[3]);
+			return false;
+		}
+
+		if (!digest_by_name(w[4])) {
+			error("%s:%u: unknown digest algorithm \"%s\"\n", path, lineno, w[4]);
+			return false;
+		}
+
+		if (!(md = parse_digest(w[5], w[4]))) {
+			error("%s:%u: cannot parse %s digest\n", path, lineno, w[4]);
+			return false;
+		}
+
+		if (!compdb_builder_add(builder, w[0], w[1], w[2], kind, md))
+			return false;
+	}
+
+	return true;
+}
+
+static int
+__compdb_record_compare(const void *a, const void *b)
+{
+	const struct compdb_record *ra = a, *rb = b;
+	int r;
+
+	if ((r = strcmp(ra->name, rb->name)) != 0
+	 || (r = strcmp(ra->arch, rb->arch)) != 0
+	 || (r = strcmp(ra->version, rb->version)) != 0)
+		return r;
+
+	if (ra->kind != rb->kind)
+		return ra->kind - rb->kind;
+	return (int) ra->digest.algo->tcg_id - (int) rb->digest.algo->tcg_id;
+}
+
+static bool
+__compdb_record_same_component(const struct compdb_record *a, const struct compdb_record *b)
+{
+	return !strcmp(a->name, b->name)
+	    && !strcmp(a->arch, b->arch)
+	    && !strcmp(a->version, b->version);
+}
+
+/*
+ * Write all records in manifest format, sorted by component
+ */
+bool
+compdb_builder_write_manifest(compdb_builder_t *builder, FILE *fp)
+{
+	unsigned int i;
+
+	qsort(builder->records, builder->count, sizeof(builder->records[0]), __compdb_record_compare);
+
+	fprintf(fp, "# name version arch kind algo digest\n");
+	for (i = 0; i < builder->count; ++i) {
+		struct compdb_record *rec = &builder->records[i];
+
+		if (i && !__compdb_record_compare(rec - 1, rec)
+		 && digest_equal(&rec[-1].digest, &rec->digest))
+			continue;
+
+		fprintf(fp, "%s %s %s %s %s %s\n",
+				rec->name, rec->version, rec->arch,
+				compdb_digest_kind_name(rec->kind),
+				rec->digest.algo->openssl_name,
+				digest_print_value(&rec->digest));
+	}
+
+	return fflush(fp) == 0;
+}
+
+bool
+compdb_builder_write(compdb_builder_t *builder, const char *path)
+{
+	struct compdb_record *rec, *prev;
+	unsigned int num_entries = 0, num_digests = 0;
+	unsigned int strings_offset, strings_size = 0;
+	unsigned int i, entry_start = 0, string_pos;
+	buffer_t *bp;
+	bool okay;
+
+	qsort(builder->records, builder->count, sizeof(builder->records[0]), __compdb_record_compare);
+
+	/* Count entries and digests, weeding out duplicates */
+	for (i = 0, prev = NULL; i < builder->count; ++i) {
+		rec = &builder->records[i];
+
+		if (prev && __compdb_record_same_component(prev, rec)) {
+			if (prev->kind == rec->kind && prev->digest.algo == rec->digest.algo) {
+				if (!digest_equal(&prev->digest, &rec->digest)) {
+					error("Conflicting %s digests for %s %s (%s)\n",
+							compdb_digest_kind_name(rec->kind),
+							rec->name, rec->version, rec->arch);
+					return false;
+				}
+				rec->kind = 0;
+				continue;
+			}
+		} else {
+			strings_size += strlen(rec->name) + strlen(rec->version) + strlen(rec->arch) + 3;
+			num_entries++;
+		}
+
+		num_digests++;
+		prev = rec;
+	}
+
+	strings_offset = sizeof(struct compdb_header)
+			+ num_entries * sizeof(struct compdb_entry)
+			+ num_digests * sizeof(struct compdb_digest);
+
+	bp = buffer_alloc_write(strings_offset + strings_size);
+
+	buffer_put(bp, COMPDB_MAGIC, 8);
+	buffer_put_u32le(bp, COMPDB_VERSION);
+	buffer_put_u32le(bp, num_entries);
+	buffer_put_u32le(bp, num_digests);
+	buffer_put_u32le(bp, strings_offset);
+	buffer_put_u32le(bp, strings_size);
+	buffer_put_u32le(bp, 0);
+
+	/* Entry table */
+	num_digests = 0;
+	string_pos = 0;
+	for (i = 0, prev = NULL; i <= builder->count; ++i) {
+		rec = (i < builder->count)? &builder->records[i] : NULL;
+
+		if (rec && prev && __compdb_record_same_component(prev, rec)) {
+			if (rec->kind)
+				num_digests++;
+			continue;
+		}
+
+		if (prev) {
+			buffer_put_u32le(bp, string_pos);
+			string_pos += strlen(prev->name) + 1;
+			buffer_put_u32le(bp, string_pos);
+			string_pos += strlen(prev->version) + 1;
+			buffer_put_u32le(bp, string_pos);
+			string_pos += strlen(prev->arch) + 1;
+			buffer_put_u32le(bp, entry_start);
+			buffer_put_u32le(bp, num_digests - entry_start);
+			buffer_put_u32le(bp, 0);
+		}
+
+		entry_start = num_digests++;
+		prev = rec;
+	}
+
+	/* Digest table */
+	for (i = 0; i < builder->count; ++i) {
+		unsigned char data[COMPDB_DIGEST_SIZE_MAX];
+		uint8_t kind, size;
+
+		rec = &builder->records[i];
+		if (rec->kind == 0)
+			continue;
+
+		memset(data, 0, sizeof(data));
+		memcpy(data, rec->digest.data, rec->digest.size);
+		kind = rec->kind;
+		size = rec->digest.size;
+
+		buffer_put_u16le(bp, rec->digest.algo->tcg_id);
+		buffer_put_u8(bp, &kind);
+		buffer_put_u8(bp, &size);
+		buffer_put_u32le(bp, 0);
+		buffer_put(bp, data, sizeof(data));
+	}
+
+	/* String table */
+	for (i = 0, prev = NULL; i < builder->count; prev = rec, ++i) {
+		rec = &builder->records[i];
+		if (prev && __compdb_record_same_component(prev, rec))
+			continue;
+
+		buffer_put(bp, rec->name, strlen(rec->name) + 1);
+		buffer_put(bp, rec->version, strlen(rec->version) + 1);
+		buffer_put(bp, rec->arch, strlen(rec->arch) + 1);
+	}
+
+	okay = buffer_write_file_atomic(path, bp);
+	buffer_free(bp);
+
+	if (okay)
+		infomsg("Wrote component database %s with %u entries\n", path, num_entries);
+	return okay;
+}
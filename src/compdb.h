@@ -0,0 +1,83 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef COMPDB_H
+#define COMPDB_H
+
+#include <stdio.h>
+#include "types.h"
+
+/*
+ * A database of known-good boot components. Each component is identified
+ * by (name, version, arch), where name is the lower-cased base name of
+ * the file (eg "shimx64.efi" or "vmlinuz-6.4.0-1-default"). For every
+ * component, the database holds precomputed digests for one or more
+ * algorithms; authenticode digests for PE/COFF images, and plain file
+ * digests for anything that is measured as a whole.
+ *
+ * The on-disk format is designed so that it can be mmapped and searched
+ * in place:
+ *
+ *   header		struct compdb_header
+ *   entries		struct compdb_entry[num_entries], sorted by (name, arch, version)
+ *   digests		struct compdb_digest[num_digests]
+ *   strings		NUL terminated strings, referenced by offset
+ *
+ * All integers are little endian.
+ */
+#define COMPDB_MAGIC		"PCRCDB\0\1"
+#define COMPDB_VERSION		1
+
+enum {
+	COMPDB_DIGEST_AUTHENTICODE = 1,
+	COMPDB_DIGEST_FILE = 2,
+};
+
+/* Results of compdb_lookup */
+enum {
+	COMPDB_NOT_FOUND = 0,
+	COMPDB_FOUND,
+	COMPDB_AMBIGUOUS,
+};
+
+typedef struct compdb_builder	compdb_builder_t;
+
+extern compdb_t *		compdb_open(const char *path);
+extern void			compdb_close(compdb_t *);
+extern void			compdb_set_arch(compdb_t *, const char *arch);
+extern bool			compdb_pin_version(compdb_t *, const char *name_version);
+extern bool			compdb_contains(const compdb_t *, const char *path);
+extern int			compdb_lookup(const compdb_t *, const char *path,
+					const tpm_algo_info_t *, int kind,
+					const tpm_evdigest_t **md_ret);
+
+extern compdb_builder_t *	compdb_builder_new(void);
+extern void			compdb_builder_free(compdb_builder_t *);
+extern bool			compdb_builder_add(compdb_builder_t *,
+					const char *name, const char *version, const char *arch,
+					int kind, const tpm_evdigest_t *);
+extern bool			compdb_builder_read_manifest(compdb_builder_t *, const char *path);
+extern bool			compdb_builder_parse_manifest(compdb_builder_t *, FILE *,
+					const char *display_name);
+extern bool			compdb_builder_write_manifest(compdb_builder_t *, FILE *);
+extern bool			compdb_builder_write(compdb_builder_t *, const char *path);
+
+extern const char *		compdb_digest_kind_name(int kind);
+extern int			compdb_digest_kind_by_name(const char *name);
+
+#endif /* COMPDB_H */
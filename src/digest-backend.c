@@ -0,0 +1,823 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <openssl/evp.h>
+#include <sys/socket.h>
+#include <linux/if_alg.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+
+#include "digest.h"
+#include "digest-backend.h"
+#include "util.h"
+
+#ifndef AF_ALG
+# define AF_ALG		38
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+# include <cpuid.h>
+# include <immintrin.h>
+# define HAVE_SHA_NI	1
+#endif
+
+/*
+ * OpenSSL EVP
+ */
+struct openssl_ctx {
+	const EVP_MD *		evp_md;
+	EVP_MD_CTX *		mdctx;
+};
+
+static bool
+openssl_available(void)
+{
+	return true;
+}
+
+static bool
+openssl_supports(const tpm_algo_info_t *algo_info)
+{
+	return algo_info->openssl_name && EVP_get_digestbyname(algo_info->openssl_name) != NULL;
+}
+
+static bool
+openssl_init(void *handle)
+{
+	struct openssl_ctx *ctx = handle;
+
+	return EVP_DigestInit_ex(ctx->mdctx, ctx->evp_md, NULL);
+}
+
+static void *
+openssl_ctx_new(const tpm_algo_info_t *algo_info)
+{
+	struct openssl_ctx *ctx;
+	const EVP_MD *evp_md;
+
+	if (!algo_info->openssl_name || !(evp_md = EVP_get_digestbyname(algo_info->openssl_name)))
+		return NULL;
+
+	if (EVP_MD_size(evp_md) != algo_info->digest_size) {
+		error("OpenSSL digest %s has unexpected size %d\n", algo_info->openssl_name, EVP_MD_size(evp_md));
+		return NULL;
+	}
+
+	ctx = calloc(1, sizeof(*ctx));
+	ctx->evp_md = evp_md;
+	ctx->mdctx = EVP_MD_CTX_new();
+	if (!openssl_init(ctx)) {
+		EVP_MD_CTX_free(ctx->mdctx);
+		free(ctx);
+		return NULL;
+	}
+
+	return ctx;
+}
+
+static bool
+openssl_update(void *handle, const void *data, size_t size)
+{
+	struct openssl_ctx *ctx = handle;
+
+	return EVP_DigestUpdate(ctx->mdctx, data, size);
+}
+
+static bool
+openssl_final(void *handle, unsigned char *md, unsigned int *md_size)
+{
+	struct openssl_ctx *ctx = handle;
+
+	return EVP_DigestFinal_ex(ctx->mdctx, md, md_size);
+}
+
+static void
+openssl_ctx_free(void *handle)
+{
+	struct openssl_ctx *ctx = handle;
+
+	EVP_MD_CTX_free(ctx->mdctx);
+	free(ctx);
+}
+
+static digest_backend_t		openssl_backend = {
+	.name		= "openssl",
+	.description	= "OpenSSL EVP",
+	.available	= openssl_available,
+	.supports	= openssl_supports,
+	.ctx_new	= openssl_ctx_new,
+	.init		= openssl_init,
+	.update		= openssl_update,
+	.final		= openssl_final,
+	.ctx_free	= openssl_ctx_free,
+};
+
+/*
+ * Linux kernel crypto API. This lets us use hardware offload engines
+ * that the kernel has drivers for.
+ * The hash names used by the kernel are the same as the OpenSSL ones.
+ */
+struct af_alg_ctx {
+	int			tfm_fd;
+	int			op_fd;
+	unsigned int		md_size;
+};
+
+static int
+af_alg_bind(const char *name)
+{
+	struct sockaddr_alg sa;
+	int fd;
+
+	if (name == NULL || strlen(name) >= sizeof(sa.salg_name))
+		return -1;
+
+	if ((fd = socket(AF_ALG, SOCK_SEQPACKET, 0)) < 0)
+		return -1;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.salg_family = AF_ALG;
+	strcpy((char *) sa.salg_type, "hash");
+	strcpy((char *) sa.salg_name, name);
+
+	if (bind(fd, (struct sockaddr *) &sa, sizeof(sa)) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static bool
+af_alg_available(void)
+{
+	static int available = -1;
+	int fd;
+
+	if (available < 0) {
+		fd = socket(AF_ALG, SOCK_SEQPACKET, 0);
+		available = (fd >= 0);
+		if (fd >= 0)
+			close(fd);
+	}
+	return available;
+}
+
+static bool
+af_alg_supports(const tpm_algo_info_t *algo_info)
+{
+	int fd;
+
+	if ((fd = af_alg_bind(algo_info->openssl_name)) < 0)
+		return false;
+
+	close(fd);
+	return true;
+}
+
+static void *
+af_alg_ctx_new(const tpm_algo_info_t *algo_info)
+{
+	struct af_alg_ctx *ctx;
+	int tfm_fd, op_fd;
+
+	if ((tfm_fd = af_alg_bind(algo_info->openssl_name)) < 0)
+		return NULL;
+
+	if ((op_fd = accept(tfm_fd, NULL, 0)) < 0) {
+		debug("AF_ALG: accept failed for %s: %m\n", algo_info->openssl_name);
+		close(tfm_fd);
+		return NULL;
+	}
+
+	ctx = calloc(1, sizeof(*ctx));
+	ctx->tfm_fd = tfm_fd;
+	ctx->op_fd = op_fd;
+	ctx->md_size = algo_info->digest_size;
+	return ctx;
+}
+
+/* Reading the digest resets the kernel side hash state, so there's nothing
+ * to do here. */
+static bool
+af_alg_init(void *handle)
+{
+	return true;
+}
+
+static bool
+af_alg_update(void *handle, const void *data, size_t size)
+{
+	struct af_alg_ctx *ctx = handle;
+	const unsigned char *p = data;
+
+	while (size) {
+		ssize_t n;
+
+		n = send(ctx->op_fd, p, size, MSG_MORE);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			error("AF_ALG: send failed: %m\n");
+			return false;
+		}
+		p += n;
+		size -= n;
+	}
+
+	return true;
+}
+
+static bool
+af_alg_final(void *handle, unsigned char *md, unsigned int *md_size)
+{
+	struct af_alg_ctx *ctx = handle;
+	ssize_t n;
+
+	n = read(ctx->op_fd, md, ctx->md_size);
+	if (n != ctx->md_size) {
+		error("AF_ALG: unable to read digest: %m\n");
+		return false;
+	}
+
+	*md_size = n;
+	return true;
+}
+
+static void
+af_alg_ctx_free(void *handle)
+{
+	struct af_alg_ctx *ctx = handle;
+
+	close(ctx->op_fd);
+	close(ctx->tfm_fd);
+	free(ctx);
+}
+
+static digest_backend_t		af_alg_backend = {
+	.name		= "af_alg",
+	.description	= "Linux kernel crypto API",
+	.available	= af_alg_available,
+	.supports	= af_alg_supports,
+	.ctx_new	= af_alg_ctx_new,
+	.init		= af_alg_init,
+	.update		= af_alg_update,
+	.final		= af_alg_final,
+	.ctx_free	= af_alg_ctx_free,
+};
+
+#ifdef HAVE_SHA_NI
+/*
+ * Built-in SHA256, using the x86 SHA extensions.
+ */
+#define SHA256_BLOCK_SIZE	64
+#define SHA256_DIGEST_SIZE	32
+
+struct sha256_ctx {
+	uint32_t		h[8];
+	uint64_t		count;
+	unsigned int		buflen;
+	unsigned char		buf[SHA256_BLOCK_SIZE];
+};
+
+static const uint32_t		sha256_k[64] __attribute__((aligned(16))) = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t		sha256_iv[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+__attribute__((target("sha,sse4.1")))
+static void
+sha256_shani_blocks(uint32_t h[8], const unsigned char *data, size_t nblocks)
+{
+	const __m128i bswap_mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i state0, state1, abef_save, cdgh_save, msg, tmp;
+	__m128i w[4];
+	unsigned int i;
+
+	/* Rearrange the state words into the ABEF/CDGH layout the instructions expect */
+	tmp = _mm_loadu_si128((const __m128i *) &h[0]);
+	state1 = _mm_loadu_si128((const __m128i *) &h[4]);
+	tmp = _mm_shuffle_epi32(tmp, 0xB1);
+	state1 = _mm_shuffle_epi32(state1, 0x1B);
+	state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+	while (nblocks--) {
+		abef_save = state0;
+		cdgh_save = state1;
+
+		for (i = 0; i < 16; ++i) {
+			__m128i *wi = &w[i % 4];
+
+			if (i < 4) {
+				*wi = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 16 * i)), bswap_mask);
+			} else {
+				/* W[t] = s1(W[t-2]) + W[t-7] + s0(W[t-15]) + W[t-16] */
+				tmp = _mm_sha256msg1_epu32(*wi, w[(i + 1) % 4]);
+				tmp = _mm_add_epi32(tmp, _mm_alignr_epi8(w[(i + 3) % 4], w[(i + 2) % 4], 4));
+				*wi = _mm_sha256msg2_epu32(tmp, w[(i + 3) % 4]);
+			}
+
+			msg = _mm_add_epi32(*wi, _mm_load_si128((const __m128i *) &sha256_k[4 * i]));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			msg = _mm_shuffle_epi32(msg, 0x0E);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+		}
+
+		state0 = _mm_add_epi32(state0, abef_save);
+		state1 = _mm_add_epi32(state1, cdgh_save);
+		data += SHA256_BLOCK_SIZE;
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1B);
+	state1 = _mm_shuffle_epi32(state1, 0xB1);
+	state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+	state1 = _mm_alignr_epi8(state1, tmp, 8);
+
+	_mm_storeu_si128((__m128i *) &h[0], state0);
+	_mm_storeu_si128((__m128i *) &h[4], state1);
+}
+
+static bool
+builtin_available(void)
+{
+	static int available = -1;
+	unsigned int eax, ebx, ecx, edx;
+
+	if (available < 0) {
+		available = 0;
+		if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_1)
+		 && __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_SHA))
+			available = 1;
+	}
+	return available;
+}
+
+static bool
+builtin_supports(const tpm_algo_info_t *algo_info)
+{
+	return algo_info->digest_size == SHA256_DIGEST_SIZE
+	    && algo_info->openssl_name
+	    && !strcmp(algo_info->openssl_name, "sha256");
+}
+
+static bool
+builtin_init(void *handle)
+{
+	struct sha256_ctx *ctx = handle;
+
+	memcpy(ctx->h, sha256_iv, sizeof(ctx->h));
+	ctx->count = 0;
+	ctx->buflen = 0;
+	return true;
+}
+
+static void *
+builtin_ctx_new(const tpm_algo_info_t *algo_info)
+{
+	struct sha256_ctx *ctx;
+
+	if (!builtin_supports(algo_info))
+		return NULL;
+
+	ctx = calloc(1, sizeof(*ctx));
+	builtin_init(ctx);
+	return ctx;
+}
+
+static bool
+builtin_update(void *handle, const void *data, size_t size)
+{
+	struct sha256_ctx *ctx = handle;
+	const unsigned char *p = data;
+	size_t n;
+
+	ctx->count += size;
+
+	if (ctx->buflen) {
+		n = SHA256_BLOCK_SIZE - ctx->buflen;
+		if (n > size)
+			n = size;
+		memcpy(ctx->buf + ctx->buflen, p, n);
+		ctx->buflen += n;
+		p += n;
+		size -= n;
+
+		if (ctx->buflen < SHA256_BLOCK_SIZE)
+			return true;
+
+		sha256_shani_blocks(ctx->h, ctx->buf, 1);
+		ctx->buflen = 0;
+	}
+
+	if (size >= SHA256_BLOCK_SIZE) {
+		n = size / SHA256_BLOCK_SIZE;
+		sha256_shani_blocks(ctx->h, p, n);
+		p += n * SHA256_BLOCK_SIZE;
+		size -= n * SHA256_BLOCK_SIZE;
+	}
+
+	memcpy(ctx->buf, p, size);
+	ctx->buflen = size;
+	return true;
+}
+
+static bool
+builtin_final(void *handle, unsigned char *md, unsigned int *md_size)
+{
+	struct sha256_ctx *ctx = handle;
+	uint64_t nbits = ctx->count * 8;
+	unsigned int i;
+
+	ctx->buf[ctx->buflen++] = 0x80;
+	if (ctx->buflen > SHA256_BLOCK_SIZE - 8) {
+		memset(ctx->buf + ctx->buflen, 0, SHA256_BLOCK_SIZE - ctx->buflen);
+		sha256_shani_blocks(ctx->h, ctx->buf, 1);
+		ctx->buflen = 0;
+	}
+
+	memset(ctx->buf + ctx->buflen, 0, SHA256_BLOCK_SIZE - 8 - ctx->buflen);
+	for (i = 0; i < 8; ++i)
+		ctx->buf[SHA256_BLOCK_SIZE - 1 - i] = nbits >> (8 * i);
+	sha256_shani_blocks(ctx->h, ctx->buf, 1);
+
+	for (i = 0; i < 8; ++i) {
+		md[4 * i + 0] = ctx->h[i] >> 24;
+		md[4 * i + 1] = ctx->h[i] >> 16;
+		md[4 * i + 2] = ctx->h[i] >> 8;
+		md[4 * i + 3] = ctx->h[i];
+	}
+
+	*md_size = SHA256_DIGEST_SIZE;
+	return true;
+}
+
+static void
+builtin_ctx_free(void *handle)
+{
+	free(handle);
+}
+
+static digest_backend_t		builtin_backend = {
+	.name		= "builtin",
+	.description	= "built-in SHA256 using x86 SHA extensions",
+	.available	= builtin_available,
+	.supports	= builtin_supports,
+	.ctx_new	= builtin_ctx_new,
+	.init		= builtin_init,
+	.update		= builtin_update,
+	.final		= builtin_final,
+	.ctx_free	= builtin_ctx_free,
+};
+#endif
+
+static const digest_backend_t *	digest_backends[] = {
+	&openssl_backend,
+#ifdef HAVE_SHA_NI
+	&builtin_backend,
+#endif
+	&af_alg_backend,
+	NULL
+};
+
+/*
+ * Known answer tests. Every backend has to pass these before we use it
+ * for a given algorithm.
+ */
+#define KAT_LONG_LEN		1000
+
+struct digest_kat {
+	const char *		algo;
+	const char *		abc;
+	const char *		two_blocks;
+	const char *		long_a;
+};
+
+static const struct digest_kat	digest_kats[] = {
+	{ "sha1",
+	  "a9993e364706816aba3e25717850c26c9cd0d89d",
+	  "84983e441c3bd26ebaae4aa1f95129e5e54670f1",
+	  "291e9a6c66994949b57ba5e650361e98fc36b1ba" },
+	{ "sha256",
+	  "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+	  "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+	  "41edece42d63e8d9bf515a9ba6932e1c20cbc9f5a5d134645adb5db1b9737ea3" },
+	{ "sha384",
+	  "cb00753f45a35e8bb5a03d699ac65007272c32ab0eded1631a8b605a43ff5bed8086072ba1e7cc2358baeca134c825a7",
+	  "3391fdddfc8dc7393707a65b1b4709397cf8b1d162af05abfe8f450de5f36bc6b0455a8520bc4e6f5fe95b1fe3c8452b",
+	  "f54480689c6b0b11d0303285d9a81b21a93bca6ba5a1b4472765dca4da45ee328082d469c650cd3b61b16d3266ab8ced" },
+	{ "sha512",
+	  "ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f",
+	  "204a8fc6dda82f0a0ced7beb8e08a41657c16ef468b228a8279be331a703c33596fd15c13b1b07f9aa1d3bea57789ca031ad85c7a71dd70354ec631238ca3445",
+	  "67ba5535a46e3f86dbfbed8cbbaf0125c76ed549ff8b0b9e03e0c88cf90fa634fa7b12b47d77b694de488ace8d9a65967dc96df599727d3292a8d9d447709c97" },
+	{ NULL }
+};
+
+static bool
+__digest_kat_check(const digest_backend_t *backend, void *handle, const char *expect,
+		const void *data, size_t size, size_t chunk)
+{
+	unsigned char md[EVP_MAX_MD_SIZE];
+	char hex[2 * EVP_MAX_MD_SIZE + 1];
+	const unsigned char *p = data;
+	unsigned int i, md_size;
+
+	if (!backend->init(handle))
+		return false;
+
+	/* Feed the data in odd sized chunks, to exercise any buffering */
+	while (size) {
+		size_t n = (size < chunk)? size : chunk;
+
+		if (!backend->update(handle, p, n))
+			return false;
+		p += n;
+		size -= n;
+	}
+
+	if (!backend->final(handle, md, &md_size) || 2 * md_size != strlen(expect))
+		return false;
+
+	for (i = 0; i < md_size; ++i)
+		sprintf(hex + 2 * i, "%02x", md[i]);
+	return !strcmp(hex, expect);
+}
+
+bool
+digest_backend_self_test(const digest_backend_t *backend, const tpm_algo_info_t *algo_info)
+{
+	static const char two_blocks[] = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+	const struct digest_kat *kat;
+	unsigned char long_a[KAT_LONG_LEN];
+	void *handle;
+	bool okay;
+
+	for (kat = digest_kats; kat->algo; ++kat) {
+		if (algo_info->openssl_name && !strcmp(kat->algo, algo_info->openssl_name))
+			break;
+	}
+
+	if (kat->algo == NULL) {
+		debug("No known answer test for %s\n", algo_info->openssl_name);
+		return false;
+	}
+
+	if (!(handle = backend->ctx_new(algo_info)))
+		return false;
+
+	memset(long_a, 'a', sizeof(long_a));
+	okay = __digest_kat_check(backend, handle, kat->abc, "abc", 3, 3)
+	    && __digest_kat_check(backend, handle, kat->two_blocks, two_blocks, strlen(two_blocks), 7)
+	    && __digest_kat_check(backend, handle, kat->long_a, long_a, sizeof(long_a), 129);
+
+	backend->ctx_free(handle);
+
+	if (!okay)
+		error("Digest backend %s failed the known answer test for %s\n", backend->name, kat->algo);
+	return okay;
+}
+
+const digest_backend_t *
+digest_backend_by_name(const char *name)
+{
+	const digest_backend_t **bp, *backend;
+
+	for (bp = digest_backends; (backend = *bp) != NULL; ++bp) {
+		if (!strcmp(backend->name, name))
+			return backend;
+	}
+	return NULL;
+}
+
+static bool
+digest_backend_usable(const digest_backend_t *backend, const tpm_algo_info_t *algo_info)
+{
+	return backend->available()
+	    && backend->supports(algo_info)
+	    && digest_backend_self_test(backend, algo_info);
+}
+
+static double
+__digest_backend_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/*
+ * Hash messages of the given size for at least min_time seconds.
+ * Returns the throughput in MB/s, or a negative value on error.
+ */
+static double
+__digest_backend_measure(const digest_backend_t *backend, const tpm_algo_info_t *algo_info,
+		const unsigned char *data, size_t size, double min_time)
+{
+	unsigned char md[EVP_MAX_MD_SIZE];
+	unsigned int md_size;
+	unsigned long count = 0;
+	double start, elapsed;
+	void *handle;
+
+	if (!(handle = backend->ctx_new(algo_info)))
+		return -1;
+
+	start = __digest_backend_now();
+	do {
+		if (!backend->init(handle)
+		 || !backend->update(handle, data, size)
+		 || !backend->final(handle, md, &md_size)) {
+			backend->ctx_free(handle);
+			return -1;
+		}
+		count++;
+		elapsed = __digest_backend_now() - start;
+	} while (elapsed < min_time);
+
+	backend->ctx_free(handle);
+	return (count * size) / (elapsed * 1e6);
+}
+
+/*
+ * The workload we care about at startup is dominated by short messages,
+ * so that's what we time.
+ */
+#define SELECT_MESSAGE_SIZE	64
+#define SELECT_MIN_TIME		0.002
+
+static const char *		digest_backend_preferred = NULL;
+
+static const digest_backend_t *
+digest_backend_select(const tpm_algo_info_t *algo_info)
+{
+	const char *preferred = digest_backend_preferred;
+	const digest_backend_t **bp, *backend, *best = NULL;
+	unsigned char data[SELECT_MESSAGE_SIZE];
+	double best_rate = 0;
+
+	if (preferred != NULL && strcmp(preferred, "auto")) {
+		backend = digest_backend_by_name(preferred);
+		if (backend && digest_backend_usable(backend, algo_info))
+			return backend;
+		debug("Digest backend %s cannot be used for %s, picking another one\n",
+				preferred, algo_info->openssl_name);
+	}
+
+	memset(data, 0x5a, sizeof(data));
+	for (bp = digest_backends; (backend = *bp) != NULL; ++bp) {
+		double rate;
+
+		if (!digest_backend_usable(backend, algo_info))
+			continue;
+
+		rate = __digest_backend_measure(backend, algo_info, data, sizeof(data), SELECT_MIN_TIME);
+		debug("Digest backend %s: %s at %.1f MB/s\n", backend->name, algo_info->openssl_name, rate);
+		if (best == NULL || rate > best_rate) {
+			best = backend;
+			best_rate = rate;
+		}
+	}
+
+	return best;
+}
+
+/*
+ * Which backend to use can be overridden via --digest-backend.
+ */
+bool
+digest_backend_set_preferred(const char *name)
+{
+	if (strcmp(name, "auto") && digest_backend_by_name(name) == NULL) {
+		error("Unknown digest backend \"%s\"\n", name);
+		return false;
+	}
+
+	digest_backend_preferred = name;
+	return true;
+}
+
+#define DIGEST_BACKEND_CACHE_MAX	8
+
+const digest_backend_t *
+digest_backend_for(const tpm_algo_info_t *algo_info)
+{
+	static struct {
+		const tpm_algo_info_t *algo_info;
+		const digest_backend_t *backend;
+	} cache[DIGEST_BACKEND_CACHE_MAX];
+	const digest_backend_t *backend;
+	unsigned int i;
+
+	for (i = 0; i < DIGEST_BACKEND_CACHE_MAX; ++i) {
+		if (cache[i].algo_info == algo_info)
+			return cache[i].backend;
+		if (cache[i].algo_info == NULL)
+			break;
+	}
+
+	if ((backend = digest_backend_select(algo_info)) == NULL)
+		return NULL;
+
+	debug("Using %s digest backend for %s\n", backend->name, algo_info->openssl_name);
+	if (i < DIGEST_BACKEND_CACHE_MAX) {
+		cache[i].algo_info = algo_info;
+		cache[i].backend = backend;
+	}
+
+	return backend;
+}
+
+/*
+ * Implementation of the digest-bench action
+ */
+static const size_t		bench_sizes[] = { 64, 1024, 16384, 1024 * 1024, 0 };
+
+bool
+digest_backend_bench(void)
+{
+	static const char *algo_names[] = { "sha1", "sha256", "sha384", "sha512", NULL };
+	const digest_backend_t **bp, *backend;
+	unsigned char *data;
+	unsigned int i, j;
+	bool okay = true;
+
+	data = malloc(1024 * 1024);
+	memset(data, 0x5a, 1024 * 1024);
+
+	printf("%-10s %-8s %-9s", "Backend", "Algo", "KAT");
+	for (j = 0; bench_sizes[j]; ++j) {
+		if (bench_sizes[j] >= 1024 * 1024)
+			printf(" %7zuM", bench_sizes[j] / (1024 * 1024));
+		else if (bench_sizes[j] >= 1024)
+			printf(" %7zuK", bench_sizes[j] / 1024);
+		else
+			printf(" %7zuB", bench_sizes[j]);
+	}
+	printf("   (MB/s)\n");
+
+	for (bp = digest_backends; (backend = *bp) != NULL; ++bp) {
+		for (i = 0; algo_names[i]; ++i) {
+			const tpm_algo_info_t *algo_info = digest_by_name(algo_names[i]);
+
+			printf("%-10s %-8s ", backend->name, algo_names[i]);
+			if (!backend->available()) {
+				printf("%-9s\n", "n/a");
+				continue;
+			}
+			if (!backend->supports(algo_info)) {
+				printf("%-9s\n", "-");
+				continue;
+			}
+			if (!digest_backend_self_test(backend, algo_info)) {
+				printf("%-9s\n", "FAILED");
+				okay = false;
+				continue;
+			}
+
+			printf("%-9s", "ok");
+			for (j = 0; bench_sizes[j]; ++j)
+				printf(" %8.1f", __digest_backend_measure(backend, algo_info, data, bench_sizes[j], 0.1));
+			printf("\n");
+		}
+	}
+
+	printf("\nSelected backends:\n");
+	for (i = 0; algo_names[i]; ++i) {
+		backend = digest_backend_for(digest_by_name(algo_names[i]));
+		printf("  %-8s %s\n", algo_names[i], backend? backend->name : "none");
+	}
+
+	free(data);
+	return okay;
+}
@@ -0,0 +1,50 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef DIGEST_BACKEND_H
+#define DIGEST_BACKEND_H
+
+#include <stddef.h>
+#include "types.h"
+
+/*
+ * A digest backend implements the actual hashing underneath digest_ctx_t
+ * and digest_compute(). A backend handle is created for one algorithm, and
+ * can be reused for several messages by calling init() before each one.
+ */
+typedef struct digest_backend {
+	const char *	name;
+	const char *	description;
+
+	bool		(*available)(void);
+	bool		(*supports)(const tpm_algo_info_t *);
+
+	void *		(*ctx_new)(const tpm_algo_info_t *);
+	bool		(*init)(void *);
+	bool		(*update)(void *, const void *, size_t);
+	bool		(*final)(void *, unsigned char *md, unsigned int *md_size);
+	void		(*ctx_free)(void *);
+} digest_backend_t;
+
+extern bool			digest_backend_set_preferred(const char *name);
+extern const digest_backend_t *	digest_backend_by_name(const char *name);
+extern const digest_backend_t *	digest_backend_for(const tpm_algo_info_t *);
+extern bool			digest_backend_self_test(const digest_backend_t *, const tpm_algo_info_t *);
+extern bool			digest_backend_bench(void);
+
+#endif /* DIGEST_BACKEND_H */
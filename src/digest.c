@@ -28,6 +28,7 @@
 #include <assert.h>
 
 #include "digest.h"
+#include "digest-backend.h"
 #include "eventlog.h"
 #include "runtime.h"
 #include "bufparser.h"
@@ -147,12 +148,85 @@ digest_set(tpm_evdigest_t *md, const tpm_algo_info_t *algo_info,
 	memcpy(md->data, data, size);
 }
 
+/*
+ * Most digests we compute are for short messages (strings, variables, PCR
+ * extends), so we do not want to go through a full context lifecycle for
+ * each of them. Keep one backend handle per algorithm around, and reuse it.
+ */
+#define DIGEST_ENGINE_CACHE_MAX	8
+
+struct digest_engine {
+	const tpm_algo_info_t *	algo_info;
+	const digest_backend_t *backend;
+	void *			handle;
+};
+
+static struct digest_engine *
+digest_get_engine(const tpm_algo_info_t *algo_info)
+{
+	static struct digest_engine cache[DIGEST_ENGINE_CACHE_MAX];
+	const digest_backend_t *backend;
+	struct digest_engine *engine;
+	unsigned int i;
+
+	for (i = 0; i < DIGEST_ENGINE_CACHE_MAX; ++i) {
+		engine = &cache[i];
+
+		if (engine->algo_info == algo_info)
+			return engine;
+
+		if (engine->algo_info == NULL) {
+			if ((backend = digest_backend_for(algo_info)) == NULL
+			 || (engine->handle = backend->ctx_new(algo_info)) == NULL)
+				return NULL;
+			engine->backend = backend;
+			engine->algo_info = algo_info;
+			return engine;
+		}
+	}
+
+	/* Cache full; should not happen with the handful of algorithms we support */
+	return NULL;
+}
+
+/*
+ * Hash the concatenation of up to two messages.
+ */
+static bool
+digest_engine_hash(struct digest_engine *engine,
+		const void *data1, size_t size1,
+		const void *data2, size_t size2,
+		tpm_evdigest_t *result)
+{
+	const digest_backend_t *backend = engine->backend;
+	unsigned char md_data[EVP_MAX_MD_SIZE];
+	unsigned int md_size;
+
+	if (!backend->init(engine->handle)
+	 || !backend->update(engine->handle, data1, size1)
+	 || (size2 && !backend->update(engine->handle, data2, size2))
+	 || !backend->final(engine->handle, md_data, &md_size)) {
+		error("Unable to compute %s digest\n", engine->algo_info->openssl_name);
+		return false;
+	}
+
+	digest_set(result, engine->algo_info, md_size, md_data);
+	return true;
+}
+
 const tpm_evdigest_t *
 digest_compute(const tpm_algo_info_t *algo_info, const void *data, unsigned int size)
 {
 	static tpm_evdigest_t md;
+	struct digest_engine *engine;
 	digest_ctx_t *ctx;
 
+	if ((engine = digest_get_engine(algo_info)) != NULL) {
+		if (!digest_engine_hash(engine, data, size, NULL, 0, &md))
+			return NULL;
+		return &md;
+	}
+
 	memset(&md, 0, sizeof(md));
 	ctx = digest_ctx_new(algo_info);
 	if (ctx == NULL)
@@ -166,6 +240,24 @@ digest_compute(const tpm_algo_info_t *algo_info, const void *data, unsigned int
 	return &md;
 }
 
+/*
+ * Extend a PCR value in place: pcr = H(pcr || d)
+ */
+bool
+digest_extend(tpm_evdigest_t *pcr, const tpm_evdigest_t *d)
+{
+	struct digest_engine *engine;
+
+	if (pcr->algo != d->algo)
+		fatal("%s: cannot extend %s digest using %s\n", __func__,
+				digest_algo_name(pcr), digest_algo_name(d));
+
+	if (!(engine = digest_get_engine(pcr->algo)))
+		return false;
+
+	return digest_engine_hash(engine, pcr->data, pcr->size, d->data, d->size, pcr);
+}
+
 const tpm_evdigest_t *
 digest_buffer(const tpm_algo_info_t *algo_info, struct buffer *buffer)
 {
@@ -220,7 +312,8 @@ digest_is_invalid(const tpm_evdigest_t *md)
 }
 
 struct digest_ctx {
-	EVP_MD_CTX *	mdctx;
+	const digest_backend_t *backend;
+	void *		handle;
 
 	tpm_evdigest_t	md;
 };
@@ -228,20 +321,23 @@ struct digest_ctx {
 digest_ctx_t *
 digest_ctx_new(const tpm_algo_info_t *algo_info)
 {
-	const EVP_MD *evp_md;
+	const digest_backend_t *backend;
 	digest_ctx_t *ctx;
+	void *handle;
 
-	evp_md = EVP_get_digestbyname(algo_info->openssl_name);
-	if (evp_md == NULL) {
+	if ((backend = digest_backend_for(algo_info)) == NULL) {
 		error("Unknown message digest %s\n", algo_info->openssl_name);
 		return NULL;
 	}
 
-	assert(EVP_MD_size(evp_md) == algo_info->digest_size);
+	if ((handle = backend->ctx_new(algo_info)) == NULL) {
+		error("Unable to create %s context for %s\n", backend->name, algo_info->openssl_name);
+		return NULL;
+	}
 
 	ctx = calloc(1, sizeof(*ctx));
-	ctx->mdctx = EVP_MD_CTX_new();
-	EVP_DigestInit_ex(ctx->mdctx, evp_md, NULL);
+	ctx->backend = backend;
+	ctx->handle = handle;
 
 	ctx->md.algo = algo_info;
 
@@ -251,10 +347,11 @@ digest_ctx_new(const tpm_algo_info_t *algo_info)
 void
 digest_ctx_update(digest_ctx_t *ctx, const void *data, unsigned int size)
 {
-	if (ctx->mdctx == NULL)
+	if (ctx->handle == NULL)
 		fatal("%s: trying to update digest after having finalized it\n", __func__);
 
-	EVP_DigestUpdate(ctx->mdctx, data, size);
+	if (!ctx->backend->update(ctx->handle, data, size))
+		fatal("%s: %s digest update failed\n", __func__, ctx->backend->name);
 }
 
 tpm_evdigest_t *
@@ -262,11 +359,12 @@ digest_ctx_final(digest_ctx_t *ctx, tpm_evdigest_t *result)
 {
 	tpm_evdigest_t *md = &ctx->md;
 
-	if (ctx->mdctx) {
-		EVP_DigestFinal_ex(ctx->mdctx, md->data, &md->size);
+	if (ctx->handle) {
+		if (!ctx->backend->final(ctx->handle, md->data, &md->size))
+			fatal("%s: %s digest computation failed\n", __func__, ctx->backend->name);
 
-		EVP_MD_CTX_free(ctx->mdctx);
-		ctx->mdctx = NULL;
+		ctx->backend->ctx_free(ctx->handle);
+		ctx->handle = NULL;
 	}
 
 	if (result) {
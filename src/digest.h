@@ -71,6 +71,7 @@ extern void			digest_ctx_free(digest_ctx_t *);
 extern const tpm_evdigest_t *	digest_buffer(const tpm_algo_info_t *, buffer_t *);
 extern const tpm_evdigest_t *	digest_compute(const tpm_algo_info_t *, const void *, unsigned int);
 extern const tpm_evdigest_t *	digest_from_file(const tpm_algo_info_t *algo_info, const char *filename, int flags);
+extern bool			digest_extend(tpm_evdigest_t *pcr, const tpm_evdigest_t *d);
 
 extern const tpm_algo_info_t *	__digest_by_tpm_alg(unsigned int, const tpm_algo_info_t *, unsigned int);
 
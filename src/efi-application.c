@@ -32,6 +32,7 @@
 #include "authenticode.h"
 #include "digest.h"
 #include "sd-boot.h"
+#include "compdb.h"
 #include "util.h"
 
 
@@ -113,7 +114,11 @@ __tpm_event_parse_efi_bsa(tpm_event_t *ev, tpm_parsed_event_t *parsed, buffer_t
 			assign_string(&ctx->efi_partition, evspec->efi_partition);
 		else
 			assign_string(&evspec->efi_partition, ctx->efi_partition);
-		__tpm_event_efi_bsa_inspect_image(evspec);
+
+		/* Note, we do not inspect the image here. Reading the whole
+		 * application from the ESP is expensive, and not needed at all
+		 * unless we actually predict a PCR that depends on it.
+		 * See efi_application_get_image_info() */
 	}
 
 	/* When the shim issue is present the efi_application will be
@@ -189,6 +194,27 @@ __tpm_event_efi_bsa_inspect_image(struct efi_bsa_event *evspec)
 	return true;
 }
 
+/*
+ * Inspect the PECOFF image on first use.
+ */
+static pecoff_image_info_t *
+__tpm_event_efi_bsa_get_image_info(struct efi_bsa_event *evspec)
+{
+	if (!evspec->img_inspected) {
+		evspec->img_inspected = true;
+		__tpm_event_efi_bsa_inspect_image(evspec);
+	}
+
+	return evspec->img_info;
+}
+
+const pecoff_image_info_t *
+efi_application_get_image_info(const tpm_parsed_event_t *parsed)
+{
+	/* The parsed event is logically const; we only fill in the cached image info */
+	return __tpm_event_efi_bsa_get_image_info((struct efi_bsa_event *) &parsed->efi_bsa_event);
+}
+
 static const tpm_evdigest_t *
 __pecoff_rehash_old(tpm_event_log_rehash_ctx_t *ctx, const char *filename)
 {
@@ -235,18 +261,22 @@ __pecoff_rehash_old(tpm_event_log_rehash_ctx_t *ctx, const char *filename)
 }
 
 static const tpm_evdigest_t *
-__efi_application_rehash_direct(const struct efi_bsa_event *evspec, tpm_event_log_rehash_ctx_t *ctx)
+__efi_application_rehash_direct(struct efi_bsa_event *evspec, tpm_event_log_rehash_ctx_t *ctx)
 {
+	pecoff_image_info_t *img_info;
 	const tpm_evdigest_t *md;
 	digest_ctx_t *digest;
 
 	debug("Computing authenticode digest using built-in PECOFF parser\n");
-	if (evspec->img_info == NULL)
+	if ((img_info = __tpm_event_efi_bsa_get_image_info(evspec)) == NULL)
 		return NULL;
 
+	/* The image may have been loaded (and cached) before anyone was tracking inputs */
+	runtime_track_efi_application(evspec->efi_partition, evspec->efi_application);
+
 	digest = digest_ctx_new(ctx->algo);
 
-	md = authenticode_get_digest(evspec->img_info, digest);
+	md = authenticode_get_digest(img_info, digest);
 
 	digest_ctx_free(digest);
 
@@ -274,14 +304,14 @@ __efi_application_rehash_pesign(tpm_event_log_rehash_ctx_t *ctx, const char *dev
 parsed_cert_t *
 efi_application_extract_signer(const tpm_parsed_event_t *parsed)
 {
-	const struct efi_bsa_event *evspec = &parsed->efi_bsa_event;
+	const pecoff_image_info_t *img_info;
 
-	if (evspec->img_info == NULL) {
+	if ((img_info = efi_application_get_image_info(parsed)) == NULL) {
 		debug("%s: cannot extract signer, no image info for this application\n", __func__);
 		return NULL;
 	}
 
-	return authenticode_get_signer(evspec->img_info);
+	return authenticode_get_signer(img_info);
 }
 
 static bool __is_shim_issue(const tpm_event_t *ev, const struct efi_bsa_event *evspec)
@@ -315,6 +345,7 @@ __tpm_event_efi_bsa_rehash(const tpm_event_t *ev, const tpm_parsed_event_t *pars
 	const struct efi_bsa_event *evspec = &parsed->efi_bsa_event;
 	const char *new_application;
 	struct efi_bsa_event evspec_clone;
+	const tpm_evdigest_t *md;
 
 	/* Some BSA events do not refer to files, but to some data blobs residing somewhere on a device.
 	 * We're not yet prepared to handle these, so we hope the user doesn't mess with them, and
@@ -340,18 +371,30 @@ __tpm_event_efi_bsa_rehash(const tpm_event_t *ev, const tpm_parsed_event_t *pars
 		 */
 		debug("Measuring %s\n", ctx->boot_entry->image_path);
 		new_application = ctx->boot_entry->image_path;
+		ctx->boot_entry_used = true;
 		if (new_application) {
 			evspec_clone = *evspec;
 			evspec_clone.efi_application = strdup(new_application);
-			__tpm_event_efi_bsa_inspect_image(&evspec_clone);
+			evspec_clone.img_info = NULL;
+			evspec_clone.img_inspected = false;
 			evspec = &evspec_clone;
 		}
 	}
 
+	if (ctx->compdb) {
+		switch (compdb_lookup(ctx->compdb, evspec->efi_application, ctx->algo, COMPDB_DIGEST_AUTHENTICODE, &md)) {
+		case COMPDB_FOUND:
+			return md;
+		case COMPDB_AMBIGUOUS:
+			return NULL;
+		}
+	}
+
 	if (ctx->use_pesign)
 		return __efi_application_rehash_pesign(ctx, evspec->efi_partition, evspec->efi_application);
 
-	return __efi_application_rehash_direct(evspec, ctx);
+	/* This may load the image info, which is cached in the parsed event */
+	return __efi_application_rehash_direct((struct efi_bsa_event *) evspec, ctx);
 }
 
 #define EFI_MAX_SIGNATURES	16
@@ -456,7 +499,7 @@ efi_application_locate_and_check_shim_vendor_cert(const parsed_cert_t *signer)
 	buffer_t *der_cert;
 	parsed_cert_t *authority = NULL;
 
-	if (!(der_cert = platform_read_shim_vendor_cert())) {
+	if (!(der_cert = runtime_read_shim_vendor_cert())) {
 		error("Cannot locate authority record - please implement platform_read_shim_vendor_cert()\n");
 		return NULL;
 	}
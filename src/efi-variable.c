@@ -120,6 +120,7 @@ efi_variable_authority_get_record(const tpm_parsed_event_t *parsed, const char *
 		return runtime_read_efi_variable(var_name);
 	}
 
+	ctx->next_stage_img_used = true;
 	if (ctx->next_stage_img == NULL) {
 		infomsg("Unable to verify signature of a boot service; probably a driver residing in ROM.\n");
 		return EFI_BSA_NOT_FOUND;
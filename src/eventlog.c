@@ -34,6 +34,7 @@
 #include "util.h"
 #include "uapi.h"
 #include "sd-boot.h"
+#include "compdb.h"
 
 #define TPM_EVENT_LOG_MAX_ALGOS		64
 
@@ -60,6 +61,7 @@ struct tpm_event_log_reader {
 
 
 static bool		__tpm_event_parse_tcg2_info(tpm_event_t *ev, struct tpm_event_log_tcg2_info *info);
+static void		tpm_parsed_event_free(tpm_parsed_event_t *parsed);
 
 
 static void
@@ -259,6 +261,16 @@ again:
 	return ev;
 }
 
+void
+tpm_event_free(tpm_event_t *ev)
+{
+	if (ev->__parsed)
+		tpm_parsed_event_free(ev->__parsed);
+	free(ev->pcr_values);
+	free(ev->event_data);
+	free(ev);
+}
+
 bool
 event_log_get_locality(tpm_event_log_reader_t *log, unsigned int pcr_index, uint8_t *loc_p)
 {
@@ -649,6 +661,29 @@ __tpm_event_grub_file_describe(const tpm_parsed_event_t *parsed)
 }
 
 
+/*
+ * Digest a file, preferring the known-good digest from the component
+ * database if there is one.
+ */
+static const tpm_evdigest_t *
+__tpm_event_digest_file(tpm_event_log_rehash_ctx_t *ctx, const char *path, bool on_efi_partition)
+{
+	const tpm_evdigest_t *md;
+
+	if (ctx->compdb) {
+		switch (compdb_lookup(ctx->compdb, path, ctx->algo, COMPDB_DIGEST_FILE, &md)) {
+		case COMPDB_FOUND:
+			return md;
+		case COMPDB_AMBIGUOUS:
+			return NULL;
+		}
+	}
+
+	if (on_efi_partition)
+		return runtime_digest_efi_file(ctx->algo, path);
+	return runtime_digest_rootfs_file(ctx->algo, path);
+}
+
 static const tpm_evdigest_t *
 __tpm_event_grub_file_rehash(const tpm_event_t *ev, const tpm_parsed_event_t *parsed, tpm_event_log_rehash_ctx_t *ctx)
 {
@@ -659,25 +694,28 @@ __tpm_event_grub_file_rehash(const tpm_event_t *ev, const tpm_parsed_event_t *pa
 	if (evspec->device == NULL || !strcmp(evspec->device, "crypto0")
 	    || !strncmp("/boot/", evspec->path, 6)) {
 		debug("  assuming the file resides on system partition\n");
-		md = runtime_digest_rootfs_file(ctx->algo, evspec->path);
+		md = __tpm_event_digest_file(ctx, evspec->path, false);
 	} else {
 		if (sdb_is_boot_entry(evspec->path) && ctx->boot_entry_path) {
 			debug("  getting different boot entry file from EFI boot partition: %s\n",
 			      ctx->boot_entry_path);
-			md = runtime_digest_rootfs_file(ctx->algo, ctx->boot_entry_path);
+			ctx->boot_entry_used = true;
+			md = __tpm_event_digest_file(ctx, ctx->boot_entry_path, false);
 		} else
 		if (sdb_is_kernel(evspec->path) && ctx->boot_entry) {
 			debug("  getting different kernel from EFI boot partition: %s\n",
 			      ctx->boot_entry->image_path);
-			md = runtime_digest_efi_file(ctx->algo, ctx->boot_entry->image_path);
+			ctx->boot_entry_used = true;
+			md = __tpm_event_digest_file(ctx, ctx->boot_entry->image_path, true);
 		} else
 		if (sdb_is_initrd(evspec->path) && ctx->boot_entry) {
 			debug("  getting different initrd from EFI boot partition: %s\n",
 			      ctx->boot_entry->initrd_path);
-			md = runtime_digest_efi_file(ctx->algo, ctx->boot_entry->initrd_path);
+			ctx->boot_entry_used = true;
+			md = __tpm_event_digest_file(ctx, ctx->boot_entry->initrd_path, true);
 		} else {
 			debug("  assuming the file resides on EFI boot partition\n");
-			md = runtime_digest_efi_file(ctx->algo, evspec->path);
+			md = __tpm_event_digest_file(ctx, evspec->path, true);
 		}
 	}
 
@@ -748,6 +786,7 @@ __tpm_event_grub_command_rehash(const tpm_event_t *ev, const tpm_parsed_event_t
 		break;
 	case GRUB_EVENT_COMMAND_LINUX:
 		if (ctx->boot_entry && parsed->grub_command.file.path) {
+			ctx->boot_entry_used = true;
 			file = (grub_file_t) {
 				.device = parsed->grub_command.file.device,
 				.path = ctx->boot_entry->image_path,
@@ -761,6 +800,7 @@ __tpm_event_grub_command_rehash(const tpm_event_t *ev, const tpm_parsed_event_t
 		break;
 	case GRUB_EVENT_COMMAND_INITRD:
 		if (ctx->boot_entry && parsed->grub_command.file.path) {
+			ctx->boot_entry_used = true;
 			file = (grub_file_t) {
 				.device = parsed->grub_command.file.device,
 				.path = ctx->boot_entry->initrd_path,
@@ -774,6 +814,7 @@ __tpm_event_grub_command_rehash(const tpm_event_t *ev, const tpm_parsed_event_t
 		break;
 	case GRUB_EVENT_KERNEL_CMDLINE:
 		if (ctx->boot_entry && parsed->grub_command.file.path) {
+			ctx->boot_entry_used = true;
 			file = (grub_file_t) {
 				.device = parsed->grub_command.file.device,
 				.path = ctx->boot_entry->image_path,
@@ -953,6 +994,8 @@ __tpm_event_systemd_rehash(const tpm_event_t *ev, const tpm_parsed_event_t *pars
 	if (boot_entry == NULL)
 		return tpm_event_get_digest(ev, ctx->algo);
 
+	ctx->boot_entry_used = true;
+
 	if (!boot_entry->image_path) {
 		error("Unable to identify the next kernel\n");
 		return NULL;
@@ -1038,6 +1081,8 @@ __tpm_event_tag_initrd_rehash(const tpm_event_t *ev, const tpm_parsed_event_t *p
 	if (boot_entry == NULL)
 		return tpm_event_get_digest(ev, ctx->algo);
 
+	ctx->boot_entry_used = true;
+
 	if (!boot_entry->initrd_path) {
 		/* Can this happen eg when going from a split kernel to a unified kernel? */
 		error("Unable to identify the next initrd\n");
@@ -1176,6 +1221,7 @@ tpm_event_log_rehash_ctx_init(tpm_event_log_rehash_ctx_t *ctx, const tpm_algo_in
 void
 tpm_event_log_rehash_ctx_destroy(tpm_event_log_rehash_ctx_t *ctx)
 {
+	drop_string(&ctx->boot_entry_path);
 }
 
 void
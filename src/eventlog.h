@@ -195,6 +195,10 @@ enum {
  */
 typedef struct tpm_event_log_scan_ctx {
 	char *			efi_partition;
+
+	/* Components found in here do not need to be inspected. This is
+	 * set when the log is opened, and used for rehashing it as well. */
+	const compdb_t *	compdb;
 } tpm_event_log_scan_ctx_t;
 
 /*
@@ -206,12 +210,18 @@ typedef struct tpm_event_log_scan_ctx {
 typedef struct tpm_event_log_rehash_ctx {
 	const tpm_algo_info_t *	algo;
 	bool			use_pesign;		/* compute authenticode FP using external pesign application */
+	const compdb_t *	compdb;			/* known-good component digests, if any */
 
 	const pecoff_image_info_t *next_stage_img;
 
 	/* This get set when the user specifies --next-kernel */
 	char *			boot_entry_path;
 	uapi_boot_entry_t *	boot_entry;
+
+	/* Set by rehash functions whenever the resulting digest depends
+	 * on the boot entry above, or on next_stage_img. */
+	bool			boot_entry_used;
+	bool			next_stage_img_used;
 } tpm_event_log_rehash_ctx_t;
 
 #define GRUB_COMMAND_ARGV_MAX	32
@@ -255,7 +265,9 @@ typedef struct tpm_parsed_event {
 			char *		efi_application;
 
 			/* If we can find an on-disk EFI application for it, try to
-			 * inspect the PECOFF image and extract useful stuff. */
+			 * inspect the PECOFF image and extract useful stuff.
+			 * This is done lazily, see efi_application_get_image_info() */
+			bool		img_inspected;
 			pecoff_image_info_t *img_info;
 		} efi_bsa_event;
 
@@ -297,6 +309,7 @@ typedef struct tpm_event_log_reader tpm_event_log_reader_t;
 extern tpm_event_log_reader_t *	event_log_open(const char *override_path);
 extern void			event_log_close(tpm_event_log_reader_t *log);
 extern tpm_event_t *		event_log_read_next(tpm_event_log_reader_t *log);
+extern void			tpm_event_free(tpm_event_t *ev);
 extern bool			event_log_get_locality(tpm_event_log_reader_t *log, unsigned int pcr_index, uint8_t *loc_p);
 extern unsigned int		event_log_get_event_count(const tpm_event_log_reader_t *log);
 extern unsigned int		event_log_get_tpm_version(const tpm_event_log_reader_t *log);
@@ -333,6 +346,7 @@ extern const char *		__tpm_event_efi_device_path_item_file_path(const struct efi
 
 extern const char *		tpm_efi_variable_event_extract_full_varname(const tpm_parsed_event_t *parsed);
 extern const char *		tpm_event_decode_uuid(const unsigned char *data);
+extern const pecoff_image_info_t *efi_application_get_image_info(const tpm_parsed_event_t *parsed);
 extern parsed_cert_t *		efi_application_extract_signer(const tpm_parsed_event_t *parsed);
 extern buffer_t *		efi_application_locate_authority_record(const char *db, const parsed_cert_t *signer);
 
@@ -0,0 +1,332 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Create sealed objects in software, wrapped for a given storage parent
+ * so that the TPM owning this parent can import them using TPM2_Import.
+ *
+ * This follows the "outer wrapper" duplication scheme described in
+ * section 23.3 of the TPM 2.0 Part 1 specification. There is no inner
+ * wrapper; the encrypted seed takes the role of the symmetric key
+ * transport.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <tss2_mu.h>
+
+#include "util.h"
+#include "import.h"
+#include "digest.h"
+#include "rsa.h"
+
+#define IMPORT_BUFFER_MAX	2048
+
+static const EVP_MD *
+import_md(const tpm_algo_info_t *algo)
+{
+	return EVP_get_digestbyname(algo->openssl_name);
+}
+
+/*
+ * KDFa as defined in section 11.4.10.2 of TPM 2.0 Part 1. The label
+ * includes its terminating NUL byte.
+ */
+static bool
+import_kdfa(const tpm_algo_info_t *algo, const void *key, unsigned int key_len,
+		const char *label,
+		const void *context_u, unsigned int context_u_len,
+		unsigned int bits, unsigned char *out)
+{
+	unsigned int label_len = strlen(label) + 1;
+	unsigned int out_len = (bits + 7) / 8;
+	unsigned int done = 0, counter = 1;
+
+	while (done < out_len) {
+		unsigned char input[IMPORT_BUFFER_MAX];
+		unsigned char md[EVP_MAX_MD_SIZE];
+		unsigned int pos = 0, md_len, n;
+
+		if (4 + label_len + context_u_len + 4 > sizeof(input))
+			return false;
+
+		input[pos++] = counter >> 24;
+		input[pos++] = counter >> 16;
+		input[pos++] = counter >> 8;
+		input[pos++] = counter;
+		memcpy(input + pos, label, label_len);
+		pos += label_len;
+		if (context_u_len) {
+			memcpy(input + pos, context_u, context_u_len);
+			pos += context_u_len;
+		}
+		input[pos++] = bits >> 24;
+		input[pos++] = bits >> 16;
+		input[pos++] = bits >> 8;
+		input[pos++] = bits;
+
+		if (!HMAC(import_md(algo), key, key_len, input, pos, md, &md_len))
+			return false;
+
+		n = out_len - done;
+		if (n > md_len)
+			n = md_len;
+		memcpy(out + done, md, n);
+		done += n;
+		counter++;
+	}
+
+	return true;
+}
+
+static bool
+import_compute_name(const TPM2B_PUBLIC *pub, TPM2B_NAME *name)
+{
+	const tpm_algo_info_t *algo;
+	const tpm_evdigest_t *d;
+	uint8_t buffer[sizeof(TPMT_PUBLIC)];
+	size_t offset = 0;
+
+	if (!(algo = digest_by_tpm_alg(pub->publicArea.nameAlg)))
+		return false;
+
+	if (Tss2_MU_TPMT_PUBLIC_Marshal(&pub->publicArea, buffer, sizeof(buffer), &offset) != TSS2_RC_SUCCESS)
+		return false;
+
+	if (!(d = digest_compute(algo, buffer, offset)))
+		return false;
+
+	name->name[0] = algo->tcg_id >> 8;
+	name->name[1] = algo->tcg_id;
+	memcpy(name->name + 2, d->data, d->size);
+	name->size = 2 + d->size;
+	return true;
+}
+
+/*
+ * Build the public and sensitive area of a sealed data object.
+ * Imported objects must not have fixedTPM or fixedParent set.
+ */
+static bool
+import_build_sealed_object(const TPM2B_DIGEST *policy, const TPM2B_SENSITIVE_DATA *secret,
+		TPM2B_PUBLIC *pub, TPMT_SENSITIVE *sensitive)
+{
+	const tpm_algo_info_t *algo = digest_by_tpm_alg(TPM2_ALG_SHA256);
+	const tpm_evdigest_t *d;
+	unsigned char unique_input[sizeof(sensitive->seedValue.buffer) + sizeof(secret->buffer)];
+
+	memset(sensitive, 0, sizeof(*sensitive));
+	sensitive->sensitiveType = TPM2_ALG_KEYEDHASH;
+	sensitive->seedValue.size = algo->digest_size;
+	if (RAND_bytes(sensitive->seedValue.buffer, sensitive->seedValue.size) != 1)
+		return false;
+	sensitive->sensitive.bits = *secret;
+
+	memset(pub, 0, sizeof(*pub));
+	pub->size = sizeof(pub->publicArea);
+	pub->publicArea.type = TPM2_ALG_KEYEDHASH;
+	pub->publicArea.nameAlg = algo->tcg_id;
+	pub->publicArea.objectAttributes = 0;
+	pub->publicArea.authPolicy = *policy;
+	pub->publicArea.parameters.keyedHashDetail.scheme.scheme = TPM2_ALG_NULL;
+
+	/* unique = H(seedValue || data) */
+	memcpy(unique_input, sensitive->seedValue.buffer, sensitive->seedValue.size);
+	memcpy(unique_input + sensitive->seedValue.size, secret->buffer, secret->size);
+	if (!(d = digest_compute(algo, unique_input, sensitive->seedValue.size + secret->size)))
+		return false;
+
+	pub->publicArea.unique.keyedHash.size = d->size;
+	memcpy(pub->publicArea.unique.keyedHash.buffer, d->data, d->size);
+	return true;
+}
+
+static const EVP_CIPHER *
+import_cipher(const TPMT_SYM_DEF_OBJECT *sym)
+{
+	if (sym->algorithm != TPM2_ALG_AES || sym->mode.sym != TPM2_ALG_CFB)
+		return NULL;
+
+	switch (sym->keyBits.sym) {
+	case 128:
+		return EVP_aes_128_cfb128();
+	case 192:
+		return EVP_aes_192_cfb128();
+	case 256:
+		return EVP_aes_256_cfb128();
+	}
+	return NULL;
+}
+
+static bool
+import_encrypt(const EVP_CIPHER *cipher, const unsigned char *key,
+		const unsigned char *in, unsigned int len, unsigned char *out)
+{
+	unsigned char iv[EVP_MAX_IV_LENGTH] = { 0 };
+	EVP_CIPHER_CTX *ctx;
+	int n1 = 0, n2 = 0;
+	bool ok;
+
+	if (!(ctx = EVP_CIPHER_CTX_new()))
+		return false;
+
+	ok = EVP_EncryptInit_ex(ctx, cipher, NULL, key, iv)
+	  && EVP_EncryptUpdate(ctx, out, &n1, in, len)
+	  && EVP_EncryptFinal_ex(ctx, out + n1, &n2)
+	  && (unsigned int) (n1 + n2) == len;
+
+	EVP_CIPHER_CTX_free(ctx);
+	return ok;
+}
+
+bool
+tpm_import_seal_secret(const TPM2B_PUBLIC *parent,
+		const TPM2B_DIGEST *policy,
+		const TPM2B_SENSITIVE_DATA *secret,
+		TPM2B_PUBLIC **public_ret,
+		TPM2B_PRIVATE **duplicate_ret,
+		TPM2B_ENCRYPTED_SECRET **seed_ret)
+{
+	const TPMT_SYM_DEF_OBJECT *parent_sym;
+	const tpm_algo_info_t *parent_algo;
+	const EVP_CIPHER *cipher;
+	tpm_rsa_key_t *parent_key = NULL;
+	TPM2B_PUBLIC *pub = NULL;
+	TPM2B_PRIVATE *duplicate = NULL;
+	TPM2B_ENCRYPTED_SECRET *seed = NULL;
+	TPMT_SENSITIVE sensitive;
+	TPM2B_NAME name;
+	unsigned char seed_value[EVP_MAX_MD_SIZE];
+	unsigned char sym_key[EVP_MAX_KEY_LENGTH];
+	unsigned char hmac_key[EVP_MAX_MD_SIZE];
+	unsigned char plain[IMPORT_BUFFER_MAX];
+	unsigned char hmac_input[IMPORT_BUFFER_MAX + sizeof(name.name)];
+	unsigned char *enc;
+	unsigned int outer_hmac_len, hmac_size;
+	size_t offset;
+	int len;
+	bool ok = false;
+
+	if (parent->publicArea.type != TPM2_ALG_RSA) {
+		error("Offline sealing is only supported for RSA storage keys\n");
+		return false;
+	}
+
+	parent_sym = &parent->publicArea.parameters.rsaDetail.symmetric;
+	if (!(cipher = import_cipher(parent_sym))) {
+		error("Unsupported symmetric algorithm for storage key\n");
+		return false;
+	}
+
+	if (!(parent_algo = digest_by_tpm_alg(parent->publicArea.nameAlg))) {
+		error("Unsupported name algorithm 0x%x for storage key\n", parent->publicArea.nameAlg);
+		return false;
+	}
+
+	if (!(parent_key = tpm_rsa_key_from_tss2(parent, "<storage key>")))
+		return false;
+
+	pub = calloc(1, sizeof(*pub));
+	duplicate = calloc(1, sizeof(*duplicate));
+	seed = calloc(1, sizeof(*seed));
+
+	if (!import_build_sealed_object(policy, secret, pub, &sensitive)
+	 || !import_compute_name(pub, &name)) {
+		error("Unable to create sealed object\n");
+		goto out;
+	}
+
+	/* Generate the seed and encrypt it to the parent */
+	if (RAND_bytes(seed_value, parent_algo->digest_size) != 1)
+		goto out;
+
+	len = tpm_rsa_encrypt_oaep(parent_key, parent_algo, "DUPLICATE",
+			seed_value, parent_algo->digest_size,
+			seed->secret, sizeof(seed->secret));
+	if (len <= 0)
+		goto out;
+	seed->size = len;
+
+	/* Derive the symmetric and HMAC keys from the seed */
+	hmac_size = parent_algo->digest_size;
+	if (!import_kdfa(parent_algo, seed_value, parent_algo->digest_size, "STORAGE",
+				name.name, name.size,
+				parent_sym->keyBits.sym, sym_key)
+	 || !import_kdfa(parent_algo, seed_value, parent_algo->digest_size, "INTEGRITY",
+				NULL, 0,
+				8 * hmac_size, hmac_key)) {
+		error("Key derivation failed\n");
+		goto out;
+	}
+
+	/* Marshal the sensitive area as a TPM2B_SENSITIVE */
+	offset = 2;
+	if (Tss2_MU_TPMT_SENSITIVE_Marshal(&sensitive, plain, sizeof(plain), &offset) != TSS2_RC_SUCCESS)
+		goto out;
+	plain[0] = (offset - 2) >> 8;
+	plain[1] = (offset - 2);
+
+	/* duplicate = TPM2B(outerHMAC) || CFB(sensitive) */
+	if (2 + hmac_size + offset > sizeof(duplicate->buffer))
+		goto out;
+
+	enc = duplicate->buffer + 2 + hmac_size;
+	if (!import_encrypt(cipher, sym_key, plain, offset, enc)) {
+		error("Unable to encrypt sealed object\n");
+		goto out;
+	}
+
+	/* outerHMAC = HMAC(hmac_key, encSensitive || name) */
+	memcpy(hmac_input, enc, offset);
+	memcpy(hmac_input + offset, name.name, name.size);
+	if (!HMAC(import_md(parent_algo), hmac_key, hmac_size,
+				hmac_input, offset + name.size,
+				duplicate->buffer + 2, &outer_hmac_len))
+		goto out;
+
+	duplicate->buffer[0] = outer_hmac_len >> 8;
+	duplicate->buffer[1] = outer_hmac_len;
+	duplicate->size = 2 + outer_hmac_len + offset;
+
+	*public_ret = pub;
+	*duplicate_ret = duplicate;
+	*seed_ret = seed;
+	pub = NULL;
+	duplicate = NULL;
+	seed = NULL;
+	ok = true;
+
+out:
+	memset(&sensitive, 0, sizeof(sensitive));
+	memset(plain, 0, sizeof(plain));
+	memset(seed_value, 0, sizeof(seed_value));
+	memset(sym_key, 0, sizeof(sym_key));
+	memset(hmac_key, 0, sizeof(hmac_key));
+
+	if (pub)
+		free(pub);
+	if (duplicate)
+		free(duplicate);
+	if (seed)
+		free(seed);
+	tpm_rsa_key_free(parent_key);
+	return ok;
+}
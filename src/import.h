@@ -0,0 +1,32 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef IMPORT_H
+#define IMPORT_H
+
+#include <tss2_tpm2_types.h>
+#include "types.h"
+
+extern bool	tpm_import_seal_secret(const TPM2B_PUBLIC *parent,
+				const TPM2B_DIGEST *policy,
+				const TPM2B_SENSITIVE_DATA *secret,
+				TPM2B_PUBLIC **public_ret,
+				TPM2B_PRIVATE **duplicate_ret,
+				TPM2B_ENCRYPTED_SECRET **seed_ret);
+
+#endif /* IMPORT_H */
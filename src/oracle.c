@@ -24,18 +24,27 @@
 #include <string.h>
 #include <ctype.h>
 #include <limits.h>
+#include <errno.h>
 
 #include "oracle.h"
 #include "util.h"
-#include "eventlog.h"
-#include "bufparser.h"
+#include "predictor.h"
 #include "runtime.h"
 #include "pcr.h"
 #include "digest.h"
+#include "digest-backend.h"
+#include "tpm-trace.h"
 #include "rsa.h"
 #include "store.h"
+#include "pkcs11.h"
 #include "testcase.h"
-#include "sd-boot.h"
+#include "replay-corpus.h"
+#include "serve.h"
+#include "compdb.h"
+#include "rehash-state.h"
+#include "watch.h"
+#include "coalesce.h"
+#include "authenticode.h"
 
 enum {
 	ACTION_NONE,
@@ -47,37 +56,16 @@ enum {
 	ACTION_SIGN,
 	ACTION_SELFTEST,
 	ACTION_RSATEST,
+	ACTION_REPLAY_CORPUS,
+	ACTION_SERVE,
+	ACTION_COMPONENT_DB,
+	ACTION_AUTHENTICODE_HASH,
+	ACTION_DIGEST_BENCH,
+	ACTION_WATCH,
 };
 
-enum {
-	STOP_EVENT_NONE,
-	STOP_EVENT_GRUB_COMMAND,
-	STOP_EVENT_GRUB_FILE,
-};
-
-struct predictor {
-	uint32_t		pcr_mask;
-	const char *		initial_source;
-
-	const char *		tpm_event_log_path;
-	const char *		boot_entry_id;
-
-	const char *		algo;
-	const tpm_algo_info_t *	algo_info;
-
-	tpm_event_t *		event_log;
-	struct {
-		int		type;
-		bool		after;
-		char *		value;
-	} stop_event;
-
-	void			(*report_fn)(struct predictor *, unsigned int);
-
-	tpm_pcr_bank_t		prediction;
-};
-
-#define GRUB_PCR_SNAPSHOT_PATH	"/sys/firmware/efi/efivars/GrubPcrSnapshot-7ce323f2-b841-4d30-a0e9-5474a76c9a3f"
+#define COMPONENT_VERSIONS_MAX		32
+#define UNSEAL_SECRETS_MAX		16
 
 enum {
 	OPT_FROM = 256,
@@ -93,7 +81,11 @@ enum {
 	OPT_RSA_PUBLIC_KEY,
 	OPT_RSA_GENERATE_KEY,
 	OPT_RSA_BITS,
+	OPT_SIGNING_KEY_TYPE,
 	OPT_ECC_SRK,
+	OPT_SRK_HANDLE,
+	OPT_SRK_PUBLIC,
+	OPT_SOCKET,
 	OPT_INPUT,
 	OPT_OUTPUT,
 	OPT_AUTHORIZED_POLICY,
@@ -104,6 +96,21 @@ enum {
 	OPT_TARGET_PLATFORM,
 	OPT_BOOT_ENTRY,
 	OPT_COMPARE_CURRENT,
+	OPT_JOBS,
+	OPT_COMPONENT_DB,
+	OPT_COMPONENT_ARCH,
+	OPT_COMPONENT_VERSION,
+	OPT_REMOTE,
+	OPT_REMOTE_BUNDLE,
+	OPT_DIGEST_BACKEND,
+	OPT_TPM_TRACE,
+	OPT_TCTI,
+	OPT_PKCS11_SESSIONS,
+	OPT_FORCE_SIGN,
+	OPT_EXIT_CODE,
+	OPT_STATE_FILE,
+	OPT_SETTLE_TIME,
+	OPT_COALESCE,
 };
 
 static struct option options[] = {
@@ -128,7 +135,12 @@ static struct option options[] = {
 	{ "public-key",		required_argument,	0,	OPT_RSA_PUBLIC_KEY },
 	{ "rsa-generate-key",	no_argument,		0,	OPT_RSA_GENERATE_KEY },
 	{ "rsa-bits",		required_argument,	0,	OPT_RSA_BITS },
+	{ "generate-key",	no_argument,		0,	OPT_RSA_GENERATE_KEY },
+	{ "signing-key-type",	required_argument,	0,	OPT_SIGNING_KEY_TYPE },
 	{ "ecc-srk",		no_argument,		0,	OPT_ECC_SRK },
+	{ "srk-handle",		required_argument,	0,	OPT_SRK_HANDLE },
+	{ "srk-public",		required_argument,	0,	OPT_SRK_PUBLIC },
+	{ "socket",		required_argument,	0,	OPT_SOCKET },
 	{ "input",		required_argument,	0,	OPT_INPUT },
 	{ "output",		required_argument,	0,	OPT_OUTPUT },
 	{ "authorized-policy",	required_argument,	0,	OPT_AUTHORIZED_POLICY },
@@ -139,6 +151,21 @@ static struct option options[] = {
 	{ "target-platform",	required_argument,	0,	OPT_TARGET_PLATFORM },
 	{ "next-kernel",	required_argument,	0,	OPT_BOOT_ENTRY },
 	{ "compare-current",	no_argument,		0,	OPT_COMPARE_CURRENT },
+	{ "jobs",		required_argument,	0,	OPT_JOBS },
+	{ "component-db",	required_argument,	0,	OPT_COMPONENT_DB },
+	{ "component-arch",	required_argument,	0,	OPT_COMPONENT_ARCH },
+	{ "component-version",	required_argument,	0,	OPT_COMPONENT_VERSION },
+	{ "remote",		no_argument,		0,	OPT_REMOTE },
+	{ "remote-bundle",	required_argument,	0,	OPT_REMOTE_BUNDLE },
+	{ "digest-backend",	required_argument,	0,	OPT_DIGEST_BACKEND },
+	{ "tpm-trace",		required_argument,	0,	OPT_TPM_TRACE },
+	{ "tcti",		required_argument,	0,	OPT_TCTI },
+	{ "pkcs11-sessions",	required_argument,	0,	OPT_PKCS11_SESSIONS },
+	{ "force-sign",		no_argument,		0,	OPT_FORCE_SIGN },
+	{ "exit-code",		no_argument,		0,	OPT_EXIT_CODE },
+	{ "state-file",		required_argument,	0,	OPT_STATE_FILE },
+	{ "settle-time",	required_argument,	0,	OPT_SETTLE_TIME },
+	{ "coalesce",		required_argument,	0,	OPT_COALESCE },
 
 	{ NULL }
 };
@@ -146,10 +173,6 @@ static struct option options[] = {
 unsigned int opt_debug	= 0;
 unsigned int opt_use_pesign = 0;
 
-static void	predictor_report_plain(struct predictor *pred, unsigned int pcr_index);
-static void	predictor_report_tpm2_tools(struct predictor *pred, unsigned int pcr_index);
-static void	predictor_report_binary(struct predictor *pred, unsigned int pcr_index);
-
 static void
 usage(int exitval, const char *msg)
 {
@@ -175,13 +198,62 @@ usage(int exitval, const char *msg)
 		"                         event. Event TYPE can be one of grub-command, grub-file.\n"
 		"                         The meaning of event ARG depends on the type. Possible examples are\n"
 		"                         grub-command=cryptomount or grub-file=grub.cfg\n"
+		"                         This option can be given several times, in which case the PCR values are\n"
+		"                         reported for each stop event, labelled with the event description.\n"
+		"                         When sealing, the secret is sealed against all of these states (up to 8).\n"
 		"  --after, --before\n"
 		"                         The default behavior when using --stop-event is to stop processing the\n"
 		"                         event log before the indicated event. Using the --after option instructs\n"
-		"                         pcr-oracle to stop after processing the event.\n"
+		"                         pcr-oracle to stop after processing the event. This can be overridden\n"
+		"                         for an individual stop event by prefixing it with \"before:\" or \"after:\".\n"
 		"  --verify SOURCE        After applying all updates, compare the prediction against the given SOURCE (see below).\n"
 		"  --tpm-eventlog PATH\n"
 		"                         Specify a different TPM event log to process.\n"
+		"  --jobs N               When replaying a corpus of testcases, run up to N replays in parallel.\n"
+		"                         When serving requests, handle up to N connections in parallel.\n"
+		"                         Defaults to the number of online CPUs.\n"
+		"  --socket PATH          Listen on the given UNIX socket when serving requests.\n"
+		"  --remote               Predict for a different system. All information about that system\n"
+		"                         is taken from the event log, the component database, or the bundle\n"
+		"                         given with --remote-bundle; the local system is never accessed.\n"
+		"  --remote-bundle DIR    Like --remote, taking EFI variables, images and digests from the given\n"
+		"                         directory, which uses the layout created by --create-testcase.\n"
+		"  --component-db PATH    Use the known-good component digests from the given database rather\n"
+		"                         than hashing local files, where available.\n"
+		"  --component-arch ARCH  Only use component database entries for the given architecture.\n"
+		"  --component-version NAME=VERSION\n"
+		"                         Use the given version of a component from the component database.\n"
+		"                         This option can be given several times. With authenticode-hash, this\n"
+		"                         option takes just the VERSION to record for all files.\n"
+		"  --generate-key, --rsa-generate-key\n"
+		"                         Generate the private key given by --private-key on the fly.\n"
+		"  --signing-key-type TYPE\n"
+		"                         Type of key to generate: rsa (the default; see --rsa-bits), ecc-p256,\n"
+		"                         or ecc-p384. ECDSA keys sign considerably faster than RSA keys.\n"
+		"  --digest-backend NAME  Compute digests using the given backend: openssl, builtin, af_alg,\n"
+		"                         or auto (the default), which picks the fastest one that passes\n"
+		"                         its self test.\n"
+		"  --tpm-trace FORMAT[:PATH]\n"
+		"                         Record all commands sent to the TPM, and report their latency\n"
+		"                         at exit. FORMAT is summary or json. The report is written to\n"
+		"                         PATH, or to stderr by default.\n"
+		"  --tcti CONF            Talk to the TPM through the given TCTI, eg device:/dev/tpmrm0,\n"
+		"                         tabrmd, or swtpm:host=localhost,port=2321. The default is taken\n"
+		"                         from the PCR_ORACLE_TCTI environment variable, if set.\n"
+		"  --pkcs11-sessions N    When the private key is a pkcs11: URI, sign using up to N token\n"
+		"                         sessions in parallel (default 4).\n"
+		"  --force-sign           Sign and write policies even if the output already holds a valid\n"
+		"                         signature for the predicted policy.\n"
+		"  --exit-code            When signing, exit with status 2 if all policies were unchanged\n"
+		"                         and nothing was written.\n"
+		"  --state-file PATH      Remember the inputs and digests of all re-hashed events in the given\n"
+		"                         file. On the next run, only events whose inputs changed are re-hashed.\n"
+		"  --settle-time SECONDS  With watch, wait until inputs have not changed for this long before\n"
+		"                         predicting again. With --coalesce, wait until no new request has\n"
+		"                         been queued for this long (default 5).\n"
+		"  --coalesce DIR         When signing or sealing, queue the request in the given spool\n"
+		"                         directory and return. Identical requests queued in quick succession,\n"
+		"                         eg by several package hooks, are executed once, in the background.\n"
 		"\n"
 		"The pcr-index argument can be one or more PCR indices or index ranges, separated by comma.\n"
 		"Using \"all\" selects all applicable PCR registers.\n"
@@ -200,842 +272,65 @@ usage(int exitval, const char *msg)
 		"  eventlog               Process the eventlog and apply updates for all events possible.\n"
 		"\n"
 		"After the PCR predictor has been extended with all updates specified, its value is printed to standard output.\n"
+		"\n"
+		"To replay a whole directory of recorded testcases, use\n"
+		"  pcr-oracle [options] replay-corpus pcr-index corpus-dir\n"
+		"Every subdirectory containing a recorded TPM event log is replayed using --from eventlog,\n"
+		"and verified against the PCR values recorded with it (or the source given by --verify).\n"
+		"\n"
+		"To serve prediction and signing requests on a UNIX socket, use\n"
+		"  pcr-oracle [options] serve\n"
+		"\n"
+		"To build a component database from a text manifest, use\n"
+		"  pcr-oracle --input manifest --output database component-db\n"
+		"\n"
+		"To compute the digests of all EFI applications in a directory tree, use\n"
+		"  pcr-oracle [-A algo,...] [-F manifest|db] [--output path] authenticode-hash path...\n"
+		"\n"
+		"To verify and benchmark the available digest backends, use\n"
+		"  pcr-oracle digest-bench\n"
+		"\n"
+		"To sign or seal again whenever the boot components change, use\n"
+		"  pcr-oracle [options] --state-file path --from eventlog watch sign|seal-secret pcr-index\n"
+		"\n"
+		"To sign or seal once after a package transaction, from each of its hooks, use\n"
+		"  pcr-oracle [options] --coalesce /run/pcr-oracle sign|seal-secret pcr-index\n"
 	       );
 	exit(exitval);
 }
 
-static void
-pcr_bank_load_initial_values(tpm_pcr_bank_t *bank, unsigned int pcr_mask, const tpm_algo_info_t *algo_info, const char *source)
-{
-	pcr_bank_initialize(bank, pcr_mask, algo_info);
-	if (!strcmp(source, "zero")
-	 || !strcmp(source, "eventlog"))
-		pcr_bank_init_from_zero(bank);
-	else if (!strcmp(source, "current"))
-		pcr_bank_init_from_current(bank);
-	else if (!strcmp(source, "snapshot"))
-		pcr_bank_init_from_snapshot(bank, GRUB_PCR_SNAPSHOT_PATH);
-	else
-		fatal("don't know how to load PCR bank with initial values: unsupported source \"%s\"\n", source);
-}
-
-static inline tpm_evdigest_t *
-predictor_get_pcr_state(struct predictor *pred, unsigned int index, const char *algo)
-{
-	return pcr_bank_get_register(&pred->prediction, index, algo);
-}
+/* The runtime provider replaced by --remote */
+static runtime_provider_t *	saved_runtime_provider;
 
 static void
-predictor_load_eventlog(struct predictor *pred)
-{
-	tpm_event_log_reader_t *log;
-	tpm_event_t *ev, **tail;
-	uint8_t pcr0_locality;
-
-	log = event_log_open(pred->tpm_event_log_path);
-	if (log == NULL)
-		fatal("Failed to open TPM event log, giving up.\n");
-
-	tail = &pred->event_log;
-	while ((ev = event_log_read_next(log)) != NULL) {
-		*tail = ev;
-		tail = &ev->next;
-	}
-
-	if (event_log_get_locality(log, 0, &pcr0_locality))
-		pcr_bank_set_locality(&pred->prediction, 0, pcr0_locality);
-
-	/* We check the TPM version after processing the log. Version info for TPMv2
-	 * is usually hidden in the first event. */
-	if (event_log_get_tpm_version(log) != 2) {
-		warning("Encountered TPM event log apparently generated by a TPMv%u device\n",
-				event_log_get_tpm_version(log));
-		warning("Things will most likely fail\n");
-	}
-
-	debug("Successfully read %u events from TPM event log\n", event_log_get_event_count(log));
-	event_log_close(log);
-}
-
-static struct predictor *
-predictor_new(const tpm_pcr_selection_t *pcr_selection, const char *source,
-		const char *tpm_eventlog_path,
-		const char *output_format,
-		const char *boot_entry_id)
-{
-	struct predictor *pred;
-
-	if (source == NULL)
-		source = "zero";
-
-	pred = calloc(1, sizeof(*pred));
-	pred->pcr_mask = pcr_selection->pcr_mask;
-	pred->initial_source = source;
-	pred->boot_entry_id = boot_entry_id;
-
-	pred->algo = pcr_selection->algo_info->openssl_name;
-	pred->algo_info = pcr_selection->algo_info;
-
-	if (!output_format || !strcasecmp(output_format, "plain"))
-		pred->report_fn = predictor_report_plain;
-	else
-	if (!strcasecmp(output_format, "tpm2-tools"))
-		pred->report_fn = predictor_report_tpm2_tools;
-	else
-	if (!strcasecmp(output_format, "binary"))
-		pred->report_fn = predictor_report_binary;
-	else
-		fatal("Unsupported output format \"%s\"\n", output_format);
-
-	debug("Initializing predictor for %s:%s from %s\n", pred->algo, print_pcr_mask(pred->pcr_mask), source);
-	pcr_bank_load_initial_values(&pred->prediction,
-			pcr_selection->pcr_mask,
-			pcr_selection->algo_info,
-			source);
-
-	if (!strcmp(source, "eventlog")) {
-		pred->tpm_event_log_path = tpm_eventlog_path;
-		predictor_load_eventlog(pred);
-	}
-
-	debug("Created new predictor\n");
-	return pred;
-}
-
-static bool
-__stop_event_parse(char *event_spec, char **name_p, char **value_p)
+restore_runtime_provider(void)
 {
-	char *s;
-
-	if (!(s = strchr(event_spec, '='))) {
-		*name_p = event_spec;
-		*value_p = NULL;
-		return true;
-	}
-
-	*s++ = '\0';
-	if (*event_spec == '\0')
-		return false;
-
-	*name_p = event_spec;
-	*value_p = s;
-	return true;
-}
-
-static void
-predictor_set_stop_event(struct predictor *pred, const char *event_desc, bool after)
-{
-	char *copy, *name, *value;
-
-	copy = strdup(event_desc);
-	if (!__stop_event_parse(copy, &name, &value))
-		fatal("Cannot parse stop event \"%s\"\n", event_desc);
-
-	if (!strcmp(name, "grub-command")) {
-		pred->stop_event.type = STOP_EVENT_GRUB_COMMAND;
-	} else
-	if (!strcmp(name, "grub-file")) {
-		pred->stop_event.type = STOP_EVENT_GRUB_FILE;
-	} else {
-		fatal("Unsupported event type \"%s\" in stop event \"%s\"\n", name, event_desc);
-	}
-
-	pred->stop_event.value = strdup(value);
-	pred->stop_event.after = after;
-	free(copy);
-}
-
-static void
-pcr_bank_extend_register(tpm_pcr_bank_t *bank, unsigned int pcr_index, const tpm_evdigest_t *d)
-{
-	tpm_evdigest_t *pcr;
-	digest_ctx_t *dctx;
-
-	if (!pcr_bank_register_is_valid(bank, pcr_index)) {
-		error("Unable to extend PCR %s:%u: register was not initialized\n",
-				bank->algo_name, pcr_index);
-		return;
-	}
-
-	pcr = &bank->pcr[pcr_index];
-	if (pcr->algo != d->algo)
-		fatal("Cannot update PCR %u: algorithm mismatch\n", pcr_index);
-
-	dctx = digest_ctx_new(pcr->algo);
-	digest_ctx_update(dctx, pcr->data, pcr->size);
-	digest_ctx_update(dctx, d->data, d->size);
-	digest_ctx_final(dctx, pcr);
-	digest_ctx_free(dctx);
-}
-
-static void
-predictor_extend_hash(struct predictor *pred, unsigned int pcr_index, const tpm_evdigest_t *d)
-{
-	debug("Extend PCR#%d: %s\n", pcr_index, digest_print(d));
-	pcr_bank_extend_register(&pred->prediction, pcr_index, d);
-}
-
-static const tpm_evdigest_t *
-predictor_compute_digest(struct predictor *pred, const void *data, unsigned int size)
-{
-	return digest_compute(pred->algo_info, data, size);
-}
-
-static const tpm_evdigest_t *
-predictor_compute_file_digest(struct predictor *pred, const char *filename, int flags)
-{
-	const tpm_evdigest_t *md;
-	buffer_t *buffer;
-
-	buffer = runtime_read_file(filename, flags);
-
-	md = predictor_compute_digest(pred,
-			buffer_read_pointer(buffer),
-			buffer_available(buffer));
-	buffer_free(buffer);
-
-	return md;
-}
-
-static void
-predictor_update_string(struct predictor *pred, unsigned int pcr_index, const char *value)
-{
-	const tpm_evdigest_t *md;
-
-	debug("Extending PCR %u with string \"%s\"\n", pcr_index, value);
-	md = predictor_compute_digest(pred, value, strlen(value));
-	predictor_extend_hash(pred, pcr_index, md);
-}
-
-static void
-predictor_update_file(struct predictor *pred, unsigned int pcr_index, const char *filename)
-{
-	const tpm_evdigest_t *md;
-
-	md = predictor_compute_file_digest(pred, filename, 0);
-	predictor_extend_hash(pred, pcr_index, md);
-}
-
-static bool
-__check_stop_event(tpm_event_t *ev, int type, const char *value, tpm_event_log_scan_ctx_t *ctx)
-{
-	const char *grub_arg = NULL;
-	const char *grub_cmd = NULL;
-	tpm_parsed_event_t *parsed;
-
-	switch (type) {
-	case STOP_EVENT_NONE:
-		return false;
-
-	case STOP_EVENT_GRUB_COMMAND:
-		if (ev->pcr_index != 8
-		 || ev->event_type != TPM2_EVENT_IPL)
-			return false;
-
-		if (!(parsed = tpm_event_parse(ev, ctx)))
-			return false;
-
-		if (parsed->event_subtype != GRUB_EVENT_COMMAND)
-			return false;
-
-		if (!(grub_arg = parsed->grub_command.argv[0]))
-			return false;
-
-		grub_cmd = grub_arg;
-		while (grub_cmd != NULL && !isalpha(*grub_cmd))
-			grub_cmd++;
-
-		return !strcmp(grub_cmd, value);
-
-	case STOP_EVENT_GRUB_FILE:
-		if (ev->pcr_index != 9
-		 || ev->event_type != TPM2_EVENT_IPL)
-			return false;
-
-		if (!(parsed = tpm_event_parse(ev, ctx)))
-			return false;
-
-		if (parsed->event_subtype != GRUB_EVENT_FILE)
-			return false;
-
-		if (!(grub_arg = parsed->grub_file.path)) {
-			return false;
-		} else {
-			unsigned int match_len = strlen(value);
-			unsigned int path_len = strlen(grub_arg);
-
-			if (path_len > match_len
-			 && grub_arg[path_len - match_len - 1] == '/'
-			 && !strcmp(value, grub_arg + path_len - match_len)) {
-				debug("grub file path \"%s\" matched \"%s\"\n",
-						grub_arg, value);
-				return true;
-			}
-		}
-
-		return !strcmp(grub_arg, value);
-	}
-
-	return false;
-}
-
-/*
- * Scan ahead to a future event that will help us understand the current one.
- */
-
-/*
- * Lookahead: when processing the GPT event, we need to know which hard disk
- * we're talking about.
- */
-static void
-__predictor_lookahead_efi_partition(tpm_event_t *ev, tpm_event_log_rehash_ctx_t *ctx)
-{
-	struct efi_gpt_event *gpt = &ev->__parsed->efi_gpt_event;
-
-	while ((ev = ev->next) != NULL) {
-		tpm_parsed_event_t *parsed;
-
-		if (ev->event_type != TPM2_EFI_BOOT_SERVICES_APPLICATION)
-			continue;
-
-		/* BSA events have already been parsed during the pre-scan */
-		if (!(parsed = ev->__parsed))
-			continue;
-
-		assign_string(&gpt->efi_partition, parsed->efi_bsa_event.efi_partition);
-		return;
-	}
-}
-
-/*
- * Lookahead: when processing the BSA event that loads the shim loader, scan ahead
- * to the next BSA event (which is probably grub getting loaded).
- * We need this in order to process the "Shim" pseudo variable event that the
- * shim loader produces when verifying the authenticode signature.
- */
-static void
-__predictor_lookahead_shim_loaded(tpm_event_t *ev, tpm_event_log_rehash_ctx_t *ctx)
-{
-	tpm_parsed_event_t *parsed;
-
-	while ((ev = ev->next) != NULL) {
-		if (ev->event_type != TPM2_EFI_BOOT_SERVICES_APPLICATION)
-			continue;
-
-		/* BSA events have already been parsed during the pre-scan */
-		if (!(parsed = ev->__parsed))
-			continue;
-
-		if (!parsed->efi_bsa_event.img_info)
-			continue;
-
-		debug("Inspecting EFI application %s(%s)\n",
-				parsed->efi_bsa_event.efi_partition,
-				parsed->efi_bsa_event.efi_application);
-		ctx->next_stage_img = parsed->efi_bsa_event.img_info;
-
-#ifdef TESTING_ONLY
-		if (ctx->next_stage_img) {
-			parsed_cert_t *signer;
-			buffer_t *record;
-
-			signer = efi_application_extract_signer(parsed);
-			if (signer != NULL) {
-				debug("Application was signed by %s\n", parsed_cert_subject(signer));
-				record = efi_application_locate_authority_record("shim-vendor-cert", signer);
-				buffer_free(record);
-			}
-		}
-#endif
-
-		return;
-	}
-}
-
-static bool
-int_list_contains(const int *list, unsigned int value)
-{
-	while (*list != -1) {
-		if (*list++ == value)
-			return true;
-	}
-	return false;
-}
-
-static int
-predictor_get_event_strategy(unsigned int event_type)
-{
-	static int rehash_types[] = {
-		TPM2_EFI_BOOT_SERVICES_APPLICATION,
-		TPM2_EFI_BOOT_SERVICES_DRIVER,
-		TPM2_EFI_VARIABLE_BOOT,
-		TPM2_EFI_VARIABLE_AUTHORITY,
-		TPM2_EFI_VARIABLE_DRIVER_CONFIG,
-
-		/* IPL: used by grub2 for PCR 8 and PCR9 */
-		TPM2_EVENT_IPL,
-
-		/* EVENT_TAG: used by the kernel for PCR9, to measure the cmdline and initrd */
-		TPM2_EVENT_EVENT_TAG,
-
-		/*
-		 * EFI_GPT_EVENT: used in updates of PCR5, seems to be a hash of several GPT headers.
-		 *	We should probably rebuild in case someone changed the partitioning.
-		 *	However, not needed as long as we don't seal against PCR5.
-		 */
-		TPM2_EFI_GPT_EVENT,
-
-		-1,
-	};
-	static int copy_types[] = {
-		TPM2_EVENT_S_CRTM_CONTENTS,
-		TPM2_EVENT_S_CRTM_VERSION,
-		TPM2_EFI_PLATFORM_FIRMWARE_BLOB,
-		TPM2_EFI_PLATFORM_FIRMWARE_BLOB2,
-		TPM2_EVENT_SEPARATOR,
-		TPM2_EVENT_POST_CODE,
-		TPM2_EFI_HANDOFF_TABLES,
-		TPM2_EFI_HANDOFF_TABLES2,
-		TPM2_EFI_ACTION,
-		TPM2_EVENT_ACTION,
-		TPM2_EVENT_NONHOST_CODE,
-		TPM2_EVENT_NONHOST_CONFIG,
-		TPM2_EVENT_NONHOST_INFO,
-		TPM2_EVENT_PLATFORM_CONFIG_FLAGS,
-
-		-1
-	};
-
-	if (event_type == TPM2_EVENT_NO_ACTION)
-		return EVENT_STRATEGY_NO_ACTION;
-
-	if (int_list_contains(rehash_types, event_type))
-		return EVENT_STRATEGY_PARSE_REHASH;
-	if (int_list_contains(copy_types, event_type))
-		return EVENT_STRATEGY_COPY;
-
-	return EVENT_STRATEGY_PARSE_NONE;
+	runtime_provider_free(runtime_set_provider(saved_runtime_provider));
 }
 
 /*
- * During the pre-scan, we propagate EFI partition information from one BSA event
- * to the next.
+ * Number of workers for --jobs. By default, use as many as there are
+ * CPUs online.
  */
-static void
-predictor_pre_scan_eventlog(struct predictor *pred, tpm_event_t **stop_event_p)
-{
-	tpm_event_log_scan_ctx_t scan_ctx;
-	tpm_event_t *ev;
-
-	*stop_event_p = NULL;
-
-	tpm_event_log_scan_ctx_init(&scan_ctx);
-	for (ev = pred->event_log; ev; ev = ev->next) {
-		ev->rehash_strategy = predictor_get_event_strategy(ev->event_type);
-		/* debug("%s -> %d\n", tpm_event_type_to_string(ev->event_type), ev->rehash_strategy); */
-
-		/* Calculate the values of PCR1 and PCR3 only based on the event data */
-		if (ev->rehash_strategy == EVENT_STRATEGY_PARSE_REHASH &&
-		    (ev->pcr_index == 1 || ev->pcr_index == 3))
-			ev->rehash_strategy = EVENT_STRATEGY_COPY;
-
-		if (ev->rehash_strategy == EVENT_STRATEGY_PARSE_REHASH) {
-			if (!tpm_event_parse(ev, &scan_ctx)) {
-				/* Provide better error logging */
-				error("Unable to parse %s event from TPM log\n", tpm_event_type_to_string(ev->event_type));
-				if (opt_debug)
-					__tpm_event_print(ev, debug);
-				fatal("Aborting.\n");
-			}
-		}
-
-		if (__check_stop_event(ev, pred->stop_event.type, pred->stop_event.value, &scan_ctx)) {
-			*stop_event_p = ev;
-			break;
-		}
-	}
-	tpm_event_log_scan_ctx_destroy(&scan_ctx);
-}
-
-static bool
-predictor_update_eventlog(struct predictor *pred)
-{
-	tpm_event_log_rehash_ctx_t rehash_ctx;
-	tpm_event_t *ev, *stop_event = NULL;
-	bool okay = true;
-	char boot_entry_path[PATH_MAX];
-
-	predictor_pre_scan_eventlog(pred, &stop_event);
-
-	tpm_event_log_rehash_ctx_init(&rehash_ctx, pred->algo_info);
-	rehash_ctx.use_pesign = opt_use_pesign;
-
-	/* The argument given to --next-kernel will be either "auto" or the
-	 * systemd ID of the next kernel entry to be booted.
-	 * FIXME: we should probably hide this behind a target_platform function.
-	 */
-	if (pred->boot_entry_id != NULL) {
-		snprintf(boot_entry_path, sizeof(boot_entry_path),
-			 "%s/%s", UAPI_BOOT_DIRECTORY, pred->boot_entry_id);
-		assign_string(&rehash_ctx.boot_entry_path, boot_entry_path);
-		if (!(rehash_ctx.boot_entry = sdb_identify_boot_entry(pred->boot_entry_id)))
-			fatal("unable to identify next kernel \"%s\"\n", pred->boot_entry_id);
-	}
-
-	for (ev = pred->event_log; ev; ev = ev->next) {
-		tpm_evdigest_t *pcr;
-		bool stop = false;
-
-		stop = (ev == stop_event);
-		if (stop && !pred->stop_event.after) {
-			debug("Stopped processing event log before indicated event\n");
-			break;
-		}
-
-		pcr = predictor_get_pcr_state(pred, ev->pcr_index, NULL);
-		if (pcr != NULL) {
-			tpm_parsed_event_t *parsed;
-			const tpm_evdigest_t *old_digest, *new_digest;
-			const char *description = NULL;
-
-			debug("\n");
-			__tpm_event_print(ev, debug);
-
-			if (!(old_digest = tpm_event_get_digest(ev, pred->algo_info)))
-				fatal("Event log lacks a hash for digest algorithm %s\n", pred->algo);
-
-			if (false) {
-				const tpm_evdigest_t *tmp_digest;
-
-				tmp_digest = digest_compute(pred->algo_info, ev->event_data, ev->event_size);
-				if (!tmp_digest) {
-					debug("cannot compute digest for event data\n");
-				} else if (!digest_equal(old_digest, tmp_digest)) {
-					debug("firmware did more than just hash the event data\n");
-					debug("  Old digest: %s\n", digest_print(old_digest));
-					debug("  New digest: %s\n", digest_print(tmp_digest));
-				}
-			}
-
-			/* By the time we encounter the GPT event, we usually haven't seen any
-			 * BOOT_SERVICES event that would tell us which partition we're booting
-			 * from.
-			 * Scan ahead to the first BSA event to extract the EFI partition.
-			 */
-			if (ev->event_type == TPM2_EFI_GPT_EVENT)
-				__predictor_lookahead_efi_partition(ev, &rehash_ctx);
-
-			/* The shim loader emits an event that tells us which certificate it
-			 * used to verify the second stage loader. We try to predict that
-			 * by checking the second stage loader's authenticode sig.
-			 */
-			if (ev->event_type == TPM2_EFI_BOOT_SERVICES_APPLICATION)
-				__predictor_lookahead_shim_loaded(ev, &rehash_ctx);
-
-			switch (ev->rehash_strategy) {
-			case EVENT_STRATEGY_PARSE_REHASH:
-				/* Event already parsed in pre-scan */
-				parsed = ev->__parsed;
-
-				new_digest = tpm_parsed_event_rehash(ev, parsed, &rehash_ctx);
-				description = tpm_parsed_event_describe(parsed);
-				break;
-
-			case EVENT_STRATEGY_COPY:
-				new_digest = old_digest;
-				break;
-
-			case EVENT_STRATEGY_NO_ACTION:
-				goto no_action;
-
-			default:
-				debug("Encountered unexpected event type %s\n",
-						tpm_event_type_to_string(ev->event_type));
-				new_digest = old_digest;
-			}
-
-			if (new_digest == NULL) {
-				error("Failed to re-hash event %u type %s\n",
-						ev->event_index,
-						tpm_event_type_to_string(ev->event_type));
-				new_digest = old_digest;
-				okay = false;
-			}
-
-			if (opt_debug && new_digest != old_digest) {
-				if (new_digest->size == old_digest->size
-				 && !memcmp(new_digest->data, old_digest->data, old_digest->size)) {
-					debug("Digest for %s did not change\n", description);
-				} else {
-					debug("Digest for %s changed\n", description);
-					debug("  Old digest: %s\n", digest_print(old_digest));
-					debug("  New digest: %s\n", digest_print(new_digest));
-				}
-			}
-
-			predictor_extend_hash(pred, ev->pcr_index, new_digest);
-
-			memcpy(&ev->predicted_digest, new_digest, sizeof(tpm_evdigest_t));
-		}
-
-no_action:
-		if (stop) {
-			debug("Stopped processing event log after indicated event\n");
-			break;
-		}
-	}
-
-	tpm_event_log_rehash_ctx_destroy(&rehash_ctx);
-	return okay;
-}
-
-static const char *
-get_next_arg(int *index_p, int argc, char **argv)
-{
-	int i = *index_p;
-
-	if (i >= argc)
-		usage(1, "Missing argument\n");
-	*index_p += 1;
-	return argv[i];
-}
-
-static bool
-predictor_update_all(struct predictor *pred, int argc, char **argv)
-{
-	int i = 0, pcr_index = -1;
-
-	if (!strcmp(pred->initial_source, "eventlog")) {
-		if (!predictor_update_eventlog(pred))
-			return false;
-	}
-
-	/* If the mask contains exactly one PCR, default pcr_index to that */
-	if (!(pred->pcr_mask & (pred->pcr_mask - 1))) {
-		unsigned int mask = pred->pcr_mask;
-
-		/* integer log2 */
-		for (pcr_index = 0; !(mask & 1); pcr_index++)
-			mask >>= 1;
-	}
-
-	while (i < argc) {
-		const char *type, *arg;
-
-		type = get_next_arg(&i, argc, argv);
-		if (isdigit(*type)) {
-			if (!parse_pcr_index(type, (unsigned int *) &pcr_index))
-				fatal("unable to parse PCR index \"%s\"\n", type);
-			type = get_next_arg(&i, argc, argv);
-		}
-
-		if (!strcmp(type, "eventlog")) {
-			/* do the event log dance */
-			continue;
-		}
-
-		arg = get_next_arg(&i, argc, argv);
-		if (pcr_index < 0) {
-			fprintf(stderr, "Unable to infer which PCR to update for %s %s\n", type, arg);
-			usage(1, NULL);
-		}
-
-		if (!strcmp(type, "string")) {
-			predictor_update_string(pred, pcr_index, arg);
-		} else
-		if (!strcmp(type, "file")) {
-			predictor_update_file(pred, pcr_index, arg);
-		} else {
-			fprintf(stderr, "Unsupported keyword \"%s\" while trying to update predictor\n", type);
-			usage(1, NULL);
-		}
-	}
-
-	return true;
-}
-
-static unsigned int
-predictor_verify(struct predictor *pred, const char *source)
-{
-	tpm_pcr_bank_t actual;
-	unsigned int pcr_index;
-	unsigned int num_mismatches = 0;
-
-	printf("Verifying predicted state versus \"%s\"\n", source);
-	pcr_bank_load_initial_values(&actual, pred->pcr_mask, pred->algo_info, source);
-
-	/* Now compare the digests */
-	for (pcr_index = 0; pcr_index < PCR_BANK_REGISTER_MAX; ++pcr_index) {
-		tpm_evdigest_t *md_predicted, *md_actual;
-
-		md_predicted = pcr_bank_get_register(&pred->prediction, pcr_index, NULL);
-		if (md_predicted == NULL)
-			continue;
-
-		if (!pcr_bank_register_is_valid(&actual, pcr_index)) {
-			md_actual = NULL;
-		} else {
-			md_actual = pcr_bank_get_register(&actual, pcr_index, NULL);
-		}
-
-		if (md_actual == NULL) {
-			/* quietly skip any PCRs we never extended.
-			 * This happens when the PCR mask was "all" */
-			if (digest_is_zero(md_predicted))
-				continue;
-
-			debug("PCR %u not present in %s\n", pcr_index, source);
-			printf("%s:%u %s MISSING\n", pred->algo, pcr_index, digest_print_value(md_predicted));
-			num_mismatches += 1;
-			continue;
-		}
-
-		if (digest_equal(md_predicted, md_actual)) {
-			printf("%s:%u %s OK\n", pred->algo, pcr_index, digest_print_value(md_predicted));
-		} else {
-			printf("%s:%u %s MISMATCH", pred->algo, pcr_index, digest_print_value(md_predicted));
-			printf("; actual=%s\n", digest_print_value(md_actual));
-			num_mismatches += 1;
-		}
-	}
-
-	if (num_mismatches)
-		error("Found %u mismatches\n", num_mismatches);
-	return num_mismatches;
-}
-
-static bool
-compare_events(struct predictor *pred, struct predictor *pred_cmp,
-	       unsigned int pcr_index, tpm_event_t *stop_event)
-{
-	tpm_event_t *ev, *ev_cmp;
-	const tpm_evdigest_t *predicted_digest, *cmp_digest;
-
-	for(ev = pred->event_log, ev_cmp = pred_cmp->event_log; ev; ev = ev->next, ev_cmp = ev_cmp->next) {
-		bool stop = false;
-		stop = (ev == stop_event);
-		if (stop && !pred->stop_event.after) {
-			debug("Stopped processing event log before indicated event\n");
-			break;
-		}
-
-		if (ev->pcr_index == pcr_index) {
-			/* Advance the event in the comparison event log */
-			while(ev_cmp) {
-				if (ev_cmp->pcr_index == pcr_index)
-					break;
-				ev_cmp = ev_cmp->next;
-			}
-
-			if (ev_cmp == NULL) {
-				tpm_event_print(ev);
-				printf("No corresponding event in the comparison event log\n");
-				printf("\n");
-				return false;
-			}
-
-			if (!(cmp_digest = tpm_event_get_digest(ev_cmp, pred->algo_info)))
-				fatal("Comparison event log lacks a hash for digest algorithm %s\n", pred->algo);
-			if (ev->predicted_digest.algo) {
-				predicted_digest = &ev->predicted_digest;
-
-				if (predicted_digest->size == cmp_digest->size
-				    && memcmp(predicted_digest->data, cmp_digest->data, cmp_digest->size)) {
-					printf("Predicted event:\n");
-					tpm_predicted_event_print(ev);
-					printf("Actual event:\n");
-					tpm_event_print(ev_cmp);
-					printf("\n");
-
-					return false;
-				}
-			}
-		}
-
-		if (stop) {
-			debug("Stopped processing event log after indicated event\n");
-			break;
-		}
-	}
-
-	return true;
-}
-
 static unsigned int
-predictor_compare(struct predictor *pred, struct predictor *pred_cmp)
-{
-	const tpm_pcr_bank_t *bank = &pred->prediction;
-	unsigned int pcr_index;
-	tpm_event_t *stop_event = NULL;
-	unsigned int num_diff = 0;
-
-	predictor_pre_scan_eventlog(pred, &stop_event);
-
-	for (pcr_index = 0; pcr_index < PCR_BANK_REGISTER_MAX; ++pcr_index) {
-		if (!pcr_bank_register_is_valid(bank, pcr_index))
-			continue;
-
-		if (!compare_events(pred, pred_cmp, pcr_index, stop_event))
-			num_diff++;
-	}
-
-	if (num_diff == 0)
-		printf("Predicted event log matches.\n");
-
-	return 0;
-}
-
-static void
-predictor_report(struct predictor *pred)
+parse_jobs(const char *string)
 {
-	const tpm_pcr_bank_t *bank = &pred->prediction;
-	unsigned int pcr_index;
+	unsigned long value;
+	long nprocs;
+	char *end;
 
-	for (pcr_index = 0; pcr_index < PCR_BANK_REGISTER_MAX; ++pcr_index) {
-		if (pcr_bank_register_is_valid(bank, pcr_index))
-			pred->report_fn(pred, pcr_index);
+	if (string == NULL) {
+		if ((nprocs = sysconf(_SC_NPROCESSORS_ONLN)) > 0)
+			return nprocs;
+		return 1;
 	}
-}
 
-static void
-predictor_report_plain(struct predictor *pred, unsigned int pcr_index)
-{
-	unsigned int i;
-	tpm_evdigest_t *pcr;
+	errno = 0;
+	value = strtoul(string, &end, 0);
+	if (*string == '\0' || *end || errno || value == 0 || value > 1024)
+		usage(1, "Invalid argument to --jobs\n");
 
-	if (!(pcr = predictor_get_pcr_state(pred, pcr_index, NULL)))
-		return;
-
-	printf("%s:%u ", pred->algo, pcr_index);
-	for (i = 0; i < pcr->size; i++)
-		printf("%02x", pcr->data[i]);
-	printf("\n");
-}
-
-static void
-predictor_report_tpm2_tools(struct predictor *pred, unsigned int pcr_index)
-{
-	unsigned int i;
-	tpm_evdigest_t *pcr;
-
-	if (!(pcr = predictor_get_pcr_state(pred, pcr_index, NULL)))
-		return;
-
-	printf("  %-2d: 0x", pcr_index);
-	for (i = 0; i < pcr->size; i++)
-		printf("%02X", pcr->data[i]);
-	printf("\n");
-}
-
-static void
-predictor_report_binary(struct predictor *pred, unsigned int pcr_index)
-{
-	tpm_evdigest_t *pcr;
-
-	if (!(pcr = predictor_get_pcr_state(pred, pcr_index, NULL)))
-		return;
-	if (fwrite(pcr->data, pcr->size, 1, stdout) != 1)
-		fatal("failed to write hash to stdout");
+	return value;
 }
 
 static const char *
@@ -1068,6 +363,12 @@ get_action_argument(int argc, char **argv)
 		{ "sign",			ACTION_SIGN	},
 		{ "self-test",			ACTION_SELFTEST	},
 		{ "rsa-test",			ACTION_RSATEST	},
+		{ "replay-corpus",		ACTION_REPLAY_CORPUS	},
+		{ "serve",			ACTION_SERVE	},
+		{ "component-db",		ACTION_COMPONENT_DB	},
+		{ "authenticode-hash",		ACTION_AUTHENTICODE_HASH	},
+		{ "digest-bench",		ACTION_DIGEST_BENCH	},
+		{ "watch",			ACTION_WATCH	},
 
 		{ NULL, 0 },
 	};
@@ -1092,6 +393,36 @@ get_action_argument(int argc, char **argv)
 	return ACTION_NONE;
 }
 
+/*
+ * Everything besides the inputs of individual events that determines how
+ * we re-hash them. If any of this changes, the state file is discarded.
+ */
+static const char *
+rehash_state_context(const char *compdb_path, const char *compdb_arch,
+		const char **compdb_versions, unsigned int num_compdb_versions)
+{
+	static char context[4096];
+	unsigned int i, len;
+	char *fingerprint = NULL;
+
+	if (compdb_path)
+		fingerprint = runtime_input_fingerprint(RUNTIME_INPUT_ROOTFS_FILE, compdb_path);
+
+	snprintf(context, sizeof(context), "pesign=%u compdb=%s:%s arch=%s versions=",
+			opt_use_pesign,
+			compdb_path? : "-", fingerprint? : "-",
+			compdb_arch? : "-");
+	drop_string(&fingerprint);
+
+	for (i = 0; i < num_compdb_versions; ++i) {
+		len = strlen(context);
+		snprintf(context + len, sizeof(context) - len, "%s%s",
+				i? "," : "", compdb_versions[i]);
+	}
+
+	return context;
+}
+
 static tpm_pcr_selection_t *
 get_pcr_selection_argument(int argc, char ** argv, const char *algo_name)
 {
@@ -1120,7 +451,10 @@ main(int argc, char **argv)
 	char *opt_from = NULL;
 	char *opt_algo = NULL;
 	char *opt_output_format = NULL;
-	char *opt_stop_event = NULL;
+	const char *opt_stop_events[PREDICTOR_STOP_EVENTS_MAX];
+	unsigned int opt_num_component_versions = 0;
+	const char *opt_component_versions[COMPONENT_VERSIONS_MAX];
+	unsigned int opt_num_stop_events = 0;
 	char *opt_eventlog_path = NULL;
 	bool opt_stop_before = true;
 	char *opt_verify = NULL;
@@ -1128,19 +462,39 @@ main(int argc, char **argv)
 	char *opt_replay_testcase = NULL;
 	char *opt_input = NULL;
 	char *opt_output = NULL;
+	const char *opt_inputs[UNSEAL_SECRETS_MAX];
+	const char *opt_outputs[UNSEAL_SECRETS_MAX];
+	unsigned int opt_num_inputs = 0, opt_num_outputs = 0;
 	char *opt_authorized_policy = NULL;
 	char *opt_pcr_policy = NULL;
 	stored_key_t *opt_rsa_private_key = NULL;
 	stored_key_t *opt_rsa_public_key = NULL;
 	bool opt_rsa_generate = false;
 	char *opt_rsa_bits = NULL;
+	char *opt_signing_key_type = NULL;
+	char *opt_srk_handle = NULL;
+	char *opt_srk_public = NULL;
+	char *opt_socket = NULL;
 	char *opt_policy_name = NULL;
 	char *opt_target_platform = NULL;
 	char *opt_boot_entry = NULL;
 	bool opt_compare_current = false;
+	bool opt_exit_code = false;
+	char *opt_jobs = NULL;
+	char *opt_component_db = NULL;
+	char *opt_component_arch = NULL;
+	char *opt_state_file = NULL;
+	unsigned int opt_settle_time = WATCH_DEFAULT_SETTLE_TIME;
+	bool opt_watch = false;
+	char *opt_coalesce = NULL;
+	bool opt_remote = false;
+	char *opt_remote_bundle = NULL;
+	char *opt_corpus = NULL;
+	rehash_state_t *rehash_state = NULL;
 	const target_platform_t *target;
 	unsigned int action_flags = 0;
 	unsigned int rsa_bits = 2048;
+	unsigned int i;
 	int c, exit_code = 0;
 
 	set_srk_alg("RSA");
@@ -1178,7 +532,9 @@ main(int argc, char **argv)
 			opt_boot_entry = optarg;
 			break;
 		case OPT_STOP_EVENT:
-			opt_stop_event = optarg;
+			if (opt_num_stop_events >= PREDICTOR_STOP_EVENTS_MAX)
+				usage(1, "Too many --stop-event options\n");
+			opt_stop_events[opt_num_stop_events++] = optarg;
 			break;
 		case OPT_TPM_EVENTLOG:
 			opt_eventlog_path = optarg;
@@ -1212,14 +568,32 @@ main(int argc, char **argv)
 		case OPT_RSA_BITS:
 			opt_rsa_bits = optarg;
 			break;
+		case OPT_SIGNING_KEY_TYPE:
+			opt_signing_key_type = optarg;
+			break;
 		case OPT_ECC_SRK:
 			set_srk_alg("ECC");
 			break;
+		case OPT_SRK_HANDLE:
+			opt_srk_handle = optarg;
+			break;
+		case OPT_SRK_PUBLIC:
+			opt_srk_public = optarg;
+			break;
+		case OPT_SOCKET:
+			opt_socket = optarg;
+			break;
 		case OPT_INPUT:
 			opt_input = optarg;
+			if (opt_num_inputs < UNSEAL_SECRETS_MAX)
+				opt_inputs[opt_num_inputs] = optarg;
+			opt_num_inputs++;
 			break;
 		case OPT_OUTPUT:
 			opt_output = optarg;
+			if (opt_num_outputs < UNSEAL_SECRETS_MAX)
+				opt_outputs[opt_num_outputs] = optarg;
+			opt_num_outputs++;
 			break;
 		case OPT_AUTHORIZED_POLICY:
 			opt_authorized_policy = optarg;
@@ -1244,6 +618,58 @@ main(int argc, char **argv)
 		case OPT_COMPARE_CURRENT:
 			opt_compare_current = true;
 			break;
+		case OPT_JOBS:
+			opt_jobs = optarg;
+			break;
+		case OPT_COMPONENT_DB:
+			opt_component_db = optarg;
+			break;
+		case OPT_COMPONENT_ARCH:
+			opt_component_arch = optarg;
+			break;
+		case OPT_REMOTE:
+			opt_remote = true;
+			break;
+		case OPT_REMOTE_BUNDLE:
+			opt_remote = true;
+			opt_remote_bundle = optarg;
+			break;
+		case OPT_DIGEST_BACKEND:
+			if (!digest_backend_set_preferred(optarg))
+				usage(1, NULL);
+			break;
+		case OPT_TPM_TRACE:
+			if (!tpm_trace_enable(optarg))
+				usage(1, NULL);
+			break;
+		case OPT_TCTI:
+			tpm_set_tcti(optarg);
+			break;
+		case OPT_PKCS11_SESSIONS:
+			if (!pkcs11_set_max_sessions(optarg))
+				usage(1, NULL);
+			break;
+		case OPT_FORCE_SIGN:
+			set_policy_always_sign(true);
+			break;
+		case OPT_EXIT_CODE:
+			opt_exit_code = true;
+			break;
+		case OPT_STATE_FILE:
+			opt_state_file = optarg;
+			break;
+		case OPT_SETTLE_TIME:
+			if (!watch_set_settle_time(optarg, &opt_settle_time))
+				usage(1, NULL);
+			break;
+		case OPT_COALESCE:
+			opt_coalesce = optarg;
+			break;
+		case OPT_COMPONENT_VERSION:
+			if (opt_num_component_versions >= COMPONENT_VERSIONS_MAX)
+				usage(1, "Too many --component-version options\n");
+			opt_component_versions[opt_num_component_versions++] = optarg;
+			break;
 		case 'h':
 			usage(0, NULL);
 		default:
@@ -1253,6 +679,31 @@ main(int argc, char **argv)
 
 	action = get_action_argument(argc, argv);
 
+	/* watch is followed by the action to repeat whenever something changes */
+	if (action == ACTION_WATCH) {
+		opt_watch = true;
+		action = get_action_argument(argc, argv);
+		if (action != ACTION_SIGN && action != ACTION_SEAL)
+			usage(1, "watch can only be combined with sign or seal-secret\n");
+		if (opt_state_file == NULL)
+			usage(1, "watch requires --state-file\n");
+		if (opt_authorized_policy)
+			usage(1, "watch cannot be used when sealing against an authorized policy\n");
+		if (action == ACTION_SEAL && (opt_input == NULL || opt_output == NULL))
+			usage(1, "watch seal-secret requires --input and --output\n");
+		if (opt_remote || opt_replay_testcase || opt_create_testcase)
+			usage(1, "watch cannot be combined with --remote or test cases\n");
+	}
+
+	if (opt_coalesce) {
+		if (action != ACTION_SIGN && action != ACTION_SEAL)
+			usage(1, "--coalesce can only be used when signing or sealing\n");
+		if (opt_watch)
+			usage(1, "--coalesce cannot be combined with watch\n");
+		if (opt_remote || opt_replay_testcase || opt_create_testcase)
+			usage(1, "--coalesce cannot be combined with --remote or test cases\n");
+	}
+
 	if (opt_replay_testcase && opt_create_testcase)
 		fatal("--create-testcase and --replay-testcase are mutually exclusive\n");
 
@@ -1265,6 +716,24 @@ main(int argc, char **argv)
 	if (!opt_replay_testcase && opt_compare_current)
 		fatal("--compare-current is only valid for --replay-testcase\n");
 
+	if (opt_remote) {
+		if (opt_replay_testcase || opt_create_testcase)
+			fatal("--remote cannot be combined with --replay-testcase or --create-testcase\n");
+		if (opt_boot_entry)
+			fatal("--boot-entry (or --next-kernel) is not supported when predicting for a remote system\n");
+		if (opt_use_pesign)
+			fatal("--use-pesign is not supported when predicting for a remote system\n");
+		if ((opt_from && !strcmp(opt_from, "snapshot")) || (opt_verify && !strcmp(opt_verify, "snapshot")))
+			fatal("PCR snapshots are not available when predicting for a remote system\n");
+		if ((opt_from && !strcmp(opt_from, "current")) || (opt_verify && !strcmp(opt_verify, "current")))
+			fatal("Current PCR values are not available when predicting for a remote system\n");
+		if (opt_remote_bundle == NULL && !opt_eventlog_path && action != ACTION_SERVE)
+			fatal("Predicting for a remote system requires --tpm-eventlog or --remote-bundle\n");
+
+		saved_runtime_provider = runtime_set_provider(runtime_provider_remote_new(opt_remote_bundle));
+		atexit(restore_runtime_provider);
+	}
+
 	if (opt_rsa_bits) {
 		if (strcmp(opt_rsa_bits, "2048") == 0)
 			rsa_bits = 2048;
@@ -1278,6 +747,24 @@ main(int argc, char **argv)
 			fatal("Unsupported RSA bits: %s\n", opt_rsa_bits);
 	}
 
+	if (opt_srk_handle) {
+		unsigned long handle;
+		char *end;
+
+		handle = strtoul(opt_srk_handle, &end, 0);
+		if (*end || !set_srk_handle(handle))
+			fatal("Invalid SRK handle \"%s\"\n", opt_srk_handle);
+	}
+
+	if (opt_srk_public) {
+		if (action != ACTION_SEAL)
+			usage(1, "--srk-public can only be used when sealing a secret\n");
+		if (opt_srk_handle)
+			usage(1, "--srk-public and --srk-handle are mutually exclusive\n");
+		if (!set_srk_public_key(opt_srk_public))
+			return 1;
+	}
+
 	if (opt_target_platform == NULL)
 		opt_target_platform = "tpm2.0";
 	if ((target = pcr_get_target_platform(opt_target_platform)) == NULL)
@@ -1328,6 +815,12 @@ main(int argc, char **argv)
 			usage(1, "You need to specify an input file via --input when unsealing a secret");
 		if ((action_flags & PLATFORM_NEED_OUTPUT_FILE) && !opt_output)
 			usage(1, "You need to specify an output file via --output when unsealing a secret");
+		if (opt_num_inputs > 1 || opt_num_outputs > 1) {
+			if (opt_num_inputs != opt_num_outputs)
+				usage(1, "When unsealing several secrets, every --input needs a matching --output\n");
+			if (opt_num_inputs > UNSEAL_SECRETS_MAX)
+				usage(1, "Too many secrets to unseal\n");
+		}
 		if (action_flags & PLATFORM_NEED_PCR_SELECTION)
 			pcr_selection = get_pcr_selection_argument(argc, argv, opt_algo);
 		end_arguments(argc, argv);
@@ -1351,10 +844,99 @@ main(int argc, char **argv)
 		end_arguments(argc, argv);
 		break;
 
+	case ACTION_REPLAY_CORPUS:
+		if (opt_replay_testcase || opt_create_testcase)
+			usage(1, "replay-corpus cannot be combined with --replay-testcase or --create-testcase\n");
+		if (opt_compare_current)
+			usage(1, "replay-corpus does not support --compare-current\n");
+		pcr_selection = get_pcr_selection_argument(argc, argv, opt_algo);
+		opt_corpus = (char *) next_argument(argc, argv);
+		end_arguments(argc, argv);
+		break;
+
+	case ACTION_SERVE:
+		if (opt_replay_testcase || opt_create_testcase)
+			usage(1, "serve cannot be combined with --replay-testcase or --create-testcase\n");
+		end_arguments(argc, argv);
+		break;
+
+	case ACTION_COMPONENT_DB:
+		if (opt_input == NULL || opt_output == NULL)
+			usage(1, "You need to specify the --input and --output options when building a component database\n");
+		end_arguments(argc, argv);
+		break;
+
+	case ACTION_AUTHENTICODE_HASH:
+		if (optind >= argc)
+			usage(1, "You need to specify the files or directories to hash\n");
+		break;
+
+	case ACTION_DIGEST_BENCH:
+		end_arguments(argc, argv);
+		break;
+
 	default:
 		fatal("Action %u not implemented", action);
 	}
 
+	if (action == ACTION_COMPONENT_DB) {
+		compdb_builder_t *builder = compdb_builder_new();
+		bool okay;
+
+		okay = compdb_builder_read_manifest(builder, opt_input)
+		    && compdb_builder_write(builder, opt_output);
+		compdb_builder_free(builder);
+		return okay? 0 : 1;
+	}
+
+	if (action == ACTION_DIGEST_BENCH)
+		return digest_backend_bench()? 0 : 1;
+
+	if (action == ACTION_AUTHENTICODE_HASH) {
+		struct authenticode_hash ah = {
+			.version	= "-",
+			.arch		= opt_component_arch,
+		};
+		char *algos, *name;
+
+		if (opt_num_component_versions > 1 || (opt_num_component_versions && strchr(opt_component_versions[0], '=')))
+			usage(1, "authenticode-hash takes a single --component-version VERSION\n");
+		if (opt_num_component_versions)
+			ah.version = opt_component_versions[0];
+
+		algos = strdup(opt_algo? : "sha256");
+		for (name = strtok(algos, ","); name; name = strtok(NULL, ",")) {
+			if (ah.num_algos >= AUTHENTICODE_HASH_ALGOS_MAX)
+				usage(1, "Too many hash algorithms\n");
+			if (!(ah.algos[ah.num_algos++] = digest_by_name(name)))
+				fatal("Unknown hash algorithm %s\n", name);
+		}
+		free(algos);
+
+		ah.max_jobs = parse_jobs(opt_jobs);
+
+		while (optind < argc)
+			authenticode_hash_scan(&ah, argv[optind++]);
+
+		return authenticode_hash(&ah, opt_output_format, opt_output);
+	}
+
+	if (opt_component_db) {
+		compdb_t *component_db;
+
+		if (!(component_db = compdb_open(opt_component_db)))
+			return 1;
+		if (opt_component_arch)
+			compdb_set_arch(component_db, opt_component_arch);
+		for (i = 0; i < opt_num_component_versions; ++i) {
+			if (!compdb_pin_version(component_db, opt_component_versions[i]))
+				return 1;
+		}
+		predictor_set_component_db(component_db);
+	} else if (opt_component_arch || opt_num_component_versions) {
+		usage(1, "--component-arch and --component-version require --component-db\n");
+	}
+
 	/* If we're asked to generate a new RSA key, do so.  This
 	 * doesn't add anything beyond what "openssl genrsa" would do,
 	 * except it saves you from installing the openssl tool suite
@@ -1364,8 +946,16 @@ main(int argc, char **argv)
 				 action == ACTION_SIGN)) {
 		tpm_rsa_key_t *key;
 
-		infomsg("Generating new RSA key\n");
-		if (!(key = tpm_rsa_generate(rsa_bits)))
+		if (opt_signing_key_type == NULL || !strcmp(opt_signing_key_type, "rsa")) {
+			infomsg("Generating new RSA key\n");
+			key = tpm_rsa_generate(rsa_bits);
+		} else if (!strncmp(opt_signing_key_type, "ecc-", 4)) {
+			infomsg("Generating new ECC key\n");
+			key = tpm_ecc_generate(opt_signing_key_type + 4);
+		} else {
+			fatal("Unsupported signing key type \"%s\"\n", opt_signing_key_type);
+		}
+		if (key == NULL)
 			return 1;
 		if (!stored_key_write_rsa_private(opt_rsa_private_key, key))
 			return 1;
@@ -1413,38 +1003,139 @@ main(int argc, char **argv)
 	}
 
 	if (action == ACTION_UNSEAL) {
-		if (!pcr_unseal_secret(target, pcr_selection, opt_pcr_policy, opt_rsa_public_key, opt_input, opt_output))
+		bool okay;
+
+		if (opt_num_inputs > 1)
+			okay = pcr_unseal_secrets(target, pcr_selection, opt_pcr_policy, opt_rsa_public_key,
+						opt_num_inputs, opt_inputs, opt_outputs);
+		else
+			okay = pcr_unseal_secret(target, pcr_selection, opt_pcr_policy, opt_rsa_public_key, opt_input, opt_output);
+		if (!okay)
 			return 1;
 
 		return 0;
 	}
 
-	if (opt_stop_event && (!opt_from || strcmp(opt_from, "eventlog")))
+	if (action == ACTION_REPLAY_CORPUS) {
+		struct replay_corpus corpus = {
+			.pcr_selection	= pcr_selection,
+			.from		= opt_from? : "eventlog",
+			.verify		= opt_verify? : "current",
+			.boot_entry_id	= opt_boot_entry,
+			.stop_events	= opt_stop_events,
+			.num_stop_events = opt_num_stop_events,
+			.stop_after	= !opt_stop_before,
+			.max_jobs	= parse_jobs(opt_jobs),
+		};
+
+		if (opt_num_stop_events && strcmp(corpus.from, "eventlog"))
+			usage(1, "--stop-event only makes sense when using event log");
+		/* Like predict --verify, we can only check a single PCR state */
+		if (opt_num_stop_events > 1)
+			usage(1, "replay-corpus cannot be combined with multiple --stop-event options\n");
+
+		return replay_corpus(&corpus, opt_corpus);
+	}
+
+	if (action == ACTION_SERVE)
+		return serve_predictor(target, opt_rsa_private_key, opt_socket? : SERVE_DEFAULT_SOCKET,
+				parse_jobs(opt_jobs));
+
+	if (opt_num_stop_events && (!opt_from || strcmp(opt_from, "eventlog")))
 		usage(1, "--stop-event only makes sense when using event log");
 
+	/* With --boot-entry all, we report one prediction per boot entry */
+	if (opt_boot_entry && !strcasecmp(opt_boot_entry, "all")) {
+		if (action != ACTION_PREDICT && action != ACTION_SIGN && action != ACTION_SEAL)
+			usage(1, "--boot-entry all is supported only when predicting, sealing or signing\n");
+		if (!opt_from || strcmp(opt_from, "eventlog"))
+			usage(1, "--boot-entry all only makes sense when using event log\n");
+		if (opt_num_stop_events > 1)
+			usage(1, "--boot-entry all cannot be combined with multiple --stop-event options\n");
+		if (opt_verify || opt_compare_current)
+			usage(1, "--boot-entry all cannot be combined with --verify or --compare-current\n");
+		if (action == ACTION_PREDICT && opt_output_format && !strcasecmp(opt_output_format, "binary"))
+			usage(1, "--boot-entry all cannot be combined with binary output\n");
+	}
+
+	/* With several stop events, we report one PCR snapshot per event */
+	if (opt_num_stop_events > 1) {
+		if (action != ACTION_PREDICT && action != ACTION_SEAL)
+			usage(1, "Multiple --stop-event options are supported only when predicting or sealing\n");
+		if (opt_verify || opt_compare_current)
+			usage(1, "Multiple --stop-event options cannot be combined with --verify or --compare-current\n");
+		if (opt_output_format && !strcasecmp(opt_output_format, "binary"))
+			usage(1, "Multiple --stop-event options cannot be combined with binary output\n");
+	}
+
 	/* If pcr_selection is NULL, the programmer must have been sloppy. */
 	if (pcr_selection == NULL)
 		fatal("BUG: action %u should have parsed a PCR selection argument", action);
 
+	if (opt_watch) {
+		if (!opt_from || strcmp(opt_from, "eventlog"))
+			usage(1, "watch requires --from eventlog\n");
+
+		/* Only the child returns from here */
+		exit_code = watch_run(pcr_selection->algo_info, opt_state_file,
+				rehash_state_context(opt_component_db, opt_component_arch,
+					opt_component_versions, opt_num_component_versions),
+				opt_settle_time);
+		if (exit_code >= 0)
+			return exit_code;
+		exit_code = 0;
+	}
+
+	if (opt_coalesce) {
+		/* Only the worker's child returns from here */
+		exit_code = coalesce_run(opt_coalesce, argc, argv, opt_settle_time);
+		if (exit_code >= 0)
+			return exit_code;
+		exit_code = 0;
+	}
+
 	pred = predictor_new(pcr_selection, opt_from, opt_eventlog_path,
 			opt_output_format, opt_boot_entry);
 
-	if (opt_stop_event)
-		predictor_set_stop_event(pred, opt_stop_event, !opt_stop_before);
+	for (i = 0; i < opt_num_stop_events; ++i)
+		predictor_add_stop_event(pred, opt_stop_events[i], !opt_stop_before);
 
 	if (opt_compare_current) {
-		testcase_t *tc_playback = runtime_get_replay_testcase();
+		runtime_provider_t *playback;
+
+		predictor_keep_events(pred);
+
 		/* Disable replay testcase temporarily to access the current TPM event log*/
-		runtime_replay_testcase(NULL);
+		playback = runtime_set_provider(NULL);
 		pred_cmp = predictor_new(pcr_selection, "eventlog", NULL,
 					 opt_output_format, opt_boot_entry);
 		/* Restore replay testcase */
-		runtime_replay_testcase(tc_playback);
+		runtime_set_provider(playback);
+	}
+
+	/* The state file describes the local system. When replaying or recording
+	 * a testcase, or predicting for a remote system, it does not apply. */
+	if (opt_state_file) {
+		if (!runtime_is_local() || opt_create_testcase)
+			usage(1, "--state-file cannot be combined with --remote, --create-testcase or --replay-testcase\n");
+
+		rehash_state = rehash_state_load(opt_state_file, predictor_get_algo(pred),
+				rehash_state_context(opt_component_db, opt_component_arch,
+					opt_component_versions, opt_num_component_versions));
+		predictor_set_rehash_state(rehash_state);
 	}
 
 	if (!predictor_update_all(pred, argc - optind, argv + optind))
 		return 1;
 
+	/* Failing to update the state only makes the next run slower */
+	if (rehash_state) {
+		if (!rehash_state_save(rehash_state))
+			warning("Unable to update state file %s\n", opt_state_file);
+		predictor_set_rehash_state(NULL);
+		rehash_state_free(rehash_state);
+	}
+
 	if (action == ACTION_PREDICT) {
 		if (opt_verify)
 			exit_code = !!predictor_verify(pred, opt_verify);
@@ -1454,12 +1145,32 @@ main(int argc, char **argv)
 			predictor_report(pred);
 	} else
 	if (action == ACTION_SEAL) {
-		if (!pcr_seal_secret(target, &pred->prediction, opt_input, opt_output))
+		const tpm_pcr_bank_t *banks[PCR_POLICY_OR_MAX];
+		unsigned int num_banks;
+
+		if (!(num_banks = predictor_get_states(pred, banks, PCR_POLICY_OR_MAX)))
+			return 1;
+
+		/* When watching, re-seal only if the policy changed */
+		if (opt_watch && pcr_sealed_secret_is_current(target, banks, num_banks, opt_output)) {
+			infomsg("Secret in %s is already sealed against the predicted policy\n", opt_output);
+		} else
+		if (num_banks == 1) {
+			if (!pcr_seal_secret(target, banks[0], opt_input, opt_output))
+				return 1;
+		} else
+		if (!pcr_seal_secret_or(target, banks, num_banks, opt_input, opt_output))
 			return 1;
 	} else
 	if (action == ACTION_SIGN) {
-		if (!pcr_policy_sign(target, &pred->prediction, opt_rsa_private_key, opt_input, opt_output, opt_policy_name))
+		bool unchanged = false;
+
+		if (!predictor_sign(pred, target, opt_rsa_private_key, opt_input, opt_output, opt_policy_name, &unchanged))
 			return 1;
+
+		/* Let package hooks know that there was nothing to do */
+		if (unchanged && opt_exit_code)
+			exit_code = 2;
 	}
 
 	return exit_code;
@@ -25,6 +25,7 @@
 
 extern bool		ima_is_active(void);
 extern buffer_t *	platform_read_shim_vendor_cert(void);
+extern void		tpm_set_tcti(const char *conf);
 extern bool		tpm_selftest(bool fulltest);
 extern bool		tpm_rsa_bits_test(unsigned int rsa_bits);
 
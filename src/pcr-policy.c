@@ -24,6 +24,7 @@
 #include <stdarg.h>
 #include <assert.h>
 #include <ctype.h>
+#include <pthread.h>
 #include <tss2_esys.h>
 #include <tss2_sys.h>
 #include <tss2_tctildr.h>
@@ -41,25 +42,74 @@
 #include "config.h"
 #include "tpm2key.h"
 #include "sd-boot.h"
+#include "import.h"
+
+/*
+ * A PCR policy that has been signed, and is waiting to be written out.
+ */
+typedef struct pcr_signed_policy {
+	char *			name;
+	char *			output_path;
+	tpm_pcr_bank_t		bank;
+	TPM2B_DIGEST *		pcr_policy;
+	TPMT_SIGNATURE *	signature;
+
+	/* The output already has a valid signature for this policy */
+	bool			unchanged;
+} pcr_signed_policy_t;
+
+struct pcr_policy_batch {
+	const target_platform_t *platform;
+	tpm_rsa_key_t *		signing_key;
+
+	unsigned int		count;
+	pcr_signed_policy_t *	policies;
+	unsigned int		num_unchanged;
+};
 
 struct target_platform {
 	const char *    name;
 	unsigned int	unseal_flags;
 
+	/* import_seed is non-NULL if the secret was sealed offline, and
+	 * sealed_private is a duplication blob that needs to be imported.
+	 * policy_or is non-NULL if the secret was sealed against several
+	 * PCR states, and lists the PolicyPCR digest of each. */
 	bool		(*write_sealed_secret)(const char *pathname,
 					const TPML_PCR_SELECTION *pcr_sel,
+					const TPML_DIGEST *policy_or,
 					const TPM2B_PRIVATE *sealed_private,
-					const TPM2B_PUBLIC *sealed_public);
+					const TPM2B_PUBLIC *sealed_public,
+					const TPM2B_ENCRYPTED_SECRET *import_seed);
 	bool		(*write_signed_policy)(const char *input_path, const char *output_path,
 					const char *policy_name,
 					const tpm_pcr_bank_t *bank,
 					const TPM2B_DIGEST *pcr_policy,
 					const tpm_rsa_key_t *signing_key,
 					const TPMT_SIGNATURE *signed_policy);
+	/* Write several signed policies to the same output file at once */
+	bool		(*write_signed_policies)(const char *input_path, const char *output_path,
+					unsigned int count,
+					const pcr_signed_policy_t **policies,
+					const tpm_rsa_key_t *signing_key);
+	/* Check whether output_path already holds a valid signature for this
+	 * policy, made with this signing key */
+	bool		(*signed_policy_is_current)(const char *output_path,
+					const pcr_signed_policy_t *policy,
+					const tpm_rsa_key_t *signing_key);
+	/* Check whether output_path holds a secret sealed against this policy */
+	bool		(*sealed_policy_is_current)(const char *output_path,
+					const TPM2B_DIGEST *policy);
 	bool		(*unseal_secret)(const char *input_path, const char *output_path,
 					const tpm_pcr_selection_t *pcr_selection,
 					const char *signed_policy_path,
 					const stored_key_t *public_key_file);
+	/* Unseal several secrets sharing the same policy at once */
+	bool		(*unseal_secrets)(unsigned int count,
+					const char **input_paths, const char **output_paths,
+					const tpm_pcr_selection_t *pcr_selection,
+					const char *signed_policy_path,
+					const stored_key_t *public_key_file);
 };
 
 static TPM2B_PUBLIC RSA_SRK_template = {
@@ -117,6 +167,27 @@ static TPM2B_PUBLIC ECC_SRK_template = {
 
 static const TPM2B_PUBLIC *SRK_template;
 
+/* If non-zero, use the SRK stored at this persistent handle rather than
+ * deriving it via CreatePrimary */
+static TPM2_HANDLE SRK_persistent_handle;
+
+/* If set, seal secrets offline to this SRK public key rather than using
+ * the local TPM */
+static TPM2B_PUBLIC *SRK_public;
+
+/* If set, sign policies even if the output already has a valid signature */
+static bool pcr_policy_always_sign;
+
+/* The SRK is cached for the lifetime of the process, so that sealing
+ * or unsealing several secrets in a row creates it only once. */
+static struct {
+	ESYS_TR		handle;
+	bool		persistent;
+	TPM2B_PUBLIC	template;
+} SRK_cache = {
+	.handle = ESYS_TR_NONE,
+};
+
 static const TPM2B_PUBLIC seal_public_template = {
             .size = sizeof(TPMT_PUBLIC),
             .publicArea = {
@@ -151,6 +222,38 @@ set_srk_rsa_bits (const unsigned int rsa_bits)
 	RSA_SRK_template.publicArea.parameters.rsaDetail.keyBits = rsa_bits;
 }
 
+bool
+set_srk_handle (unsigned int handle)
+{
+	if (handle < TPM2_PERSISTENT_FIRST || handle > TPM2_PERSISTENT_LAST) {
+		error("SRK handle 0x%x is not a persistent handle\n", handle);
+		return false;
+	}
+
+	SRK_persistent_handle = handle;
+	return true;
+}
+
+void
+set_policy_always_sign(bool always)
+{
+	pcr_policy_always_sign = always;
+}
+
+bool
+set_srk_public_key (const char *path)
+{
+	TPM2B_PUBLIC *pub;
+
+	if (!(pub = tss_read_public_key(path)))
+		return false;
+
+	if (SRK_public)
+		free(SRK_public);
+	SRK_public = pub;
+	return true;
+}
+
 static inline const tpm_evdigest_t *
 tpm_evdigest_from_TPM2B_DIGEST(const TPM2B_DIGEST *td, tpm_evdigest_t *result, const tpm_algo_info_t *algo_info)
 {
@@ -228,18 +331,25 @@ read_secret(const char *path)
 	return sd;
 }
 
+/*
+ * If the secret was sealed against several PCR states, the list of
+ * PolicyPCR digests needed for PolicyOR is appended to the file.
+ */
 static bool
-write_sealed_secret(const char *path, const TPM2B_PUBLIC *pub, const TPM2B_PRIVATE *priv)
+write_sealed_secret(const char *path, const TPM2B_PUBLIC *pub, const TPM2B_PRIVATE *priv,
+		const TPML_DIGEST *policy_or)
 {
 	buffer_t *bp;
 	TPM2_RC rc;
 	bool ok = false;
 
-	bp = buffer_alloc_write(sizeof(*pub) + sizeof(*priv));
+	bp = buffer_alloc_write(sizeof(*pub) + sizeof(*priv) + sizeof(*policy_or));
 
 	rc = Tss2_MU_TPM2B_PUBLIC_Marshal(pub, bp->data, bp->size, &bp->wpos);
 	if (rc == TSS2_RC_SUCCESS)
 		rc = Tss2_MU_TPM2B_PRIVATE_Marshal(priv, bp->data, bp->size, &bp->wpos);
+	if (rc == TSS2_RC_SUCCESS && policy_or)
+		rc = Tss2_MU_TPML_DIGEST_Marshal(policy_or, bp->data, bp->size, &bp->wpos);
 
 	if (tss_check_error(rc, "Tss2_MU_TPM2B_MAX_BUFFER_Marshal failed"))
 		ok = buffer_write_file(path, bp);
@@ -249,10 +359,12 @@ write_sealed_secret(const char *path, const TPM2B_PUBLIC *pub, const TPM2B_PRIVA
 }
 
 static bool
-read_sealed_secret(const char *path, TPM2B_PUBLIC **pub_ret, TPM2B_PRIVATE **priv_ret)
+read_sealed_secret(const char *path, TPM2B_PUBLIC **pub_ret, TPM2B_PRIVATE **priv_ret,
+		TPML_DIGEST **policy_or_ret)
 {
 	TPM2B_PUBLIC *pub = NULL;
 	TPM2B_PRIVATE *priv = NULL;
+	TPML_DIGEST *policy_or = NULL;
 	buffer_t *bp;
 	TPM2_RC rc;
 	bool ok = false;
@@ -266,13 +378,19 @@ read_sealed_secret(const char *path, TPM2B_PUBLIC **pub_ret, TPM2B_PRIVATE **pri
 	rc = Tss2_MU_TPM2B_PUBLIC_Unmarshal(bp->data, bp->size, &bp->rpos, pub);
 	if (rc == TSS2_RC_SUCCESS)
 		rc = Tss2_MU_TPM2B_PRIVATE_Unmarshal(bp->data, bp->size, &bp->rpos, priv);
+	if (rc == TSS2_RC_SUCCESS && bp->rpos < bp->size) {
+		policy_or = calloc(1, sizeof(*policy_or));
+		rc = Tss2_MU_TPML_DIGEST_Unmarshal(bp->data, bp->size, &bp->rpos, policy_or);
+	}
 
 	if (tss_check_error(rc, "Tss2_MU_TPM2B_MAX_BUFFER_Unmarshal failed")) {
 		*priv_ret = priv;
 		*pub_ret = pub;
+		*policy_or_ret = policy_or;
 		ok = true;
 	} else {
 		error("%s does not seem to contain a valid pair of public/private sealed data\n", path);
+		free(policy_or);
 		free(priv);
 		free(pub);
 	}
@@ -574,6 +692,96 @@ __pcr_policy_make(ESYS_CONTEXT *esys_context, const tpm_pcr_bank_t *bank)
 	return result;
 }
 
+/*
+ * Compute the PolicyPCR digest in software, yielding the same result as
+ * __pcr_policy_make. This is used when sealing offline, where we may not
+ * have a TPM at all.
+ */
+static TPM2B_DIGEST *
+__pcr_policy_compute(const tpm_pcr_bank_t *bank)
+{
+	const tpm_algo_info_t *policy_algo = digest_by_tpm_alg(TPM2_ALG_SHA256);
+	TPML_PCR_SELECTION pcrSel;
+	tpm_evdigest_t pcr_digest, md;
+	digest_ctx_t *ctx;
+	uint8_t buffer[sizeof(TPML_PCR_SELECTION) + 4];
+	size_t offset = 0;
+	TPM2B_DIGEST *result;
+	unsigned int i;
+
+	memset(&pcrSel, 0, sizeof(pcrSel));
+
+	ctx = digest_ctx_new(bank->algo_info);
+	for (i = 0; i < PCR_BANK_REGISTER_MAX; ++i) {
+		const tpm_evdigest_t *d;
+
+		if (!pcr_bank_register_is_valid(bank, i))
+			continue;
+		d = &bank->pcr[i];
+
+		digest_ctx_update(ctx, d->data, d->size);
+		__pcr_selection_add(&pcrSel, bank->algo_info->tcg_id, i);
+	}
+	digest_ctx_final(ctx, &pcr_digest);
+	digest_ctx_free(ctx);
+
+	/* policyDigest = H(0...0 || TPM_CC_PolicyPCR || pcrs || digest) */
+	if (Tss2_MU_TPM2_CC_Marshal(TPM2_CC_PolicyPCR, buffer, sizeof(buffer), &offset) != TSS2_RC_SUCCESS
+	 || Tss2_MU_TPML_PCR_SELECTION_Marshal(&pcrSel, buffer, sizeof(buffer), &offset) != TSS2_RC_SUCCESS) {
+		error("%s: unable to marshal PCR selection\n", __func__);
+		return NULL;
+	}
+
+	memset(&md, 0, sizeof(md));
+	ctx = digest_ctx_new(policy_algo);
+	digest_ctx_update(ctx, md.data, policy_algo->digest_size);
+	digest_ctx_update(ctx, buffer, offset);
+	digest_ctx_update(ctx, pcr_digest.data, pcr_digest.size);
+	digest_ctx_final(ctx, &md);
+	digest_ctx_free(ctx);
+
+	result = calloc(1, sizeof(*result));
+	result->size = md.size;
+	memcpy(result->buffer, md.data, md.size);
+	return result;
+}
+
+/*
+ * Compute the PolicyOR digest over the given branches in software.
+ * Each branch is the policy digest of one PolicyPCR.
+ */
+static TPM2B_DIGEST *
+__pcr_policy_compute_or(const TPML_DIGEST *branches)
+{
+	const tpm_algo_info_t *policy_algo = digest_by_tpm_alg(TPM2_ALG_SHA256);
+	tpm_evdigest_t md;
+	uint8_t buffer[4];
+	size_t offset = 0;
+	digest_ctx_t *ctx;
+	TPM2B_DIGEST *result;
+	unsigned int i;
+
+	if (Tss2_MU_TPM2_CC_Marshal(TPM2_CC_PolicyOR, buffer, sizeof(buffer), &offset) != TSS2_RC_SUCCESS) {
+		error("%s: unable to marshal command code\n", __func__);
+		return NULL;
+	}
+
+	/* policyDigest = H(0...0 || TPM_CC_PolicyOR || digests) */
+	memset(&md, 0, sizeof(md));
+	ctx = digest_ctx_new(policy_algo);
+	digest_ctx_update(ctx, md.data, policy_algo->digest_size);
+	digest_ctx_update(ctx, buffer, offset);
+	for (i = 0; i < branches->count; ++i)
+		digest_ctx_update(ctx, branches->digests[i].buffer, branches->digests[i].size);
+	digest_ctx_final(ctx, &md);
+	digest_ctx_free(ctx);
+
+	result = calloc(1, sizeof(*result));
+	result->size = md.size;
+	memcpy(result->buffer, md.data, md.size);
+	return result;
+}
+
 static bool
 esys_create_authorized_policy(ESYS_CONTEXT *esys_context,
 			TPM2B_DIGEST *pcrPolicy, const TPM2B_PUBLIC *pubKey,
@@ -659,6 +867,150 @@ esys_create_primary(ESYS_CONTEXT *esys_context, ESYS_TR *handle_ret)
 	return true;
 }
 
+/*
+ * Check whether the persistent key we've been pointed to really is
+ * an SRK created from our template. Otherwise, we would happily seal
+ * secrets to some random key that grub or systemd will not be able
+ * to recreate.
+ */
+static bool
+srk_public_matches_template(const TPMT_PUBLIC *pub, const TPMT_PUBLIC *tmpl)
+{
+	if (pub->type != tmpl->type
+	 || pub->nameAlg != tmpl->nameAlg
+	 || pub->objectAttributes != tmpl->objectAttributes)
+		return false;
+
+	if (pub->type == TPM2_ALG_RSA) {
+		const TPMS_RSA_PARMS *a = &pub->parameters.rsaDetail;
+		const TPMS_RSA_PARMS *b = &tmpl->parameters.rsaDetail;
+
+		return a->symmetric.algorithm == b->symmetric.algorithm
+		    && a->symmetric.keyBits.sym == b->symmetric.keyBits.sym
+		    && a->symmetric.mode.sym == b->symmetric.mode.sym
+		    && a->scheme.scheme == b->scheme.scheme
+		    && a->keyBits == b->keyBits;
+	}
+
+	if (pub->type == TPM2_ALG_ECC) {
+		const TPMS_ECC_PARMS *a = &pub->parameters.eccDetail;
+		const TPMS_ECC_PARMS *b = &tmpl->parameters.eccDetail;
+
+		return a->symmetric.algorithm == b->symmetric.algorithm
+		    && a->symmetric.keyBits.sym == b->symmetric.keyBits.sym
+		    && a->symmetric.mode.sym == b->symmetric.mode.sym
+		    && a->scheme.scheme == b->scheme.scheme
+		    && a->curveID == b->curveID;
+	}
+
+	return false;
+}
+
+static bool
+esys_load_persistent_srk(ESYS_CONTEXT *esys_context, TPM2_HANDLE tpm_handle, ESYS_TR *handle_ret)
+{
+	TPM2B_PUBLIC *srk_public = NULL;
+	ESYS_TR handle = ESYS_TR_NONE;
+	TPM2_RC rc;
+	bool okay = false;
+
+	rc = Esys_TR_FromTPMPublic(esys_context, tpm_handle,
+			ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE, &handle);
+	if (!tss_check_error(rc, "Esys_TR_FromTPMPublic failed"))
+		return false;
+
+	rc = Esys_ReadPublic(esys_context, handle,
+			ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE,
+			&srk_public, NULL, NULL);
+	if (!tss_check_error(rc, "Esys_ReadPublic failed"))
+		goto out;
+
+	if (!srk_public_matches_template(&srk_public->publicArea, &SRK_template->publicArea)) {
+		error("Key at persistent handle 0x%x does not match the SRK template\n", tpm_handle);
+		goto out;
+	}
+
+	debug("Using persistent SRK at handle 0x%x\n", tpm_handle);
+	*handle_ret = handle;
+	handle = ESYS_TR_NONE;
+	okay = true;
+
+out:
+	if (srk_public)
+		free(srk_public);
+	if (handle != ESYS_TR_NONE)
+		Esys_TR_Close(esys_context, &handle);
+	return okay;
+}
+
+static void
+esys_srk_cache_drop(ESYS_CONTEXT *esys_context)
+{
+	if (SRK_cache.handle == ESYS_TR_NONE)
+		return;
+
+	/* Never evict a persistent SRK; just drop our reference to it */
+	if (SRK_cache.persistent)
+		Esys_TR_Close(esys_context, &SRK_cache.handle);
+	else
+		esys_flush_context(esys_context, &SRK_cache.handle);
+	SRK_cache.handle = ESYS_TR_NONE;
+}
+
+static void
+esys_srk_cache_cleanup(void)
+{
+	esys_srk_cache_drop(tss_esys_context());
+}
+
+/*
+ * Obtain a handle for the SRK, either from the given persistent handle
+ * or by creating the primary key. The handle is cached for the lifetime
+ * of the process; callers should release it using esys_srk_release
+ * rather than flushing it.
+ */
+static bool
+esys_srk_acquire(ESYS_CONTEXT *esys_context, TPM2_HANDLE persistent_handle, ESYS_TR *handle_ret)
+{
+	static bool cleanup_registered = false;
+	bool persistent = (persistent_handle != 0);
+	bool okay;
+
+	if (SRK_cache.handle != ESYS_TR_NONE) {
+		if (SRK_cache.persistent == persistent
+		 && !memcmp(&SRK_cache.template, SRK_template, sizeof(SRK_cache.template))) {
+			*handle_ret = SRK_cache.handle;
+			return true;
+		}
+		esys_srk_cache_drop(esys_context);
+	}
+
+	if (persistent)
+		okay = esys_load_persistent_srk(esys_context, persistent_handle, handle_ret);
+	else
+		okay = esys_create_primary(esys_context, handle_ret);
+
+	if (!okay)
+		return false;
+
+	SRK_cache.handle = *handle_ret;
+	SRK_cache.persistent = persistent;
+	SRK_cache.template = *SRK_template;
+
+	if (!cleanup_registered) {
+		atexit(esys_srk_cache_cleanup);
+		cleanup_registered = true;
+	}
+	return true;
+}
+
+static void
+esys_srk_release(ESYS_CONTEXT *esys_context, ESYS_TR *handle_p)
+{
+	/* The SRK stays cached; the handle is flushed at exit */
+	*handle_p = ESYS_TR_NONE;
+}
+
 static bool
 esys_create(ESYS_CONTEXT *esys_context,
 		ESYS_TR srk_handle, TPM2B_DIGEST *authorized_policy, TPM2B_SENSITIVE_DATA *secret,
@@ -690,6 +1042,7 @@ esys_create(ESYS_CONTEXT *esys_context,
 static bool
 esys_seal_secret(const target_platform_t *platform, ESYS_CONTEXT *esys_context,
 		 TPM2B_DIGEST *policy, const TPML_PCR_SELECTION *pcr_sel,
+		 const TPML_DIGEST *policy_or,
 		 const char *input_path, const char *output_path)
 {
 	TPM2B_SENSITIVE_DATA *secret = NULL;
@@ -702,14 +1055,15 @@ esys_seal_secret(const target_platform_t *platform, ESYS_CONTEXT *esys_context,
 		goto cleanup;
 
 	/* On my machine, the TPM needs 20 seconds to derive the SRK in CreatePrimary */
-	infomsg("Sealing secret - this may take a moment\n");
-	if (!esys_create_primary(esys_context, &srk_handle))
+	if (!SRK_persistent_handle)
+		infomsg("Sealing secret - this may take a moment\n");
+	if (!esys_srk_acquire(esys_context, SRK_persistent_handle, &srk_handle))
 		goto cleanup;
 
 	if (!esys_create(esys_context, srk_handle, policy, secret, &sealed_private, &sealed_public))
 		goto cleanup;
 
-	ok = platform->write_sealed_secret(output_path, pcr_sel, sealed_private, sealed_public);
+	ok = platform->write_sealed_secret(output_path, pcr_sel, policy_or, sealed_private, sealed_public, NULL);
 	if (ok)
 		infomsg("Sealed secret written to %s\n", output_path?: "(standard output)");
 
@@ -721,87 +1075,193 @@ cleanup:
 	if (secret)
 		free_secret(secret);
 
-	esys_flush_context(esys_context, &srk_handle);
+	esys_srk_release(esys_context, &srk_handle);
 	return ok;
 }
 
+/*
+ * Seal a secret for the TPM owning the SRK given via set_srk_public_key,
+ * without talking to the local TPM. The result must be imported by the
+ * remote TPM before it can be loaded.
+ */
 static bool
-esys_unseal_pcr_policy(ESYS_CONTEXT *esys_context,
-		const tpm_pcr_bank_t *bank,
-		const TPM2B_PUBLIC *sealed_public, const TPM2B_PRIVATE *sealed_private,
-		TPM2B_SENSITIVE_DATA **sensitive_ret)
+offline_seal_secret(const target_platform_t *platform,
+		 const TPM2B_DIGEST *policy, const TPML_PCR_SELECTION *pcr_sel,
+		 const TPML_DIGEST *policy_or,
+		 const char *input_path, const char *output_path)
 {
-	TPML_PCR_SELECTION pcrs;
-	ESYS_TR session_handle = ESYS_TR_NONE;
-	ESYS_TR primary_handle = ESYS_TR_NONE;
-	ESYS_TR sealed_object_handle = ESYS_TR_NONE;
-	TPM2_RC rc;
-	bool okay = false;
+	TPM2B_SENSITIVE_DATA *secret = NULL;
+	TPM2B_PRIVATE *duplicate = NULL;
+	TPM2B_PUBLIC *sealed_public = NULL;
+	TPM2B_ENCRYPTED_SECRET *seed = NULL;
+	bool ok = false;
 
-	pcr_bank_to_selection(&pcrs, bank);
-	if (!esys_create_primary(esys_context, &primary_handle))
-		goto cleanup;
+	if (!srk_public_matches_template(&SRK_public->publicArea, &SRK_template->publicArea)) {
+		error("The given SRK public key does not match the SRK template\n");
+		return false;
+	}
 
-	rc = Esys_Load(esys_context, primary_handle,
-		ESYS_TR_PASSWORD, ESYS_TR_NONE, ESYS_TR_NONE,
-		sealed_private, sealed_public,
-                &sealed_object_handle);
-	if (!tss_check_error(rc, "Esys_Load failed"))
+	if (!(secret = read_secret(input_path)))
 		goto cleanup;
 
-	/* Create a policy session */
-	if (!esys_start_auth_session(esys_context, TPM2_SE_POLICY, &session_handle))
+	if (!tpm_import_seal_secret(SRK_public, policy, secret, &sealed_public, &duplicate, &seed))
 		goto cleanup;
 
-	TPM2B_DIGEST empty_digest = { .size = 0 };
-	rc = Esys_PolicyPCR(esys_context, session_handle,
-			ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE,
-			&empty_digest, &pcrs);
-	if (!tss_check_error(rc, "Esys_PolicyPCR failed"))
-		goto cleanup;
+	ok = platform->write_sealed_secret(output_path, pcr_sel, policy_or, duplicate, sealed_public, seed);
+	if (ok)
+		infomsg("Sealed secret written to %s\n", output_path?: "(standard output)");
 
-	rc = Esys_Unseal(esys_context, sealed_object_handle,
-                session_handle, ESYS_TR_NONE, ESYS_TR_NONE,
-                (TPM2B_SENSITIVE_DATA **) sensitive_ret);
-	if (!tss_check_error(rc, "Esys_Unseal failed"))
-		goto cleanup;
+cleanup:
+	if (duplicate)
+		free(duplicate);
+	if (sealed_public)
+		free(sealed_public);
+	if (seed)
+		free(seed);
+	if (secret)
+		free_secret(secret);
+	return ok;
+}
 
-	infomsg("Successfully unsealed... something.\n");
-	okay = true;
+static bool
+seal_secret(const target_platform_t *platform,
+		 TPM2B_DIGEST *policy, const TPML_PCR_SELECTION *pcr_sel,
+		 const TPML_DIGEST *policy_or,
+		 const char *input_path, const char *output_path)
+{
+	if (SRK_public)
+		return offline_seal_secret(platform, policy, pcr_sel, policy_or, input_path, output_path);
 
-cleanup:
-	esys_flush_context(esys_context, &session_handle);
-	esys_flush_context(esys_context, &primary_handle);
-	esys_flush_context(esys_context, &sealed_object_handle);
+	return esys_seal_secret(platform, tss_esys_context(), policy, pcr_sel, policy_or, input_path, output_path);
+}
+
+static inline TPMI_ALG_HASH
+__TPMT_SIGNATURE_get_hash_alg (const TPMT_SIGNATURE *sig)
+{
+  switch (sig->sigAlg)
+    {
+    case TPM2_ALG_RSASSA:
+      return sig->signature.rsassa.hash;
+    case TPM2_ALG_RSAPSS:
+      return sig->signature.rsapss.hash;
+    case TPM2_ALG_ECDSA:
+      return sig->signature.ecdsa.hash;
+    case TPM2_ALG_ECDAA:
+      return sig->signature.ecdaa.hash;
+    case TPM2_ALG_SM2:
+      return sig->signature.sm2.hash;
+    case TPM2_ALG_ECSCHNORR:
+      return sig->signature.ecschnorr.hash;
+    case TPM2_ALG_HMAC:
+      return sig->signature.hmac.hashAlg;
+    default:
+      break;
+    }
+
+  return TPM2_ALG_NULL;
+}
+
+/*
+ * Unsealing several objects that share the same policy, eg a LUKS key plus a
+ * recovery key, or the keys of several volumes. Deriving the SRK and verifying
+ * the policy signature happens only once; for every object, we just reset the
+ * policy session using PolicyRestart and replay the policy commands.
+ */
+typedef struct esys_sealed_object {
+	const char *		input_path;
+	const char *		output_path;
+	TPM2B_PUBLIC *		sealed_public;
+	TPM2B_PRIVATE *		sealed_private;
+	TPML_DIGEST *		policy_or;
+	TPM2B_SENSITIVE_DATA *	unsealed;
+} esys_sealed_object_t;
+
+/* The result of verifying the signature of an authorized policy */
+typedef struct esys_policy_authorization {
+	TPM2B_NAME *		public_key_name;
+	TPM2B_DIGEST *		pcr_policy;
+	TPMT_TK_VERIFIED *	verification_ticket;
+} esys_policy_authorization_t;
+
+static bool
+esys_sealed_objects_read(esys_sealed_object_t *objects, unsigned int count,
+		const char **input_paths, const char **output_paths)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; ++i) {
+		esys_sealed_object_t *obj = &objects[i];
+
+		obj->input_path = input_paths[i];
+		obj->output_path = output_paths[i];
+		if (!read_sealed_secret(obj->input_path, &obj->sealed_public, &obj->sealed_private, &obj->policy_or))
+			return false;
+	}
+	return true;
+}
+
+static bool
+esys_sealed_objects_write(esys_sealed_object_t *objects, unsigned int count)
+{
+	unsigned int i;
+	bool okay = true;
+
+	for (i = 0; i < count; ++i) {
+		esys_sealed_object_t *obj = &objects[i];
+		buffer_t *bp;
+
+		if (obj->unsealed == NULL)
+			continue;
+
+		bp = buffer_alloc_write(obj->unsealed->size);
+		buffer_put(bp, obj->unsealed->buffer, obj->unsealed->size);
+		if (!buffer_write_file(obj->output_path, bp))
+			okay = false;
+		buffer_free(bp);
+	}
 	return okay;
 }
 
+static void
+esys_sealed_objects_free(esys_sealed_object_t *objects, unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; ++i) {
+		esys_sealed_object_t *obj = &objects[i];
+
+		if (obj->unsealed)
+			free_secret(obj->unsealed);
+		if (obj->sealed_public)
+			free(obj->sealed_public);
+		if (obj->sealed_private)
+			free(obj->sealed_private);
+		if (obj->policy_or)
+			free(obj->policy_or);
+	}
+	free(objects);
+}
+
+/*
+ * Verify the signature on the PCR policy. The policy session must have been
+ * through PolicyPCR already.
+ */
 static bool
-esys_unseal_authorized(ESYS_CONTEXT *esys_context,
-		const tpm_pcr_bank_t *bank,
+esys_policy_authorization_verify(ESYS_CONTEXT *esys_context, ESYS_TR session_handle,
 		const TPMT_SIGNATURE *policy_signature,
 		const TPM2B_PUBLIC *pub_key,
-		const TPM2B_PUBLIC *sealed_public, const TPM2B_PRIVATE *sealed_private,
-		TPM2B_SENSITIVE_DATA **sensitive_ret)
+		esys_policy_authorization_t *auth)
 {
-	TPML_PCR_SELECTION pcrs;
 	ESYS_TR pub_key_handle = ESYS_TR_NONE;
-	ESYS_TR session_handle = ESYS_TR_NONE;
-	ESYS_TR primary_handle = ESYS_TR_NONE;
-	ESYS_TR sealed_object_handle = ESYS_TR_NONE;
-	TPM2B_NAME *public_key_name = NULL;
-	TPM2B_DIGEST *pcr_policy = NULL;
 	TPM2B_DIGEST *pcr_policy_hash = NULL;
-	TPMT_TK_VERIFIED *verification_ticket = NULL;
+	TPMI_ALG_HASH sig_hash_alg;
 	TPM2_RC rc;
 	bool okay = false;
 
-	if (policy_signature->sigAlg != TPM2_ALG_RSASSA)
+	if (policy_signature->sigAlg != TPM2_ALG_RSASSA && policy_signature->sigAlg != TPM2_ALG_ECDSA)
 		warning("%s: bad sigAlg %x\n", __func__, policy_signature->sigAlg);
-	if (policy_signature->signature.rsassa.hash != TPM2_ALG_SHA256)
-		warning("%s: bad hash %x\n", __func__, policy_signature->signature.rsassa.hash);
 
-	pcr_bank_to_selection(&pcrs, bank);
+	sig_hash_alg = __TPMT_SIGNATURE_get_hash_alg(policy_signature);
 
 	rc = Esys_LoadExternal(esys_context,
 			ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE, NULL,
@@ -810,41 +1270,19 @@ esys_unseal_authorized(ESYS_CONTEXT *esys_context,
 	if (!tss_check_error(rc, "Esys_LoadExternal failed"))
 		goto cleanup;
 
-	rc = Esys_TR_GetName(esys_context, pub_key_handle, &public_key_name);
+	rc = Esys_TR_GetName(esys_context, pub_key_handle, &auth->public_key_name);
 	if (!tss_check_error(rc, "Esys_TR_GetName failed"))
 		goto cleanup;
 
-	if (!esys_create_primary(esys_context, &primary_handle))
-		goto cleanup;
-
-	rc = Esys_Load(esys_context, primary_handle,
-		ESYS_TR_PASSWORD, ESYS_TR_NONE, ESYS_TR_NONE,
-		sealed_private, sealed_public,
-                &sealed_object_handle);
-	if (!tss_check_error(rc, "Esys_Load failed"))
-		goto cleanup;
-
-
-	/* Create a policy session */
-	if (!esys_start_auth_session(esys_context, TPM2_SE_POLICY, &session_handle))
-		goto cleanup;
-
-	TPM2B_DIGEST empty_digest = { .size = 0 };
-	rc = Esys_PolicyPCR(esys_context, session_handle,
-			ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE,
-			&empty_digest, &pcrs);
-	if (!tss_check_error(rc, "Esys_PolicyPCR failed"))
-		goto cleanup;
-
 	rc = Esys_PolicyGetDigest(esys_context, session_handle, ESYS_TR_NONE,
-			ESYS_TR_NONE, ESYS_TR_NONE, &pcr_policy);
+			ESYS_TR_NONE, ESYS_TR_NONE, &auth->pcr_policy);
 	if (!tss_check_error(rc, "Esys_PolicyGetDigest failed"))
 		goto cleanup;
 
 	rc = Esys_Hash(esys_context,
 			ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE,
-			(const TPM2B_MAX_BUFFER *) pcr_policy,
-			TPM2_ALG_SHA256, esys_tr_rh_null,
+			(const TPM2B_MAX_BUFFER *) auth->pcr_policy,
+			sig_hash_alg, esys_tr_rh_null,
 			&pcr_policy_hash, NULL);
 	if (!tss_check_error(rc, "Esys_Hash failed"))
 		goto cleanup;
@@ -853,60 +1291,191 @@ esys_unseal_authorized(ESYS_CONTEXT *esys_context,
 			pub_key_handle,
 			ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE,
 			pcr_policy_hash, policy_signature,
-			&verification_ticket);
+			&auth->verification_ticket);
 	if (!tss_check_error(rc, "Esys_VerifySignature failed"))
 		goto cleanup;
 
-	TPM2B_NONCE policyRef = { .size = 0 };
-	rc = Esys_PolicyAuthorize(esys_context, session_handle,
-			ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE,
-			pcr_policy, &policyRef,
-			public_key_name, verification_ticket);
-	if (!tss_check_error(rc, "Esys_PolicyAuthorize failed"))
+	okay = true;
+
+cleanup:
+	if (pcr_policy_hash)
+		free(pcr_policy_hash);
+	esys_flush_context(esys_context, &pub_key_handle);
+	return okay;
+}
+
+static void
+esys_policy_authorization_destroy(esys_policy_authorization_t *auth)
+{
+	if (auth->public_key_name)
+		free(auth->public_key_name);
+	if (auth->pcr_policy)
+		free(auth->pcr_policy);
+	if (auth->verification_ticket)
+		free(auth->verification_ticket);
+	memset(auth, 0, sizeof(*auth));
+}
+
+/*
+ * Unseal one object, using a policy session that has been through
+ * PolicyPCR already.
+ */
+static bool
+esys_unseal_object(ESYS_CONTEXT *esys_context, ESYS_TR primary_handle, ESYS_TR session_handle,
+		const esys_policy_authorization_t *auth,
+		esys_sealed_object_t *obj)
+{
+	ESYS_TR sealed_object_handle = ESYS_TR_NONE;
+	TPM2_RC rc;
+	bool okay = false;
+
+	rc = Esys_Load(esys_context, primary_handle,
+		ESYS_TR_PASSWORD, ESYS_TR_NONE, ESYS_TR_NONE,
+		obj->sealed_private, obj->sealed_public,
+                &sealed_object_handle);
+	if (!tss_check_error(rc, "Esys_Load failed"))
 		goto cleanup;
 
+	if (auth != NULL) {
+		TPM2B_NONCE policyRef = { .size = 0 };
+
+		rc = Esys_PolicyAuthorize(esys_context, session_handle,
+				ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE,
+				auth->pcr_policy, &policyRef,
+				auth->public_key_name, auth->verification_ticket);
+		if (!tss_check_error(rc, "Esys_PolicyAuthorize failed"))
+			goto cleanup;
+	}
+
 	rc = Esys_Unseal(esys_context, sealed_object_handle,
                 session_handle, ESYS_TR_NONE, ESYS_TR_NONE,
-                (TPM2B_SENSITIVE_DATA **) sensitive_ret);
+                &obj->unsealed);
 	if (!tss_check_error(rc, "Esys_Unseal failed"))
 		goto cleanup;
 
-	infomsg("Successfully unsealed... something.\n");
+	infomsg("Successfully unsealed %s\n", obj->input_path);
 	okay = true;
 
 cleanup:
-	if (public_key_name)
-		free(public_key_name);
-	if (pcr_policy_hash)
-		free(pcr_policy_hash);
-	esys_flush_context(esys_context, &pub_key_handle);
-	esys_flush_context(esys_context, &session_handle);
-	esys_flush_context(esys_context, &primary_handle);
 	esys_flush_context(esys_context, &sealed_object_handle);
 	return okay;
 }
 
+/*
+ * Unseal a batch of objects sealed against the current values of the PCRs in
+ * the given bank. If policy_signature is given, the objects are sealed against
+ * an authorized policy, and the signature is verified using pub_key.
+ */
 static bool
-__pcr_policy_sign(const tpm_rsa_key_t *rsa_key, const TPM2B_DIGEST *authorized_policy, TPMT_SIGNATURE **signed_policy)
+esys_unseal_objects(ESYS_CONTEXT *esys_context,
+		const tpm_pcr_bank_t *bank,
+		const TPMT_SIGNATURE *policy_signature,
+		const TPM2B_PUBLIC *pub_key,
+		esys_sealed_object_t *objects, unsigned int count)
+{
+	esys_policy_authorization_t auth = { NULL };
+	TPML_PCR_SELECTION pcrs;
+	TPM2B_DIGEST empty_digest = { .size = 0 };
+	ESYS_TR session_handle = ESYS_TR_NONE;
+	ESYS_TR primary_handle = ESYS_TR_NONE;
+	unsigned int i, num_failed = 0;
+	TPM2_RC rc;
+	bool okay = false;
+
+	pcr_bank_to_selection(&pcrs, bank);
+	if (!esys_srk_acquire(esys_context, SRK_persistent_handle, &primary_handle))
+		goto cleanup;
+
+	/* Create a policy session, and keep it alive across all Unseal commands */
+	if (!esys_start_auth_session(esys_context, TPM2_SE_POLICY, &session_handle))
+		goto cleanup;
+
+	rc = Esys_TRSess_SetAttributes(esys_context, session_handle,
+			TPMA_SESSION_CONTINUESESSION, TPMA_SESSION_CONTINUESESSION);
+	if (!tss_check_error(rc, "Esys_TRSess_SetAttributes failed"))
+		goto cleanup;
+
+	for (i = 0; i < count; ++i) {
+		esys_sealed_object_t *obj = &objects[i];
+
+		if (i != 0) {
+			rc = Esys_PolicyRestart(esys_context, session_handle,
+					ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE);
+			if (!tss_check_error(rc, "Esys_PolicyRestart failed"))
+				goto cleanup;
+		}
+
+		rc = Esys_PolicyPCR(esys_context, session_handle,
+				ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE,
+				&empty_digest, &pcrs);
+		if (!tss_check_error(rc, "Esys_PolicyPCR failed"))
+			goto cleanup;
+
+		/* Sealed against several PCR states; the TPM checks that the
+		 * current state is one of them */
+		if (obj->policy_or) {
+			rc = Esys_PolicyOR(esys_context, session_handle,
+					ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE,
+					obj->policy_or);
+			if (!tss_check_error(rc, "Esys_PolicyOR failed"))
+				goto cleanup;
+		}
+
+		/* The verification ticket stays valid for the whole batch */
+		if (policy_signature && auth.verification_ticket == NULL
+		 && !esys_policy_authorization_verify(esys_context, session_handle,
+					policy_signature, pub_key, &auth))
+			goto cleanup;
+
+		if (!esys_unseal_object(esys_context, primary_handle, session_handle,
+					policy_signature? &auth : NULL, obj)) {
+			error("Unable to unseal %s\n", obj->input_path);
+			num_failed++;
+		}
+	}
+
+	okay = (num_failed == 0);
+
+cleanup:
+	esys_policy_authorization_destroy(&auth);
+	esys_flush_context(esys_context, &session_handle);
+	esys_srk_release(esys_context, &primary_handle);
+	return okay;
+}
+
+static bool
+__pcr_policy_sign(const tpm_rsa_key_t *signing_key, const TPM2B_DIGEST *authorized_policy, TPMT_SIGNATURE **signed_policy)
 {
 	TPMT_SIGNATURE *result;
-	TPM2B_PUBLIC_KEY_RSA *sigbuf;
 
 	*signed_policy = NULL;
 	result = calloc(1, sizeof(*result));
 
-	result->sigAlg = TPM2_ALG_RSASSA;
-	result->signature.rsassa.hash = TPM2_ALG_SHA256;
+	if (tpm_rsa_key_is_ecc(signing_key)) {
+		result->sigAlg = TPM2_ALG_ECDSA;
+		if (!tpm_ecc_sign(signing_key,
+				authorized_policy->buffer, authorized_policy->size,
+				&result->signature.ecdsa)) {
+			error("Unable to sign authorized policy\n");
+			free(result);
+			return false;
+		}
+	} else {
+		TPM2B_PUBLIC_KEY_RSA *sigbuf;
 
-	sigbuf = &result->signature.rsassa.sig;
+		result->sigAlg = TPM2_ALG_RSASSA;
+		result->signature.rsassa.hash = TPM2_ALG_SHA256;
 
-	sigbuf->size = tpm_rsa_sign(rsa_key,
-			authorized_policy->buffer, authorized_policy->size,
-			sigbuf->buffer, sizeof(sigbuf->buffer));
-	if (sigbuf->size <= 0) {
-		error("Unable to sign authorized policy\n");
-		free(result);
-		return false;
+		sigbuf = &result->signature.rsassa.sig;
+
+		sigbuf->size = tpm_rsa_sign(signing_key,
+				authorized_policy->buffer, authorized_policy->size,
+				sigbuf->buffer, sizeof(sigbuf->buffer));
+		if (sigbuf->size <= 0) {
+			error("Unable to sign authorized policy\n");
+			free(result);
+			return false;
+		}
 	}
 
 	*signed_policy = result;
@@ -914,6 +1483,32 @@ __pcr_policy_sign(const tpm_rsa_key_t *rsa_key, const TPM2B_DIGEST *authorized_p
 	return true;
 }
 
+/*
+ * Get the raw signature bytes, for file formats that store the signature
+ * outside of a TPMT_SIGNATURE. ECDSA signatures are DER encoded.
+ */
+static unsigned int
+__pcr_policy_signature_bytes(const TPMT_SIGNATURE *signed_policy, unsigned char *buf, unsigned int size)
+{
+	int len;
+
+	switch (signed_policy->sigAlg) {
+	case TPM2_ALG_RSASSA:
+		len = signed_policy->signature.rsassa.sig.size;
+		if (len > size)
+			return 0;
+		memcpy(buf, signed_policy->signature.rsassa.sig.buffer, len);
+		return len;
+
+	case TPM2_ALG_ECDSA:
+		len = tpm_ecc_signature_to_der(&signed_policy->signature.ecdsa, buf, size);
+		return len > 0? len : 0;
+	}
+
+	error("Unsupported signature algorithm 0x%x\n", signed_policy->sigAlg);
+	return 0;
+}
+
 static bool
 __pcr_policy_create_authorized(ESYS_CONTEXT *esys_context, const tpm_pcr_selection_t *pcr_selection,
 				const stored_key_t *private_key_file,
@@ -948,86 +1543,324 @@ out:
 /*
  * This implements the ESYS backend for pcr_bank_init_from_current
  * The previous implementation used FAPI and that's just messy.
+ *
+ * Every TPM2_PCR_Read command is expensive on slow TPMs, so we pack
+ * the PCRs of all requested banks into as few commands as possible.
+ * The TPM returns at most 8 digests per command, and tells us which
+ * ones it returned in pcrSelectionOut. We keep asking for the rest
+ * until we have everything.
+ *
+ * The values read are cached as one snapshot of the TPM's PCRs. The TPM's
+ * pcrUpdateCounter tells us whether any PCR was extended between two
+ * commands; in that case, the snapshot is no longer consistent and we start
+ * over. Before using the snapshot again, we check the counter once more, so
+ * that long-running modes such as watch and serve never see stale values.
  */
-bool
-pcr_read_into_bank(tpm_pcr_bank_t *bank)
+#define PCR_SNAPSHOT_BANKS_MAX	8
+#define PCR_READ_RETRIES	4
+
+struct pcr_snapshot_bank {
+	const tpm_algo_info_t *	algo_info;
+	uint32_t		read_mask;
+	uint32_t		valid_mask;
+	tpm_evdigest_t		pcr[PCR_BANK_REGISTER_MAX];
+};
+
+static struct pcr_snapshot {
+	bool			have_counter;
+	uint32_t		update_counter;
+
+	unsigned int		num_banks;
+	struct pcr_snapshot_bank bank[PCR_SNAPSHOT_BANKS_MAX];
+} pcr_snapshot;
+
+static struct pcr_snapshot_bank *
+pcr_snapshot_get_bank(const tpm_algo_info_t *algo_info)
 {
-	ESYS_CONTEXT *esys_context = tss_esys_context();
-	TPML_PCR_SELECTION pcr_selection;
-	TPML_DIGEST *pcr_values = NULL;
-	unsigned int pcr_chunk_offset;
-	unsigned int index, k;
-	bool okay = false;
-	TPM2_RC rc;
+	struct pcr_snapshot_bank *sb;
+	unsigned int i;
+
+	for (i = 0; i < pcr_snapshot.num_banks; ++i) {
+		sb = &pcr_snapshot.bank[i];
+		if (sb->algo_info == algo_info)
+			return sb;
+	}
 
-	/* TPML_DIGEST will hold only up to 8 digests, which means
-	 * if we're interested in more PCRs, we need to do them in
-	 * chunks of 8 or less.
-	 */
-	for (pcr_chunk_offset = 0; pcr_chunk_offset < PCR_BANK_REGISTER_MAX; pcr_chunk_offset += 8) {
-		unsigned int pcr_mask;
+	if (pcr_snapshot.num_banks >= PCR_SNAPSHOT_BANKS_MAX) {
+		error("Too many PCR banks\n");
+		return NULL;
+	}
+
+	sb = &pcr_snapshot.bank[pcr_snapshot.num_banks++];
+	memset(sb, 0, sizeof(*sb));
+	sb->algo_info = algo_info;
+	return sb;
+}
 
-		pcr_mask = bank->pcr_mask & (0xFFU << pcr_chunk_offset);
-		if (pcr_mask == 0)
+static struct pcr_snapshot_bank *
+pcr_snapshot_find_bank_by_tcg_id(unsigned int algo_id)
+{
+	unsigned int i;
+
+	for (i = 0; i < pcr_snapshot.num_banks; ++i) {
+		if (pcr_snapshot.bank[i].algo_info->tcg_id == algo_id)
+			return &pcr_snapshot.bank[i];
+	}
+	return NULL;
+}
+
+static void
+pcr_snapshot_invalidate(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < pcr_snapshot.num_banks; ++i) {
+		pcr_snapshot.bank[i].read_mask = 0;
+		pcr_snapshot.bank[i].valid_mask = 0;
+	}
+	pcr_snapshot.have_counter = false;
+}
+
+/*
+ * Build a selection of all PCRs we still need to read
+ */
+static bool
+pcr_snapshot_build_selection(TPML_PCR_SELECTION *sel, const uint32_t *want_mask)
+{
+	unsigned int i, j;
+
+	memset(sel, 0, sizeof(*sel));
+	for (i = 0; i < pcr_snapshot.num_banks; ++i) {
+		struct pcr_snapshot_bank *sb = &pcr_snapshot.bank[i];
+		uint32_t missing = want_mask[i] & ~sb->read_mask & 0xFFFFFF;
+		TPMS_PCR_SELECTION *bankSel;
+
+		if (missing == 0)
 			continue;
 
-		/* drop the values from previous iteration */
-		if (pcr_values) {
-			free(pcr_values);
-			pcr_values = NULL;
-		}
+		bankSel = &sel->pcrSelections[sel->count++];
+		bankSel->hash = sb->algo_info->tcg_id;
+		bankSel->sizeofSelect = 3;
+		for (j = 0; j < 3; ++j, missing >>= 8)
+			bankSel->pcrSelect[j] = missing & 0xFF;
+	}
 
-		/* We cannot use pcr_bank_to_selection here, because that function
-		 * only selects digests for those PCRs that are valid. We haven't read
-		 * any PCR values yet, so we need to consult the mask of PCRs
-		 * that we *want* to have */
-		if (!__pcr_selection_build(&pcr_selection, pcr_mask, bank->algo_info))
-			return false;
+	return sel->count != 0;
+}
 
-		debug2("Trying to read PCR chunk starting with PCR %u\n", pcr_chunk_offset);
-		rc = Esys_PCR_Read(esys_context,
-				ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE,
-				&pcr_selection, NULL, NULL, &pcr_values);
-		if (!tss_check_error(rc, "Esys_PCR_Read failed"))
-			goto cleanup;
+/*
+ * Store the digests returned by one TPM2_PCR_Read command
+ */
+static bool
+pcr_snapshot_store(const TPML_PCR_SELECTION *sel_out, const TPML_DIGEST *pcr_values)
+{
+	unsigned int i, index, k = 0;
 
-		for (index = 0, k = 0; index < PCR_BANK_REGISTER_MAX; ++index) {
-			TPM2B_DIGEST *d;
+	for (i = 0; i < sel_out->count; ++i) {
+		const TPMS_PCR_SELECTION *bankSel = &sel_out->pcrSelections[i];
+		struct pcr_snapshot_bank *sb;
 
-			if (!(pcr_mask & (1 << index)))
+		if (!(sb = pcr_snapshot_find_bank_by_tcg_id(bankSel->hash))) {
+			error("Esys_PCR_Read returned unexpected PCR bank %u\n", bankSel->hash);
+			return false;
+		}
+
+		for (index = 0; index < PCR_BANK_REGISTER_MAX && index / 8 < bankSel->sizeofSelect; ++index) {
+			const TPM2B_DIGEST *d;
+			tpm_evdigest_t *pcr;
+
+			if (!(bankSel->pcrSelect[index / 8] & (1 << (index % 8))))
 				continue;
 
+			if (k >= pcr_values->count) {
+				error("Esys_PCR_Read returned fewer digests than selected\n");
+				return false;
+			}
 			d = &pcr_values->digests[k++];
+
+			sb->read_mask |= (1 << index);
 			if (d->size == 0)
 				continue;
 
-			if (d->size != bank->algo_info->digest_size) {
+			if (d->size != sb->algo_info->digest_size) {
 				error("Esys_PCR_Read returns a %s digest with size %u (expected %u)\n",
-						bank->algo_info->openssl_name,
+						sb->algo_info->openssl_name,
 						d->size,
-						bank->algo_info->digest_size);
+						sb->algo_info->digest_size);
 				debug("PCR %u value %u size 0x%x\n", index, k, d->size);
-				goto cleanup;
+				return false;
 			}
 
-			tpm_evdigest_t *pcr = &bank->pcr[index];
-
-			digest_set(pcr, bank->algo_info, d->size, d->buffer);
+			pcr = &sb->pcr[index];
+			digest_set(pcr, sb->algo_info, d->size, d->buffer);
 			if (digest_is_invalid(pcr)) {
 				debug2("ignoring PCR %u; %s\n", index, digest_print(pcr));
 			} else {
-				pcr_bank_mark_valid(bank, index);
+				sb->valid_mask |= (1 << index);
 			}
 		}
 	}
 
-	okay = true;
+	return true;
+}
 
-cleanup:
-	if (pcr_values)
+/*
+ * Read all PCRs in want_mask[] that are not in the snapshot yet.
+ * Returns 0 when done, -1 on error, and 1 if the PCRs changed under us.
+ */
+static int
+pcr_snapshot_fill(ESYS_CONTEXT *esys_context, const uint32_t *want_mask)
+{
+	TPML_PCR_SELECTION pcr_selection;
+
+	while (pcr_snapshot_build_selection(&pcr_selection, want_mask)) {
+		TPML_PCR_SELECTION *sel_out = NULL;
+		TPML_DIGEST *pcr_values = NULL;
+		uint32_t update_counter;
+		bool okay;
+		TPM2_RC rc;
+
+		debug2("Reading PCRs from %u bank(s)\n", pcr_selection.count);
+		rc = Esys_PCR_Read(esys_context,
+				ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE,
+				&pcr_selection, &update_counter, &sel_out, &pcr_values);
+		if (!tss_check_error(rc, "Esys_PCR_Read failed"))
+			return -1;
+
+		if (pcr_snapshot.have_counter && pcr_snapshot.update_counter != update_counter) {
+			debug("PCR update counter changed from %u to %u while reading PCRs\n",
+					pcr_snapshot.update_counter, update_counter);
+			free(sel_out);
+			free(pcr_values);
+			return 1;
+		}
+		pcr_snapshot.update_counter = update_counter;
+		pcr_snapshot.have_counter = true;
+
+		if (pcr_values->count == 0) {
+			unsigned int i;
+
+			/* The TPM does not have any of the remaining PCRs, eg because
+			 * a bank is not allocated. Do not ask again. */
+			debug("TPM returned no PCR values; remaining PCRs are not available\n");
+			for (i = 0; i < pcr_snapshot.num_banks; ++i)
+				pcr_snapshot.bank[i].read_mask |= want_mask[i];
+			okay = true;
+		} else {
+			okay = pcr_snapshot_store(sel_out, pcr_values);
+		}
+
+		free(sel_out);
 		free(pcr_values);
 
-	return okay;
+		if (!okay)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Check whether any PCR was extended since the snapshot was taken. Reading
+ * an empty selection just returns the update counter.
+ * Returns 0 if nothing changed, -1 on error, and 1 if the PCRs changed.
+ */
+static int
+pcr_snapshot_check_counter(ESYS_CONTEXT *esys_context)
+{
+	TPML_PCR_SELECTION pcr_selection, *sel_out = NULL;
+	TPML_DIGEST *pcr_values = NULL;
+	uint32_t update_counter;
+	TPM2_RC rc;
+
+	memset(&pcr_selection, 0, sizeof(pcr_selection));
+	rc = Esys_PCR_Read(esys_context,
+			ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE,
+			&pcr_selection, &update_counter, &sel_out, &pcr_values);
+	if (!tss_check_error(rc, "Esys_PCR_Read failed"))
+		return -1;
+
+	free(sel_out);
+	free(pcr_values);
+
+	if (update_counter == pcr_snapshot.update_counter)
+		return 0;
+
+	debug("PCR update counter changed from %u to %u since the PCRs were read\n",
+			pcr_snapshot.update_counter, update_counter);
+	return 1;
+}
+
+bool
+pcr_read_into_banks(tpm_pcr_bank_t **banks, unsigned int count)
+{
+	ESYS_CONTEXT *esys_context = NULL;
+	uint32_t want_mask[PCR_SNAPSHOT_BANKS_MAX];
+	unsigned int i, index, retries = 0;
+	int rv;
+
+	memset(want_mask, 0, sizeof(want_mask));
+	for (i = 0; i < count; ++i) {
+		tpm_pcr_bank_t *bank = banks[i];
+		struct pcr_snapshot_bank *sb;
+
+		if (!(sb = pcr_snapshot_get_bank(bank->algo_info)))
+			return false;
+		want_mask[sb - pcr_snapshot.bank] |= bank->pcr_mask;
+	}
+
+	/* Check whether the snapshot already has everything, and is still current */
+	for (i = 0; i < pcr_snapshot.num_banks; ++i) {
+		if (want_mask[i] & ~pcr_snapshot.bank[i].read_mask)
+			esys_context = tss_esys_context();
+	}
+
+	if (esys_context == NULL && pcr_snapshot.have_counter) {
+		esys_context = tss_esys_context();
+		if ((rv = pcr_snapshot_check_counter(esys_context)) < 0)
+			return false;
+		if (rv == 0)
+			esys_context = NULL;
+		else
+			pcr_snapshot_invalidate();
+	}
+
+	if (esys_context != NULL) {
+		while ((rv = pcr_snapshot_fill(esys_context, want_mask)) > 0) {
+			if (++retries >= PCR_READ_RETRIES) {
+				error("PCR values keep changing while reading them, giving up\n");
+				return false;
+			}
+			pcr_snapshot_invalidate();
+		}
+
+		if (rv < 0)
+			return false;
+	} else {
+		debug("Using cached PCR values\n");
+	}
+
+	for (i = 0; i < count; ++i) {
+		tpm_pcr_bank_t *bank = banks[i];
+		struct pcr_snapshot_bank *sb = pcr_snapshot_get_bank(bank->algo_info);
+
+		for (index = 0; index < PCR_BANK_REGISTER_MAX; ++index) {
+			if (!(bank->pcr_mask & (1 << index))
+			 || !(sb->valid_mask & (1 << index)))
+				continue;
+
+			bank->pcr[index] = sb->pcr[index];
+			pcr_bank_mark_valid(bank, index);
+		}
+	}
+
+	return true;
+}
+
+bool
+pcr_read_into_bank(tpm_pcr_bank_t *bank)
+{
+	return pcr_read_into_banks(&bank, 1);
 }
 
 /*
@@ -1054,56 +1887,165 @@ bool
 pcr_seal_secret(const target_platform_t *platform, const tpm_pcr_bank_t *bank,
 		const char *input_path, const char *output_path)
 {
-	ESYS_CONTEXT *esys_context = tss_esys_context();
 	TPM2B_DIGEST *pcr_policy = NULL;
 	TPML_PCR_SELECTION pcr_sel;
 	bool ok = false;
 
-	if (!(pcr_policy = __pcr_policy_make(esys_context, bank)))
+	if (SRK_public)
+		pcr_policy = __pcr_policy_compute(bank);
+	else
+		pcr_policy = __pcr_policy_make(tss_esys_context(), bank);
+	if (pcr_policy == NULL)
 		return false;
 
 	if (!pcr_bank_to_selection(&pcr_sel, bank))
 		return false;
 
-	ok = esys_seal_secret(platform, esys_context, pcr_policy, &pcr_sel,
-			      input_path, output_path);
+	ok = seal_secret(platform, pcr_policy, &pcr_sel, NULL, input_path, output_path);
 
 	free(pcr_policy);
 	return ok;
 }
 
+/*
+ * Seal a secret against several predicted PCR states at once, eg the
+ * current boot and the one after a kernel update. The secret can be unsealed
+ * in any of these states. The policy is a PolicyOR over the PolicyPCR digests
+ * of all states, which are computed in software.
+ */
+/*
+ * Compute the PolicyPCR digests of several predicted PCR states, dropping
+ * duplicates. Several states may well have identical PCR values.
+ */
+static bool
+__pcr_policy_collect_branches(const tpm_pcr_bank_t **banks, unsigned int count, TPML_DIGEST *branches)
+{
+	unsigned int i, j;
+
+	if (count > PCR_POLICY_OR_MAX) {
+		error("Cannot seal against more than %u PCR states\n", PCR_POLICY_OR_MAX);
+		return false;
+	}
+
+	branches->count = 0;
+	for (i = 0; i < count; ++i) {
+		TPM2B_DIGEST *pcr_policy;
+
+		if (banks[i]->algo_info != banks[0]->algo_info
+		 || banks[i]->valid_mask != banks[0]->valid_mask) {
+			error("All PCR states must use the same PCR selection\n");
+			return false;
+		}
+
+		if (!(pcr_policy = __pcr_policy_compute(banks[i])))
+			return false;
+
+		for (j = 0; j < branches->count; ++j) {
+			if (!memcmp(&branches->digests[j], pcr_policy, sizeof(*pcr_policy)))
+				break;
+		}
+		if (j == branches->count)
+			branches->digests[branches->count++] = *pcr_policy;
+
+		free(pcr_policy);
+	}
+
+	return true;
+}
+
+/*
+ * Seal a secret against several predicted PCR states at once, eg the
+ * current boot and the one after a kernel update. The secret can be unsealed
+ * in any of these states. The policy is a PolicyOR over the PolicyPCR digests
+ * of all states, which are computed in software.
+ */
+bool
+pcr_seal_secret_or(const target_platform_t *platform,
+		const tpm_pcr_bank_t **banks, unsigned int count,
+		const char *input_path, const char *output_path)
+{
+	TPML_DIGEST branches = { .count = 0 };
+	TPM2B_DIGEST *or_policy = NULL;
+	TPML_PCR_SELECTION pcr_sel;
+	bool ok = false;
+
+	if (!__pcr_policy_collect_branches(banks, count, &branches))
+		return false;
+
+	/* PolicyOR needs at least two branches */
+	if (branches.count <= 1)
+		return count && pcr_seal_secret(platform, banks[0], input_path, output_path);
+
+	if (!pcr_bank_to_selection(&pcr_sel, banks[0]))
+		return false;
+
+	if (!(or_policy = __pcr_policy_compute_or(&branches)))
+		return false;
+
+	infomsg("Sealing secret against %u different PCR states\n", branches.count);
+	ok = seal_secret(platform, or_policy, &pcr_sel, &branches, input_path, output_path);
+
+	free(or_policy);
+	return ok;
+}
+
+/*
+ * Check whether the secret in output_path was sealed against exactly the
+ * policy that pcr_seal_secret_or() would use for these PCR states. There is
+ * no way to tell whether it is the same secret, though.
+ */
+bool
+pcr_sealed_secret_is_current(const target_platform_t *platform,
+		const tpm_pcr_bank_t **banks, unsigned int count,
+		const char *output_path)
+{
+	TPML_DIGEST branches = { .count = 0 };
+	TPM2B_DIGEST *policy;
+	bool current;
+
+	if (platform->sealed_policy_is_current == NULL || count == 0
+	 || access(output_path, F_OK) < 0)
+		return false;
+
+	if (!__pcr_policy_collect_branches(banks, count, &branches))
+		return false;
+
+	if (branches.count == 1)
+		policy = __pcr_policy_compute(banks[0]);
+	else
+		policy = __pcr_policy_compute_or(&branches);
+	if (policy == NULL)
+		return false;
+
+	current = platform->sealed_policy_is_current(output_path, policy);
+	free(policy);
+	return current;
+}
+
 static bool
-pcr_unseal_secret_pcr(const tpm_pcr_selection_t *pcr_selection, const char *input_path, const char *output_path)
+pcr_unseal_secrets_pcr(const tpm_pcr_selection_t *pcr_selection,
+				unsigned int count, const char **input_paths, const char **output_paths)
 {
 	ESYS_CONTEXT *esys_context = tss_esys_context();
 	tpm_pcr_bank_t pcr_current_bank;
-	TPM2B_PRIVATE *sealed_private = NULL;
-	TPM2B_PUBLIC *sealed_public = NULL;
-	TPM2B_SENSITIVE_DATA *unsealed = NULL;
+	esys_sealed_object_t *objects;
 	bool okay = false;
 
-	if (!read_sealed_secret(input_path, &sealed_public, &sealed_private))
+	objects = calloc(count, sizeof(objects[0]));
+	if (!esys_sealed_objects_read(objects, count, input_paths, output_paths))
 		goto cleanup;
 
 	pcr_bank_initialize(&pcr_current_bank, pcr_selection->pcr_mask, pcr_selection->algo_info);
 	pcr_bank_init_from_current(&pcr_current_bank);
 
 	/* Now we've got all the ingredients we need. Go for it. */
-	okay = esys_unseal_pcr_policy(esys_context,
-			&pcr_current_bank,
-			sealed_public, sealed_private, &unsealed);
+	okay = esys_unseal_objects(esys_context, &pcr_current_bank, NULL, NULL, objects, count);
 
-	if (unsealed) {
-		buffer_t *bp = buffer_alloc_write(unsealed->size);
-
-		buffer_put(bp, unsealed->buffer, unsealed->size);
-		buffer_write_file(output_path, bp);
-		buffer_free(bp);
-	}
+	if (!esys_sealed_objects_write(objects, count))
+		okay = false;
 
 cleanup:
-	if (unsealed)
-		free_secret(unsealed);
+	esys_sealed_objects_free(objects, count);
 	return okay;
 }
 
@@ -1129,15 +2071,13 @@ bool
 pcr_authorized_policy_seal_secret(const target_platform_t *platform, const char *authpolicy_path,
 				  const char *input_path, const char *output_path)
 {
-	ESYS_CONTEXT *esys_context = tss_esys_context();
 	TPM2B_DIGEST *authorized_policy = NULL;
 	bool ok = false;
 
 	if (!(authorized_policy = read_digest(authpolicy_path)))
 		return false;
 
-	ok = esys_seal_secret(platform, esys_context, authorized_policy, NULL,
-			      input_path, output_path);
+	ok = seal_secret(platform, authorized_policy, NULL, NULL, input_path, output_path);
 	free(authorized_policy);
 	return ok;
 }
@@ -1160,80 +2100,352 @@ old_pcr_authorized_policy_seal_secret(const char *authpolicy_path, const char *i
 		goto cleanup;
 
 	/* On my machine, the TPM needs 20 seconds to derive the SRK in CreatePrimary */
-	infomsg("Sealing secret - this may take a moment\n");
+	if (!SRK_persistent_handle)
+		infomsg("Sealing secret - this may take a moment\n");
+
+	if (!esys_srk_acquire(esys_context, SRK_persistent_handle, &srk_handle))
+		goto cleanup;
 
-	if (!esys_create_primary(esys_context, &srk_handle))
+	if (!esys_create(esys_context, srk_handle, authorized_policy, secret, &sealed_private, &sealed_public))
 		goto cleanup;
 
-	if (!esys_create(esys_context, srk_handle, authorized_policy, secret, &sealed_private, &sealed_public))
-		goto cleanup;
+	ok = write_sealed_secret(output_path, sealed_public, sealed_private, NULL);
+
+	if (ok)
+		infomsg("Sealed secret written to %s\n", output_path?: "(standard output)");
+
+cleanup:
+	if (sealed_private)
+		free(sealed_private);
+	if (sealed_public)
+		free(sealed_public);
+	if (authorized_policy)
+		free(authorized_policy);
+	if (secret)
+		free_secret(secret);
+
+	esys_srk_release(esys_context, &srk_handle);
+	return ok;
+}
+
+
+/*
+ * The "signing" part of using authorized policies consists of hashing together the set of
+ * expected PCR values, and signing the resulting digest.
+ *
+ * When signing many policies (eg one per boot entry), we load the signing key only
+ * once, and write each output file only once, no matter how many policies go into it.
+ */
+pcr_policy_batch_t *
+pcr_policy_batch_new(const target_platform_t *platform, const stored_key_t *private_key_file)
+{
+	pcr_policy_batch_t *batch;
+	tpm_rsa_key_t *rsa_key;
+
+	if (platform->write_signed_policy == NULL && platform->write_signed_policies == NULL) {
+		error("Platform %s does not support signing policies yet\n", platform->name);
+		return NULL;
+	}
+
+	if (!(rsa_key = stored_key_read_rsa_private(private_key_file)))
+		return NULL;
+
+	batch = calloc(1, sizeof(*batch));
+	batch->platform = platform;
+	batch->signing_key = rsa_key;
+	return batch;
+}
+
+/*
+ * Drop all policies, but keep the signing key loaded.
+ */
+void
+pcr_policy_batch_clear(pcr_policy_batch_t *batch)
+{
+	unsigned int i;
+
+	for (i = 0; i < batch->count; ++i) {
+		pcr_signed_policy_t *sp = &batch->policies[i];
+
+		drop_string(&sp->name);
+		drop_string(&sp->output_path);
+		if (sp->pcr_policy)
+			free(sp->pcr_policy);
+		if (sp->signature)
+			free(sp->signature);
+	}
+
+	if (batch->policies)
+		free(batch->policies);
+	batch->policies = NULL;
+	batch->count = 0;
+	batch->num_unchanged = 0;
+}
+
+void
+pcr_policy_batch_free(pcr_policy_batch_t *batch)
+{
+	pcr_policy_batch_clear(batch);
+	if (batch->signing_key)
+		tpm_rsa_key_free(batch->signing_key);
+	free(batch);
+}
+
+bool
+pcr_policy_batch_add(pcr_policy_batch_t *batch, const tpm_pcr_bank_t *bank,
+		const char *policy_name, const char *output_path)
+{
+	pcr_signed_policy_t *sp;
+
+	if ((batch->count % 8) == 0)
+		batch->policies = realloc(batch->policies, (batch->count + 8) * sizeof(batch->policies[0]));
+
+	sp = &batch->policies[batch->count];
+	memset(sp, 0, sizeof(*sp));
+	sp->bank = *bank;
+
+	/* Signing does not need a TPM; compute the PCR policy in software.
+	 * The signature is created later, by __pcr_policy_batch_sign() */
+	if (!(sp->pcr_policy = __pcr_policy_compute(bank)))
+		return false;
+
+	assign_string(&sp->name, policy_name);
+	assign_string(&sp->output_path, output_path);
+	batch->count++;
+	return true;
+}
+
+/*
+ * Sign all policies of a batch that have not been signed yet. If the
+ * signing key lives on a PKCS#11 token that gives us several sessions,
+ * we use one thread per session, so that the token can create several
+ * signatures in parallel.
+ */
+struct pcr_policy_signer {
+	pcr_policy_batch_t *	batch;
+	pthread_mutex_t		lock;
+	unsigned int		next;
+	bool			okay;
+};
+
+static void *
+__pcr_policy_sign_worker(void *arg)
+{
+	struct pcr_policy_signer *signer = arg;
+	pcr_policy_batch_t *batch = signer->batch;
+
+	while (true) {
+		pcr_signed_policy_t *sp = NULL;
+
+		pthread_mutex_lock(&signer->lock);
+		while (signer->okay && signer->next < batch->count) {
+			sp = &batch->policies[signer->next++];
+			if (sp->signature == NULL && !sp->unchanged)
+				break;
+			sp = NULL;
+		}
+		pthread_mutex_unlock(&signer->lock);
+
+		if (sp == NULL)
+			break;
+
+		if (!__pcr_policy_sign(batch->signing_key, sp->pcr_policy, &sp->signature)) {
+			pthread_mutex_lock(&signer->lock);
+			signer->okay = false;
+			pthread_mutex_unlock(&signer->lock);
+		}
+	}
+
+	return NULL;
+}
+
+static bool
+__pcr_policy_batch_sign(pcr_policy_batch_t *batch)
+{
+	struct pcr_policy_signer signer = {
+		.batch = batch,
+		.okay = true,
+	};
+	unsigned int i, pending = 0, num_threads;
+	pthread_t *threads;
+
+	for (i = 0; i < batch->count; ++i) {
+		if (batch->policies[i].signature == NULL && !batch->policies[i].unchanged)
+			pending++;
+	}
+
+	if (pending == 0)
+		return true;
+
+	num_threads = tpm_rsa_key_max_signers(batch->signing_key);
+	if (num_threads > pending)
+		num_threads = pending;
+
+	pthread_mutex_init(&signer.lock, NULL);
+
+	if (num_threads <= 1) {
+		__pcr_policy_sign_worker(&signer);
+		goto out;
+	}
+
+	debug("Signing %u policies using %u threads\n", pending, num_threads);
+
+	/* The calling thread does its share of the work, too */
+	threads = calloc(num_threads - 1, sizeof(threads[0]));
+	for (i = 0; i < num_threads - 1; ++i) {
+		if (pthread_create(&threads[i], NULL, __pcr_policy_sign_worker, &signer) != 0)
+			break;
+	}
+	num_threads = i;
+
+	__pcr_policy_sign_worker(&signer);
+
+	for (i = 0; i < num_threads; ++i)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+out:
+	pthread_mutex_destroy(&signer.lock);
+	return signer.okay;
+}
+
+static inline bool
+__output_path_equal(const char *a, const char *b)
+{
+	if (a == NULL || b == NULL)
+		return a == b;
+	return !strcmp(a, b);
+}
+
+/*
+ * Find the policies whose output already contains a valid signature for
+ * them. Package hooks tend to call us on every update, even if none of the
+ * PCRs we care about changed; there's no point in signing and rewriting
+ * the output in that case.
+ *
+ * This only applies to in-place updates; if we're given a separate input
+ * file, the output is always written.
+ */
+static void
+__pcr_policy_batch_find_unchanged(pcr_policy_batch_t *batch, const char *input_path)
+{
+	const target_platform_t *platform = batch->platform;
+	unsigned int i;
+
+	batch->num_unchanged = 0;
+	for (i = 0; i < batch->count; ++i) {
+		pcr_signed_policy_t *sp = &batch->policies[i];
+
+		sp->unchanged = false;
+		if (pcr_policy_always_sign
+		 || platform->signed_policy_is_current == NULL
+		 || sp->signature != NULL
+		 || sp->output_path == NULL
+		 || (input_path && strcmp(input_path, sp->output_path))
+		 || access(sp->output_path, R_OK) < 0)
+			continue;
+
+		if (platform->signed_policy_is_current(sp->output_path, sp, batch->signing_key)) {
+			debug("%s: PCR policy %s is unchanged\n", sp->output_path, sp->name?: "default");
+			sp->unchanged = true;
+			batch->num_unchanged++;
+		}
+	}
+}
+
+/*
+ * Write all signed policies, grouped by output file.
+ */
+bool
+pcr_policy_batch_write(pcr_policy_batch_t *batch, const char *input_path)
+{
+	const target_platform_t *platform = batch->platform;
+	const pcr_signed_policy_t **group;
+	bool *written;
+	unsigned int i, j, count;
+	bool okay = true;
+
+	__pcr_policy_batch_find_unchanged(batch, input_path);
+
+	if (!__pcr_policy_batch_sign(batch))
+		return false;
+
+	group = calloc(batch->count, sizeof(group[0]));
+	written = calloc(batch->count, sizeof(written[0]));
+
+	for (i = 0; i < batch->count && okay; ++i) {
+		const char *output_path = batch->policies[i].output_path;
+
+		if (written[i])
+			continue;
+
+		for (j = i, count = 0; j < batch->count; ++j) {
+			if (!written[j] && __output_path_equal(batch->policies[j].output_path, output_path)) {
+				if (!batch->policies[j].unchanged)
+					group[count++] = &batch->policies[j];
+				written[j] = true;
+			}
+		}
 
-	ok = write_sealed_secret(output_path, sealed_public, sealed_private);
+		if (count == 0) {
+			infomsg("Signed PCR policy in %s is unchanged\n", output_path);
+			continue;
+		}
 
-	if (ok)
-		infomsg("Sealed secret written to %s\n", output_path?: "(standard output)");
+		if (platform->write_signed_policies) {
+			okay = platform->write_signed_policies(input_path, output_path,
+					count, group, batch->signing_key);
+		} else
+		if (count == 1) {
+			okay = platform->write_signed_policy(input_path, output_path,
+					group[0]->name, &group[0]->bank, group[0]->pcr_policy,
+					batch->signing_key, group[0]->signature);
+		} else {
+			error("Platform %s cannot store several signed policies in %s\n",
+					platform->name, output_path?: "(standard output)");
+			okay = false;
+		}
 
-cleanup:
-	if (sealed_private)
-		free(sealed_private);
-	if (sealed_public)
-		free(sealed_public);
-	if (authorized_policy)
-		free(authorized_policy);
-	if (secret)
-		free_secret(secret);
+		if (okay)
+			infomsg("Signed PCR %s written to %s\n",
+					count == 1? "policy" : "policies",
+					output_path?: "(standard output)");
+	}
 
-	esys_flush_context(esys_context, &srk_handle);
-	return ok;
+	free(group);
+	free(written);
+	return okay;
 }
 
-
 /*
- * The "signing" part of using authorized policies consists of hashing together the set of
- * expected PCR values, and signing the resulting digest.
+ * Returns true if the last call to pcr_policy_batch_write found that all
+ * outputs were up to date already, and did not write anything.
  */
+bool
+pcr_policy_batch_unchanged(const pcr_policy_batch_t *batch)
+{
+	return batch->count != 0 && batch->num_unchanged == batch->count;
+}
+
 bool
 pcr_policy_sign(const target_platform_t *platform, const tpm_pcr_bank_t *bank,
 		const stored_key_t *private_key_file,
-		const char *input_path, const char *output_path, const char *policy_name)
+		const char *input_path, const char *output_path, const char *policy_name,
+		bool *unchanged_ret)
 {
-	ESYS_CONTEXT *esys_context = tss_esys_context();
-	TPM2B_DIGEST *pcr_policy = NULL;
-	tpm_rsa_key_t *rsa_key = NULL;
-	TPM2B_PUBLIC *pub_key = NULL;
-	TPMT_SIGNATURE *signed_policy = NULL;
-	bool okay = false;
-
-	if (platform->write_signed_policy == NULL) {
-		error("Platform %s does not support signing policies yet\n", platform->name);
-		goto out;
-	}
-
-	if (!(rsa_key = stored_key_read_rsa_private(private_key_file)))
-		goto out;
-
-	if (!(pcr_policy = __pcr_policy_make(esys_context, bank)))
-		goto out;
+	pcr_policy_batch_t *batch;
+	bool okay;
 
-	if (!__pcr_policy_sign(rsa_key, pcr_policy, &signed_policy))
-		goto out;
+	if (!(batch = pcr_policy_batch_new(platform, private_key_file)))
+		return false;
 
-	okay = platform->write_signed_policy(input_path, output_path,
-			policy_name, bank, pcr_policy,
-			rsa_key, signed_policy);
-	if (okay)
-		infomsg("Signed PCR policy written to %s\n", output_path?: "(standard output)");
+	okay = pcr_policy_batch_add(batch, bank, policy_name, output_path)
+	    && pcr_policy_batch_write(batch, input_path);
 
-out:
-	if (pcr_policy)
-		free(pcr_policy);
-	if (signed_policy)
-		free(signed_policy);
-	if (pub_key)
-		free(pub_key);
-	if (rsa_key)
-		tpm_rsa_key_free(rsa_key);
+	if (okay && unchanged_ret)
+		*unchanged_ret = pcr_policy_batch_unchanged(batch);
 
+	pcr_policy_batch_free(batch);
 	return okay;
 }
 
@@ -1243,25 +2455,24 @@ out:
  * The code is here mostly for educational/testing purposes.
  */
 static bool
-pcr_authorized_policy_unseal_secret(const tpm_pcr_selection_t *pcr_selection,
+pcr_authorized_policy_unseal_secrets(const tpm_pcr_selection_t *pcr_selection,
 				const char *signed_policy_path,
 				const stored_key_t *public_key_file,
-                                const char *input_path, const char *output_path)
+				unsigned int count, const char **input_paths, const char **output_paths)
 {
 	ESYS_CONTEXT *esys_context = tss_esys_context();
 	tpm_pcr_bank_t pcr_current_bank;
 	TPMT_SIGNATURE *policy_signature = NULL;
-	tpm_rsa_key_t *rsa_key = NULL;
 	TPM2B_PUBLIC *pub_key = NULL;
-	TPM2B_PRIVATE *sealed_private = NULL;
-	TPM2B_PUBLIC *sealed_public = NULL;
-	TPM2B_SENSITIVE_DATA *unsealed = NULL;
+	esys_sealed_object_t *objects;
 	bool okay = false;
 
+	objects = calloc(count, sizeof(objects[0]));
+
 	if (!(pub_key = stored_key_read_native_public(public_key_file)))
 		goto cleanup;
 
-	if (!read_sealed_secret(input_path, &sealed_public, &sealed_private))
+	if (!esys_sealed_objects_read(objects, count, input_paths, output_paths))
 		goto cleanup;
 
 	if (!read_signature(signed_policy_path, &policy_signature))
@@ -1274,57 +2485,23 @@ pcr_authorized_policy_unseal_secret(const tpm_pcr_selection_t *pcr_selection,
 	pcr_bank_init_from_current(&pcr_current_bank);
 
 	/* Now we've got all the ingredients we need. Go for it. */
-	okay = esys_unseal_authorized(esys_context,
+	okay = esys_unseal_objects(esys_context,
 			&pcr_current_bank, policy_signature, pub_key,
-			sealed_public, sealed_private, &unsealed);
-
-	if (unsealed) {
-		buffer_t *bp = buffer_alloc_write(unsealed->size);
+			objects, count);
 
-		buffer_put(bp, unsealed->buffer, unsealed->size);
-		buffer_write_file(output_path, bp);
-		buffer_free(bp);
-	}
+	if (!esys_sealed_objects_write(objects, count))
+		okay = false;
 
 cleanup:
-	if (unsealed)
-		free_secret(unsealed);
+	esys_sealed_objects_free(objects, count);
 	if (policy_signature)
 		free(policy_signature);
 	if (pub_key)
 		free(pub_key);
-	if (rsa_key)
-		tpm_rsa_key_free(rsa_key);
 
 	return okay;
 }
 
-static inline TPMI_ALG_HASH
-__TPMT_SIGNATURE_get_hash_alg (TPMT_SIGNATURE *sig)
-{
-  switch (sig->sigAlg)
-    {
-    case TPM2_ALG_RSASSA:
-      return sig->signature.rsassa.hash;
-    case TPM2_ALG_RSAPSS:
-      return sig->signature.rsapss.hash;
-    case TPM2_ALG_ECDSA:
-      return sig->signature.ecdsa.hash;
-    case TPM2_ALG_ECDAA:
-      return sig->signature.ecdaa.hash;
-    case TPM2_ALG_SM2:
-      return sig->signature.sm2.hash;
-    case TPM2_ALG_ECSCHNORR:
-      return sig->signature.ecschnorr.hash;
-    case TPM2_ALG_HMAC:
-      return sig->signature.hmac.hashAlg;
-    default:
-      break;
-    }
-
-  return TPM2_ALG_NULL;
-}
-
 static bool
 __pcr_policy_tpm2_policyauthorize(ESYS_CONTEXT *esys_context, ESYS_TR session_handle, buffer_t *bp)
 {
@@ -1430,6 +2607,25 @@ __pcr_policy_tpm2_policypcr(ESYS_CONTEXT *esys_context, ESYS_TR session_handle,
 	return true;
 }
 
+static bool
+__pcr_policy_tpm2_policyor(ESYS_CONTEXT *esys_context, ESYS_TR session_handle, buffer_t *bp)
+{
+	TPML_DIGEST digests = { 0 };
+	TPM2_RC rc;
+
+	rc = Tss2_MU_TPML_DIGEST_Unmarshal(bp->data, bp->size, &bp->rpos, &digests);
+	if (rc != TSS2_RC_SUCCESS)
+		return false;
+
+	rc = Esys_PolicyOR(esys_context, session_handle,
+			ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE,
+			&digests);
+	if (!tss_check_error(rc, "Esys_PolicyOR failed"))
+		return false;
+
+	return true;
+}
+
 static bool
 __pcr_policy_unseal_policy_seq(ESYS_CONTEXT *esys_context,
 			ESYS_TR sealed_object_handle,
@@ -1463,6 +2659,10 @@ __pcr_policy_unseal_policy_seq(ESYS_CONTEXT *esys_context,
 			if (!__pcr_policy_tpm2_policyauthorize(esys_context, session_handle, &buf))
 				goto cleanup;
 			break;
+		case TPM2_CC_PolicyOR:
+			if (!__pcr_policy_tpm2_policyor(esys_context, session_handle, &buf))
+				goto cleanup;
+			break;
 		default:
 			error("Unsupported TPM command: %d\n", code);
 			goto cleanup;
@@ -1498,6 +2698,9 @@ tpm2key_unseal_secret(const char *input_path, const char *output_path,
 	TPM2B_PRIVATE priv = { 0 };
 	ESYS_TR primary_handle = ESYS_TR_NONE;
 	ESYS_TR sealed_object_handle = ESYS_TR_NONE;
+	TPM2_HANDLE parent_handle;
+	TPM2B_ENCRYPTED_SECRET import_seed;
+	TPM2B_PRIVATE *imported_priv = NULL;
 	TPM2B_SENSITIVE_DATA *unsealed = NULL;
 	TPM2_RC rc;
 	bool okay = false;
@@ -1510,6 +2713,11 @@ tpm2key_unseal_secret(const char *input_path, const char *output_path,
 	else
 		SRK_template = &ECC_SRK_template;
 
+	/* If the secret was sealed to a persistent SRK, use that one */
+	parent_handle = ASN1_INTEGER_get(tpm2key->parent);
+	if (parent_handle < TPM2_PERSISTENT_FIRST || parent_handle > TPM2_PERSISTENT_LAST)
+		parent_handle = SRK_persistent_handle;
+
 	buffer_init_read(&buf, tpm2key->pubkey->data, tpm2key->pubkey->length);
 	rc = Tss2_MU_TPM2B_PUBLIC_Unmarshal(buf.data, buf.size, &buf.rpos, &pub);
 	if (rc != TSS2_RC_SUCCESS)
@@ -1520,9 +2728,23 @@ tpm2key_unseal_secret(const char *input_path, const char *output_path,
 	if (rc != TSS2_RC_SUCCESS)
 		goto cleanup;
 
-	if (!esys_create_primary(esys_context, &primary_handle))
+	if (!esys_srk_acquire(esys_context, parent_handle, &primary_handle))
 		goto cleanup;
 
+	/* Secrets sealed offline need to be imported first */
+	if (tpm2key_get_import_secret(tpm2key, &import_seed)) {
+		TPMT_SYM_DEF_OBJECT no_inner_wrapper = { .algorithm = TPM2_ALG_NULL };
+
+		rc = Esys_Import(esys_context, primary_handle,
+			ESYS_TR_PASSWORD, ESYS_TR_NONE, ESYS_TR_NONE,
+			NULL, &pub, &priv, &import_seed, &no_inner_wrapper,
+			&imported_priv);
+		if (!tss_check_error(rc, "Esys_Import failed"))
+			goto cleanup;
+
+		priv = *imported_priv;
+	}
+
 	rc = Esys_Load(esys_context, primary_handle,
 		ESYS_TR_PASSWORD, ESYS_TR_NONE, ESYS_TR_NONE,
 		&priv, &pub, &sealed_object_handle);
@@ -1559,28 +2781,55 @@ tpm2key_unseal_secret(const char *input_path, const char *output_path,
 cleanup:
 	if (tpm2key)
 		TSSPRIVKEY_free(tpm2key);
+	if (imported_priv)
+		free(imported_priv);
 	if (unsealed)
 		free_secret(unsealed);
 
-	esys_flush_context(esys_context, &primary_handle);
+	esys_srk_release(esys_context, &primary_handle);
 	esys_flush_context(esys_context, &sealed_object_handle);
 
 	return okay;
 }
 
 bool
-pcr_unseal_secret(const target_platform_t *platform,
+pcr_unseal_secrets(const target_platform_t *platform,
 				const tpm_pcr_selection_t *pcr_selection,
 				const char *signed_policy_path,
 				const stored_key_t *public_key_file,
-				const char *input_path, const char *output_path)
+				unsigned int count, const char **input_paths, const char **output_paths)
 {
+	unsigned int i;
+	bool okay = true;
+
+	if (platform->unseal_secrets)
+		return platform->unseal_secrets(count, input_paths, output_paths,
+				pcr_selection, signed_policy_path, public_key_file);
+
 	if (!platform->unseal_secret) {
 		error("target platform %s does not support unsealing yet\n", platform->name);
 		return false;
 	}
 
-	return platform->unseal_secret(input_path, output_path, pcr_selection, signed_policy_path, public_key_file);
+	/* Fall back to unsealing one secret after the other. These at least
+	 * share the SRK and the connection to the TPM. */
+	for (i = 0; i < count; ++i) {
+		if (!platform->unseal_secret(input_paths[i], output_paths[i],
+					pcr_selection, signed_policy_path, public_key_file))
+			okay = false;
+	}
+	return okay;
+}
+
+bool
+pcr_unseal_secret(const target_platform_t *platform,
+				const tpm_pcr_selection_t *pcr_selection,
+				const char *signed_policy_path,
+				const stored_key_t *public_key_file,
+				const char *input_path, const char *output_path)
+{
+	return pcr_unseal_secrets(platform, pcr_selection, signed_policy_path, public_key_file,
+			1, &input_path, &output_path);
 }
 
 /*
@@ -1590,11 +2839,38 @@ pcr_unseal_secret(const target_platform_t *platform,
 static bool
 oldgrub_write_sealed_secret(const char *pathname,
 					const TPML_PCR_SELECTION *pcr_sel,
+					const TPML_DIGEST *policy_or,
 					const TPM2B_PRIVATE *sealed_private,
-					const TPM2B_PUBLIC *sealed_public)
+					const TPM2B_PUBLIC *sealed_public,
+					const TPM2B_ENCRYPTED_SECRET *import_seed)
 {
+	if (import_seed) {
+		error("Target platform oldgrub cannot store secrets that were sealed offline\n");
+		return false;
+	}
+
 	/* Just marshal public and private portions and concat them into a single file. */
-	return write_sealed_secret(pathname, sealed_public, sealed_private);
+	return write_sealed_secret(pathname, sealed_public, sealed_private, policy_or);
+}
+
+static bool
+oldgrub_sealed_policy_is_current(const char *output_path, const TPM2B_DIGEST *policy)
+{
+	TPM2B_PUBLIC *pub = NULL;
+	TPM2B_PRIVATE *priv = NULL;
+	TPML_DIGEST *policy_or = NULL;
+	bool current;
+
+	if (!read_sealed_secret(output_path, &pub, &priv, &policy_or))
+		return false;
+
+	current = pub->publicArea.authPolicy.size == policy->size
+	       && !memcmp(pub->publicArea.authPolicy.buffer, policy->buffer, policy->size);
+
+	free(policy_or);
+	free(priv);
+	free(pub);
+	return current;
 }
 
 static bool
@@ -1610,17 +2886,18 @@ oldgrub_write_signed_policy(const char *input_path, const char *output_path,
 }
 
 static bool
-oldgrub_unseal_secret(const char *input_path, const char *output_path,
+oldgrub_unseal_secrets(unsigned int count,
+				const char **input_paths, const char **output_paths,
 				const tpm_pcr_selection_t *pcr_selection,
 				const char *signed_policy_path,
 				const stored_key_t *public_key_file)
 {
 	if (signed_policy_path == NULL)
-		return pcr_unseal_secret_pcr(pcr_selection, input_path, output_path);
+		return pcr_unseal_secrets_pcr(pcr_selection, count, input_paths, output_paths);
 
-	return pcr_authorized_policy_unseal_secret(pcr_selection,
+	return pcr_authorized_policy_unseal_secrets(pcr_selection,
 				signed_policy_path, public_key_file,
-				input_path, output_path);
+				count, input_paths, output_paths);
 }
 
 /*
@@ -1630,21 +2907,29 @@ oldgrub_unseal_secret(const char *input_path, const char *output_path,
 static bool
 tpm2key_write_sealed_secret(const char *pathname,
 					const TPML_PCR_SELECTION *pcr_sel,
+					const TPML_DIGEST *policy_or,
 					const TPM2B_PRIVATE *sealed_private,
-					const TPM2B_PUBLIC *sealed_public)
+					const TPM2B_PUBLIC *sealed_public,
+					const TPM2B_ENCRYPTED_SECRET *import_seed)
 {
 	TSSPRIVKEY *tpm2key = NULL;
 	bool ok = false;
 
-	if (!tpm2key_basekey(&tpm2key, TPM2_RH_OWNER, sealed_public, sealed_private))
+	if (!tpm2key_basekey(&tpm2key, SRK_persistent_handle? : TPM2_RH_OWNER, sealed_public, sealed_private))
 		goto cleanup;
 
 	if (SRK_template->publicArea.type == TPM2_ALG_RSA)
 		tpm2key->rsaParent = 1;
 
+	if (import_seed && !tpm2key_set_import_secret(tpm2key, import_seed))
+		goto cleanup;
+
 	if (pcr_sel && !tpm2key_add_policy_policypcr(tpm2key, pcr_sel))
 		goto cleanup;
 
+	if (policy_or && !tpm2key_add_policy_policyor(tpm2key, policy_or))
+		goto cleanup;
+
 	ok = tpm2key_write_file(pathname, tpm2key);
 
 cleanup:
@@ -1653,6 +2938,26 @@ cleanup:
 	return ok;
 }
 
+static bool
+tpm2key_sealed_policy_is_current(const char *output_path, const TPM2B_DIGEST *policy)
+{
+	TSSPRIVKEY *tpm2key = NULL;
+	TPM2B_PUBLIC pub = { .size = 0 };
+	buffer_t buf;
+	bool current = false;
+
+	if (!tpm2key_read_file(output_path, &tpm2key))
+		return false;
+
+	buffer_init_read(&buf, tpm2key->pubkey->data, tpm2key->pubkey->length);
+	if (Tss2_MU_TPM2B_PUBLIC_Unmarshal(buf.data, buf.size, &buf.rpos, &pub) == TSS2_RC_SUCCESS)
+		current = pub.publicArea.authPolicy.size == policy->size
+		       && !memcmp(pub.publicArea.authPolicy.buffer, policy->buffer, policy->size);
+
+	TSSPRIVKEY_free(tpm2key);
+	return current;
+}
+
 static bool
 tpm2key_write_signed_policy(const char *input_path, const char *output_path,
 					const char *policy_name,
@@ -1697,6 +3002,92 @@ out:
 	return okay;
 }
 
+/*
+ * The policy is current if the first authPolicy of that name authorizes the
+ * same PCR selection with our key, and its signature matches the new policy.
+ */
+static bool
+tpm2key_signed_policy_is_current(const char *output_path,
+					const pcr_signed_policy_t *sp,
+					const tpm_rsa_key_t *signing_key)
+{
+	TSSPRIVKEY *tpm2key = NULL;
+	TPM2B_PUBLIC *pub_key = NULL;
+	TPML_PCR_SELECTION pcr_sel;
+	TPMT_SIGNATURE signature;
+	bool current = false;
+
+	if (!tpm2key_read_file(output_path, &tpm2key))
+		goto out;
+
+	if (!(pub_key = tpm_rsa_key_to_tss2(signing_key))
+	 || !pcr_bank_to_selection(&pcr_sel, &sp->bank))
+		goto out;
+
+	if (tpm2key_find_authpolicy_policyauthorize(tpm2key, sp->name? : "default",
+				&pcr_sel, pub_key, &signature))
+		current = tpm_rsa_key_verify(signing_key,
+				sp->pcr_policy->buffer, sp->pcr_policy->size,
+				&signature);
+
+out:
+	if (pub_key)
+		free(pub_key);
+	if (tpm2key)
+		TSSPRIVKEY_free(tpm2key);
+
+	return current;
+}
+
+/*
+ * Add several signed policies to a tpm2key file, and write it once.
+ */
+static bool
+tpm2key_write_signed_policies(const char *input_path, const char *output_path,
+					unsigned int count,
+					const pcr_signed_policy_t **policies,
+					const tpm_rsa_key_t *signing_key)
+{
+	TSSPRIVKEY *tpm2key = NULL;
+	TPM2B_PUBLIC *pub_key = NULL;
+	TPML_PCR_SELECTION pcr_sel;
+	unsigned int i;
+	bool okay = false;
+
+	/* Allow an in-place update */
+	if (input_path == NULL)
+		input_path = output_path;
+
+	if (!tpm2key_read_file(input_path, &tpm2key))
+		goto out;
+
+	if (!(pub_key = tpm_rsa_key_to_tss2(signing_key)))
+		goto out;
+
+	for (i = 0; i < count; ++i) {
+		const pcr_signed_policy_t *sp = policies[i];
+
+		if (!pcr_bank_to_selection(&pcr_sel, &sp->bank))
+			goto out;
+
+		/* Prepend the signed policy, just like repeated calls to
+		 * tpm2key_write_signed_policy would do */
+		if (!tpm2key_add_authpolicy_policyauthorize(tpm2key, sp->name? : "default",
+					&pcr_sel, pub_key, sp->signature, false))
+			goto out;
+	}
+
+	okay = tpm2key_write_file(output_path, tpm2key);
+
+out:
+	if (pub_key)
+		free(pub_key);
+	if (tpm2key)
+		TSSPRIVKEY_free(tpm2key);
+
+	return okay;
+}
+
 static bool
 systemd_write_signed_policy(const char *input_path, const char *output_path,
 					const char *policy_name,
@@ -1706,6 +3097,8 @@ systemd_write_signed_policy(const char *input_path, const char *output_path,
 					const TPMT_SIGNATURE *signed_policy)
 {
 	const tpm_evdigest_t *digest;
+	unsigned char sigbuf[TPM2_MAX_RSA_KEY_BYTES];
+	unsigned int siglen;
 	bool okay;
 
 	if (input_path && strcmp(input_path, output_path)) {
@@ -1718,6 +3111,9 @@ systemd_write_signed_policy(const char *input_path, const char *output_path,
 		return false;
 	}
 
+	if (!(siglen = __pcr_policy_signature_bytes(signed_policy, sigbuf, sizeof(sigbuf))))
+		return false;
+
 	okay = sdb_policy_file_add_entry(output_path,
 			policy_name,
 			bank->algo_name,
@@ -1727,11 +3123,96 @@ systemd_write_signed_policy(const char *input_path, const char *output_path,
 			/* policy */
 			pcr_policy->buffer, pcr_policy->size,
 			/* signature */
-			signed_policy->signature.rsassa.sig.buffer, signed_policy->signature.rsassa.sig.size);
+			sigbuf, siglen);
+
+	return okay;
+}
+
+/*
+ * Add several signed policies to the systemd json file, and write it once.
+ */
+static bool
+systemd_write_signed_policies(const char *input_path, const char *output_path,
+					unsigned int count,
+					const pcr_signed_policy_t **policies,
+					const tpm_rsa_key_t *signing_key)
+{
+	const tpm_evdigest_t *digest;
+	sdb_policy_file_t *file;
+	unsigned int i;
+	bool okay = true;
+
+	if (input_path && strcmp(input_path, output_path)) {
+		error("systemd policy will only do in-place updates of the json file\n");
+		return false;
+	}
+
+	if (!(digest = tpm_rsa_key_public_digest(signing_key))) {
+		error("%s: cannot compute signing key fingerprint\n", __func__);
+		return false;
+	}
+
+	if (!(file = sdb_policy_file_open(output_path)))
+		return false;
+
+	for (i = 0; i < count && okay; ++i) {
+		const pcr_signed_policy_t *sp = policies[i];
+		unsigned char sigbuf[TPM2_MAX_RSA_KEY_BYTES];
+		unsigned int siglen;
+
+		if (!(siglen = __pcr_policy_signature_bytes(sp->signature, sigbuf, sizeof(sigbuf)))) {
+			okay = false;
+			break;
+		}
+
+		okay = sdb_policy_file_add(file,
+				sp->name,
+				sp->bank.algo_name,
+				sp->bank.pcr_mask,
+				/* fingerprint */
+				digest->data, digest->size,
+				/* policy */
+				sp->pcr_policy->buffer, sp->pcr_policy->size,
+				/* signature */
+				sigbuf, siglen);
+	}
 
+	if (okay)
+		okay = sdb_policy_file_commit(file);
+
+	sdb_policy_file_free(file);
 	return okay;
 }
 
+/*
+ * The json file is indexed by policy digest. The digest covers the PCR values,
+ * so an entry for the same digest, PCRs and key needs no new signature.
+ */
+static bool
+systemd_signed_policy_is_current(const char *output_path,
+					const pcr_signed_policy_t *sp,
+					const tpm_rsa_key_t *signing_key)
+{
+	const tpm_evdigest_t *digest;
+	sdb_policy_file_t *file;
+	bool current;
+
+	if (!(digest = tpm_rsa_key_public_digest(signing_key)))
+		return false;
+
+	if (!(file = sdb_policy_file_open(output_path)))
+		return false;
+
+	current = sdb_policy_file_has_entry(file,
+			sp->bank.algo_name,
+			sp->bank.pcr_mask,
+			digest->data, digest->size,
+			sp->pcr_policy->buffer, sp->pcr_policy->size);
+
+	sdb_policy_file_free(file);
+	return current;
+}
+
 static target_platform_t	target_platforms[] = {
 	{
 		.name			= "oldgrub",
@@ -1739,21 +3220,28 @@ static target_platform_t	target_platforms[] = {
 					| PLATFORM_NEED_OUTPUT_FILE
 					| PLATFORM_NEED_PCR_SELECTION,
 		.write_sealed_secret	= oldgrub_write_sealed_secret,
+		.sealed_policy_is_current = oldgrub_sealed_policy_is_current,
 		.write_signed_policy	= oldgrub_write_signed_policy,
-		.unseal_secret		= oldgrub_unseal_secret,
+		.unseal_secrets		= oldgrub_unseal_secrets,
 	},
 	{
 		.name			= "tpm2.0",
 		.unseal_flags		= PLATFORM_NEED_INPUT_FILE | PLATFORM_NEED_OUTPUT_FILE,
 		.write_sealed_secret	= tpm2key_write_sealed_secret,
+		.sealed_policy_is_current = tpm2key_sealed_policy_is_current,
 		.write_signed_policy	= tpm2key_write_signed_policy,
+		.write_signed_policies	= tpm2key_write_signed_policies,
+		.signed_policy_is_current = tpm2key_signed_policy_is_current,
 		.unseal_secret		= tpm2key_unseal_secret,
 	},
 	{
 		.name			= "systemd",
 		.unseal_flags		= PLATFORM_NEED_INPUT_FILE | PLATFORM_NEED_OUTPUT_FILE,
 		.write_sealed_secret	= tpm2key_write_sealed_secret,
+		.sealed_policy_is_current = tpm2key_sealed_policy_is_current,
 		.write_signed_policy	= systemd_write_signed_policy,
+		.write_signed_policies	= systemd_write_signed_policies,
+		.signed_policy_is_current = systemd_signed_policy_is_current,
 	},
 	{ NULL }
 };
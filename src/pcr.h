@@ -26,6 +26,9 @@
 
 #define PCR_BANK_REGISTER_MAX	24
 
+/* The TPM accepts at most 8 branches in a PolicyOR */
+#define PCR_POLICY_OR_MAX	8
+
 typedef struct tpm_pcr_bank {
 	uint32_t		pcr_mask;
 	uint32_t		valid_mask;
@@ -41,6 +44,9 @@ typedef struct tpm_pcr_selection {
 
 extern void		set_srk_alg (const char *alg);
 extern void		set_srk_rsa_bits (const unsigned int rsa_bits);
+extern bool		set_srk_handle (unsigned int handle);
+extern bool		set_srk_public_key (const char *path);
+extern void		set_policy_always_sign(bool always);
 extern void		pcr_bank_initialize(tpm_pcr_bank_t *bank, unsigned int pcr_mask, const tpm_algo_info_t *algo);
 extern bool		pcr_bank_wants_pcr(tpm_pcr_bank_t *bank, unsigned int index);
 extern void		pcr_bank_mark_valid(tpm_pcr_bank_t *bank, unsigned int index);
@@ -57,6 +63,7 @@ extern tpm_pcr_selection_t *pcr_selection_new(const char *algo_name, const char
 extern void		pcr_selection_free(tpm_pcr_selection_t *);
 
 extern bool		pcr_read_into_bank(tpm_pcr_bank_t *bank);
+extern bool		pcr_read_into_banks(tpm_pcr_bank_t **banks, unsigned int count);
 extern bool		pcr_authorized_policy_create(const tpm_pcr_selection_t *pcr_selection,
 				const stored_key_t *private_key_file,
 				const char *output_path);
@@ -65,17 +72,38 @@ extern bool		pcr_store_public_key(const stored_key_t *private_key_file,
 extern bool		pcr_policy_sign(const target_platform_t *platform, const tpm_pcr_bank_t *bank,
 				const stored_key_t *private_key_file,
 				const char *input_path,
-				const char *output_path, const char *policy_name);
+				const char *output_path, const char *policy_name,
+				bool *unchanged_ret);
+extern pcr_policy_batch_t *pcr_policy_batch_new(const target_platform_t *platform,
+				const stored_key_t *private_key_file);
+extern bool		pcr_policy_batch_add(pcr_policy_batch_t *, const tpm_pcr_bank_t *bank,
+				const char *policy_name, const char *output_path);
+extern bool		pcr_policy_batch_write(pcr_policy_batch_t *, const char *input_path);
+extern bool		pcr_policy_batch_unchanged(const pcr_policy_batch_t *);
+extern void		pcr_policy_batch_clear(pcr_policy_batch_t *);
+extern void		pcr_policy_batch_free(pcr_policy_batch_t *);
 extern bool		pcr_authorized_policy_seal_secret(const target_platform_t *platform,
 				const char *authorized_policy, const char *input_path,
 				const char *output_path);
 extern bool		pcr_seal_secret(const target_platform_t *, const tpm_pcr_bank_t *bank,
 				const char *input_path, const char *output_path);
+extern bool		pcr_seal_secret_or(const target_platform_t *,
+				const tpm_pcr_bank_t **banks, unsigned int count,
+				const char *input_path, const char *output_path);
+extern bool		pcr_sealed_secret_is_current(const target_platform_t *,
+				const tpm_pcr_bank_t **banks, unsigned int count,
+				const char *output_path);
 extern bool		pcr_unseal_secret(const target_platform_t *,
 				const tpm_pcr_selection_t *pcr_selection,
 				const char *signed_policy_path,
 				const stored_key_t *public_key_file,
 				const char *input_path, const char *output_path);
+extern bool		pcr_unseal_secrets(const target_platform_t *,
+				const tpm_pcr_selection_t *pcr_selection,
+				const char *signed_policy_path,
+				const stored_key_t *public_key_file,
+				unsigned int count, const char **input_paths,
+				const char **output_paths);
 extern bool		pcr_policy_unseal_tpm2key(const char *input_path,
 				const char *output_path);
 
@@ -0,0 +1,923 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <pthread.h>
+
+#include "config.h"
+#include "pkcs11.h"
+#include "util.h"
+
+#define PKCS11_MAX_SESSIONS	256
+
+static unsigned int		pkcs11_max_sessions = PKCS11_DEFAULT_SESSIONS;
+
+bool
+pkcs11_set_max_sessions(const char *count)
+{
+	unsigned long value;
+	char *end;
+
+	value = strtoul(count, &end, 10);
+	if (*end || value == 0 || value > PKCS11_MAX_SESSIONS) {
+		error("Invalid number of PKCS#11 sessions \"%s\" (must be between 1 and %u)\n",
+				count, PKCS11_MAX_SESSIONS);
+		return false;
+	}
+
+	pkcs11_max_sessions = value;
+	return true;
+}
+
+bool
+pkcs11_is_uri(const char *string)
+{
+	return !strncasecmp(string, PKCS11_URI_PREFIX, strlen(PKCS11_URI_PREFIX));
+}
+
+#ifdef HAVE_P11_KIT_1
+
+#include <p11-kit/pkcs11.h>
+
+#define PKCS11_DEFAULT_MODULE	"p11-kit-proxy.so"
+#define PKCS11_ID_MAX		128
+
+/*
+ * The parts of a PKCS#11 URI (RFC 7512) we understand.
+ */
+struct pkcs11_uri {
+	char *			token;
+	char *			serial;
+	char *			object;
+	unsigned char		id[PKCS11_ID_MAX];
+	unsigned int		id_len;
+	char *			pin_value;
+	char *			pin_source;
+	char *			module_path;
+};
+
+struct pkcs11_key {
+	/* For messages; this never includes the PIN */
+	char *			name;
+	struct pkcs11_uri	match;
+
+	void *			module;
+	CK_FUNCTION_LIST_PTR	p11;
+	bool			finalize;
+	pid_t			owner;
+
+	CK_SLOT_ID		slot;
+	CK_FLAGS		token_flags;
+	CK_KEY_TYPE		key_type;
+	CK_OBJECT_HANDLE	handle;
+	TPM2B_PUBLIC		public;
+
+	/*
+	 * The session pool. All sessions share the login of the first one,
+	 * and are opened on demand, up to max_sessions.
+	 */
+	pthread_mutex_t		lock;
+	pthread_cond_t		idle_cond;
+	unsigned int		max_sessions;
+	unsigned int		num_sessions;
+	CK_SESSION_HANDLE *	sessions;
+	unsigned int		num_idle;
+	CK_SESSION_HANDLE *	idle;
+};
+
+static const char *
+pkcs11_strerror(CK_RV rv)
+{
+	static char buffer[32];
+
+	switch (rv) {
+	case CKR_OK:
+		return "success";
+	case CKR_HOST_MEMORY:
+		return "out of memory";
+	case CKR_GENERAL_ERROR:
+		return "general error";
+	case CKR_FUNCTION_FAILED:
+		return "function failed";
+	case CKR_ARGUMENTS_BAD:
+		return "bad arguments";
+	case CKR_DEVICE_ERROR:
+		return "device error";
+	case CKR_DEVICE_REMOVED:
+		return "device removed";
+	case CKR_KEY_TYPE_INCONSISTENT:
+		return "key type inconsistent";
+	case CKR_MECHANISM_INVALID:
+		return "mechanism not supported";
+	case CKR_PIN_INCORRECT:
+		return "incorrect PIN";
+	case CKR_PIN_LOCKED:
+		return "PIN locked";
+	case CKR_SESSION_COUNT:
+		return "too many sessions";
+	case CKR_SESSION_HANDLE_INVALID:
+		return "invalid session handle";
+	case CKR_TOKEN_NOT_PRESENT:
+		return "token not present";
+	case CKR_USER_NOT_LOGGED_IN:
+		return "user not logged in";
+	case CKR_BUFFER_TOO_SMALL:
+		return "buffer too small";
+	case CKR_CRYPTOKI_NOT_INITIALIZED:
+		return "not initialized";
+	}
+
+	snprintf(buffer, sizeof(buffer), "CKR_0x%lx", (unsigned long) rv);
+	return buffer;
+}
+
+/*
+ * PKCS#11 URI handling
+ */
+static int
+pkcs11_uri_decode(const char *value, size_t len, unsigned char *buf, size_t bufsz)
+{
+	const char *end = value + len;
+	unsigned int n = 0;
+
+	while (value < end) {
+		unsigned char cc = *value++;
+
+		if (cc == '%') {
+			cc = 0;
+			if (end - value < 2 || !parse_octet(&value, &cc))
+				return -1;
+		}
+		if (n >= bufsz)
+			return -1;
+		buf[n++] = cc;
+	}
+
+	return n;
+}
+
+static inline bool
+pkcs11_uri_attr_is(const char *attr, size_t attr_len, const char *name)
+{
+	return attr_len == strlen(name) && !strncmp(attr, name, attr_len);
+}
+
+static void
+pkcs11_uri_destroy(struct pkcs11_uri *uri)
+{
+	drop_string(&uri->token);
+	drop_string(&uri->serial);
+	drop_string(&uri->object);
+	drop_string(&uri->pin_value);
+	drop_string(&uri->pin_source);
+	drop_string(&uri->module_path);
+}
+
+/*
+ * Note that the URI may contain the PIN, so we never print it.
+ */
+static bool
+pkcs11_uri_parse(const char *string, struct pkcs11_uri *uri)
+{
+	const char *pos = string + strlen(PKCS11_URI_PREFIX);
+	bool in_query = false;
+
+	while (*pos) {
+		const char *attr, *value;
+		size_t attr_len, len;
+		char **var = NULL;
+		int n;
+
+		len = strcspn(pos, in_query? "&" : ";?");
+		attr = pos;
+		pos += len;
+
+		if (len == 0)
+			goto next;
+
+		if (!(value = memchr(attr, '=', len))) {
+			error("Bad PKCS#11 URI attribute \"%.*s\"\n", (int) len, attr);
+			return false;
+		}
+
+		attr_len = value - attr;
+		value++;
+		len -= attr_len + 1;
+
+		if (!in_query) {
+			if (pkcs11_uri_attr_is(attr, attr_len, "token"))
+				var = &uri->token;
+			else if (pkcs11_uri_attr_is(attr, attr_len, "serial"))
+				var = &uri->serial;
+			else if (pkcs11_uri_attr_is(attr, attr_len, "object"))
+				var = &uri->object;
+		} else {
+			if (pkcs11_uri_attr_is(attr, attr_len, "module-path"))
+				var = &uri->module_path;
+			else if (pkcs11_uri_attr_is(attr, attr_len, "pin-value"))
+				var = &uri->pin_value;
+			else if (pkcs11_uri_attr_is(attr, attr_len, "pin-source"))
+				var = &uri->pin_source;
+		}
+
+		if (var != NULL) {
+			char *decoded = malloc(len + 1);
+
+			if ((n = pkcs11_uri_decode(value, len, (unsigned char *) decoded, len)) < 0) {
+				free(decoded);
+				goto bad_value;
+			}
+			decoded[n] = '\0';
+
+			drop_string(var);
+			*var = decoded;
+		} else
+		if (!in_query && pkcs11_uri_attr_is(attr, attr_len, "id")) {
+			if ((n = pkcs11_uri_decode(value, len, uri->id, sizeof(uri->id))) < 0)
+				goto bad_value;
+			uri->id_len = n;
+		} else
+		if (!in_query && pkcs11_uri_attr_is(attr, attr_len, "pin-value")) {
+			/* RFC 7512 only allows the PIN in the query component */
+			error("PKCS#11 URI attribute pin-value must be given after the \"?\"\n");
+			return false;
+		} else
+		if (!in_query && pkcs11_uri_attr_is(attr, attr_len, "type")) {
+			if (len != 7 || strncmp(value, "private", 7)) {
+				error("PKCS#11 URI must refer to a private key\n");
+				return false;
+			}
+		} else {
+			error("Unsupported PKCS#11 URI attribute \"%.*s\"\n", (int) attr_len, attr);
+			return false;
+		}
+
+next:
+		if (*pos == '?') {
+			if (in_query)
+				goto bad_uri;
+			in_query = true;
+		}
+		if (*pos)
+			pos++;
+		continue;
+
+bad_value:
+		error("Bad value for PKCS#11 URI attribute \"%.*s\"\n", (int) attr_len, attr);
+		return false;
+	}
+
+	if (uri->object == NULL && uri->id_len == 0) {
+		error("PKCS#11 URI must specify the key by object label or id\n");
+		return false;
+	}
+
+	return true;
+
+bad_uri:
+	error("Bad PKCS#11 URI (more than one query component)\n");
+	return false;
+}
+
+static char *
+pkcs11_uri_display_name(const struct pkcs11_uri *uri)
+{
+	char buffer[256];
+
+	snprintf(buffer, sizeof(buffer), "pkcs11:%s%s%s%s%s",
+			uri->token? "token=" : "", uri->token?: "",
+			uri->token? ";" : "",
+			uri->object? "object=" : "id=",
+			uri->object?: print_hex_string(uri->id, uri->id_len));
+	return strdup(buffer);
+}
+
+/*
+ * Get the PIN, which is either given in the URI, read from a file
+ * given as pin-source, or taken from the environment.
+ */
+static const char *
+pkcs11_key_get_pin(const pkcs11_key_t *key, char *buffer, size_t size)
+{
+	const char *path;
+
+	if (key->match.pin_value)
+		return key->match.pin_value;
+
+	if ((path = key->match.pin_source) != NULL) {
+		if (!strncmp(path, "file:", 5))
+			path += 5;
+		if (!read_single_line_file(path, buffer, size)) {
+			error("%s: unable to read PIN from %s\n", key->name, path);
+			return NULL;
+		}
+		return buffer;
+	}
+
+	return getenv("PCR_ORACLE_PKCS11_PIN");
+}
+
+/*
+ * Token labels and serial numbers are padded with blanks
+ */
+static bool
+pkcs11_padded_string_equal(const unsigned char *padded, size_t size, const char *string)
+{
+	size_t len = strlen(string);
+
+	while (size && padded[size - 1] == ' ')
+		size--;
+	return size == len && !memcmp(padded, string, len);
+}
+
+static bool
+pkcs11_module_load(pkcs11_key_t *key)
+{
+	CK_RV (*get_function_list)(CK_FUNCTION_LIST_PTR_PTR);
+	const char *path;
+	CK_RV rv;
+
+	if (!(path = key->match.module_path) && !(path = getenv("PCR_ORACLE_PKCS11_MODULE")))
+		path = PKCS11_DEFAULT_MODULE;
+
+	if (!(key->module = dlopen(path, RTLD_NOW | RTLD_LOCAL))) {
+		error("Unable to load PKCS#11 module %s: %s\n", path, dlerror());
+		return false;
+	}
+
+	if (!(get_function_list = dlsym(key->module, "C_GetFunctionList"))) {
+		error("%s: not a PKCS#11 module\n", path);
+		return false;
+	}
+
+	rv = get_function_list(&key->p11);
+	if (rv != CKR_OK) {
+		error("%s: C_GetFunctionList failed: %s\n", path, pkcs11_strerror(rv));
+		return false;
+	}
+
+	debug("Loaded PKCS#11 module %s\n", path);
+	return true;
+}
+
+/*
+ * Initialize the module for use by several threads. If the module does
+ * not support OS locking, we have to serialize all signing requests.
+ */
+static bool
+pkcs11_initialize(pkcs11_key_t *key)
+{
+	CK_C_INITIALIZE_ARGS args = {
+		.flags = CKF_OS_LOCKING_OK,
+	};
+	CK_RV rv;
+
+	rv = key->p11->C_Initialize(&args);
+	if (rv == CKR_CANT_LOCK) {
+		debug("%s: PKCS#11 module is not thread safe, using a single session\n", key->name);
+		key->max_sessions = 1;
+		rv = key->p11->C_Initialize(NULL);
+	}
+
+	if (rv == CKR_CRYPTOKI_ALREADY_INITIALIZED) {
+		key->finalize = false;
+	} else if (rv == CKR_OK) {
+		key->finalize = true;
+	} else {
+		error("%s: C_Initialize failed: %s\n", key->name, pkcs11_strerror(rv));
+		return false;
+	}
+
+	return true;
+}
+
+static bool
+pkcs11_find_slot(pkcs11_key_t *key)
+{
+	CK_SLOT_ID *slots = NULL;
+	CK_ULONG i, count = 0;
+	unsigned int found = 0;
+	CK_RV rv;
+
+	rv = key->p11->C_GetSlotList(CK_TRUE, NULL, &count);
+	if (rv == CKR_OK && count) {
+		slots = calloc(count, sizeof(slots[0]));
+		rv = key->p11->C_GetSlotList(CK_TRUE, slots, &count);
+	}
+	if (rv != CKR_OK) {
+		error("%s: C_GetSlotList failed: %s\n", key->name, pkcs11_strerror(rv));
+		goto out;
+	}
+
+	for (i = 0; i < count; ++i) {
+		CK_TOKEN_INFO info;
+
+		if (key->p11->C_GetTokenInfo(slots[i], &info) != CKR_OK)
+			continue;
+
+		if (key->match.token && !pkcs11_padded_string_equal(info.label, sizeof(info.label), key->match.token))
+			continue;
+		if (key->match.serial && !pkcs11_padded_string_equal(info.serialNumber, sizeof(info.serialNumber), key->match.serial))
+			continue;
+
+		if (found++ == 0) {
+			key->slot = slots[i];
+			key->token_flags = info.flags;
+		}
+	}
+
+	if (found == 0)
+		error("%s: no matching PKCS#11 token found\n", key->name);
+	else if (found > 1)
+		error("%s: URI matches more than one PKCS#11 token; please specify token label or serial\n", key->name);
+
+out:
+	if (slots)
+		free(slots);
+	return found == 1;
+}
+
+static bool
+pkcs11_session_open(pkcs11_key_t *key, CK_SESSION_HANDLE *ret)
+{
+	CK_RV rv;
+
+	rv = key->p11->C_OpenSession(key->slot, CKF_SERIAL_SESSION, NULL, NULL, ret);
+	if (rv != CKR_OK) {
+		error("%s: C_OpenSession failed: %s\n", key->name, pkcs11_strerror(rv));
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * The login state is shared by all sessions of an application,
+ * so we need to log in only once.
+ */
+static bool
+pkcs11_login(pkcs11_key_t *key, CK_SESSION_HANDLE session)
+{
+	char buffer[256];
+	const char *pin = NULL;
+	CK_RV rv;
+
+	if (!(key->token_flags & CKF_LOGIN_REQUIRED))
+		return true;
+
+	if (!(key->token_flags & CKF_PROTECTED_AUTHENTICATION_PATH)
+	 && !(pin = pkcs11_key_get_pin(key, buffer, sizeof(buffer)))) {
+		error("%s: token requires a PIN; please specify pin-source in the URI, or set PCR_ORACLE_PKCS11_PIN\n",
+				key->name);
+		return false;
+	}
+
+	rv = key->p11->C_Login(session, CKU_USER, (CK_UTF8CHAR_PTR) pin, pin? strlen(pin) : 0);
+	memset(buffer, 0, sizeof(buffer));
+
+	if (rv != CKR_OK && rv != CKR_USER_ALREADY_LOGGED_IN) {
+		error("%s: C_Login failed: %s\n", key->name, pkcs11_strerror(rv));
+		return false;
+	}
+
+	return true;
+}
+
+static CK_OBJECT_HANDLE
+pkcs11_find_object(pkcs11_key_t *key, CK_SESSION_HANDLE session, CK_OBJECT_CLASS class,
+			const unsigned char *id, unsigned int id_len)
+{
+	CK_ATTRIBUTE template[3];
+	CK_OBJECT_HANDLE found[2];
+	CK_ULONG count = 0, n = 0;
+	CK_RV rv;
+
+	template[n++] = (CK_ATTRIBUTE) { CKA_CLASS, &class, sizeof(class) };
+	if (key->match.object)
+		template[n++] = (CK_ATTRIBUTE) { CKA_LABEL, key->match.object, strlen(key->match.object) };
+	if (id_len)
+		template[n++] = (CK_ATTRIBUTE) { CKA_ID, (void *) id, id_len };
+
+	rv = key->p11->C_FindObjectsInit(session, template, n);
+	if (rv == CKR_OK) {
+		rv = key->p11->C_FindObjects(session, found, 2, &count);
+		key->p11->C_FindObjectsFinal(session);
+	}
+
+	if (rv != CKR_OK) {
+		error("%s: unable to search for objects: %s\n", key->name, pkcs11_strerror(rv));
+		return CK_INVALID_HANDLE;
+	}
+
+	if (count > 1) {
+		error("%s: URI matches more than one %s key\n", key->name,
+				class == CKO_PRIVATE_KEY? "private" : "public");
+		return CK_INVALID_HANDLE;
+	}
+
+	return count? found[0] : CK_INVALID_HANDLE;
+}
+
+static bool
+pkcs11_get_attribute(pkcs11_key_t *key, CK_SESSION_HANDLE session, CK_OBJECT_HANDLE obj,
+			CK_ATTRIBUTE_TYPE type, void *buf, CK_ULONG size, CK_ULONG *ret_len)
+{
+	CK_ATTRIBUTE attr = { type, buf, size };
+
+	if (key->p11->C_GetAttributeValue(session, obj, &attr, 1) != CKR_OK
+	 || attr.ulValueLen == CK_UNAVAILABLE_INFORMATION)
+		return false;
+
+	if (ret_len)
+		*ret_len = attr.ulValueLen;
+	return true;
+}
+
+static bool
+pkcs11_rsa_public(pkcs11_key_t *key, CK_SESSION_HANDLE session, CK_OBJECT_HANDLE obj)
+{
+	TPM2B_PUBLIC_KEY_RSA *rsaPublic = &key->public.publicArea.unique.rsa;
+	unsigned char modulus[TPM2_MAX_RSA_KEY_BYTES + 1], exponent[8];
+	CK_ULONG n_len, e_len, i, off;
+	uint32_t e = 0;
+
+	if (!pkcs11_get_attribute(key, session, obj, CKA_MODULUS, modulus, sizeof(modulus), &n_len)
+	 || !pkcs11_get_attribute(key, session, obj, CKA_PUBLIC_EXPONENT, exponent, sizeof(exponent), &e_len))
+		return false;
+
+	for (off = 0; off < n_len && modulus[off] == 0; ++off)
+		;
+	n_len -= off;
+
+	for (i = 0; i < e_len; ++i) {
+		if (e >> 24) {
+			error("%s: RSA exponent too large\n", key->name);
+			return false;
+		}
+		e = (e << 8) | exponent[i];
+	}
+
+	if (n_len > sizeof(rsaPublic->buffer)) {
+		error("%s: RSA modulus too large\n", key->name);
+		return false;
+	}
+
+	key->public.publicArea.type = TPM2_ALG_RSA;
+	key->public.publicArea.parameters.rsaDetail.keyBits = n_len * 8;
+	key->public.publicArea.parameters.rsaDetail.exponent = e;
+	memcpy(rsaPublic->buffer, modulus + off, n_len);
+	rsaPublic->size = n_len;
+	return true;
+}
+
+static bool
+pkcs11_ecc_public(pkcs11_key_t *key, CK_SESSION_HANDLE session, CK_OBJECT_HANDLE obj)
+{
+	static const unsigned char oid_p256[] = { 0x06, 0x08, 0x2a, 0x86, 0x48, 0xce, 0x3d, 0x03, 0x01, 0x07 };
+	static const unsigned char oid_p384[] = { 0x06, 0x05, 0x2b, 0x81, 0x04, 0x00, 0x22 };
+	TPMS_ECC_POINT *eccPublic = &key->public.publicArea.unique.ecc;
+	unsigned char params[64], point[256], *p;
+	CK_ULONG params_len, point_len;
+	unsigned int curve_id, nbytes;
+
+	if (!pkcs11_get_attribute(key, session, obj, CKA_EC_PARAMS, params, sizeof(params), &params_len)
+	 || !pkcs11_get_attribute(key, session, obj, CKA_EC_POINT, point, sizeof(point), &point_len))
+		return false;
+
+	if (params_len == sizeof(oid_p256) && !memcmp(params, oid_p256, params_len)) {
+		curve_id = TPM2_ECC_NIST_P256;
+		nbytes = 32;
+	} else
+	if (params_len == sizeof(oid_p384) && !memcmp(params, oid_p384, params_len)) {
+		curve_id = TPM2_ECC_NIST_P384;
+		nbytes = 48;
+	} else {
+		error("%s: unsupported ECC curve (only NIST P-256 and P-384 are supported)\n", key->name);
+		return false;
+	}
+
+	/* CKA_EC_POINT should be a DER OCTET STRING wrapping the uncompressed point.
+	 * Some tokens return the bare point. */
+	p = point;
+	if (point_len != 1 + 2 * nbytes) {
+		if (point_len < 2 || point[0] != 0x04 || point[1] != point_len - 2) {
+			error("%s: cannot decode ECC public point\n", key->name);
+			return false;
+		}
+		p += 2;
+		point_len -= 2;
+	}
+
+	if (point_len != 1 + 2 * nbytes || p[0] != 0x04) {
+		error("%s: ECC public point is not in uncompressed format\n", key->name);
+		return false;
+	}
+
+	key->public.publicArea.type = TPM2_ALG_ECC;
+	key->public.publicArea.parameters.eccDetail.curveID = curve_id;
+	memcpy(eccPublic->x.buffer, p + 1, nbytes);
+	eccPublic->x.size = nbytes;
+	memcpy(eccPublic->y.buffer, p + 1 + nbytes, nbytes);
+	eccPublic->y.size = nbytes;
+	return true;
+}
+
+/*
+ * Locate the private key, and retrieve its public part. Private RSA key objects
+ * usually carry the modulus and exponent; for the EC point, we need to look at
+ * the corresponding public key object.
+ */
+static bool
+pkcs11_find_key(pkcs11_key_t *key, CK_SESSION_HANDLE session)
+{
+	unsigned char id[PKCS11_ID_MAX];
+	CK_ULONG id_len = 0;
+	CK_OBJECT_HANDLE pub;
+	bool okay;
+
+	key->handle = pkcs11_find_object(key, session, CKO_PRIVATE_KEY, key->match.id, key->match.id_len);
+	if (key->handle == CK_INVALID_HANDLE) {
+		error("%s: private key not found on token\n", key->name);
+		return false;
+	}
+
+	if (!pkcs11_get_attribute(key, session, key->handle, CKA_KEY_TYPE, &key->key_type, sizeof(key->key_type), NULL)) {
+		error("%s: unable to get key type\n", key->name);
+		return false;
+	}
+
+	if (key->key_type != CKK_RSA && key->key_type != CKK_EC) {
+		error("%s: neither an RSA nor an ECC key\n", key->name);
+		return false;
+	}
+
+	/* The public key has already been retrieved in the parent process */
+	if (key->public.size)
+		return true;
+
+	if (key->key_type == CKK_RSA && pkcs11_rsa_public(key, session, key->handle))
+		goto done;
+
+	if (!pkcs11_get_attribute(key, session, key->handle, CKA_ID, id, sizeof(id), &id_len))
+		id_len = 0;
+
+	pub = pkcs11_find_object(key, session, CKO_PUBLIC_KEY, id, id_len);
+	if (pub == CK_INVALID_HANDLE) {
+		error("%s: cannot find the public key belonging to the private key\n", key->name);
+		return false;
+	}
+
+	if (key->key_type == CKK_RSA)
+		okay = pkcs11_rsa_public(key, session, pub);
+	else
+		okay = pkcs11_ecc_public(key, session, pub);
+	if (!okay) {
+		error("%s: unable to retrieve public key\n", key->name);
+		return false;
+	}
+
+done:
+	key->public.size = sizeof(key->public.publicArea);
+	key->public.publicArea.nameAlg = TPM2_ALG_SHA256;
+	return true;
+}
+
+/*
+ * Set up everything we need for signing, in the current process. The first
+ * session is used to log in and to locate the key, and then goes to the pool.
+ */
+static bool
+pkcs11_key_attach(pkcs11_key_t *key)
+{
+	CK_SESSION_HANDLE session;
+
+	key->owner = getpid();
+	key->num_sessions = 0;
+	key->num_idle = 0;
+
+	if (!pkcs11_initialize(key)
+	 || !pkcs11_find_slot(key)
+	 || !pkcs11_session_open(key, &session))
+		return false;
+
+	key->sessions[key->num_sessions++] = session;
+	if (!pkcs11_login(key, session)
+	 || !pkcs11_find_key(key, session))
+		return false;
+
+	key->idle[key->num_idle++] = session;
+	return true;
+}
+
+pkcs11_key_t *
+pkcs11_key_open(const char *uri)
+{
+	pkcs11_key_t *key;
+
+	key = calloc(1, sizeof(*key));
+	pthread_mutex_init(&key->lock, NULL);
+	pthread_cond_init(&key->idle_cond, NULL);
+
+	if (!pkcs11_uri_parse(uri, &key->match)) {
+		pkcs11_key_close(key);
+		return NULL;
+	}
+
+	key->name = pkcs11_uri_display_name(&key->match);
+	key->max_sessions = pkcs11_max_sessions;
+	key->sessions = calloc(key->max_sessions, sizeof(key->sessions[0]));
+	key->idle = calloc(key->max_sessions, sizeof(key->idle[0]));
+
+	if (!pkcs11_module_load(key) || !pkcs11_key_attach(key)) {
+		pkcs11_key_close(key);
+		return NULL;
+	}
+
+	debug("%s: using %s key on PKCS#11 token, up to %u sessions\n", key->name,
+			key->key_type == CKK_EC? "ECC" : "RSA", key->max_sessions);
+	return key;
+}
+
+void
+pkcs11_key_close(pkcs11_key_t *key)
+{
+	unsigned int i;
+
+	/* After a fork, the sessions belong to our parent */
+	if (key->p11 && key->owner == getpid()) {
+		for (i = 0; i < key->num_sessions; ++i)
+			key->p11->C_CloseSession(key->sessions[i]);
+		if (key->finalize)
+			key->p11->C_Finalize(NULL);
+	}
+
+	if (key->module)
+		dlclose(key->module);
+
+	if (key->sessions)
+		free(key->sessions);
+	if (key->idle)
+		free(key->idle);
+
+	pkcs11_uri_destroy(&key->match);
+	drop_string(&key->name);
+	pthread_mutex_destroy(&key->lock);
+	pthread_cond_destroy(&key->idle_cond);
+	free(key);
+}
+
+const char *
+pkcs11_key_name(const pkcs11_key_t *key)
+{
+	return key->name;
+}
+
+const TPM2B_PUBLIC *
+pkcs11_key_public(const pkcs11_key_t *key)
+{
+	return &key->public;
+}
+
+unsigned int
+pkcs11_key_max_sessions(const pkcs11_key_t *key)
+{
+	return key->max_sessions;
+}
+
+/*
+ * Take a session from the pool, opening a new one if all are busy and
+ * we have not reached the limit yet.
+ *
+ * PKCS#11 handles cannot be used across fork(). A forked child re-initializes
+ * the module and logs in again on first use. Serve workers are long-lived,
+ * so this happens once per worker rather than once per request.
+ */
+static bool
+pkcs11_session_acquire(pkcs11_key_t *key, CK_SESSION_HANDLE *ret)
+{
+	bool okay = true;
+
+	pthread_mutex_lock(&key->lock);
+	if (key->owner != getpid()) {
+		debug("%s: re-initializing PKCS#11 module in process %d\n", key->name, (int) getpid());
+		okay = pkcs11_key_attach(key);
+	}
+
+	while (okay && key->num_idle == 0 && key->num_sessions >= key->max_sessions)
+		pthread_cond_wait(&key->idle_cond, &key->lock);
+
+	if (!okay)
+		;
+	else if (key->num_idle)
+		*ret = key->idle[--(key->num_idle)];
+	else if ((okay = pkcs11_session_open(key, ret)))
+		key->sessions[key->num_sessions++] = *ret;
+	pthread_mutex_unlock(&key->lock);
+
+	return okay;
+}
+
+static void
+pkcs11_session_release(pkcs11_key_t *key, CK_SESSION_HANDLE session)
+{
+	pthread_mutex_lock(&key->lock);
+	key->idle[key->num_idle++] = session;
+	pthread_cond_signal(&key->idle_cond);
+	pthread_mutex_unlock(&key->lock);
+}
+
+/*
+ * Create a raw signature. For RSA keys, the caller passes a DER encoded
+ * DigestInfo, which is signed using CKM_RSA_PKCS. For ECC keys, the caller
+ * passes the digest, and the token returns R and S, concatenated.
+ * Doing the hashing on our side means we only need mechanisms that every
+ * token supports. This is safe to call from several threads at once.
+ */
+int
+pkcs11_key_sign(pkcs11_key_t *key, const void *data, size_t len, void *sig_data, size_t sig_size)
+{
+	CK_MECHANISM mech = { key->key_type == CKK_EC? CKM_ECDSA : CKM_RSA_PKCS, NULL, 0 };
+	CK_SESSION_HANDLE session;
+	CK_ULONG sig_len = sig_size;
+	CK_RV rv;
+
+	if (!pkcs11_session_acquire(key, &session))
+		return 0;
+
+	rv = key->p11->C_SignInit(session, &mech, key->handle);
+	if (rv == CKR_OK)
+		rv = key->p11->C_Sign(session, (CK_BYTE_PTR) data, len, sig_data, &sig_len);
+
+	pkcs11_session_release(key, session);
+
+	if (rv != CKR_OK) {
+		error("%s: PKCS#11 signing failed: %s\n", key->name, pkcs11_strerror(rv));
+		return 0;
+	}
+
+	return sig_len;
+}
+
+#else /* HAVE_P11_KIT_1 */
+
+struct pkcs11_key {
+	TPM2B_PUBLIC		public;
+};
+
+pkcs11_key_t *
+pkcs11_key_open(const char *uri)
+{
+	error("%s: pcr-oracle was built without PKCS#11 support\n", uri);
+	return NULL;
+}
+
+void
+pkcs11_key_close(pkcs11_key_t *key)
+{
+	free(key);
+}
+
+const char *
+pkcs11_key_name(const pkcs11_key_t *key)
+{
+	return NULL;
+}
+
+const TPM2B_PUBLIC *
+pkcs11_key_public(const pkcs11_key_t *key)
+{
+	return &key->public;
+}
+
+unsigned int
+pkcs11_key_max_sessions(const pkcs11_key_t *key)
+{
+	return 1;
+}
+
+int
+pkcs11_key_sign(pkcs11_key_t *key, const void *data, size_t len, void *sig_data, size_t sig_size)
+{
+	return 0;
+}
+
+#endif /* HAVE_P11_KIT_1 */
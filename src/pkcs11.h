@@ -0,0 +1,48 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef PKCS11_KEY_H
+#define PKCS11_KEY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <tss2_tpm2_types.h>
+
+/*
+ * A private key that lives on a PKCS#11 token (such as an HSM, or SoftHSM
+ * for testing), identified by a PKCS#11 URI (RFC 7512). The token is
+ * accessed through a pool of sessions that all share one login, so that
+ * several signatures can be created concurrently.
+ */
+typedef struct pkcs11_key	pkcs11_key_t;
+
+#define PKCS11_URI_PREFIX	"pkcs11:"
+#define PKCS11_DEFAULT_SESSIONS	4
+
+extern bool			pkcs11_set_max_sessions(const char *count);
+extern bool			pkcs11_is_uri(const char *string);
+extern pkcs11_key_t *		pkcs11_key_open(const char *uri);
+extern void			pkcs11_key_close(pkcs11_key_t *);
+extern const char *		pkcs11_key_name(const pkcs11_key_t *);
+extern const TPM2B_PUBLIC *	pkcs11_key_public(const pkcs11_key_t *);
+extern unsigned int		pkcs11_key_max_sessions(const pkcs11_key_t *);
+extern int			pkcs11_key_sign(pkcs11_key_t *,
+					const void *data, size_t len,
+					void *sig_data, size_t sig_size);
+
+#endif /* PKCS11_KEY_H */
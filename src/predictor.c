@@ -0,0 +1,1583 @@
+/*
+ *   Copyright (C) 2022, 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Written by Olaf Kirch <okir@suse.com>
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+
+#include "predictor.h"
+#include "util.h"
+#include "eventlog.h"
+#include "bufparser.h"
+#include "runtime.h"
+#include "digest.h"
+#include "sd-boot.h"
+#include "compdb.h"
+#include "rehash-state.h"
+
+enum {
+	STOP_EVENT_NONE,
+	STOP_EVENT_GRUB_COMMAND,
+	STOP_EVENT_GRUB_FILE,
+};
+
+struct stop_event {
+	int			type;
+	bool			after;
+	char *			value;
+	char *			label;
+
+	/* Filled in while processing the event log */
+	tpm_event_t *		event;
+	bool			reached;
+	tpm_pcr_bank_t		snapshot;
+};
+
+/*
+ * When predicting for all boot entries, we record the state right before
+ * the first event that depends on the boot entry. This covers the PCR bank
+ * and the complete rehash context, except for the boot entry itself.
+ */
+struct predictor_checkpoint {
+	tpm_event_t *		event;
+	tpm_pcr_bank_t		bank;
+	tpm_event_log_rehash_ctx_t rehash_ctx;
+};
+
+struct boot_entry_prediction {
+	uapi_boot_entry_t *	entry;
+	tpm_pcr_bank_t		bank;
+};
+
+struct predictor {
+	uint32_t		pcr_mask;
+	const char *		initial_source;
+
+	const char *		tpm_event_log_path;
+	const char *		boot_entry_id;
+
+	const char *		algo;
+	const tpm_algo_info_t *	algo_info;
+
+	tpm_event_t *		event_log;
+	bool			keep_events;
+
+	/* While we're still reading the event log */
+	tpm_event_log_reader_t *event_log_reader;
+	tpm_event_t **		event_log_tail;
+	tpm_event_log_scan_ctx_t scan_ctx;
+	bool			scan_events;
+
+	unsigned int		num_stop_events;
+	struct stop_event	stop_events[PREDICTOR_STOP_EVENTS_MAX];
+
+	/* Set when using --boot-entry all */
+	unsigned int		num_boot_entry_predictions;
+	struct boot_entry_prediction *boot_entry_predictions;
+
+	void			(*report_fn)(struct predictor *, tpm_pcr_bank_t *, unsigned int);
+
+	tpm_pcr_bank_t		prediction;
+};
+
+#define GRUB_PCR_SNAPSHOT_PATH	"/sys/firmware/efi/efivars/GrubPcrSnapshot-7ce323f2-b841-4d30-a0e9-5474a76c9a3f"
+
+/* Known-good component digests, from --component-db */
+static compdb_t *component_db = NULL;
+
+/* Event digests from a previous run, from --state-file */
+static rehash_state_t *rehash_state = NULL;
+
+/* Returns the previous database, if any */
+compdb_t *
+predictor_set_component_db(compdb_t *db)
+{
+	compdb_t *prev = component_db;
+
+	component_db = db;
+	return prev;
+}
+
+void
+predictor_set_rehash_state(rehash_state_t *state)
+{
+	rehash_state = state;
+}
+
+static void	predictor_report_plain(struct predictor *pred, tpm_pcr_bank_t *bank, unsigned int pcr_index);
+static void	predictor_report_tpm2_tools(struct predictor *pred, tpm_pcr_bank_t *bank, unsigned int pcr_index);
+static void	predictor_report_binary(struct predictor *pred, tpm_pcr_bank_t *bank, unsigned int pcr_index);
+
+static void
+pcr_bank_load_initial_values(tpm_pcr_bank_t *bank, unsigned int pcr_mask, const tpm_algo_info_t *algo_info, const char *source)
+{
+	pcr_bank_initialize(bank, pcr_mask, algo_info);
+	if (!strcmp(source, "zero")
+	 || !strcmp(source, "eventlog"))
+		pcr_bank_init_from_zero(bank);
+	else if (!strcmp(source, "current"))
+		pcr_bank_init_from_current(bank);
+	else if (!strcmp(source, "snapshot"))
+		pcr_bank_init_from_snapshot(bank, GRUB_PCR_SNAPSHOT_PATH);
+	else
+		fatal("don't know how to load PCR bank with initial values: unsupported source \"%s\"\n", source);
+}
+
+static inline tpm_evdigest_t *
+predictor_get_pcr_state(struct predictor *pred, unsigned int index, const char *algo)
+{
+	return pcr_bank_get_register(&pred->prediction, index, algo);
+}
+
+/*
+ * The event log is not read up front. Instead, we read and pre-scan events
+ * as the predictor works its way through the log (see predictor_next_event),
+ * so that we never read or parse anything past the last stop event.
+ */
+static void
+predictor_open_eventlog(struct predictor *pred)
+{
+	pred->event_log_reader = event_log_open(pred->tpm_event_log_path);
+	if (pred->event_log_reader == NULL)
+		fatal("Failed to open TPM event log, giving up.\n");
+
+	pred->event_log_tail = &pred->event_log;
+
+	tpm_event_log_scan_ctx_init(&pred->scan_ctx);
+	pred->scan_ctx.compdb = component_db;
+}
+
+static void
+predictor_close_eventlog(struct predictor *pred)
+{
+	tpm_event_log_reader_t *log;
+
+	if ((log = pred->event_log_reader) == NULL)
+		return;
+
+	debug("Read %u events from TPM event log\n", event_log_get_event_count(log));
+	event_log_close(log);
+	pred->event_log_reader = NULL;
+}
+
+struct predictor *
+predictor_new(const tpm_pcr_selection_t *pcr_selection, const char *source,
+		const char *tpm_eventlog_path,
+		const char *output_format,
+		const char *boot_entry_id)
+{
+	struct predictor *pred;
+
+	if (source == NULL)
+		source = "zero";
+
+	pred = calloc(1, sizeof(*pred));
+	pred->pcr_mask = pcr_selection->pcr_mask;
+	pred->initial_source = source;
+	pred->boot_entry_id = boot_entry_id;
+
+	pred->algo = pcr_selection->algo_info->openssl_name;
+	pred->algo_info = pcr_selection->algo_info;
+
+	if (!output_format || !strcasecmp(output_format, "plain"))
+		pred->report_fn = predictor_report_plain;
+	else
+	if (!strcasecmp(output_format, "tpm2-tools"))
+		pred->report_fn = predictor_report_tpm2_tools;
+	else
+	if (!strcasecmp(output_format, "binary"))
+		pred->report_fn = predictor_report_binary;
+	else
+		fatal("Unsupported output format \"%s\"\n", output_format);
+
+	debug("Initializing predictor for %s:%s from %s\n", pred->algo, print_pcr_mask(pred->pcr_mask), source);
+	pcr_bank_load_initial_values(&pred->prediction,
+			pcr_selection->pcr_mask,
+			pcr_selection->algo_info,
+			source);
+
+	if (!strcmp(source, "eventlog")) {
+		pred->tpm_event_log_path = tpm_eventlog_path;
+		predictor_open_eventlog(pred);
+	}
+
+	debug("Created new predictor\n");
+	return pred;
+}
+
+void
+predictor_free(struct predictor *pred)
+{
+	tpm_event_t *ev;
+	unsigned int i;
+
+	predictor_close_eventlog(pred);
+	tpm_event_log_scan_ctx_destroy(&pred->scan_ctx);
+
+	while ((ev = pred->event_log) != NULL) {
+		pred->event_log = ev->next;
+		tpm_event_free(ev);
+	}
+
+	for (i = 0; i < pred->num_stop_events; ++i) {
+		free(pred->stop_events[i].value);
+		free(pred->stop_events[i].label);
+	}
+
+	for (i = 0; i < pred->num_boot_entry_predictions; ++i)
+		uapi_boot_entry_free(pred->boot_entry_predictions[i].entry);
+	free(pred->boot_entry_predictions);
+
+	free(pred);
+}
+
+static bool
+__stop_event_parse(char *event_spec, char **name_p, char **value_p)
+{
+	char *s;
+
+	if (!(s = strchr(event_spec, '='))) {
+		*name_p = event_spec;
+		*value_p = NULL;
+		return true;
+	}
+
+	*s++ = '\0';
+	if (*event_spec == '\0')
+		return false;
+
+	*name_p = event_spec;
+	*value_p = s;
+	return true;
+}
+
+/*
+ * Add a stop event. The event description may be prefixed with "before:"
+ * or "after:", overriding the default given by --before/--after.
+ */
+void
+predictor_add_stop_event(struct predictor *pred, const char *event_desc, bool after)
+{
+	struct stop_event *stop;
+	char *copy, *name, *value;
+
+	if (pred->num_stop_events >= PREDICTOR_STOP_EVENTS_MAX)
+		fatal("Too many stop events (max %u)\n", PREDICTOR_STOP_EVENTS_MAX);
+	stop = &pred->stop_events[pred->num_stop_events];
+
+	stop->label = strdup(event_desc);
+	if (!strncmp(event_desc, "before:", 7)) {
+		event_desc += 7;
+		after = false;
+	} else
+	if (!strncmp(event_desc, "after:", 6)) {
+		event_desc += 6;
+		after = true;
+	}
+
+	copy = strdup(event_desc);
+	if (!__stop_event_parse(copy, &name, &value))
+		fatal("Cannot parse stop event \"%s\"\n", event_desc);
+
+	if (!strcmp(name, "grub-command")) {
+		stop->type = STOP_EVENT_GRUB_COMMAND;
+	} else
+	if (!strcmp(name, "grub-file")) {
+		stop->type = STOP_EVENT_GRUB_FILE;
+	} else {
+		fatal("Unsupported event type \"%s\" in stop event \"%s\"\n", name, event_desc);
+	}
+
+	if (value == NULL)
+		fatal("Missing argument in stop event \"%s\"\n", event_desc);
+
+	stop->value = strdup(value);
+	stop->after = after;
+	pred->num_stop_events += 1;
+	free(copy);
+}
+
+static void
+predictor_extend_hash(struct predictor *pred, unsigned int pcr_index, const tpm_evdigest_t *d)
+{
+	tpm_pcr_bank_t *bank = &pred->prediction;
+	tpm_evdigest_t *pcr;
+
+	debug("Extend PCR#%d: %s\n", pcr_index, digest_print(d));
+	if (!pcr_bank_register_is_valid(bank, pcr_index)) {
+		error("Unable to extend PCR %s:%u: register was not initialized\n",
+				bank->algo_name, pcr_index);
+		return;
+	}
+
+	pcr = &bank->pcr[pcr_index];
+	if (pcr->algo != d->algo)
+		fatal("Cannot update PCR %u: algorithm mismatch\n", pcr_index);
+
+	if (!digest_extend(pcr, d))
+		fatal("Unable to extend PCR %u\n", pcr_index);
+}
+
+/*
+ * Of all the stop events located during the pre-scan, return the one at
+ * which we stop processing the event log altogether.
+ */
+static const struct stop_event *
+predictor_last_stop_event(const struct predictor *pred)
+{
+	const struct stop_event *stop, *last = NULL;
+	unsigned int i;
+
+	for (i = 0; i < pred->num_stop_events; ++i) {
+		stop = &pred->stop_events[i];
+
+		/* If we never found one of the stop events, we process the
+		 * entire log */
+		if (stop->event == NULL)
+			return NULL;
+
+		if (last == NULL
+		 || stop->event->event_index > last->event->event_index
+		 || (stop->event == last->event && stop->after))
+			last = stop;
+	}
+
+	return last;
+}
+
+static void
+predictor_take_snapshots(struct predictor *pred, const tpm_event_t *ev, bool after)
+{
+	unsigned int i;
+
+	for (i = 0; i < pred->num_stop_events; ++i) {
+		struct stop_event *stop = &pred->stop_events[i];
+
+		if (stop->reached)
+			continue;
+
+		if (ev == NULL || (stop->event == ev && stop->after == after)) {
+			debug("Taking PCR snapshot %s %s event\n", stop->label,
+					ev == NULL? "at end of" : (after? "after" : "before"));
+			stop->snapshot = pred->prediction;
+			stop->reached = true;
+		}
+	}
+}
+
+static const tpm_evdigest_t *
+predictor_compute_digest(struct predictor *pred, const void *data, unsigned int size)
+{
+	return digest_compute(pred->algo_info, data, size);
+}
+
+static const tpm_evdigest_t *
+predictor_compute_file_digest(struct predictor *pred, const char *filename, int flags)
+{
+	const tpm_evdigest_t *md;
+	buffer_t *buffer;
+
+	buffer = runtime_read_file(filename, flags);
+
+	md = predictor_compute_digest(pred,
+			buffer_read_pointer(buffer),
+			buffer_available(buffer));
+	buffer_free(buffer);
+
+	return md;
+}
+
+static void
+predictor_update_string(struct predictor *pred, unsigned int pcr_index, const char *value)
+{
+	const tpm_evdigest_t *md;
+
+	debug("Extending PCR %u with string \"%s\"\n", pcr_index, value);
+	md = predictor_compute_digest(pred, value, strlen(value));
+	predictor_extend_hash(pred, pcr_index, md);
+}
+
+static void
+predictor_update_file(struct predictor *pred, unsigned int pcr_index, const char *filename)
+{
+	const tpm_evdigest_t *md;
+
+	md = predictor_compute_file_digest(pred, filename, 0);
+	predictor_extend_hash(pred, pcr_index, md);
+}
+
+static bool
+__check_stop_event(tpm_event_t *ev, int type, const char *value, tpm_event_log_scan_ctx_t *ctx)
+{
+	const char *grub_arg = NULL;
+	const char *grub_cmd = NULL;
+	tpm_parsed_event_t *parsed;
+
+	switch (type) {
+	case STOP_EVENT_NONE:
+		return false;
+
+	case STOP_EVENT_GRUB_COMMAND:
+		if (ev->pcr_index != 8
+		 || ev->event_type != TPM2_EVENT_IPL)
+			return false;
+
+		if (!(parsed = tpm_event_parse(ev, ctx)))
+			return false;
+
+		if (parsed->event_subtype != GRUB_EVENT_COMMAND)
+			return false;
+
+		if (!(grub_arg = parsed->grub_command.argv[0]))
+			return false;
+
+		grub_cmd = grub_arg;
+		while (grub_cmd != NULL && !isalpha(*grub_cmd))
+			grub_cmd++;
+
+		return !strcmp(grub_cmd, value);
+
+	case STOP_EVENT_GRUB_FILE:
+		if (ev->pcr_index != 9
+		 || ev->event_type != TPM2_EVENT_IPL)
+			return false;
+
+		if (!(parsed = tpm_event_parse(ev, ctx)))
+			return false;
+
+		if (parsed->event_subtype != GRUB_EVENT_FILE)
+			return false;
+
+		if (!(grub_arg = parsed->grub_file.path)) {
+			return false;
+		} else {
+			unsigned int match_len = strlen(value);
+			unsigned int path_len = strlen(grub_arg);
+
+			if (path_len > match_len
+			 && grub_arg[path_len - match_len - 1] == '/'
+			 && !strcmp(value, grub_arg + path_len - match_len)) {
+				debug("grub file path \"%s\" matched \"%s\"\n",
+						grub_arg, value);
+				return true;
+			}
+		}
+
+		return !strcmp(grub_arg, value);
+	}
+
+	return false;
+}
+
+static bool
+int_list_contains(const int *list, unsigned int value)
+{
+	while (*list != -1) {
+		if (*list++ == value)
+			return true;
+	}
+	return false;
+}
+
+static int
+predictor_get_event_strategy(unsigned int event_type)
+{
+	static int rehash_types[] = {
+		TPM2_EFI_BOOT_SERVICES_APPLICATION,
+		TPM2_EFI_BOOT_SERVICES_DRIVER,
+		TPM2_EFI_VARIABLE_BOOT,
+		TPM2_EFI_VARIABLE_AUTHORITY,
+		TPM2_EFI_VARIABLE_DRIVER_CONFIG,
+
+		/* IPL: used by grub2 for PCR 8 and PCR9 */
+		TPM2_EVENT_IPL,
+
+		/* EVENT_TAG: used by the kernel for PCR9, to measure the cmdline and initrd */
+		TPM2_EVENT_EVENT_TAG,
+
+		/*
+		 * EFI_GPT_EVENT: used in updates of PCR5, seems to be a hash of several GPT headers.
+		 *	We should probably rebuild in case someone changed the partitioning.
+		 *	However, not needed as long as we don't seal against PCR5.
+		 */
+		TPM2_EFI_GPT_EVENT,
+
+		-1,
+	};
+	static int copy_types[] = {
+		TPM2_EVENT_S_CRTM_CONTENTS,
+		TPM2_EVENT_S_CRTM_VERSION,
+		TPM2_EFI_PLATFORM_FIRMWARE_BLOB,
+		TPM2_EFI_PLATFORM_FIRMWARE_BLOB2,
+		TPM2_EVENT_SEPARATOR,
+		TPM2_EVENT_POST_CODE,
+		TPM2_EFI_HANDOFF_TABLES,
+		TPM2_EFI_HANDOFF_TABLES2,
+		TPM2_EFI_ACTION,
+		TPM2_EVENT_ACTION,
+		TPM2_EVENT_NONHOST_CODE,
+		TPM2_EVENT_NONHOST_CONFIG,
+		TPM2_EVENT_NONHOST_INFO,
+		TPM2_EVENT_PLATFORM_CONFIG_FLAGS,
+
+		-1
+	};
+
+	if (event_type == TPM2_EVENT_NO_ACTION)
+		return EVENT_STRATEGY_NO_ACTION;
+
+	if (int_list_contains(rehash_types, event_type))
+		return EVENT_STRATEGY_PARSE_REHASH;
+	if (int_list_contains(copy_types, event_type))
+		return EVENT_STRATEGY_COPY;
+
+	return EVENT_STRATEGY_PARSE_NONE;
+}
+
+/*
+ * Check whether we need to parse an event during the pre-scan. That's the case
+ * for all events on PCRs we predict. BSA events on other PCRs are parsed by
+ * the GPT and shim lookaheads, if and when they get to them.
+ */
+static bool
+predictor_wants_event(const struct predictor *pred, const tpm_event_t *ev)
+{
+	return ev->pcr_index < 32 && (pred->pcr_mask & (1 << ev->pcr_index));
+}
+
+static tpm_parsed_event_t *
+predictor_parse_event(struct predictor *pred, tpm_event_t *ev)
+{
+	tpm_parsed_event_t *parsed;
+
+	if (!(parsed = tpm_event_parse(ev, &pred->scan_ctx))) {
+		/* Provide better error logging */
+		error("Unable to parse %s event from TPM log\n", tpm_event_type_to_string(ev->event_type));
+		if (opt_debug)
+			__tpm_event_print(ev, debug);
+		fatal("Aborting.\n");
+	}
+	return parsed;
+}
+
+/*
+ * Pre-scan an event right after reading it from the log.
+ * We propagate EFI partition information from one BSA event to the next,
+ * and check whether this is one of our stop events.
+ *
+ * Events on PCRs that we do not predict are not parsed at all (unless they're
+ * needed to locate a stop event).
+ */
+static void
+predictor_scan_event(struct predictor *pred, tpm_event_t *ev)
+{
+	unsigned int i;
+
+	ev->rehash_strategy = predictor_get_event_strategy(ev->event_type);
+	/* debug("%s -> %d\n", tpm_event_type_to_string(ev->event_type), ev->rehash_strategy); */
+
+	/* Calculate the values of PCR1 and PCR3 only based on the event data */
+	if (ev->rehash_strategy == EVENT_STRATEGY_PARSE_REHASH &&
+	    (ev->pcr_index == 1 || ev->pcr_index == 3))
+		ev->rehash_strategy = EVENT_STRATEGY_COPY;
+
+	if (ev->rehash_strategy == EVENT_STRATEGY_PARSE_REHASH
+	 && predictor_wants_event(pred, ev))
+		predictor_parse_event(pred, ev);
+
+	for (i = 0; i < pred->num_stop_events; ++i) {
+		struct stop_event *stop = &pred->stop_events[i];
+
+		if (stop->event == NULL
+		 && __check_stop_event(ev, stop->type, stop->value, &pred->scan_ctx))
+			stop->event = ev;
+	}
+
+	/* Once we've located all stop events, there's no point in reading
+	 * the remainder of the log. */
+	if (predictor_last_stop_event(pred) != NULL) {
+		debug("Located all stop events, not reading the rest of the event log\n");
+		predictor_close_eventlog(pred);
+	}
+}
+
+static tpm_event_t *
+predictor_read_event(struct predictor *pred)
+{
+	tpm_event_log_reader_t *log;
+	tpm_event_t *ev;
+	unsigned int i;
+
+	if ((log = pred->event_log_reader) == NULL)
+		return NULL;
+
+	if (!(ev = event_log_read_next(log))) {
+		for (i = 0; i < pred->num_stop_events; ++i) {
+			if (pred->stop_events[i].event == NULL)
+				warning("Stop event %s not found in event log\n", pred->stop_events[i].label);
+		}
+
+		predictor_close_eventlog(pred);
+		return NULL;
+	}
+
+	/* Version info for TPMv2 and the startup locality are hidden in the
+	 * header events, which the reader has consumed by now. */
+	if (ev->event_index == 0) {
+		uint8_t pcr0_locality;
+
+		if (event_log_get_locality(log, 0, &pcr0_locality))
+			pcr_bank_set_locality(&pred->prediction, 0, pcr0_locality);
+
+		if (event_log_get_tpm_version(log) != 2) {
+			warning("Encountered TPM event log apparently generated by a TPMv%u device\n",
+					event_log_get_tpm_version(log));
+			warning("Things will most likely fail\n");
+		}
+	}
+
+	*pred->event_log_tail = ev;
+	pred->event_log_tail = &ev->next;
+
+	if (pred->scan_events)
+		predictor_scan_event(pred, ev);
+
+	return ev;
+}
+
+/*
+ * Walk the event log, reading the next event from disk when needed.
+ * Apart from the event currently processed, we only hold as many events
+ * in memory as the lookahead helpers have asked for; the replay releases
+ * the events it is done with (see predictor_release_events).
+ */
+static tpm_event_t *
+predictor_first_event(struct predictor *pred)
+{
+	if (pred->event_log == NULL)
+		return predictor_read_event(pred);
+	return pred->event_log;
+}
+
+static tpm_event_t *
+predictor_next_event(struct predictor *pred, tpm_event_t *ev)
+{
+	if (ev->next == NULL)
+		return predictor_read_event(pred);
+	return ev->next;
+}
+
+/*
+ * Check whether we still need an event the replay has moved past.
+ * Stop events are referred to until the end. The shim lookahead hands
+ * the image of a BSA event to the rehash context, which may still use
+ * it after we're past that event.
+ */
+static bool
+predictor_event_is_pinned(const struct predictor *pred, const tpm_event_t *ev,
+		const tpm_event_log_rehash_ctx_t *rehash_ctx)
+{
+	unsigned int i;
+
+	for (i = 0; i < pred->num_stop_events; ++i) {
+		if (pred->stop_events[i].event == ev)
+			return true;
+	}
+
+	return rehash_ctx->next_stage_img != NULL
+	    && ev->event_type == TPM2_EFI_BOOT_SERVICES_APPLICATION
+	    && ev->__parsed != NULL
+	    && ev->__parsed->efi_bsa_event.img_info == rehash_ctx->next_stage_img;
+}
+
+/*
+ * Free all events before the current one, except those still pinned.
+ */
+static void
+predictor_release_events(struct predictor *pred, const tpm_event_t *current,
+		const tpm_event_log_rehash_ctx_t *rehash_ctx)
+{
+	tpm_event_t **pos = &pred->event_log, *ev;
+
+	while ((ev = *pos) != NULL && ev != current) {
+		if (predictor_event_is_pinned(pred, ev, rehash_ctx)) {
+			pos = &ev->next;
+			continue;
+		}
+
+		*pos = ev->next;
+		tpm_event_free(ev);
+	}
+}
+
+/*
+ * The caller wants to look at the predicted events after the replay,
+ * as predictor_compare() does. Keep them all in memory.
+ */
+void
+predictor_keep_events(struct predictor *pred)
+{
+	pred->keep_events = true;
+}
+
+/*
+ * Start pre-scanning events. This also catches up on any events read so far.
+ */
+static void
+predictor_start_scan(struct predictor *pred)
+{
+	tpm_event_t *ev;
+	unsigned int i;
+
+	for (i = 0; i < pred->num_stop_events; ++i)
+		pred->stop_events[i].reached = false;
+
+	if (pred->scan_events)
+		return;
+
+	pred->scan_events = true;
+	for (ev = pred->event_log; ev; ev = ev->next)
+		predictor_scan_event(pred, ev);
+}
+
+/*
+ * Scan ahead to a future event that will help us understand the current one.
+ *
+ * Unless we predict PCR 4, BSA events are not parsed during the pre-scan;
+ * the lookaheads parse the ones they need. A BSA event may inherit its EFI
+ * partition from the previous one, so this must happen in log order. The
+ * lookaheads only ever move forward, so that is a given.
+ */
+
+/*
+ * Lookahead: when processing the GPT event, we need to know which hard disk
+ * we're talking about.
+ */
+static void
+__predictor_lookahead_efi_partition(struct predictor *pred, tpm_event_t *ev, tpm_event_log_rehash_ctx_t *ctx)
+{
+	struct efi_gpt_event *gpt = &ev->__parsed->efi_gpt_event;
+
+	while ((ev = predictor_next_event(pred, ev)) != NULL) {
+		tpm_parsed_event_t *parsed;
+
+		if (ev->event_type != TPM2_EFI_BOOT_SERVICES_APPLICATION)
+			continue;
+
+		parsed = predictor_parse_event(pred, ev);
+		assign_string(&gpt->efi_partition, parsed->efi_bsa_event.efi_partition);
+		return;
+	}
+}
+
+/*
+ * Lookahead: when processing the BSA event that loads the shim loader, scan ahead
+ * to the next BSA event (which is probably grub getting loaded).
+ * We need this in order to process the "Shim" pseudo variable event that the
+ * shim loader produces when verifying the authenticode signature.
+ */
+static void
+__predictor_lookahead_shim_loaded(struct predictor *pred, tpm_event_t *ev, tpm_event_log_rehash_ctx_t *ctx)
+{
+	tpm_parsed_event_t *parsed;
+	const char *application;
+
+	/* The next BSA event may take its partition from this one */
+	predictor_parse_event(pred, ev);
+
+	while ((ev = predictor_next_event(pred, ev)) != NULL) {
+		if (ev->event_type != TPM2_EFI_BOOT_SERVICES_APPLICATION)
+			continue;
+
+		parsed = predictor_parse_event(pred, ev);
+
+		if (!(application = parsed->efi_bsa_event.efi_application))
+			continue;
+
+		/* Known-good components are not read from disk at all */
+		if (ctx->compdb && compdb_contains(ctx->compdb, application)) {
+			debug("Not inspecting %s; found in component database\n", application);
+			ctx->next_stage_img = NULL;
+			return;
+		}
+
+		/* This is where the image actually gets loaded */
+		if (!efi_application_get_image_info(parsed))
+			continue;
+
+		debug("Inspecting EFI application %s(%s)\n",
+				parsed->efi_bsa_event.efi_partition,
+				application);
+		ctx->next_stage_img = efi_application_get_image_info(parsed);
+
+#ifdef TESTING_ONLY
+		if (ctx->next_stage_img) {
+			parsed_cert_t *signer;
+			buffer_t *record;
+
+			signer = efi_application_extract_signer(parsed);
+			if (signer != NULL) {
+				debug("Application was signed by %s\n", parsed_cert_subject(signer));
+				record = efi_application_locate_authority_record("shim-vendor-cert", signer);
+				buffer_free(record);
+			}
+		}
+#endif
+
+		return;
+	}
+}
+
+/*
+ * Re-hash a single event, unless none of its inputs changed since the
+ * state file was written.
+ */
+static const tpm_evdigest_t *
+predictor_rehash_event(tpm_event_t *ev, tpm_parsed_event_t *parsed, tpm_event_log_rehash_ctx_t *rehash_ctx)
+{
+	const tpm_evdigest_t *new_digest;
+
+	if (rehash_state == NULL)
+		return tpm_parsed_event_rehash(ev, parsed, rehash_ctx);
+
+	if ((new_digest = rehash_state_lookup(rehash_state, ev, rehash_ctx)) != NULL)
+		return new_digest;
+
+	rehash_state_begin(rehash_state);
+	new_digest = tpm_parsed_event_rehash(ev, parsed, rehash_ctx);
+	rehash_state_end(rehash_state, ev, rehash_ctx, new_digest);
+
+	return new_digest;
+}
+
+/*
+ * Select the boot entry to predict for. Besides the boot entry itself,
+ * grub measures the file it was loaded from.
+ */
+static void
+predictor_set_boot_entry(tpm_event_log_rehash_ctx_t *rehash_ctx, uapi_boot_entry_t *entry)
+{
+	char path[PATH_MAX];
+
+	if (snprintf(path, sizeof(path), "%s/%s.conf", UAPI_BOOT_DIRECTORY, entry->id) >= (int) sizeof(path))
+		fatal("Boot entry path too long for %s\n", entry->id);
+
+	assign_string(&rehash_ctx->boot_entry_path, path);
+	rehash_ctx->boot_entry = entry;
+}
+
+/*
+ * Record the state right before the given event. The rehash context is the
+ * one from before the event was rehashed. The boot entry is not part of the
+ * checkpoint, as it is what changes between replays.
+ */
+static void
+predictor_checkpoint_save(struct predictor *pred, struct predictor_checkpoint *checkpoint,
+		tpm_event_t *ev, const tpm_event_log_rehash_ctx_t *rehash_ctx)
+{
+	checkpoint->event = ev;
+	checkpoint->bank = pred->prediction;
+	checkpoint->rehash_ctx = *rehash_ctx;
+	checkpoint->rehash_ctx.boot_entry_path = NULL;
+	checkpoint->rehash_ctx.boot_entry = NULL;
+}
+
+static void
+predictor_checkpoint_restore(struct predictor *pred, const struct predictor_checkpoint *checkpoint,
+		tpm_event_log_rehash_ctx_t *rehash_ctx)
+{
+	char *boot_entry_path = rehash_ctx->boot_entry_path;
+	uapi_boot_entry_t *boot_entry = rehash_ctx->boot_entry;
+
+	pred->prediction = checkpoint->bank;
+	*rehash_ctx = checkpoint->rehash_ctx;
+	rehash_ctx->boot_entry_path = boot_entry_path;
+	rehash_ctx->boot_entry = boot_entry;
+}
+
+/*
+ * Replay the event log, starting at the given event.
+ *
+ * If a checkpoint is given, we record the PCR state right before the first
+ * event whose digest depends on the boot entry. Replaying the log for a
+ * different boot entry can then pick up from there.
+ */
+static bool
+predictor_replay_eventlog(struct predictor *pred, tpm_event_t *ev,
+		tpm_event_log_rehash_ctx_t *rehash_ctx,
+		struct predictor_checkpoint *checkpoint)
+{
+	tpm_event_log_rehash_ctx_t saved_ctx;
+	bool okay = true;
+
+	for (; ev; ev = predictor_next_event(pred, ev)) {
+		const struct stop_event *last_stop;
+		tpm_evdigest_t *pcr;
+		bool stop = false;
+
+		/* When predicting for all boot entries, the replays for the other
+		 * entries start from the checkpoint, so keep everything from there. */
+		if (!pred->keep_events && (checkpoint == NULL || checkpoint->event == NULL))
+			predictor_release_events(pred, ev, rehash_ctx);
+
+		predictor_take_snapshots(pred, ev, false);
+
+		/* Events are pre-scanned when read, so by the time we get here,
+		 * we know whether this is the last stop event. */
+		last_stop = predictor_last_stop_event(pred);
+		stop = (last_stop && ev == last_stop->event);
+		if (stop && !last_stop->after) {
+			debug("Stopped processing event log before indicated event\n");
+			break;
+		}
+
+		/* The shim loader emits an event that tells us which certificate it
+		 * used to verify the second stage loader. We try to predict that
+		 * by checking the second stage loader's authenticode sig.
+		 * This is needed for PCR 7, whether or not we predict PCR 4.
+		 */
+		if (ev->event_type == TPM2_EFI_BOOT_SERVICES_APPLICATION
+		 && (pred->pcr_mask & (1 << 7)))
+			__predictor_lookahead_shim_loaded(pred, ev, rehash_ctx);
+
+		pcr = predictor_get_pcr_state(pred, ev->pcr_index, NULL);
+		if (pcr != NULL) {
+			tpm_parsed_event_t *parsed;
+			const tpm_evdigest_t *old_digest, *new_digest;
+			const char *description = NULL;
+
+			debug("\n");
+			__tpm_event_print(ev, debug);
+
+			if (!(old_digest = tpm_event_get_digest(ev, pred->algo_info)))
+				fatal("Event log lacks a hash for digest algorithm %s\n", pred->algo);
+
+			if (false) {
+				const tpm_evdigest_t *tmp_digest;
+
+				tmp_digest = digest_compute(pred->algo_info, ev->event_data, ev->event_size);
+				if (!tmp_digest) {
+					debug("cannot compute digest for event data\n");
+				} else if (!digest_equal(old_digest, tmp_digest)) {
+					debug("firmware did more than just hash the event data\n");
+					debug("  Old digest: %s\n", digest_print(old_digest));
+					debug("  New digest: %s\n", digest_print(tmp_digest));
+				}
+			}
+
+			/* By the time we encounter the GPT event, we usually haven't seen any
+			 * BOOT_SERVICES event that would tell us which partition we're booting
+			 * from.
+			 * Scan ahead to the first BSA event to extract the EFI partition.
+			 */
+			if (ev->event_type == TPM2_EFI_GPT_EVENT)
+				__predictor_lookahead_efi_partition(pred, ev, rehash_ctx);
+
+			switch (ev->rehash_strategy) {
+			case EVENT_STRATEGY_PARSE_REHASH:
+				/* Event already parsed in pre-scan */
+				parsed = ev->__parsed;
+
+				rehash_ctx->boot_entry_used = false;
+				rehash_ctx->next_stage_img_used = false;
+				if (checkpoint && checkpoint->event == NULL)
+					saved_ctx = *rehash_ctx;
+
+				new_digest = predictor_rehash_event(ev, parsed, rehash_ctx);
+				description = tpm_parsed_event_describe(parsed);
+
+				if (checkpoint && checkpoint->event == NULL && rehash_ctx->boot_entry_used) {
+					debug("Event %u depends on the boot entry, creating checkpoint\n",
+							ev->event_index);
+					predictor_checkpoint_save(pred, checkpoint, ev, &saved_ctx);
+				}
+				break;
+
+			case EVENT_STRATEGY_COPY:
+				new_digest = old_digest;
+				break;
+
+			case EVENT_STRATEGY_NO_ACTION:
+				goto no_action;
+
+			default:
+				debug("Encountered unexpected event type %s\n",
+						tpm_event_type_to_string(ev->event_type));
+				new_digest = old_digest;
+			}
+
+			if (new_digest == NULL) {
+				error("Failed to re-hash event %u type %s\n",
+						ev->event_index,
+						tpm_event_type_to_string(ev->event_type));
+				new_digest = old_digest;
+				okay = false;
+			}
+
+			if (opt_debug && new_digest != old_digest) {
+				if (new_digest->size == old_digest->size
+				 && !memcmp(new_digest->data, old_digest->data, old_digest->size)) {
+					debug("Digest for %s did not change\n", description);
+				} else {
+					debug("Digest for %s changed\n", description);
+					debug("  Old digest: %s\n", digest_print(old_digest));
+					debug("  New digest: %s\n", digest_print(new_digest));
+				}
+			}
+
+			predictor_extend_hash(pred, ev->pcr_index, new_digest);
+
+			memcpy(&ev->predicted_digest, new_digest, sizeof(tpm_evdigest_t));
+		}
+
+no_action:
+		predictor_take_snapshots(pred, ev, true);
+
+		if (stop) {
+			debug("Stopped processing event log after indicated event\n");
+			break;
+		}
+	}
+
+	return okay;
+}
+
+/*
+ * Predict the PCR values for every boot entry installed.
+ * The events up to the first one that depends on the boot entry are
+ * replayed only once; for all other boot entries, we restart from
+ * the checkpoint taken at that point.
+ */
+static bool
+predictor_update_eventlog_all_boot_entries(struct predictor *pred,
+		tpm_event_log_rehash_ctx_t *rehash_ctx)
+{
+	struct predictor_checkpoint checkpoint = { .event = NULL };
+	uapi_boot_entry_t **entries;
+	unsigned int i, count;
+	bool okay = true;
+
+	if (!(entries = sdb_get_boot_entries(&count)) || count == 0)
+		fatal("Unable to find any boot entries in %s\n", UAPI_BOOT_DIRECTORY);
+
+	pred->boot_entry_predictions = calloc(count, sizeof(pred->boot_entry_predictions[0]));
+	pred->num_boot_entry_predictions = count;
+
+	for (i = 0; i < count; ++i) {
+		struct boot_entry_prediction *bep = &pred->boot_entry_predictions[i];
+		tpm_event_t *start = predictor_first_event(pred);
+
+		bep->entry = entries[i];
+
+		debug("Predicting PCR values for boot entry %s\n", bep->entry->id);
+		predictor_set_boot_entry(rehash_ctx, bep->entry);
+
+		if (i != 0) {
+			/* Nothing in the event log depends on the boot entry */
+			if (checkpoint.event == NULL) {
+				bep->bank = pred->boot_entry_predictions[0].bank;
+				continue;
+			}
+
+			predictor_checkpoint_restore(pred, &checkpoint, rehash_ctx);
+			start = checkpoint.event;
+		}
+
+		if (!predictor_replay_eventlog(pred, start, rehash_ctx, &checkpoint))
+			okay = false;
+
+		bep->bank = pred->prediction;
+	}
+
+	/* The boot entries are now owned by the predictor */
+	rehash_ctx->boot_entry = NULL;
+	free(entries);
+
+	return okay;
+}
+
+static bool
+predictor_update_eventlog(struct predictor *pred)
+{
+	tpm_event_log_rehash_ctx_t rehash_ctx;
+	uapi_boot_entry_t *boot_entry;
+	bool okay = true;
+
+	predictor_start_scan(pred);
+
+	tpm_event_log_rehash_ctx_init(&rehash_ctx, pred->algo_info);
+	rehash_ctx.use_pesign = opt_use_pesign;
+	rehash_ctx.compdb = pred->scan_ctx.compdb;
+
+	if (pred->boot_entry_id != NULL && !strcasecmp(pred->boot_entry_id, "all")) {
+		okay = predictor_update_eventlog_all_boot_entries(pred, &rehash_ctx);
+		tpm_event_log_rehash_ctx_destroy(&rehash_ctx);
+		return okay;
+	}
+
+	/* The argument given to --next-kernel will be either "auto" or the
+	 * systemd ID of the next kernel entry to be booted.
+	 * FIXME: we should probably hide this behind a target_platform function.
+	 */
+	if (pred->boot_entry_id != NULL) {
+		if (!(boot_entry = sdb_identify_boot_entry(pred->boot_entry_id)))
+			fatal("unable to identify next kernel \"%s\"\n", pred->boot_entry_id);
+		predictor_set_boot_entry(&rehash_ctx, boot_entry);
+	}
+
+	okay = predictor_replay_eventlog(pred, predictor_first_event(pred), &rehash_ctx, NULL);
+
+	/* Any stop events we did not encounter get the final state */
+	predictor_take_snapshots(pred, NULL, false);
+
+	tpm_event_log_rehash_ctx_destroy(&rehash_ctx);
+	return okay;
+}
+
+static const char *
+get_next_arg(int *index_p, int argc, char **argv)
+{
+	int i = *index_p;
+
+	if (i >= argc) {
+		error("Missing argument\n");
+		return NULL;
+	}
+	*index_p += 1;
+	return argv[i];
+}
+
+bool
+predictor_update_all(struct predictor *pred, int argc, char **argv)
+{
+	int i = 0, pcr_index = -1;
+
+	if (!strcmp(pred->initial_source, "eventlog")) {
+		if (!predictor_update_eventlog(pred))
+			return false;
+	}
+
+	/* If the mask contains exactly one PCR, default pcr_index to that */
+	if (!(pred->pcr_mask & (pred->pcr_mask - 1))) {
+		unsigned int mask = pred->pcr_mask;
+
+		/* integer log2 */
+		for (pcr_index = 0; !(mask & 1); pcr_index++)
+			mask >>= 1;
+	}
+
+	while (i < argc) {
+		const char *type, *arg;
+
+		if (!(type = get_next_arg(&i, argc, argv)))
+			return false;
+		if (isdigit(*type)) {
+			if (!parse_pcr_index(type, (unsigned int *) &pcr_index))
+				fatal("unable to parse PCR index \"%s\"\n", type);
+			if (!(type = get_next_arg(&i, argc, argv)))
+				return false;
+		}
+
+		if (!strcmp(type, "eventlog")) {
+			/* do the event log dance */
+			continue;
+		}
+
+		if (!(arg = get_next_arg(&i, argc, argv)))
+			return false;
+		if (pcr_index < 0) {
+			error("Unable to infer which PCR to update for %s %s\n", type, arg);
+			return false;
+		}
+
+		if (!strcmp(type, "string")) {
+			predictor_update_string(pred, pcr_index, arg);
+		} else
+		if (!strcmp(type, "file")) {
+			predictor_update_file(pred, pcr_index, arg);
+		} else {
+			error("Unsupported keyword \"%s\" while trying to update predictor\n", type);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+unsigned int
+predictor_verify(struct predictor *pred, const char *source)
+{
+	tpm_pcr_bank_t actual;
+	unsigned int pcr_index;
+	unsigned int num_mismatches = 0;
+
+	printf("Verifying predicted state versus \"%s\"\n", source);
+	pcr_bank_load_initial_values(&actual, pred->pcr_mask, pred->algo_info, source);
+
+	/* Now compare the digests */
+	for (pcr_index = 0; pcr_index < PCR_BANK_REGISTER_MAX; ++pcr_index) {
+		tpm_evdigest_t *md_predicted, *md_actual;
+
+		md_predicted = pcr_bank_get_register(&pred->prediction, pcr_index, NULL);
+		if (md_predicted == NULL)
+			continue;
+
+		if (!pcr_bank_register_is_valid(&actual, pcr_index)) {
+			md_actual = NULL;
+		} else {
+			md_actual = pcr_bank_get_register(&actual, pcr_index, NULL);
+		}
+
+		if (md_actual == NULL) {
+			/* quietly skip any PCRs we never extended.
+			 * This happens when the PCR mask was "all" */
+			if (digest_is_zero(md_predicted))
+				continue;
+
+			debug("PCR %u not present in %s\n", pcr_index, source);
+			printf("%s:%u %s MISSING\n", pred->algo, pcr_index, digest_print_value(md_predicted));
+			num_mismatches += 1;
+			continue;
+		}
+
+		if (digest_equal(md_predicted, md_actual)) {
+			printf("%s:%u %s OK\n", pred->algo, pcr_index, digest_print_value(md_predicted));
+		} else {
+			printf("%s:%u %s MISMATCH", pred->algo, pcr_index, digest_print_value(md_predicted));
+			printf("; actual=%s\n", digest_print_value(md_actual));
+			num_mismatches += 1;
+		}
+	}
+
+	if (num_mismatches)
+		error("Found %u mismatches\n", num_mismatches);
+	return num_mismatches;
+}
+
+static bool
+compare_events(struct predictor *pred, struct predictor *pred_cmp,
+	       unsigned int pcr_index, const struct stop_event *last_stop)
+{
+	tpm_event_t *ev, *ev_cmp;
+	const tpm_evdigest_t *predicted_digest, *cmp_digest;
+
+	for (ev = predictor_first_event(pred), ev_cmp = predictor_first_event(pred_cmp); ev;
+	     ev = predictor_next_event(pred, ev), ev_cmp = ev_cmp? predictor_next_event(pred_cmp, ev_cmp) : NULL) {
+		bool stop = false;
+		stop = (last_stop && ev == last_stop->event);
+		if (stop && !last_stop->after) {
+			debug("Stopped processing event log before indicated event\n");
+			break;
+		}
+
+		if (ev->pcr_index == pcr_index) {
+			/* Advance the event in the comparison event log */
+			while(ev_cmp) {
+				if (ev_cmp->pcr_index == pcr_index)
+					break;
+				ev_cmp = predictor_next_event(pred_cmp, ev_cmp);
+			}
+
+			if (ev_cmp == NULL) {
+				tpm_event_print(ev);
+				printf("No corresponding event in the comparison event log\n");
+				printf("\n");
+				return false;
+			}
+
+			if (!(cmp_digest = tpm_event_get_digest(ev_cmp, pred->algo_info)))
+				fatal("Comparison event log lacks a hash for digest algorithm %s\n", pred->algo);
+			if (ev->predicted_digest.algo) {
+				predicted_digest = &ev->predicted_digest;
+
+				if (predicted_digest->size == cmp_digest->size
+				    && memcmp(predicted_digest->data, cmp_digest->data, cmp_digest->size)) {
+					printf("Predicted event:\n");
+					tpm_predicted_event_print(ev);
+					printf("Actual event:\n");
+					tpm_event_print(ev_cmp);
+					printf("\n");
+
+					return false;
+				}
+			}
+		}
+
+		if (stop) {
+			debug("Stopped processing event log after indicated event\n");
+			break;
+		}
+	}
+
+	return true;
+}
+
+unsigned int
+predictor_compare(struct predictor *pred, struct predictor *pred_cmp)
+{
+	const tpm_pcr_bank_t *bank = &pred->prediction;
+	unsigned int pcr_index;
+	const struct stop_event *last_stop;
+	unsigned int num_diff = 0;
+
+	last_stop = predictor_last_stop_event(pred);
+
+	for (pcr_index = 0; pcr_index < PCR_BANK_REGISTER_MAX; ++pcr_index) {
+		if (!pcr_bank_register_is_valid(bank, pcr_index))
+			continue;
+
+		if (!compare_events(pred, pred_cmp, pcr_index, last_stop))
+			num_diff++;
+	}
+
+	if (num_diff == 0)
+		printf("Predicted event log matches.\n");
+
+	return 0;
+}
+
+static void
+predictor_report_bank(struct predictor *pred, tpm_pcr_bank_t *bank)
+{
+	unsigned int pcr_index;
+
+	for (pcr_index = 0; pcr_index < PCR_BANK_REGISTER_MAX; ++pcr_index) {
+		if (pcr_bank_register_is_valid(bank, pcr_index))
+			pred->report_fn(pred, bank, pcr_index);
+	}
+}
+
+/*
+ * When given several stop events, report the PCR snapshot for each of them,
+ * preceded by the stop event's label.
+ * Likewise, when predicting for all boot entries, report the PCR values
+ * for each of them, preceded by the boot entry ID.
+ */
+void
+predictor_report(struct predictor *pred)
+{
+	unsigned int i;
+
+	if (pred->num_boot_entry_predictions) {
+		for (i = 0; i < pred->num_boot_entry_predictions; ++i) {
+			struct boot_entry_prediction *bep = &pred->boot_entry_predictions[i];
+
+			printf("# %s\n", bep->entry->id);
+			predictor_report_bank(pred, &bep->bank);
+		}
+		return;
+	}
+
+	if (pred->num_stop_events <= 1) {
+		predictor_report_bank(pred, &pred->prediction);
+		return;
+	}
+
+	for (i = 0; i < pred->num_stop_events; ++i) {
+		struct stop_event *stop = &pred->stop_events[i];
+
+		printf("# %s\n", stop->label);
+		predictor_report_bank(pred, &stop->snapshot);
+	}
+}
+
+const tpm_algo_info_t *
+predictor_get_algo(const struct predictor *pred)
+{
+	return pred->algo_info;
+}
+
+const tpm_pcr_bank_t *
+predictor_get_prediction(const struct predictor *pred)
+{
+	return &pred->prediction;
+}
+
+/*
+ * Get all predicted PCR states: one per boot entry when predicting for all
+ * boot entries, one per stop event when given several, or just the one.
+ */
+unsigned int
+predictor_get_states(struct predictor *pred, const tpm_pcr_bank_t **banks, unsigned int max)
+{
+	unsigned int i, count = 0;
+
+	if (pred->num_boot_entry_predictions) {
+		count = pred->num_boot_entry_predictions;
+		if (count <= max) {
+			for (i = 0; i < count; ++i)
+				banks[i] = &pred->boot_entry_predictions[i].bank;
+		}
+	} else
+	if (pred->num_stop_events > 1) {
+		count = pred->num_stop_events;
+		if (count <= max) {
+			for (i = 0; i < count; ++i)
+				banks[i] = &pred->stop_events[i].snapshot;
+		}
+	} else {
+		banks[count++] = &pred->prediction;
+	}
+
+	if (count > max) {
+		error("Too many predicted PCR states (%u); at most %u are supported\n", count, max);
+		return 0;
+	}
+
+	return count;
+}
+
+static void
+predictor_report_plain(struct predictor *pred, tpm_pcr_bank_t *bank, unsigned int pcr_index)
+{
+	unsigned int i;
+	tpm_evdigest_t *pcr;
+
+	if (!(pcr = pcr_bank_get_register(bank, pcr_index, NULL)))
+		return;
+
+	printf("%s:%u ", pred->algo, pcr_index);
+	for (i = 0; i < pcr->size; i++)
+		printf("%02x", pcr->data[i]);
+	printf("\n");
+}
+
+static void
+predictor_report_tpm2_tools(struct predictor *pred, tpm_pcr_bank_t *bank, unsigned int pcr_index)
+{
+	unsigned int i;
+	tpm_evdigest_t *pcr;
+
+	if (!(pcr = pcr_bank_get_register(bank, pcr_index, NULL)))
+		return;
+
+	printf("  %-2d: 0x", pcr_index);
+	for (i = 0; i < pcr->size; i++)
+		printf("%02X", pcr->data[i]);
+	printf("\n");
+}
+
+static void
+predictor_report_binary(struct predictor *pred, tpm_pcr_bank_t *bank, unsigned int pcr_index)
+{
+	tpm_evdigest_t *pcr;
+
+	if (!(pcr = pcr_bank_get_register(bank, pcr_index, NULL)))
+		return;
+	if (fwrite(pcr->data, pcr->size, 1, stdout) != 1)
+		fatal("failed to write hash to stdout");
+}
+
+/*
+ * When signing policies for all boot entries, the output file name may
+ * contain a literal "%s", the first of which gets replaced with the boot
+ * entry ID. Without it, all policies are written to the same file. This
+ * works for target platforms that can hold several policies in one file,
+ * such as systemd's JSON file, or a tpm2.0 key that is both input and output.
+ */
+static char *
+boot_entry_output_path(const char *output, const char *id)
+{
+	char path[PATH_MAX];
+	const char *s;
+
+	if (!(s = strstr(output, "%s")))
+		return strdup(output);
+
+	if (snprintf(path, sizeof(path), "%.*s%s%s", (int) (s - output), output, id, s + 2) >= (int) sizeof(path)) {
+		error("Output file name for boot entry %s is too long\n", id);
+		return NULL;
+	}
+	return strdup(path);
+}
+
+/*
+ * Policies that end up in the same file must have distinct names, or
+ * each one replaces the previous one. So when a policy name is given,
+ * we append the boot entry ID to it.
+ */
+static char *
+boot_entry_policy_name(const char *policy_name, const char *id)
+{
+	char *name;
+	size_t len;
+
+	if (policy_name == NULL)
+		return strdup(id);
+
+	len = strlen(policy_name) + strlen(id) + 2;
+	name = malloc(len);
+	snprintf(name, len, "%s-%s", policy_name, id);
+	return name;
+}
+
+static bool
+predictor_sign_all_boot_entries(struct predictor *pred, const target_platform_t *target,
+		const stored_key_t *private_key_file, const char *input, const char *output,
+		const char *policy_name, bool *unchanged_ret)
+{
+	pcr_policy_batch_t *batch;
+	unsigned int i;
+	bool okay = true;
+
+	/* Load the signing key once, and write every output file only once */
+	if (!(batch = pcr_policy_batch_new(target, private_key_file)))
+		return false;
+
+	for (i = 0; i < pred->num_boot_entry_predictions && okay; ++i) {
+		struct boot_entry_prediction *bep = &pred->boot_entry_predictions[i];
+		char *output_path, *name;
+
+		infomsg("Signing policy for boot entry %s\n", bep->entry->id);
+		if (!(output_path = boot_entry_output_path(output, bep->entry->id))) {
+			okay = false;
+			break;
+		}
+
+		name = boot_entry_policy_name(policy_name, bep->entry->id);
+		okay = pcr_policy_batch_add(batch, &bep->bank, name, output_path);
+		free(output_path);
+		free(name);
+	}
+
+	if (okay)
+		okay = pcr_policy_batch_write(batch, input);
+
+	if (okay)
+		*unchanged_ret = pcr_policy_batch_unchanged(batch);
+
+	pcr_policy_batch_free(batch);
+	return okay;
+}
+
+bool
+predictor_sign(struct predictor *pred, const target_platform_t *target,
+		const stored_key_t *private_key_file, const char *input, const char *output,
+		const char *policy_name, bool *unchanged_ret)
+{
+	if (pred->num_boot_entry_predictions)
+		return predictor_sign_all_boot_entries(pred, target, private_key_file, input, output,
+				policy_name, unchanged_ret);
+
+	return pcr_policy_sign(target, &pred->prediction, private_key_file, input, output,
+			policy_name, unchanged_ret);
+}
@@ -0,0 +1,57 @@
+/*
+ *   Copyright (C) 2022, 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Written by Olaf Kirch <okir@suse.com>
+ */
+
+#ifndef PREDICTOR_H
+#define PREDICTOR_H
+
+#include "types.h"
+#include "pcr.h"
+#include "rehash-state.h"
+
+#define PREDICTOR_STOP_EVENTS_MAX	16
+
+struct predictor;
+
+extern unsigned int		opt_use_pesign;
+
+extern compdb_t *		predictor_set_component_db(compdb_t *);
+extern void			predictor_set_rehash_state(rehash_state_t *);
+
+extern struct predictor *	predictor_new(const tpm_pcr_selection_t *pcr_selection, const char *source,
+					const char *tpm_eventlog_path,
+					const char *output_format,
+					const char *boot_entry_id);
+extern void			predictor_free(struct predictor *);
+extern void			predictor_add_stop_event(struct predictor *, const char *event_desc, bool after);
+extern void			predictor_keep_events(struct predictor *);
+extern bool			predictor_update_all(struct predictor *, int argc, char **argv);
+extern unsigned int		predictor_verify(struct predictor *, const char *source);
+extern unsigned int		predictor_compare(struct predictor *, struct predictor *pred_cmp);
+extern void			predictor_report(struct predictor *);
+extern const tpm_algo_info_t *	predictor_get_algo(const struct predictor *);
+extern const tpm_pcr_bank_t *	predictor_get_prediction(const struct predictor *);
+extern unsigned int		predictor_get_states(struct predictor *, const tpm_pcr_bank_t **banks,
+					unsigned int max);
+extern bool			predictor_sign(struct predictor *, const target_platform_t *,
+					const stored_key_t *private_key_file,
+					const char *input, const char *output,
+					const char *policy_name, bool *unchanged_ret);
+
+#endif /* PREDICTOR_H */
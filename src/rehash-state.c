@@ -0,0 +1,524 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+
+#include "rehash-state.h"
+#include "runtime.h"
+#include "uapi.h"
+#include "digest.h"
+#include "util.h"
+
+#define REHASH_STATE_NO_BOOT_ENTRY	"-"
+#define REHASH_STATE_ANY_BOOT_ENTRY	"*"
+
+struct rehash_state_key {
+	unsigned int		pcr_index;
+	unsigned int		event_type;
+	char *			logged_digest;
+	char *			data_digest;
+};
+
+struct rehash_state_entry {
+	struct rehash_state_key	key;
+	char *			boot_entry;
+	tpm_evdigest_t		predicted;
+	runtime_input_set_t	inputs;
+
+	/* Entries not used during this run are not written back */
+	bool			used;
+};
+
+struct rehash_state {
+	char *			path;
+	const tpm_algo_info_t *	algo;
+	char *			context;
+
+	unsigned int		count;
+	struct rehash_state_entry *entries;
+
+	/* Current fingerprints of all inputs we have checked so far.
+	 * Inputs that no longer exist have an empty fingerprint. */
+	runtime_input_set_t	current;
+
+	/* Inputs of the event being re-hashed */
+	runtime_input_set_t	pending;
+	runtime_input_set_t *	saved;
+
+	unsigned int		hits;
+	unsigned int		misses;
+};
+
+static void
+rehash_state_key_destroy(struct rehash_state_key *key)
+{
+	drop_string(&key->logged_digest);
+	drop_string(&key->data_digest);
+}
+
+static bool
+rehash_state_key_equal(const struct rehash_state_key *a, const struct rehash_state_key *b)
+{
+	return a->pcr_index == b->pcr_index
+	    && a->event_type == b->event_type
+	    && !strcmp(a->logged_digest, b->logged_digest)
+	    && !strcmp(a->data_digest, b->data_digest);
+}
+
+/*
+ * The key of an event is what the firmware logged: the digest it extended
+ * into the PCR, and the event data itself.
+ */
+static bool
+rehash_state_key_init(struct rehash_state_key *key, const rehash_state_t *state, const tpm_event_t *ev)
+{
+	const tpm_evdigest_t *logged;
+	tpm_evdigest_t md;
+	digest_ctx_t *ctx;
+
+	memset(key, 0, sizeof(*key));
+	if (!(logged = tpm_event_get_digest(ev, state->algo)))
+		return false;
+
+	/* Do not use digest_compute(), the caller may be holding on to
+	 * the static digest it returns. */
+	if (!(ctx = digest_ctx_new(state->algo)))
+		return false;
+	digest_ctx_update(ctx, ev->event_data, ev->event_size);
+	digest_ctx_final(ctx, &md);
+	digest_ctx_free(ctx);
+
+	key->pcr_index = ev->pcr_index;
+	key->event_type = ev->event_type;
+	key->logged_digest = strdup(digest_print_value(logged));
+	key->data_digest = strdup(digest_print_value(&md));
+	return true;
+}
+
+static void
+rehash_state_entry_destroy(struct rehash_state_entry *entry)
+{
+	rehash_state_key_destroy(&entry->key);
+	drop_string(&entry->boot_entry);
+	runtime_input_set_destroy(&entry->inputs);
+}
+
+static struct rehash_state_entry *
+rehash_state_add_entry(rehash_state_t *state)
+{
+	struct rehash_state_entry *entry;
+
+	if ((state->count % 32) == 0)
+		state->entries = realloc(state->entries, (state->count + 32) * sizeof(state->entries[0]));
+
+	entry = &state->entries[state->count++];
+	memset(entry, 0, sizeof(*entry));
+	return entry;
+}
+
+static void
+rehash_state_clear(rehash_state_t *state)
+{
+	unsigned int i;
+
+	for (i = 0; i < state->count; ++i)
+		rehash_state_entry_destroy(&state->entries[i]);
+	state->count = 0;
+}
+
+static bool
+rehash_state_boot_entry_matches(const struct rehash_state_entry *entry, const tpm_event_log_rehash_ctx_t *ctx)
+{
+	if (!strcmp(entry->boot_entry, REHASH_STATE_NO_BOOT_ENTRY))
+		return ctx->boot_entry == NULL;
+	if (ctx->boot_entry == NULL)
+		return false;
+	if (!strcmp(entry->boot_entry, REHASH_STATE_ANY_BOOT_ENTRY))
+		return true;
+	return !strcmp(entry->boot_entry, ctx->boot_entry->id);
+}
+
+static bool
+rehash_state_parse(rehash_state_t *state, FILE *fp, const char *display_name)
+{
+	struct rehash_state_entry *entry = NULL;
+	char linebuf[PATH_MAX + 512];
+	unsigned int lineno = 0;
+	bool have_algo = false, have_context = false;
+
+	while (fgets(linebuf, sizeof(linebuf), fp) != NULL) {
+		char *w[7], *s;
+		unsigned int n = 0;
+
+		lineno++;
+		if (linebuf[0] == '#')
+			continue;
+
+		if (!(w[n++] = strtok(linebuf, " \t\n")))
+			continue;
+
+		if (!strcmp(w[0], "algo")) {
+			if (!(w[1] = strtok(NULL, " \t\n")))
+				goto bad_line;
+			if (strcmp(w[1], state->algo->openssl_name)) {
+				debug("%s: state was recorded for %s, ignoring it\n", display_name, w[1]);
+				goto ignore;
+			}
+			have_algo = true;
+		} else
+		if (!strcmp(w[0], "context")) {
+			s = strtok(NULL, "\n");
+			if (strcmp(s? : "", state->context)) {
+				debug("%s: state was recorded with different options, ignoring it\n", display_name);
+				goto ignore;
+			}
+			have_context = true;
+		} else
+		if (!strcmp(w[0], "event")) {
+			const tpm_evdigest_t *md;
+
+			/* We need to know what the events were recorded for */
+			if (!have_algo || !have_context)
+				goto bad_line;
+
+			for (n = 1; n < 7 && (s = strtok(NULL, " \t\n")) != NULL; ++n)
+				w[n] = s;
+			if (n != 7)
+				goto bad_line;
+
+			if (!(md = parse_digest(w[6], state->algo->openssl_name)))
+				goto bad_line;
+
+			entry = rehash_state_add_entry(state);
+			entry->key.pcr_index = strtoul(w[1], NULL, 0);
+			entry->key.event_type = strtoul(w[2], NULL, 0);
+			entry->key.logged_digest = strdup(w[3]);
+			entry->key.data_digest = strdup(w[4]);
+			entry->boot_entry = strdup(w[5]);
+			entry->predicted = *md;
+		} else
+		if (!strcmp(w[0], "input")) {
+			int kind;
+
+			if (entry == NULL)
+				goto bad_line;
+
+			for (n = 1; n < 3 && (s = strtok(NULL, " \t\n")) != NULL; ++n)
+				w[n] = s;
+			if (n != 3 || !(w[3] = strtok(NULL, "\n")))
+				goto bad_line;
+
+			if ((kind = runtime_input_kind_by_name(w[1])) < 0)
+				goto bad_line;
+
+			runtime_input_set_add(&entry->inputs, kind, w[3], w[2]);
+		} else {
+			goto bad_line;
+		}
+	}
+
+	return true;
+
+bad_line:
+	warning("%s:%u: cannot parse state file, ignoring it\n", display_name, lineno);
+
+ignore:
+	rehash_state_clear(state);
+	return false;
+}
+
+/*
+ * Load the state file. A missing or unusable state file is not an error;
+ * we simply start from scratch and re-hash everything.
+ */
+rehash_state_t *
+rehash_state_load(const char *path, const tpm_algo_info_t *algo, const char *context)
+{
+	rehash_state_t *state;
+	FILE *fp;
+
+	state = calloc(1, sizeof(*state));
+	state->path = strdup(path);
+	state->algo = algo;
+	state->context = strdup(context);
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		if (errno != ENOENT)
+			warning("Unable to open state file %s: %m\n", path);
+		return state;
+	}
+
+	/* A state recorded for a different algorithm or with different
+	 * options is of no use to us, and is silently discarded */
+	if (rehash_state_parse(state, fp, path))
+		debug("Loaded %u events from state file %s\n", state->count, path);
+
+	fclose(fp);
+	return state;
+}
+
+void
+rehash_state_free(rehash_state_t *state)
+{
+	rehash_state_clear(state);
+	if (state->entries)
+		free(state->entries);
+
+	runtime_input_set_destroy(&state->current);
+	runtime_input_set_destroy(&state->pending);
+	drop_string(&state->path);
+	drop_string(&state->context);
+	free(state);
+}
+
+/*
+ * Check whether an input still has the fingerprint we recorded. Every input
+ * is looked at only once per run.
+ */
+static bool
+rehash_state_input_unchanged(rehash_state_t *state, const runtime_input_t *input)
+{
+	const runtime_input_t *current;
+
+	if (!(current = runtime_input_set_find(&state->current, input->kind, input->name))) {
+		char *fingerprint;
+
+		fingerprint = runtime_input_fingerprint(input->kind, input->name);
+		runtime_input_set_add(&state->current, input->kind, input->name, fingerprint? : "");
+		drop_string(&fingerprint);
+
+		current = runtime_input_set_find(&state->current, input->kind, input->name);
+	}
+
+	if (strcmp(current->fingerprint, input->fingerprint)) {
+		debug("  %s %s changed\n", runtime_input_kind_name(input->kind), input->name);
+		return false;
+	}
+	return true;
+}
+
+const tpm_evdigest_t *
+rehash_state_lookup(rehash_state_t *state, const tpm_event_t *ev, tpm_event_log_rehash_ctx_t *ctx)
+{
+	struct rehash_state_key key;
+	struct rehash_state_entry *found = NULL;
+	unsigned int i, j;
+
+	if (!rehash_state_key_init(&key, state, ev))
+		return NULL;
+
+	for (i = 0; i < state->count && !found; ++i) {
+		struct rehash_state_entry *entry = &state->entries[i];
+
+		if (!rehash_state_key_equal(&entry->key, &key)
+		 || !rehash_state_boot_entry_matches(entry, ctx))
+			continue;
+
+		for (j = 0; j < entry->inputs.count; ++j) {
+			if (!rehash_state_input_unchanged(state, &entry->inputs.inputs[j]))
+				break;
+		}
+
+		if (j == entry->inputs.count)
+			found = entry;
+	}
+
+	rehash_state_key_destroy(&key);
+
+	if (found == NULL)
+		return NULL;
+
+	debug("Inputs of event %u did not change, reusing digest from state file\n", ev->event_index);
+	if (strcmp(found->boot_entry, REHASH_STATE_NO_BOOT_ENTRY)
+	 && strcmp(found->boot_entry, REHASH_STATE_ANY_BOOT_ENTRY))
+		ctx->boot_entry_used = true;
+
+	found->used = true;
+	state->hits++;
+	return &found->predicted;
+}
+
+/*
+ * Start tracking the inputs of an event we're about to re-hash.
+ */
+void
+rehash_state_begin(rehash_state_t *state)
+{
+	runtime_input_set_destroy(&state->pending);
+	state->saved = runtime_track_inputs(&state->pending);
+}
+
+/*
+ * Stop tracking, and record the new digest along with its inputs.
+ */
+void
+rehash_state_end(rehash_state_t *state, const tpm_event_t *ev, tpm_event_log_rehash_ctx_t *ctx,
+		const tpm_evdigest_t *new_digest)
+{
+	struct rehash_state_entry *entry = NULL;
+	struct rehash_state_key key;
+	const char *boot_entry;
+	unsigned int i;
+
+	runtime_track_inputs(state->saved);
+	state->saved = NULL;
+	state->misses++;
+
+	if (new_digest == NULL)
+		goto out;
+
+	if (state->pending.opaque || ctx->next_stage_img_used) {
+		debug("Event %u depends on inputs we cannot track, not recording it\n", ev->event_index);
+		goto out;
+	}
+
+	if (ctx->boot_entry == NULL) {
+		boot_entry = REHASH_STATE_NO_BOOT_ENTRY;
+	} else
+	if (!ctx->boot_entry_used) {
+		boot_entry = REHASH_STATE_ANY_BOOT_ENTRY;
+	} else {
+		char name[PATH_MAX], *fingerprint;
+
+		/* Kernel, initrd and options all come from the boot entry */
+		boot_entry = ctx->boot_entry->id;
+		if (snprintf(name, sizeof(name), "%s/%s.conf", UAPI_BOOT_DIRECTORY_EFI, boot_entry) >= (int) sizeof(name))
+			goto out;
+		if (!(fingerprint = runtime_input_fingerprint(RUNTIME_INPUT_EFI_FILE, name)))
+			goto out;
+
+		runtime_input_set_add(&state->pending, RUNTIME_INPUT_EFI_FILE, name, fingerprint);
+		free(fingerprint);
+	}
+
+	if (!rehash_state_key_init(&key, state, ev))
+		goto out;
+
+	for (i = 0; i < state->count; ++i) {
+		if (rehash_state_key_equal(&state->entries[i].key, &key)
+		 && !strcmp(state->entries[i].boot_entry, boot_entry)) {
+			entry = &state->entries[i];
+			rehash_state_entry_destroy(entry);
+			break;
+		}
+	}
+
+	if (entry == NULL)
+		entry = rehash_state_add_entry(state);
+
+	entry->key = key;
+	entry->boot_entry = strdup(boot_entry);
+	entry->predicted = *new_digest;
+	entry->inputs = state->pending;
+	entry->used = true;
+
+	/* The entry now owns the input set */
+	memset(&state->pending, 0, sizeof(state->pending));
+
+out:
+	runtime_input_set_destroy(&state->pending);
+}
+
+/*
+ * Collect the inputs of all events in the state.
+ */
+void
+rehash_state_get_inputs(const rehash_state_t *state, runtime_input_set_t *result)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < state->count; ++i) {
+		const runtime_input_set_t *inputs = &state->entries[i].inputs;
+
+		for (j = 0; j < inputs->count; ++j)
+			runtime_input_set_add(result, inputs->inputs[j].kind,
+					inputs->inputs[j].name, inputs->inputs[j].fingerprint);
+	}
+}
+
+/*
+ * Write back all events we used during this run. The file is replaced
+ * atomically, so that a concurrent pcr-oracle never sees half a state.
+ */
+bool
+rehash_state_save(rehash_state_t *state)
+{
+	char temp_path[PATH_MAX];
+	unsigned int i, j;
+	FILE *fp;
+
+	debug("Reused %u event digests from state file, re-hashed %u\n", state->hits, state->misses);
+
+	if (snprintf(temp_path, sizeof(temp_path), "%s.tmp", state->path) >= (int) sizeof(temp_path)) {
+		error("State file name %s is too long\n", state->path);
+		return false;
+	}
+	if ((fp = fopen(temp_path, "w")) == NULL) {
+		error("Unable to create %s: %m\n", temp_path);
+		return false;
+	}
+
+	fprintf(fp, "# pcr-oracle rehash state, do not edit\n");
+	fprintf(fp, "algo %s\n", state->algo->openssl_name);
+	fprintf(fp, "context %s\n", state->context);
+
+	for (i = 0; i < state->count; ++i) {
+		const struct rehash_state_entry *entry = &state->entries[i];
+
+		if (!entry->used)
+			continue;
+
+		fprintf(fp, "event %u 0x%x %s %s %s %s\n",
+				entry->key.pcr_index,
+				entry->key.event_type,
+				entry->key.logged_digest,
+				entry->key.data_digest,
+				entry->boot_entry,
+				digest_print_value(&entry->predicted));
+
+		for (j = 0; j < entry->inputs.count; ++j) {
+			const runtime_input_t *input = &entry->inputs.inputs[j];
+
+			fprintf(fp, "input %s %s %s\n",
+					runtime_input_kind_name(input->kind),
+					input->fingerprint,
+					input->name);
+		}
+	}
+
+	if (fflush(fp) != 0 || ferror(fp)) {
+		error("Error writing %s: %m\n", temp_path);
+		fclose(fp);
+		unlink(temp_path);
+		return false;
+	}
+	fclose(fp);
+
+	if (rename(temp_path, state->path) < 0) {
+		error("Unable to rename %s to %s: %m\n", temp_path, state->path);
+		unlink(temp_path);
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,57 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef REHASH_STATE_H
+#define REHASH_STATE_H
+
+#include "eventlog.h"
+#include "runtime.h"
+
+/*
+ * Incremental re-prediction. For every event we re-hash, the state file
+ * records the inputs the new digest was computed from (EFI applications,
+ * files on the ESP or the root file system, EFI variables, the boot entry),
+ * each with a fingerprint, plus the resulting digest. On the next run, an
+ * event whose inputs all have the same fingerprint is not re-hashed; we
+ * reuse the digest from the state file instead.
+ *
+ * The file is a text file with one record per line:
+ *
+ *   algo <name>
+ *   context <string>
+ *   event <pcr> <type> <logged digest> <data digest> <boot entry> <predicted digest>
+ *   input <kind> <fingerprint> <name>
+ *
+ * where input lines belong to the event line preceding them, and the
+ * boot entry is "-" if no boot entry was selected, "*" if the event does
+ * not depend on the boot entry, or the ID of the entry otherwise.
+ */
+typedef struct rehash_state	rehash_state_t;
+
+extern rehash_state_t *		rehash_state_load(const char *path, const tpm_algo_info_t *,
+					const char *context);
+extern bool			rehash_state_save(rehash_state_t *);
+extern void			rehash_state_free(rehash_state_t *);
+extern const tpm_evdigest_t *	rehash_state_lookup(rehash_state_t *, const tpm_event_t *,
+					tpm_event_log_rehash_ctx_t *);
+extern void			rehash_state_begin(rehash_state_t *);
+extern void			rehash_state_end(rehash_state_t *, const tpm_event_t *,
+					tpm_event_log_rehash_ctx_t *, const tpm_evdigest_t *);
+extern void			rehash_state_get_inputs(const rehash_state_t *, runtime_input_set_t *);
+
+#endif /* REHASH_STATE_H */
@@ -0,0 +1,286 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <dirent.h>
+
+#include "replay-corpus.h"
+#include "predictor.h"
+#include "runtime.h"
+#include "testcase.h"
+#include "workers.h"
+#include "util.h"
+
+/*
+ * Replay a directory full of testcases.
+ *
+ * Every testcase is replayed by a forked worker process. The event log
+ * parsing and rehashing code makes liberal use of static result buffers,
+ * and bails out via fatal() when it encounters something it cannot handle.
+ * Running each replay in its own worker keeps all of this (including the
+ * playback testcase registered with the runtime layer) confined to that
+ * one testcase, while we pay for program startup only once.
+ */
+
+struct replay_job {
+	char *			name;
+	char *			path;
+
+	pid_t			pid;
+	FILE *			output;
+	double			start_time;
+	double			elapsed;
+	int			status;
+};
+
+enum {
+	REPLAY_OK = 0,
+	REPLAY_MISMATCH = 1,
+	REPLAY_FAILED = 2,
+};
+
+static int
+replay_job_compare(const void *a, const void *b)
+{
+	const struct replay_job *ja = a, *jb = b;
+
+	return strcmp(ja->name, jb->name);
+}
+
+static void
+replay_jobs_free(struct replay_job *jobs, unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; ++i) {
+		free(jobs[i].name);
+		free(jobs[i].path);
+	}
+	free(jobs);
+}
+
+static bool
+replay_corpus_scan(const char *corpus_dir, struct replay_job **jobs_ret, unsigned int *count_ret)
+{
+	struct replay_job *jobs = NULL;
+	unsigned int count = 0;
+	struct dirent *de;
+	DIR *dir;
+
+	if (!(dir = opendir(corpus_dir))) {
+		error("Unable to open testcase corpus %s: %m\n", corpus_dir);
+		return false;
+	}
+
+	while ((de = readdir(dir)) != NULL) {
+		char path[PATH_MAX], eventlog[PATH_MAX];
+		struct replay_job *job;
+
+		if (de->d_name[0] == '.')
+			continue;
+
+		if (snprintf(path, sizeof(path), "%s/%s", corpus_dir, de->d_name) >= (int) sizeof(path)
+		 || snprintf(eventlog, sizeof(eventlog), "%s/tpm_measurements", path) >= (int) sizeof(eventlog)) {
+			warning("Ignoring %s/%s: path name too long\n", corpus_dir, de->d_name);
+			continue;
+		}
+
+		/* A testcase is any directory that contains a recorded event log */
+		if (access(eventlog, R_OK) < 0) {
+			debug("Ignoring %s: not a testcase\n", path);
+			continue;
+		}
+
+		if ((count % 16) == 0) {
+			struct replay_job *tmp;
+
+			tmp = realloc(jobs, (count + 16) * sizeof(jobs[0]));
+			if (tmp == NULL) {
+				error("Out of memory while scanning %s\n", corpus_dir);
+				goto failed;
+			}
+			jobs = tmp;
+		}
+
+		job = &jobs[count++];
+		memset(job, 0, sizeof(*job));
+		job->name = strdup(de->d_name);
+		job->path = strdup(path);
+	}
+	closedir(dir);
+
+	if (count)
+		qsort(jobs, count, sizeof(jobs[0]), replay_job_compare);
+
+	*jobs_ret = jobs;
+	*count_ret = count;
+	return true;
+
+failed:
+	closedir(dir);
+	replay_jobs_free(jobs, count);
+	return false;
+}
+
+static int
+replay_corpus_run_one(const struct replay_corpus *corpus, struct replay_job *job)
+{
+	struct predictor *pred;
+	unsigned int i;
+
+	runtime_replay_testcase(testcase_alloc(job->path));
+
+	pred = predictor_new(corpus->pcr_selection, corpus->from, NULL, NULL, corpus->boot_entry_id);
+	for (i = 0; i < corpus->num_stop_events; ++i)
+		predictor_add_stop_event(pred, corpus->stop_events[i], corpus->stop_after);
+
+	if (!predictor_update_all(pred, 0, NULL))
+		return REPLAY_FAILED;
+
+	if (predictor_verify(pred, corpus->verify))
+		return REPLAY_MISMATCH;
+
+	return REPLAY_OK;
+}
+
+static const char *
+replay_job_status_string(const struct replay_job *job)
+{
+	switch (job->status) {
+	case REPLAY_OK:
+		return "OK";
+	case REPLAY_MISMATCH:
+		return "MISMATCH";
+	}
+	return "FAILED";
+}
+
+static void
+replay_job_report(const struct replay_job *job)
+{
+	char line[1024];
+
+	printf("%-40s %-8s %8.3fs\n", job->name, replay_job_status_string(job), job->elapsed);
+
+	/* Show the worker's output for anything that did not verify okay */
+	if (job->output == NULL || (job->status == REPLAY_OK && !opt_debug))
+		return;
+
+	rewind(job->output);
+	while (fgets(line, sizeof(line), job->output) != NULL)
+		printf("    %s", line);
+}
+
+static void
+replay_job_complete(void *data, int wstatus)
+{
+	struct replay_job *job = data;
+
+	job->elapsed = timing_since(job->start_time);
+	job->pid = 0;
+
+	if (WIFEXITED(wstatus) && WEXITSTATUS(wstatus) <= REPLAY_MISMATCH)
+		job->status = WEXITSTATUS(wstatus);
+	else
+		job->status = REPLAY_FAILED;
+
+	replay_job_report(job);
+
+	if (job->output) {
+		fclose(job->output);
+		job->output = NULL;
+	}
+}
+
+static bool
+replay_job_start(const struct replay_corpus *corpus, worker_pool_t *pool, struct replay_job *job)
+{
+	/* Capture everything the worker writes, so that the output of
+	 * concurrent replays does not get mixed up. */
+	if (!(job->output = tmpfile())) {
+		error("Unable to create output file for testcase %s: %m\n", job->name);
+		return false;
+	}
+
+	job->start_time = timing_begin();
+	if ((job->pid = worker_pool_fork(pool, replay_job_complete, job)) < 0) {
+		error("Unable to start worker for testcase %s\n", job->name);
+		fclose(job->output);
+		job->output = NULL;
+		return false;
+	}
+
+	if (job->pid == 0) {
+		dup2(fileno(job->output), 1);
+		dup2(fileno(job->output), 2);
+		exit(replay_corpus_run_one(corpus, job));
+	}
+
+	debug("Started worker %d for testcase %s\n", (int) job->pid, job->name);
+	return true;
+}
+
+int
+replay_corpus(const struct replay_corpus *corpus, const char *corpus_dir)
+{
+	struct replay_job *jobs = NULL;
+	unsigned int num_jobs, i;
+	unsigned int num_status[REPLAY_FAILED + 1] = { 0 };
+	worker_pool_t *pool;
+	double t0;
+
+	if (!replay_corpus_scan(corpus_dir, &jobs, &num_jobs))
+		return 1;
+
+	if (num_jobs == 0) {
+		error("No testcases found in %s\n", corpus_dir);
+		return 1;
+	}
+
+	infomsg("Replaying %u testcases from %s using up to %u workers\n",
+			num_jobs, corpus_dir, corpus->max_jobs);
+
+	t0 = timing_begin();
+	pool = worker_pool_new(corpus->max_jobs);
+	for (i = 0; i < num_jobs; ++i) {
+		struct replay_job *job = &jobs[i];
+
+		if (!replay_job_start(corpus, pool, job)) {
+			job->status = REPLAY_FAILED;
+			replay_job_report(job);
+		}
+	}
+	worker_pool_free(pool);
+
+	for (i = 0; i < num_jobs; ++i)
+		num_status[jobs[i].status] += 1;
+	replay_jobs_free(jobs, num_jobs);
+
+	printf("%u testcases: %u OK, %u MISMATCH, %u FAILED (%.3fs)\n",
+			num_jobs,
+			num_status[REPLAY_OK],
+			num_status[REPLAY_MISMATCH],
+			num_status[REPLAY_FAILED],
+			timing_since(t0));
+
+	return num_status[REPLAY_OK] == num_jobs? 0 : 1;
+}
@@ -0,0 +1,37 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef REPLAY_CORPUS_H
+#define REPLAY_CORPUS_H
+
+#include "pcr.h"
+
+struct replay_corpus {
+	const tpm_pcr_selection_t *pcr_selection;
+	const char *		from;
+	const char *		verify;
+	const char *		boot_entry_id;
+	const char **		stop_events;
+	unsigned int		num_stop_events;
+	bool			stop_after;
+	unsigned int		max_jobs;
+};
+
+extern int			replay_corpus(const struct replay_corpus *, const char *corpus_dir);
+
+#endif /* REPLAY_CORPUS_H */
@@ -24,6 +24,8 @@
 #include <sys/stat.h> /* for umask */
 
 #include <openssl/pem.h>
+#include <openssl/ec.h>
+#include <openssl/obj_mac.h>
 #include <tss2_esys.h>
 
 #if OPENSSL_VERSION_NUMBER >= 0x30000000L
@@ -33,12 +35,16 @@
 #include "util.h"
 #include "rsa.h"
 #include "digest.h"
+#include "pkcs11.h"
 
 struct tpm_rsa_key {
 	bool		is_private;
 
 	char *		path;
 	EVP_PKEY *	pkey;
+
+	/* For keys on a PKCS#11 token, pkey holds the public key only */
+	pkcs11_key_t *	token;
 };
 
 static tpm_rsa_key_t *
@@ -53,6 +59,71 @@ tpm_rsa_key_alloc(const char *path, EVP_PKEY *pkey, bool priv)
 	return key;
 }
 
+/*
+ * Besides RSA, we support ECDSA signing keys on the NIST P-256 and P-384
+ * curves. Return the TPM curve ID of an EC key, or TPM2_ECC_NONE.
+ */
+static unsigned int
+__ecc_key_curve(EVP_PKEY *pkey)
+{
+	int nid = NID_undef;
+
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+	const EC_KEY *ec;
+
+	if ((ec = EVP_PKEY_get0_EC_KEY(pkey)) != NULL)
+		nid = EC_GROUP_get_curve_name(EC_KEY_get0_group(ec));
+#else
+	char name[64];
+
+	if (EVP_PKEY_get_utf8_string_param(pkey, OSSL_PKEY_PARAM_GROUP_NAME, name, sizeof(name), NULL))
+		nid = OBJ_sn2nid(name);
+#endif
+
+	switch (nid) {
+	case NID_X9_62_prime256v1:
+		return TPM2_ECC_NIST_P256;
+	case NID_secp384r1:
+		return TPM2_ECC_NIST_P384;
+	}
+	return TPM2_ECC_NONE;
+}
+
+static unsigned int
+__ecc_curve_bytes(unsigned int curve_id)
+{
+	switch (curve_id) {
+	case TPM2_ECC_NIST_P256:
+		return 32;
+	case TPM2_ECC_NIST_P384:
+		return 48;
+	}
+	return 0;
+}
+
+static bool
+__key_type_supported(EVP_PKEY *pkey, const char *pathname)
+{
+	switch (EVP_PKEY_id(pkey)) {
+	case EVP_PKEY_RSA:
+		return true;
+
+	case EVP_PKEY_EC:
+		if (__ecc_key_curve(pkey) != TPM2_ECC_NONE)
+			return true;
+		error("%s: unsupported ECC curve (only NIST P-256 and P-384 are supported)\n", pathname);
+		return false;
+	}
+
+	error("%s: neither an RSA nor an ECC key\n", pathname);
+	return false;
+}
+
+bool
+tpm_rsa_key_is_ecc(const tpm_rsa_key_t *key)
+{
+	return EVP_PKEY_id(key->pkey) == EVP_PKEY_EC;
+}
 
 void
 tpm_rsa_key_free(tpm_rsa_key_t *key)
@@ -62,6 +133,10 @@ tpm_rsa_key_free(tpm_rsa_key_t *key)
 		EVP_PKEY_free(key->pkey);
 		key->pkey = NULL;
 	}
+	if (key->token) {
+		pkcs11_key_close(key->token);
+		key->token = NULL;
+	}
 }
 
 /*
@@ -85,10 +160,8 @@ tpm_rsa_key_read_public(const char *pathname)
 		goto fail;
 	}
 
-	if (EVP_PKEY_id(pkey) != EVP_PKEY_RSA) {
-		error("Not a RSA public key: %s\n", pathname);
+	if (!__key_type_supported(pkey, pathname))
 		goto fail;
-	}
 
 	return tpm_rsa_key_alloc(pathname, pkey, false);
 
@@ -111,6 +184,11 @@ tpm_rsa_key_write_private(const char *pathname, const tpm_rsa_key_t *key)
 
 	/* Turn off group and other rw bits to make the private key mode 600 
 	 * right from the start. */
+	if (key->token) {
+		error("Cannot write %s to %s: private key is stored on a PKCS#11 token\n", key->path, pathname);
+		return false;
+	}
+
 	omask = umask(077);
 
 	if (!(fp = fopen(pathname, "w"))) {
@@ -181,10 +259,8 @@ tpm_rsa_key_read_private(const char *pathname)
 		goto fail;
 	}
 
-	if (EVP_PKEY_id(pkey) != EVP_PKEY_RSA) {
-		error("Not a RSA private key: %s\n", pathname);
+	if (!__key_type_supported(pkey, pathname))
 		goto fail;
-	}
 
 	return tpm_rsa_key_alloc(pathname, pkey, true);
 
@@ -194,6 +270,41 @@ fail:
 	return NULL;
 }
 
+/*
+ * Use a private key on a PKCS#11 token, given by its URI. The private
+ * key never leaves the token; we only retrieve the public key.
+ */
+tpm_rsa_key_t *
+tpm_rsa_key_open_pkcs11(const char *uri)
+{
+	pkcs11_key_t *token;
+	tpm_rsa_key_t *key;
+
+	if (!(token = pkcs11_key_open(uri)))
+		return NULL;
+
+	/* The URI may contain the PIN, so don't use it in messages */
+	if (!(key = tpm_rsa_key_from_tss2(pkcs11_key_public(token), pkcs11_key_name(token)))) {
+		pkcs11_key_close(token);
+		return NULL;
+	}
+
+	key->is_private = true;
+	key->token = token;
+	return key;
+}
+
+/*
+ * How many signatures can be created with this key concurrently.
+ */
+unsigned int
+tpm_rsa_key_max_signers(const tpm_rsa_key_t *key)
+{
+	if (key->token)
+		return pkcs11_key_max_sessions(key->token);
+	return 1;
+}
+
 tpm_rsa_key_t *
 tpm_rsa_generate(unsigned int bits)
 {
@@ -229,6 +340,89 @@ failed:
 	return NULL;
 }
 
+/*
+ * Generate an ECC key. The curve is given as "p256" or "p384".
+ */
+tpm_rsa_key_t *
+tpm_ecc_generate(const char *curve_name)
+{
+	EVP_PKEY_CTX *ctx = NULL;
+	EVP_PKEY *pkey = NULL;
+	int nid;
+
+	if (!strcasecmp(curve_name, "p256"))
+		nid = NID_X9_62_prime256v1;
+	else if (!strcasecmp(curve_name, "p384"))
+		nid = NID_secp384r1;
+	else {
+		error("Unsupported ECC curve \"%s\"\n", curve_name);
+		return NULL;
+	}
+
+	if (!(ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL))
+	 || EVP_PKEY_keygen_init(ctx) <= 0
+	 || EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx, nid) <= 0
+	 || EVP_PKEY_keygen(ctx, &pkey) <= 0) {
+		error("Failed to generate ECC key on curve %s\n", curve_name);
+		EVP_PKEY_CTX_free(ctx);
+		return NULL;
+	}
+
+	EVP_PKEY_CTX_free(ctx);
+	return tpm_rsa_key_alloc("<generated>", pkey, true);
+}
+
+/*
+ * Signing with a PKCS#11 token. We do the hashing ourselves, which
+ * means we only need the raw CKM_RSA_PKCS and CKM_ECDSA mechanisms.
+ */
+static int
+__rsa_sign_pkcs11(const tpm_rsa_key_t *key,
+			const void *tbs_data, size_t tbs_len,
+			void *sig_data, size_t sig_size)
+{
+	/* DER encoded DigestInfo header for SHA256 */
+	static const unsigned char sha256_prefix[] = {
+		0x30, 0x31, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01,
+		0x65, 0x03, 0x04, 0x02, 0x01, 0x05, 0x00, 0x04, 0x20
+	};
+	unsigned char digest_info[sizeof(sha256_prefix) + 32];
+
+	memcpy(digest_info, sha256_prefix, sizeof(sha256_prefix));
+	if (!EVP_Digest(tbs_data, tbs_len, digest_info + sizeof(sha256_prefix), NULL, EVP_sha256(), NULL)) {
+		error("EVP_Digest failed\n");
+		return 0;
+	}
+
+	return pkcs11_key_sign(key->token, digest_info, sizeof(digest_info), sig_data, sig_size);
+}
+
+static bool
+__ecc_sign_pkcs11(const tpm_rsa_key_t *key, const EVP_MD *md, unsigned int nbytes,
+			const void *tbs_data, size_t tbs_len,
+			TPMS_SIGNATURE_ECC *sig)
+{
+	unsigned char digest[EVP_MAX_MD_SIZE], rs[2 * 48];
+	unsigned int digest_len;
+
+	if (!EVP_Digest(tbs_data, tbs_len, digest, &digest_len, md, NULL)) {
+		error("EVP_Digest failed\n");
+		return false;
+	}
+
+	/* The token returns R and S, concatenated */
+	if (pkcs11_key_sign(key->token, digest, digest_len, rs, sizeof(rs)) != 2 * nbytes) {
+		error("%s: unexpected ECDSA signature size\n", key->path);
+		return false;
+	}
+
+	memcpy(sig->signatureR.buffer, rs, nbytes);
+	sig->signatureR.size = nbytes;
+	memcpy(sig->signatureS.buffer, rs + nbytes, nbytes);
+	sig->signatureS.size = nbytes;
+	return true;
+}
+
 int
 tpm_rsa_sign(const tpm_rsa_key_t *key,
 			const void *tbs_data, size_t tbs_len,
@@ -241,6 +435,14 @@ tpm_rsa_sign(const tpm_rsa_key_t *key,
 		return 0;
 	}
 
+	if (EVP_PKEY_id(key->pkey) != EVP_PKEY_RSA) {
+		error("Cannot use %s for RSA signing - not an RSA key\n", key->path);
+		return 0;
+	}
+
+	if (key->token)
+		return __rsa_sign_pkcs11(key, tbs_data, tbs_len, sig_data, sig_size);
+
 	ctx = EVP_MD_CTX_new();
 
 	if (!EVP_DigestSignInit(ctx, NULL, EVP_sha256(), NULL, key->pkey)) {
@@ -260,6 +462,367 @@ tpm_rsa_sign(const tpm_rsa_key_t *key,
 	return sig_size;
 }
 
+/*
+ * Create an ECDSA signature in the format used by the TPM. Keys on P-256
+ * sign a SHA256 digest, keys on P-384 a SHA384 digest.
+ */
+bool
+tpm_ecc_sign(const tpm_rsa_key_t *key,
+			const void *tbs_data, size_t tbs_len,
+			TPMS_SIGNATURE_ECC *sig)
+{
+	unsigned int curve_id, nbytes;
+	const EVP_MD *md;
+	EVP_MD_CTX *ctx = NULL;
+	ECDSA_SIG *ecdsa = NULL;
+	unsigned char der[256];
+	const unsigned char *p;
+	const BIGNUM *r, *s;
+	size_t der_len = sizeof(der);
+	bool ok = false;
+
+	if (!key->is_private) {
+		error("Cannot use %s for signing - not a private key\n", key->path);
+		return false;
+	}
+
+	if (EVP_PKEY_id(key->pkey) != EVP_PKEY_EC
+	 || (curve_id = __ecc_key_curve(key->pkey)) == TPM2_ECC_NONE) {
+		error("Cannot use %s for ECDSA signing - not a supported ECC key\n", key->path);
+		return false;
+	}
+
+	nbytes = __ecc_curve_bytes(curve_id);
+	if (curve_id == TPM2_ECC_NIST_P384) {
+		md = EVP_sha384();
+		sig->hash = TPM2_ALG_SHA384;
+	} else {
+		md = EVP_sha256();
+		sig->hash = TPM2_ALG_SHA256;
+	}
+
+	if (key->token)
+		return __ecc_sign_pkcs11(key, md, nbytes, tbs_data, tbs_len, sig);
+
+	ctx = EVP_MD_CTX_new();
+	if (!EVP_DigestSignInit(ctx, NULL, md, NULL, key->pkey)) {
+		error("EVP_DigestSignInit failed\n");
+		goto out;
+	}
+
+	if (!EVP_DigestSign(ctx, der, &der_len,
+			(const unsigned char *) tbs_data, tbs_len)) {
+		error("EVP_DigestSign failed\n");
+		goto out;
+	}
+
+	/* openssl returns a DER encoded ECDSA-Sig-Value; the TPM wants R and S */
+	p = der;
+	if (!(ecdsa = d2i_ECDSA_SIG(NULL, &p, der_len))) {
+		error("%s: unable to decode ECDSA signature\n", key->path);
+		goto out;
+	}
+
+	ECDSA_SIG_get0(ecdsa, &r, &s);
+	if (BN_bn2binpad(r, sig->signatureR.buffer, nbytes) < 0
+	 || BN_bn2binpad(s, sig->signatureS.buffer, nbytes) < 0)
+		goto out;
+	sig->signatureR.size = nbytes;
+	sig->signatureS.size = nbytes;
+	ok = true;
+
+out:
+	if (ecdsa)
+		ECDSA_SIG_free(ecdsa);
+	EVP_MD_CTX_free(ctx);
+	return ok;
+}
+
+/*
+ * Convert an ECDSA signature from TPM format to DER, as used by openssl
+ * and most other consumers outside the TPM.
+ */
+int
+tpm_ecc_signature_to_der(const TPMS_SIGNATURE_ECC *sig, void *der_data, size_t der_size)
+{
+	ECDSA_SIG *ecdsa;
+	BIGNUM *r, *s;
+	unsigned char *p = der_data;
+	int len = 0;
+
+	r = BN_bin2bn(sig->signatureR.buffer, sig->signatureR.size, NULL);
+	s = BN_bin2bn(sig->signatureS.buffer, sig->signatureS.size, NULL);
+	ecdsa = ECDSA_SIG_new();
+	if (r == NULL || s == NULL || ecdsa == NULL || !ECDSA_SIG_set0(ecdsa, r, s)) {
+		BN_free(r);
+		BN_free(s);
+		goto out;
+	}
+
+	len = i2d_ECDSA_SIG(ecdsa, NULL);
+	if (len <= 0 || (size_t) len > der_size) {
+		error("Unable to encode ECDSA signature\n");
+		len = 0;
+		goto out;
+	}
+
+	len = i2d_ECDSA_SIG(ecdsa, &p);
+
+out:
+	if (ecdsa)
+		ECDSA_SIG_free(ecdsa);
+	return len;
+}
+
+/*
+ * Check a signature created by tpm_rsa_sign or tpm_ecc_sign. A mismatch is
+ * not an error, so this does not complain about it.
+ */
+bool
+tpm_rsa_key_verify(const tpm_rsa_key_t *key,
+			const void *tbs_data, size_t tbs_len,
+			const TPMT_SIGNATURE *sig)
+{
+	unsigned char der[256];
+	const unsigned char *sig_data;
+	size_t sig_len;
+	TPMI_ALG_HASH hash;
+	const EVP_MD *md;
+	EVP_MD_CTX *ctx;
+	bool ok;
+
+	if (sig->sigAlg == TPM2_ALG_RSASSA && EVP_PKEY_id(key->pkey) == EVP_PKEY_RSA) {
+		hash = sig->signature.rsassa.hash;
+		sig_data = sig->signature.rsassa.sig.buffer;
+		sig_len = sig->signature.rsassa.sig.size;
+	} else
+	if (sig->sigAlg == TPM2_ALG_ECDSA && EVP_PKEY_id(key->pkey) == EVP_PKEY_EC) {
+		int der_len;
+
+		hash = sig->signature.ecdsa.hash;
+		if ((der_len = tpm_ecc_signature_to_der(&sig->signature.ecdsa, der, sizeof(der))) <= 0)
+			return false;
+		sig_data = der;
+		sig_len = der_len;
+	} else {
+		debug("%s: signature algorithm 0x%x does not match key type\n", key->path, sig->sigAlg);
+		return false;
+	}
+
+	switch (hash) {
+	case TPM2_ALG_SHA256:
+		md = EVP_sha256();
+		break;
+	case TPM2_ALG_SHA384:
+		md = EVP_sha384();
+		break;
+	case TPM2_ALG_SHA512:
+		md = EVP_sha512();
+		break;
+	default:
+		debug("%s: unsupported signature hash 0x%x\n", key->path, hash);
+		return false;
+	}
+
+	ctx = EVP_MD_CTX_new();
+	ok = EVP_DigestVerifyInit(ctx, NULL, md, NULL, key->pkey) == 1
+	  && EVP_DigestVerify(ctx, sig_data, sig_len,
+			(const unsigned char *) tbs_data, tbs_len) == 1;
+	EVP_MD_CTX_free(ctx);
+
+	return ok;
+}
+
+static tpm_rsa_key_t *
+__ecc_key_from_tss2(const TPM2B_PUBLIC *pub, const char *pathname)
+{
+	const TPMS_ECC_POINT *eccPublic = &pub->publicArea.unique.ecc;
+	EVP_PKEY *pkey = NULL;
+	int nid;
+
+	switch (pub->publicArea.parameters.eccDetail.curveID) {
+	case TPM2_ECC_NIST_P256:
+		nid = NID_X9_62_prime256v1;
+		break;
+	case TPM2_ECC_NIST_P384:
+		nid = NID_secp384r1;
+		break;
+	default:
+		error("%s: unsupported ECC curve (only NIST P-256 and P-384 are supported)\n", pathname);
+		return NULL;
+	}
+
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+	BIGNUM *x = NULL, *y = NULL;
+	EC_KEY *ec = NULL;
+
+	x = BN_bin2bn(eccPublic->x.buffer, eccPublic->x.size, NULL);
+	y = BN_bin2bn(eccPublic->y.buffer, eccPublic->y.size, NULL);
+	if (x == NULL || y == NULL)
+		goto failed;
+
+	if (!(ec = EC_KEY_new_by_curve_name(nid))
+	 || !EC_KEY_set_public_key_affine_coordinates(ec, x, y))
+		goto failed;
+
+	pkey = EVP_PKEY_new();
+	if (!EVP_PKEY_assign_EC_KEY(pkey, ec))
+		goto failed;
+	ec = NULL;
+
+	BN_free(x);
+	BN_free(y);
+	return tpm_rsa_key_alloc(pathname, pkey, false);
+
+failed:
+	error("%s: unable to convert TPM public key\n", pathname);
+	if (pkey)
+		EVP_PKEY_free(pkey);
+	if (ec)
+		EC_KEY_free(ec);
+	BN_free(x);
+	BN_free(y);
+	return NULL;
+#else
+	unsigned char point[1 + 2 * 48];
+	unsigned int nbytes = __ecc_curve_bytes(pub->publicArea.parameters.eccDetail.curveID);
+	EVP_PKEY_CTX *ctx = NULL;
+	OSSL_PARAM params[3];
+
+	if (eccPublic->x.size > nbytes || eccPublic->y.size > nbytes)
+		goto failed;
+
+	/* Uncompressed point: 0x04 || X || Y, each padded to the field size */
+	memset(point, 0, sizeof(point));
+	point[0] = POINT_CONVERSION_UNCOMPRESSED;
+	memcpy(point + 1 + nbytes - eccPublic->x.size, eccPublic->x.buffer, eccPublic->x.size);
+	memcpy(point + 1 + 2 * nbytes - eccPublic->y.size, eccPublic->y.buffer, eccPublic->y.size);
+
+	params[0] = OSSL_PARAM_construct_utf8_string(OSSL_PKEY_PARAM_GROUP_NAME, (char *) OBJ_nid2sn(nid), 0);
+	params[1] = OSSL_PARAM_construct_octet_string(OSSL_PKEY_PARAM_PUB_KEY, point, 1 + 2 * nbytes);
+	params[2] = OSSL_PARAM_construct_end();
+
+	if (!(ctx = EVP_PKEY_CTX_new_from_name(NULL, "EC", NULL))
+	 || EVP_PKEY_fromdata_init(ctx) <= 0
+	 || EVP_PKEY_fromdata(ctx, &pkey, EVP_PKEY_PUBLIC_KEY, params) <= 0)
+		goto failed;
+
+	EVP_PKEY_CTX_free(ctx);
+	return tpm_rsa_key_alloc(pathname, pkey, false);
+
+failed:
+	error("%s: unable to convert TPM public key\n", pathname);
+	EVP_PKEY_CTX_free(ctx);
+	return NULL;
+#endif
+}
+
+/*
+ * Convert a TPM RSA or ECC public key (such as the SRK of some remote system)
+ * into an openssl public key.
+ */
+tpm_rsa_key_t *
+tpm_rsa_key_from_tss2(const TPM2B_PUBLIC *pub, const char *pathname)
+{
+	const TPMS_RSA_PARMS *rsaDetail = &pub->publicArea.parameters.rsaDetail;
+	const TPM2B_PUBLIC_KEY_RSA *rsaPublic = &pub->publicArea.unique.rsa;
+	BIGNUM *n = NULL, *e = NULL;
+	RSA *rsa = NULL;
+	EVP_PKEY *pkey = NULL;
+
+	if (pub->publicArea.type == TPM2_ALG_ECC)
+		return __ecc_key_from_tss2(pub, pathname);
+
+	if (pub->publicArea.type != TPM2_ALG_RSA) {
+		error("%s: neither an RSA nor an ECC public key\n", pathname);
+		return NULL;
+	}
+
+	n = BN_bin2bn(rsaPublic->buffer, rsaPublic->size, NULL);
+	e = BN_new();
+	if (n == NULL || e == NULL)
+		goto failed;
+
+	/* An exponent of 0 means "the default exponent" */
+	if (!BN_set_word(e, rsaDetail->exponent? : RSA_F4))
+		goto failed;
+
+	rsa = RSA_new();
+	if (!RSA_set0_key(rsa, n, e, NULL))
+		goto failed;
+	n = e = NULL;
+
+	pkey = EVP_PKEY_new();
+	if (!EVP_PKEY_assign_RSA(pkey, rsa))
+		goto failed;
+
+	return tpm_rsa_key_alloc(pathname, pkey, false);
+
+failed:
+	error("%s: unable to convert TPM public key\n", pathname);
+	if (pkey)
+		EVP_PKEY_free(pkey);
+	if (rsa)
+		RSA_free(rsa);
+	if (n)
+		BN_free(n);
+	if (e)
+		BN_free(e);
+	return NULL;
+}
+
+/*
+ * RSA-OAEP encryption as done by the TPM when protecting a secret
+ * for a storage key. Note that the TPM includes the terminating NUL
+ * byte of the label.
+ */
+int
+tpm_rsa_encrypt_oaep(const tpm_rsa_key_t *key,
+			const tpm_algo_info_t *hash_algo, const char *label,
+			const void *in_data, size_t in_len,
+			void *out_data, size_t out_size)
+{
+	EVP_PKEY_CTX *ctx;
+	const EVP_MD *md;
+	unsigned char *label_copy = NULL;
+	int result = 0;
+
+	/* OAEP and MGF1 both use the name algorithm of the key we encrypt to */
+	if (!(md = EVP_get_digestbyname(hash_algo->openssl_name))) {
+		error("%s: unsupported hash algorithm %s for RSA OAEP\n", key->path, hash_algo->openssl_name);
+		return 0;
+	}
+
+	if (!(ctx = EVP_PKEY_CTX_new(key->pkey, NULL)))
+		return 0;
+
+	if (EVP_PKEY_encrypt_init(ctx) <= 0
+	 || EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_OAEP_PADDING) <= 0
+	 || EVP_PKEY_CTX_set_rsa_oaep_md(ctx, md) <= 0
+	 || EVP_PKEY_CTX_set_rsa_mgf1_md(ctx, md) <= 0) {
+		error("%s: unable to set up RSA OAEP encryption\n", key->path);
+		goto out;
+	}
+
+	/* openssl takes ownership of the label */
+	label_copy = OPENSSL_memdup(label, strlen(label) + 1);
+	if (EVP_PKEY_CTX_set0_rsa_oaep_label(ctx, label_copy, strlen(label) + 1) <= 0) {
+		OPENSSL_free(label_copy);
+		goto out;
+	}
+
+	if (EVP_PKEY_encrypt(ctx, out_data, &out_size, in_data, in_len) <= 0) {
+		error("%s: RSA OAEP encryption failed\n", key->path);
+		goto out;
+	}
+
+	result = out_size;
+
+out:
+	EVP_PKEY_CTX_free(ctx);
+	return result;
+}
+
 /*
  * Convert openssl public key to a structure understood by tss2
  */
@@ -327,8 +890,76 @@ failed:
 	return NULL;
 }
 
-TPM2B_PUBLIC *
-tpm_rsa_key_to_tss2(const tpm_rsa_key_t *key)
+static TPM2B_PUBLIC *
+ecc_pubkey_alloc(unsigned int curve_id, const BIGNUM *x, const BIGNUM *y, const char *pathname)
+{
+	unsigned int nbytes = __ecc_curve_bytes(curve_id);
+	TPM2B_PUBLIC *result;
+
+	result = calloc(1, sizeof(*result));
+	result->size = sizeof(result->publicArea);
+	result->publicArea.type = TPM2_ALG_ECC;
+	result->publicArea.nameAlg = TPM2_ALG_SHA256;
+	result->publicArea.objectAttributes = TPMA_OBJECT_DECRYPT | TPMA_OBJECT_SIGN_ENCRYPT | TPMA_OBJECT_USERWITHAUTH;
+
+	TPMS_ECC_PARMS *eccDetail = &result->publicArea.parameters.eccDetail;
+	eccDetail->symmetric.algorithm = TPM2_ALG_NULL;
+	eccDetail->scheme.scheme = TPM2_ALG_NULL;
+	eccDetail->curveID = curve_id;
+	eccDetail->kdf.scheme = TPM2_ALG_NULL;
+
+	TPMS_ECC_POINT *eccPublic = &result->publicArea.unique.ecc;
+	if (BN_bn2binpad(x, eccPublic->x.buffer, nbytes) < 0
+	 || BN_bn2binpad(y, eccPublic->y.buffer, nbytes) < 0) {
+		error("%s: cannot convert ECC public key\n", pathname);
+		free(result);
+		return NULL;
+	}
+	eccPublic->x.size = nbytes;
+	eccPublic->y.size = nbytes;
+
+	return result;
+}
+
+static TPM2B_PUBLIC *
+tpm_ecc_key_to_tss2(const tpm_rsa_key_t *key)
+{
+	unsigned int curve_id = __ecc_key_curve(key->pkey);
+	BIGNUM *x = NULL, *y = NULL;
+	TPM2B_PUBLIC *result = NULL;
+
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+	const EC_KEY *ec;
+
+	if (!(ec = EVP_PKEY_get0_EC_KEY(key->pkey))) {
+		error("%s: cannot extract ECC public key - EVP_PKEY_get0_EC_KEY failed\n", key->path);
+		return NULL;
+	}
+
+	x = BN_new();
+	y = BN_new();
+	if (!EC_POINT_get_affine_coordinates(EC_KEY_get0_group(ec), EC_KEY_get0_public_key(ec), x, y, NULL)) {
+		error("%s: cannot extract ECC public point\n", key->path);
+		goto out;
+	}
+#else
+	if (!EVP_PKEY_get_bn_param(key->pkey, OSSL_PKEY_PARAM_EC_PUB_X, &x)
+	 || !EVP_PKEY_get_bn_param(key->pkey, OSSL_PKEY_PARAM_EC_PUB_Y, &y)) {
+		error("%s: cannot extract ECC public point\n", key->path);
+		goto out;
+	}
+#endif
+
+	result = ecc_pubkey_alloc(curve_id, x, y, key->path);
+
+out:
+	BN_free(x);
+	BN_free(y);
+	return result;
+}
+
+static TPM2B_PUBLIC *
+__rsa_key_to_tss2(const tpm_rsa_key_t *key)
 {
 #if OPENSSL_VERSION_NUMBER < 0x30000000L
 	RSA *rsa;
@@ -355,6 +986,14 @@ tpm_rsa_key_to_tss2(const tpm_rsa_key_t *key)
 	return rsa_pubkey_alloc(n, e, key->path);
 }
 
+TPM2B_PUBLIC *
+tpm_rsa_key_to_tss2(const tpm_rsa_key_t *key)
+{
+	if (tpm_rsa_key_is_ecc(key))
+		return tpm_ecc_key_to_tss2(key);
+	return __rsa_key_to_tss2(key);
+}
+
 const tpm_evdigest_t *
 tpm_rsa_key_public_digest(const tpm_rsa_key_t *pubkey)
 {
@@ -22,22 +22,41 @@
 #define RSA_H
 
 #include <tss2_tpm2_types.h>
+#include "types.h"
 
 typedef struct tpm_rsa_key	tpm_rsa_key_t;
 
 extern tpm_rsa_key_t *	tpm_rsa_key_read_public(const char *pathname);
 extern tpm_rsa_key_t *	tpm_rsa_key_read_private(const char *pathname);
+extern tpm_rsa_key_t *	tpm_rsa_key_open_pkcs11(const char *uri);
 extern bool		tpm_rsa_key_write_public(const char *pathname,
 				const tpm_rsa_key_t *key);
 extern bool		tpm_rsa_key_write_private(const char *pathname,
 				const tpm_rsa_key_t *key);
 extern void		tpm_rsa_key_free(tpm_rsa_key_t *key);
+extern bool		tpm_rsa_key_is_ecc(const tpm_rsa_key_t *key);
+extern unsigned int	tpm_rsa_key_max_signers(const tpm_rsa_key_t *key);
 extern tpm_rsa_key_t *	tpm_rsa_generate(unsigned int bits);
+extern tpm_rsa_key_t *	tpm_ecc_generate(const char *curve_name);
 extern int		tpm_rsa_sign(const tpm_rsa_key_t *,
 				const void *tbs_data, size_t tbs_len,
 				void *sig_data, size_t sig_size);
+extern bool		tpm_ecc_sign(const tpm_rsa_key_t *,
+				const void *tbs_data, size_t tbs_len,
+				TPMS_SIGNATURE_ECC *sig);
+extern bool		tpm_rsa_key_verify(const tpm_rsa_key_t *,
+				const void *tbs_data, size_t tbs_len,
+				const TPMT_SIGNATURE *sig);
+extern int		tpm_ecc_signature_to_der(const TPMS_SIGNATURE_ECC *sig,
+				void *der_data, size_t der_size);
+
+extern int		tpm_rsa_encrypt_oaep(const tpm_rsa_key_t *key,
+				const tpm_algo_info_t *hash_algo, const char *label,
+				const void *in_data, size_t in_len,
+				void *out_data, size_t out_size);
 
 extern TPM2B_PUBLIC *	tpm_rsa_key_to_tss2(const tpm_rsa_key_t *key);
+extern tpm_rsa_key_t *	tpm_rsa_key_from_tss2(const TPM2B_PUBLIC *pub, const char *pathname);
 
 extern const tpm_evdigest_t * tpm_rsa_key_public_digest(const tpm_rsa_key_t *pubkey);
 
@@ -20,6 +20,9 @@
 
 #include <sys/stat.h>
 #include <sys/mount.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+#include <mntent.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
@@ -31,6 +34,7 @@
 #include "bufparser.h"
 #include "digest.h"
 #include "testcase.h"
+#include "oracle.h"
 #include "util.h"
 
 struct file_locator {
@@ -50,8 +54,111 @@ struct block_dev_io {
 	testcase_block_dev_t *recording;
 };
 
-static testcase_t *	testcase_recording;
-static testcase_t *	testcase_playback;
+/*
+ * A runtime provider supplies everything we need to know about the system
+ * whose PCRs we're predicting: EFI variables, boot loader images, file
+ * digests, partition tables etc. By default, this is the local system;
+ * when replaying a testcase or predicting for a remote system, these are
+ * taken from a directory instead.
+ */
+struct runtime_provider_ops {
+	const char *		name;
+	bool			local;
+
+	int			(*open_sysfs_file)(runtime_provider_t *, const char *sysfs_path, const char *nickname);
+	buffer_t *		(*read_efi_variable)(runtime_provider_t *, const char *var_name);
+	buffer_t *		(*read_efi_application)(runtime_provider_t *, const char *partition, const char *application);
+	const tpm_evdigest_t *	(*digest_efi_file)(runtime_provider_t *, const tpm_algo_info_t *, const char *path);
+	const tpm_evdigest_t *	(*digest_rootfs_file)(runtime_provider_t *, const tpm_algo_info_t *, const char *path);
+	char *			(*disk_for_partition)(runtime_provider_t *, const char *part_dev);
+	char *			(*blockdev_by_partuuid)(runtime_provider_t *, const char *uuid);
+	int			(*open_block_dev)(runtime_provider_t *, const char *dev);
+	FILE *			(*open_pcrs)(runtime_provider_t *);
+	buffer_t *		(*read_shim_vendor_cert)(runtime_provider_t *);
+};
+
+struct runtime_provider {
+	const struct runtime_provider_ops *ops;
+
+	/* For the testcase and remote providers */
+	testcase_t *		testcase;
+};
+
+static const struct runtime_provider_ops system_provider_ops;
+static const struct runtime_provider_ops testcase_provider_ops;
+static const struct runtime_provider_ops remote_provider_ops;
+
+static runtime_provider_t	system_provider = {
+	.ops		= &system_provider_ops,
+};
+
+static runtime_provider_t *	current_provider = &system_provider;
+static testcase_t *		testcase_recording;
+static runtime_input_set_t *	input_tracking;
+
+/*
+ * Runtime provider handling
+ */
+runtime_provider_t *
+runtime_provider_testcase_new(testcase_t *tc)
+{
+	runtime_provider_t *provider;
+
+	provider = calloc(1, sizeof(*provider));
+	provider->ops = &testcase_provider_ops;
+	provider->testcase = tc;
+	return provider;
+}
+
+/*
+ * Create a provider for predicting the PCRs of a different system.
+ * Anything not found in the bundle directory (which uses the testcase
+ * layout) is an error; we never fall back to looking at the local system.
+ * Without a bundle, all information must come from the event log or the
+ * component database.
+ */
+runtime_provider_t *
+runtime_provider_remote_new(const char *bundle_dir)
+{
+	runtime_provider_t *provider;
+
+	provider = calloc(1, sizeof(*provider));
+	provider->ops = &remote_provider_ops;
+	if (bundle_dir)
+		provider->testcase = testcase_open(bundle_dir);
+	return provider;
+}
+
+void
+runtime_provider_free(runtime_provider_t *provider)
+{
+	if (provider == &system_provider)
+		return;
+
+	if (provider->testcase)
+		testcase_free(provider->testcase);
+	free(provider);
+}
+
+/*
+ * Install the given provider, and return the previous one.
+ * NULL selects the local system.
+ */
+runtime_provider_t *
+runtime_set_provider(runtime_provider_t *provider)
+{
+	runtime_provider_t *prev = current_provider;
+
+	current_provider = provider? : &system_provider;
+	debug("Using %s runtime provider\n", current_provider->ops->name);
+	return prev;
+}
+
+bool
+runtime_is_local(void)
+{
+	return current_provider->ops->local;
+}
 
 /*
  * Testcase handling
@@ -66,20 +173,376 @@ runtime_record_testcase(testcase_t *tc)
 void
 runtime_replay_testcase(testcase_t *tc)
 {
+	runtime_provider_t *prev;
+
 	debug("Starting testcase playback\n");
-	testcase_playback = tc;
+	prev = runtime_set_provider(tc? runtime_provider_testcase_new(tc) : NULL);
+	if (prev->ops == &testcase_provider_ops) {
+		/* the testcase itself is owned by the caller */
+		prev->testcase = NULL;
+		runtime_provider_free(prev);
+	}
 }
 
 testcase_t *
 runtime_get_replay_testcase(void)
 {
-	return testcase_playback;
+	if (current_provider->ops == &testcase_provider_ops)
+		return current_provider->testcase;
+	return NULL;
+}
+
+/*
+ * Input tracking
+ */
+static const char *	runtime_input_kind_names[__RUNTIME_INPUT_MAX] = {
+	[RUNTIME_INPUT_EFI_VARIABLE]	= "efi-variable",
+	[RUNTIME_INPUT_EFI_FILE]	= "efi-file",
+	[RUNTIME_INPUT_EFI_APPLICATION]	= "efi-application",
+	[RUNTIME_INPUT_ROOTFS_FILE]	= "rootfs-file",
+};
+
+const char *
+runtime_input_kind_name(int kind)
+{
+	if (kind < 0 || kind >= __RUNTIME_INPUT_MAX)
+		return "unknown";
+	return runtime_input_kind_names[kind];
+}
+
+int
+runtime_input_kind_by_name(const char *name)
+{
+	int kind;
+
+	for (kind = 0; kind < __RUNTIME_INPUT_MAX; ++kind) {
+		if (!strcmp(runtime_input_kind_names[kind], name))
+			return kind;
+	}
+	return -1;
+}
+
+const runtime_input_t *
+runtime_input_set_find(const runtime_input_set_t *set, int kind, const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < set->count; ++i) {
+		const runtime_input_t *input = &set->inputs[i];
+
+		if (input->kind == kind && !strcmp(input->name, name))
+			return input;
+	}
+	return NULL;
+}
+
+void
+runtime_input_set_add(runtime_input_set_t *set, int kind, const char *name, const char *fingerprint)
+{
+	runtime_input_t *input;
+
+	/* The first time we see an input is what counts */
+	if (runtime_input_set_find(set, kind, name))
+		return;
+
+	if ((set->count % 8) == 0)
+		set->inputs = realloc(set->inputs, (set->count + 8) * sizeof(set->inputs[0]));
+
+	input = &set->inputs[set->count++];
+	input->kind = kind;
+	input->name = strdup(name);
+	input->fingerprint = strdup(fingerprint);
+}
+
+void
+runtime_input_set_destroy(runtime_input_set_t *set)
+{
+	unsigned int i;
+
+	for (i = 0; i < set->count; ++i) {
+		drop_string(&set->inputs[i].name);
+		drop_string(&set->inputs[i].fingerprint);
+	}
+	if (set->inputs)
+		free(set->inputs);
+	memset(set, 0, sizeof(*set));
+}
+
+/*
+ * Install the given input set, and return the previous one.
+ * Only the local system is tracked; the testcase and remote providers
+ * read from a directory that we assume does not change under our feet.
+ */
+runtime_input_set_t *
+runtime_track_inputs(runtime_input_set_t *set)
+{
+	runtime_input_set_t *prev = input_tracking;
+
+	input_tracking = set;
+	return prev;
+}
+
+static inline void
+runtime_input_opaque(void)
+{
+	if (input_tracking)
+		input_tracking->opaque = true;
+}
+
+/*
+ * A file is identified by its metadata. Anyone replacing a boot component
+ * (package manager, dracut, sdbootutil) will at least change mtime and
+ * ctime, and usually the inode as well.
+ * FAT has no inode numbers; the kernel makes them up, and they change
+ * whenever the ESP is mounted again. So leave them out on vfat.
+ */
+static char *
+__runtime_file_fingerprint(const char *path)
+{
+	struct stat stb;
+	struct statfs sfs;
+	unsigned long ino;
+	char buffer[128];
+
+	if (stat(path, &stb) < 0)
+		return NULL;
+
+	ino = stb.st_ino;
+	if (statfs(path, &sfs) == 0 && sfs.f_type == MSDOS_SUPER_MAGIC)
+		ino = 0;
+
+	snprintf(buffer, sizeof(buffer), "%lx:%lx:%llx:%ld.%09ld:%ld.%09ld",
+			(unsigned long) stb.st_dev,
+			ino,
+			(unsigned long long) stb.st_size,
+			(long) stb.st_mtim.tv_sec, stb.st_mtim.tv_nsec,
+			(long) stb.st_ctim.tv_sec, stb.st_ctim.tv_nsec);
+	return strdup(buffer);
+}
+
+/*
+ * EFI variables live in a pseudo file system whose timestamps mean nothing,
+ * but they are small enough to simply digest their contents.
+ */
+static char *
+__runtime_efi_variable_fingerprint(buffer_t *data)
+{
+	tpm_evdigest_t md;
+	digest_ctx_t *ctx;
+
+	if (data == NULL)
+		return strdup("absent");
+
+	/* Do not use digest_compute(), which returns a static buffer that
+	 * the caller may still be holding on to. */
+	if (!(ctx = digest_ctx_new(digest_by_name("sha256"))))
+		return NULL;
+
+	digest_ctx_update(ctx, buffer_read_pointer(data), buffer_available(data));
+	digest_ctx_final(ctx, &md);
+	digest_ctx_free(ctx);
+
+	return strdup(digest_print_value(&md));
+}
+
+static void
+__runtime_track_file(int kind, const char *name, const char *path)
+{
+	char *fingerprint;
+
+	if (input_tracking == NULL)
+		return;
+
+	if (!(fingerprint = __runtime_file_fingerprint(path))) {
+		debug("Cannot stat %s, not tracking it\n", path);
+		runtime_input_opaque();
+		return;
+	}
+
+	runtime_input_set_add(input_tracking, kind, name, fingerprint);
+	free(fingerprint);
+}
+
+static void
+__runtime_track_efi_variable(const char *var_name, buffer_t *data)
+{
+	char *fingerprint;
+
+	if (input_tracking == NULL)
+		return;
+
+	if (!(fingerprint = __runtime_efi_variable_fingerprint(data))) {
+		runtime_input_opaque();
+		return;
+	}
+
+	runtime_input_set_add(input_tracking, RUNTIME_INPUT_EFI_VARIABLE, var_name, fingerprint);
+	free(fingerprint);
+}
+
+/*
+ * EFI applications are read once and the parsed image is cached in the event.
+ * Whoever uses the cached image must tell us that the application is an input.
+ */
+void
+runtime_track_efi_application(const char *partition, const char *application)
+{
+	file_locator_t *loc;
+
+	if (input_tracking == NULL)
+		return;
+
+	/* runtime_locate_file() does the actual tracking */
+	if (partition == NULL || (loc = runtime_locate_file(partition, application)) == NULL) {
+		runtime_input_opaque();
+		return;
+	}
+	file_locator_free(loc);
+}
+
+/*
+ * Find the directory a partition is mounted on, if any. The partition
+ * is given as a device path such as /dev/disk/by-partuuid/..., which
+ * is not what /proc/self/mounts lists, so compare device numbers.
+ */
+static bool
+runtime_find_mount_point(const char *device_path, char *buf, size_t size)
+{
+	struct stat dev_stb, stb;
+	struct mntent *m;
+	bool found = false;
+	FILE *fp;
+
+	if (stat(device_path, &dev_stb) < 0 || !S_ISBLK(dev_stb.st_mode))
+		return false;
+
+	if (!(fp = setmntent("/proc/self/mounts", "r")))
+		return false;
+
+	while (!found && (m = getmntent(fp)) != NULL) {
+		if (stat(m->mnt_fsname, &stb) < 0 || !S_ISBLK(stb.st_mode)
+		 || stb.st_rdev != dev_stb.st_rdev)
+			continue;
+		found = snprintf(buf, size, "%s", m->mnt_dir) < (int) size;
+	}
+
+	endmntent(fp);
+	return found;
+}
+
+/*
+ * Where the ESP is mounted. If we know which partition the boot loader
+ * came from and it is mounted, that is the place; otherwise assume
+ * /boot/efi.
+ */
+static const char *
+runtime_esp_path(const char *partition)
+{
+	static char path[PATH_MAX];
+
+	if (partition && runtime_find_mount_point(partition, path, sizeof(path)))
+		return path;
+	return "/boot/efi";
+}
+
+/*
+ * Split "(partition)/path" as used to name EFI application inputs.
+ * Returns the partition, which the caller must free, and the path.
+ */
+static char *
+runtime_split_efi_application(const char *name, const char **application_ret)
+{
+	const char *end;
+
+	if (name[0] != '(' || !(end = strchr(name, ')')))
+		return NULL;
+
+	*application_ret = end + 1;
+	return strndup(name + 1, end - name - 1);
+}
+
+/*
+ * Where to find an input on the local system, eg for watching it.
+ */
+const char *
+runtime_input_local_path(int kind, const char *name)
+{
+	static char path[PATH_MAX];
+	const char *application;
+	char *partition;
+	int n;
+
+	switch (kind) {
+	case RUNTIME_INPUT_EFI_VARIABLE:
+		n = snprintf(path, sizeof(path), "/sys/firmware/efi/efivars/%s", name);
+		break;
+
+	case RUNTIME_INPUT_EFI_FILE:
+		n = snprintf(path, sizeof(path), "%s%s", runtime_esp_path(NULL), name);
+		break;
+
+	case RUNTIME_INPUT_EFI_APPLICATION:
+		if (!(partition = runtime_split_efi_application(name, &application)))
+			return NULL;
+		n = snprintf(path, sizeof(path), "%s%s", runtime_esp_path(partition), application);
+		free(partition);
+		break;
+
+	case RUNTIME_INPUT_ROOTFS_FILE:
+		n = snprintf(path, sizeof(path), "%s", name);
+		break;
+
+	default:
+		return NULL;
+	}
+
+	if (n >= (int) sizeof(path))
+		return NULL;
+
+	return path;
+}
+
+/*
+ * Compute the current fingerprint of an input, without tracking it.
+ * Returns NULL if the input no longer exists.
+ */
+char *
+runtime_input_fingerprint(int kind, const char *name)
+{
+	runtime_input_set_t *saved = runtime_track_inputs(NULL);
+	const char *local_path;
+	char *fingerprint = NULL;
+	buffer_t *data;
+
+	switch (kind) {
+	case RUNTIME_INPUT_EFI_VARIABLE:
+		data = runtime_read_efi_variable(name);
+		fingerprint = __runtime_efi_variable_fingerprint(data);
+		if (data)
+			buffer_free(data);
+		break;
+
+	case RUNTIME_INPUT_EFI_FILE:
+	case RUNTIME_INPUT_EFI_APPLICATION:
+		/* Neither of these mounts anything; we look at the ESP where it is mounted */
+		if ((local_path = runtime_input_local_path(kind, name)) != NULL)
+			fingerprint = __runtime_file_fingerprint(local_path);
+		break;
+
+	case RUNTIME_INPUT_ROOTFS_FILE:
+		fingerprint = __runtime_file_fingerprint(name);
+		break;
+	}
+
+	runtime_track_inputs(saved);
+	return fingerprint;
 }
 
 file_locator_t *
 runtime_locate_file(const char *device_path, const char *file_path)
 {
 	char template[] = "/tmp/efimnt.XXXXXX";
+	char mounted[PATH_MAX];
 	char fullpath[PATH_MAX];
 	file_locator_t *loc;
 	char *dirname;
@@ -88,22 +551,40 @@ runtime_locate_file(const char *device_path, const char *file_path)
 	assign_string(&loc->partition, device_path);
 	assign_string(&loc->relative_path, file_path);
 
-	if (!(dirname = mkdtemp(template))) {
-		error("Cannot create temporary mount point for EFI partition");
-		return NULL;
+	/* If the partition is mounted already (usually on /boot/efi), use that */
+	if (runtime_find_mount_point(device_path, mounted, sizeof(mounted))) {
+		dirname = mounted;
+	} else {
+		if (!(dirname = mkdtemp(template))) {
+			error("Cannot create temporary mount point for EFI partition");
+			return NULL;
+		}
+
+		if (mount(device_path, dirname, "vfat", 0, NULL) < 0) {
+			(void) rmdir(dirname);
+			error("Unable to mount %s on %s\n", device_path, dirname);
+			return NULL;
+		}
+
+		assign_string(&loc->mount_point, dirname);
+		loc->is_mounted = true;
 	}
 
-	if (mount(device_path, dirname, "vfat", 0, NULL) < 0) {
-		(void) rmdir(dirname);
-		error("Unable to mount %s on %s\n", device_path, dirname);
+	if (snprintf(fullpath, sizeof(fullpath), "%s/%s", dirname, file_path) >= (int) sizeof(fullpath)) {
+		error("%s: path name too long\n", file_path);
+		file_locator_free(loc);
 		return NULL;
 	}
+	assign_string(&loc->full_path, fullpath);
 
-	assign_string(&loc->mount_point, dirname);
-	loc->is_mounted = true;
+	if (input_tracking) {
+		char name[PATH_MAX];
 
-	snprintf(fullpath, sizeof(fullpath), "%s/%s", dirname, file_path);
-	assign_string(&loc->full_path, fullpath);
+		if (snprintf(name, sizeof(name), "(%s)%s", device_path, file_path) >= (int) sizeof(name))
+			runtime_input_opaque();
+		else
+			__runtime_track_file(RUNTIME_INPUT_EFI_APPLICATION, name, fullpath);
+	}
 
 	return loc;
 }
@@ -142,14 +623,11 @@ file_locator_get_full_path(const file_locator_t *loc)
 }
 
 static buffer_t *
-__system_read_efi_variable(const char *var_name)
+__system_read_efi_variable(runtime_provider_t *provider, const char *var_name)
 {
 	char filename[PATH_MAX];
 	buffer_t *result;
 
-	if (testcase_playback)
-		return testcase_playback_efi_variable(testcase_playback, var_name);
-
 	/* First, try new efivars interface */
 	snprintf(filename, sizeof(filename), "/sys/firmware/efi/efivars/%s", var_name);
 	result = buffer_read_file(filename, RUNTIME_SHORT_READ_OKAY | RUNTIME_MISSING_FILE_OKAY);
@@ -167,17 +645,15 @@ __system_read_efi_variable(const char *var_name)
 	else if (testcase_recording)
 		testcase_record_efi_variable(testcase_recording, var_name, result);
 
+	__runtime_track_efi_variable(var_name, result);
 	return result;
 }
 
 static int
-runtime_open_sysfs_file(const char *sysfs_path, const char *nickname)
+__system_open_sysfs_file(runtime_provider_t *provider, const char *sysfs_path, const char *nickname)
 {
 	int fd;
 
-	if (testcase_playback)
-		return testcase_playback_sysfs_file(testcase_playback, nickname);
-
 	fd = open(sysfs_path, O_RDONLY);
 	if (fd < 0)
 		return -1;
@@ -193,10 +669,19 @@ runtime_open_eventlog(const char *override_path)
 	const char *eventlog_path = "/sys/kernel/security/tpm0/binary_bios_measurements";
 	int fd;
 
-	if (override_path)
+	if (override_path) {
 		eventlog_path = override_path;
 
-	fd = runtime_open_sysfs_file(eventlog_path, "tpm_measurements");
+		/* An explicitly given event log takes precedence over the
+		 * one contained in a testcase we're replaying */
+		if (!runtime_is_local()) {
+			if ((fd = open(eventlog_path, O_RDONLY)) < 0)
+				error("Unable to open TPM event log %s: %m\n", eventlog_path);
+			return fd;
+		}
+	}
+
+	fd = current_provider->ops->open_sysfs_file(current_provider, eventlog_path, "tpm_measurements");
 	if (fd < 0)
 		error("Unable to open TPM event log %s: %m\n", eventlog_path);
 	return fd;
@@ -208,7 +693,7 @@ runtime_open_ima_measurements(void)
 {
 	const char *ima_path = "/sys/kernel/security/integrity/ima/ascii_runtime_measurements";
 
-	return runtime_open_sysfs_file(ima_path, "ima_measurements");
+	return current_provider->ops->open_sysfs_file(current_provider, ima_path, "ima_measurements");
 }
 
 buffer_t *
@@ -226,22 +711,26 @@ runtime_write_file(const char *path, buffer_t *bp)
 buffer_t *
 runtime_read_efi_variable(const char *var_name)
 {
-	return __system_read_efi_variable(var_name);
+	return current_provider->ops->read_efi_variable(current_provider, var_name);
 }
 
 const tpm_evdigest_t *
 runtime_digest_efi_file(const tpm_algo_info_t *algo, const char *path)
+{
+	return current_provider->ops->digest_efi_file(current_provider, algo, path);
+}
+
+static const tpm_evdigest_t *
+__system_digest_efi_file(runtime_provider_t *provider, const tpm_algo_info_t *algo, const char *path)
 {
 	const tpm_evdigest_t *md;
 	char esp_path[PATH_MAX];
 
-	if (testcase_playback)
-		return testcase_playback_efi_digest(testcase_playback, path, algo);
-
 	/* FIXME: We may be better off having the caller tell us where to find the ESP.
 	 * The caller should know from the previous EFI BSA event for eg grub.efi
 	 * which partition is the ESP that was used. */
-	snprintf(esp_path, sizeof(esp_path), "/boot/efi%s", path);
+	snprintf(esp_path, sizeof(esp_path), "%s%s", runtime_esp_path(NULL), path);
+	__runtime_track_file(RUNTIME_INPUT_EFI_FILE, path, esp_path);
 	md = digest_from_file(algo, esp_path, 0);
 	if (md && testcase_recording)
 		testcase_record_efi_digest(testcase_recording, path, md);
@@ -252,11 +741,15 @@ runtime_digest_efi_file(const tpm_algo_info_t *algo, const char *path)
 const tpm_evdigest_t *
 runtime_digest_rootfs_file(const tpm_algo_info_t *algo, const char *path)
 {
-	const tpm_evdigest_t *md;
+	return current_provider->ops->digest_rootfs_file(current_provider, algo, path);
+}
 
-	if (testcase_playback)
-		return testcase_playback_rootfs_digest(testcase_playback, path, algo);
+static const tpm_evdigest_t *
+__system_digest_rootfs_file(runtime_provider_t *provider, const tpm_algo_info_t *algo, const char *path)
+{
+	const tpm_evdigest_t *md;
 
+	__runtime_track_file(RUNTIME_INPUT_ROOTFS_FILE, path, path);
 	md = digest_from_file(algo, path, 0);
 	if (md && testcase_recording)
 		testcase_record_rootfs_digest(testcase_recording, path, md);
@@ -266,13 +759,16 @@ runtime_digest_rootfs_file(const tpm_algo_info_t *algo, const char *path)
 
 buffer_t *
 runtime_read_efi_application(const char *partition, const char *application)
+{
+	return current_provider->ops->read_efi_application(current_provider, partition, application);
+}
+
+static buffer_t *
+__system_read_efi_application(runtime_provider_t *provider, const char *partition, const char *application)
 {
         file_locator_t *loc;
 	const char *fullpath;
-	buffer_t *result;
-
-	if (testcase_playback)
-		return testcase_playback_efi_application(testcase_playback, partition, application);
+	buffer_t *result = NULL;
 
 	debug("%s(%s, %s)\n", __func__, partition, application);
         loc = runtime_locate_file(partition, application);
@@ -292,6 +788,13 @@ runtime_read_efi_application(const char *partition, const char *application)
 
 char *
 runtime_disk_for_partition(const char *part_dev)
+{
+	runtime_input_opaque();
+	return current_provider->ops->disk_for_partition(current_provider, part_dev);
+}
+
+static char *
+__system_disk_for_partition(runtime_provider_t *provider, const char *part_dev)
 {
 	char *part_name;
 	char sys_block[PATH_MAX];
@@ -301,9 +804,6 @@ runtime_disk_for_partition(const char *part_dev)
 	size_t r_size;
 	char *result;
 
-	if (testcase_playback)
-		return testcase_playback_partition_disk(testcase_playback, part_dev);
-
 	/* Get the disk name from the sysfs path */
 	/* example:
 	 *   To get the disk device name of /dev/nvme0n1p1
@@ -347,13 +847,17 @@ runtime_disk_for_partition(const char *part_dev)
 
 char *
 runtime_blockdev_by_partuuid(const char *uuid)
+{
+	runtime_input_opaque();
+	return current_provider->ops->blockdev_by_partuuid(current_provider, uuid);
+}
+
+static char *
+__system_blockdev_by_partuuid(runtime_provider_t *provider, const char *uuid)
 {
 	char pathbuf[PATH_MAX];
 	char *dev_name;
 
-	if (testcase_playback)
-		return testcase_playback_partition_uuid(testcase_playback, uuid);
-
 	snprintf(pathbuf, sizeof(pathbuf), "/dev/disk/by-partuuid/%s", uuid);
 	dev_name = realpath(pathbuf, NULL);
 
@@ -368,17 +872,17 @@ runtime_blockdev_open(const char *dev)
 	block_dev_io_t *io;
 	int fd;
 
-	if (testcase_playback)
-		fd = testcase_playback_block_dev(testcase_playback, dev);
-	else
-	if ((fd = open(dev, O_RDONLY)) < 0)
+	/* Block device contents (such as the GPT) are never fingerprinted */
+	runtime_input_opaque();
+
+	if ((fd = current_provider->ops->open_block_dev(current_provider, dev)) < 0)
 		return NULL;
 
 	io = calloc(1, sizeof(*io));
 	io->fd = fd;
 	io->sector_size = 512;
 
-	if (testcase_recording)
+	if (testcase_recording && runtime_is_local())
 		io->recording = testcase_record_block_dev(testcase_recording, dev);
 
 	return io;
@@ -452,7 +956,248 @@ runtime_maybe_record_pcrs(void)
 FILE *
 runtime_maybe_playback_pcrs(void)
 {
-	if (testcase_playback)
-		return testcase_playback_pcrs(testcase_playback, "current-pcrs");
+	return current_provider->ops->open_pcrs(current_provider);
+}
+
+buffer_t *
+runtime_read_shim_vendor_cert(void)
+{
+	runtime_input_opaque();
+	return current_provider->ops->read_shim_vendor_cert(current_provider);
+}
+
+/*
+ * The local system
+ */
+static int
+__system_open_block_dev(runtime_provider_t *provider, const char *dev)
+{
+	return open(dev, O_RDONLY);
+}
+
+static FILE *
+__system_open_pcrs(runtime_provider_t *provider)
+{
 	return NULL;
 }
+
+static buffer_t *
+__system_read_shim_vendor_cert(runtime_provider_t *provider)
+{
+	buffer_t *result;
+
+	result = platform_read_shim_vendor_cert();
+	if (result && testcase_recording)
+		testcase_record_shim_vendor_cert(testcase_recording, result);
+	return result;
+}
+
+static const struct runtime_provider_ops system_provider_ops = {
+	.name			= "system",
+	.local			= true,
+	.open_sysfs_file	= __system_open_sysfs_file,
+	.read_efi_variable	= __system_read_efi_variable,
+	.read_efi_application	= __system_read_efi_application,
+	.digest_efi_file	= __system_digest_efi_file,
+	.digest_rootfs_file	= __system_digest_rootfs_file,
+	.disk_for_partition	= __system_disk_for_partition,
+	.blockdev_by_partuuid	= __system_blockdev_by_partuuid,
+	.open_block_dev		= __system_open_block_dev,
+	.open_pcrs		= __system_open_pcrs,
+	.read_shim_vendor_cert	= __system_read_shim_vendor_cert,
+};
+
+/*
+ * Testcase playback
+ */
+static int
+__testcase_open_sysfs_file(runtime_provider_t *provider, const char *sysfs_path, const char *nickname)
+{
+	return testcase_playback_sysfs_file(provider->testcase, nickname);
+}
+
+static buffer_t *
+__testcase_read_efi_variable(runtime_provider_t *provider, const char *var_name)
+{
+	return testcase_playback_efi_variable(provider->testcase, var_name);
+}
+
+static buffer_t *
+__testcase_read_efi_application(runtime_provider_t *provider, const char *partition, const char *application)
+{
+	return testcase_playback_efi_application(provider->testcase, partition, application);
+}
+
+static const tpm_evdigest_t *
+__testcase_digest_efi_file(runtime_provider_t *provider, const tpm_algo_info_t *algo, const char *path)
+{
+	return testcase_playback_efi_digest(provider->testcase, path, algo);
+}
+
+static const tpm_evdigest_t *
+__testcase_digest_rootfs_file(runtime_provider_t *provider, const tpm_algo_info_t *algo, const char *path)
+{
+	return testcase_playback_rootfs_digest(provider->testcase, path, algo);
+}
+
+static char *
+__testcase_disk_for_partition(runtime_provider_t *provider, const char *part_dev)
+{
+	return testcase_playback_partition_disk(provider->testcase, part_dev);
+}
+
+static char *
+__testcase_blockdev_by_partuuid(runtime_provider_t *provider, const char *uuid)
+{
+	return testcase_playback_partition_uuid(provider->testcase, uuid);
+}
+
+static int
+__testcase_open_block_dev(runtime_provider_t *provider, const char *dev)
+{
+	return testcase_playback_block_dev(provider->testcase, dev);
+}
+
+static FILE *
+__testcase_open_pcrs(runtime_provider_t *provider)
+{
+	return testcase_playback_pcrs(provider->testcase, "current-pcrs");
+}
+
+static buffer_t *
+__testcase_read_shim_vendor_cert(runtime_provider_t *provider)
+{
+	buffer_t *result;
+
+	/* Older testcases do not contain the vendor cert */
+	if ((result = testcase_playback_shim_vendor_cert(provider->testcase)) == NULL)
+		result = platform_read_shim_vendor_cert();
+	return result;
+}
+
+static const struct runtime_provider_ops testcase_provider_ops = {
+	.name			= "testcase",
+	.open_sysfs_file	= __testcase_open_sysfs_file,
+	.read_efi_variable	= __testcase_read_efi_variable,
+	.read_efi_application	= __testcase_read_efi_application,
+	.digest_efi_file	= __testcase_digest_efi_file,
+	.digest_rootfs_file	= __testcase_digest_rootfs_file,
+	.disk_for_partition	= __testcase_disk_for_partition,
+	.blockdev_by_partuuid	= __testcase_blockdev_by_partuuid,
+	.open_block_dev		= __testcase_open_block_dev,
+	.open_pcrs		= __testcase_open_pcrs,
+	.read_shim_vendor_cert	= __testcase_read_shim_vendor_cert,
+};
+
+/*
+ * Remote system. If there is a bundle, we use it like a testcase.
+ * Otherwise, everything that is not in the event log or the component
+ * database is simply unavailable.
+ */
+static bool
+__remote_has_bundle(runtime_provider_t *provider, const char *what)
+{
+	if (provider->testcase == NULL) {
+		error("Cannot access %s of remote system without an input bundle\n", what);
+		return false;
+	}
+	return true;
+}
+
+static int
+__remote_open_sysfs_file(runtime_provider_t *provider, const char *sysfs_path, const char *nickname)
+{
+	if (!__remote_has_bundle(provider, nickname))
+		return -1;
+	return testcase_playback_sysfs_file(provider->testcase, nickname);
+}
+
+static buffer_t *
+__remote_read_efi_variable(runtime_provider_t *provider, const char *var_name)
+{
+	if (!__remote_has_bundle(provider, var_name))
+		return NULL;
+	return testcase_playback_efi_variable(provider->testcase, var_name);
+}
+
+static buffer_t *
+__remote_read_efi_application(runtime_provider_t *provider, const char *partition, const char *application)
+{
+	if (!__remote_has_bundle(provider, application))
+		return NULL;
+	return testcase_playback_efi_application(provider->testcase, partition, application);
+}
+
+static const tpm_evdigest_t *
+__remote_digest_efi_file(runtime_provider_t *provider, const tpm_algo_info_t *algo, const char *path)
+{
+	if (!__remote_has_bundle(provider, path))
+		return NULL;
+	return testcase_playback_efi_digest(provider->testcase, path, algo);
+}
+
+static const tpm_evdigest_t *
+__remote_digest_rootfs_file(runtime_provider_t *provider, const tpm_algo_info_t *algo, const char *path)
+{
+	if (!__remote_has_bundle(provider, path))
+		return NULL;
+	return testcase_playback_rootfs_digest(provider->testcase, path, algo);
+}
+
+static char *
+__remote_disk_for_partition(runtime_provider_t *provider, const char *part_dev)
+{
+	if (!__remote_has_bundle(provider, part_dev))
+		return NULL;
+	return testcase_playback_partition_disk(provider->testcase, part_dev);
+}
+
+static char *
+__remote_blockdev_by_partuuid(runtime_provider_t *provider, const char *uuid)
+{
+	if (!__remote_has_bundle(provider, "partition table"))
+		return NULL;
+	return testcase_playback_partition_uuid(provider->testcase, uuid);
+}
+
+static int
+__remote_open_block_dev(runtime_provider_t *provider, const char *dev)
+{
+	if (!__remote_has_bundle(provider, dev))
+		return -1;
+	return testcase_playback_block_dev(provider->testcase, dev);
+}
+
+static FILE *
+__remote_open_pcrs(runtime_provider_t *provider)
+{
+	if (!__remote_has_bundle(provider, "current PCR values"))
+		return NULL;
+	return testcase_playback_pcrs(provider->testcase, "current-pcrs");
+}
+
+static buffer_t *
+__remote_read_shim_vendor_cert(runtime_provider_t *provider)
+{
+	buffer_t *result;
+
+	if (!__remote_has_bundle(provider, "shim vendor certificate"))
+		return NULL;
+	if ((result = testcase_playback_shim_vendor_cert(provider->testcase)) == NULL)
+		error("Input bundle does not contain the shim vendor certificate\n");
+	return result;
+}
+
+static const struct runtime_provider_ops remote_provider_ops = {
+	.name			= "remote",
+	.open_sysfs_file	= __remote_open_sysfs_file,
+	.read_efi_variable	= __remote_read_efi_variable,
+	.read_efi_application	= __remote_read_efi_application,
+	.digest_efi_file	= __remote_digest_efi_file,
+	.digest_rootfs_file	= __remote_digest_rootfs_file,
+	.disk_for_partition	= __remote_disk_for_partition,
+	.blockdev_by_partuuid	= __remote_blockdev_by_partuuid,
+	.open_block_dev		= __remote_open_block_dev,
+	.open_pcrs		= __remote_open_pcrs,
+	.read_shim_vendor_cert	= __remote_read_shim_vendor_cert,
+};
@@ -28,6 +28,13 @@
 
 typedef struct file_locator	file_locator_t;
 typedef struct block_dev_io	block_dev_io_t;
+typedef struct runtime_provider	runtime_provider_t;
+
+extern runtime_provider_t *runtime_provider_testcase_new(testcase_t *);
+extern runtime_provider_t *runtime_provider_remote_new(const char *bundle_dir);
+extern void		runtime_provider_free(runtime_provider_t *);
+extern runtime_provider_t *runtime_set_provider(runtime_provider_t *);
+extern bool		runtime_is_local(void);
 
 extern file_locator_t *	runtime_locate_file(const char *fs_dev, const char *path);
 extern void		file_locator_free(file_locator_t *);
@@ -38,6 +45,7 @@ extern buffer_t *	runtime_read_file(const char *pathname, int flags);
 extern bool		runtime_write_file(const char *pathname, buffer_t *);
 extern buffer_t *	runtime_read_efi_variable(const char *var_name);
 extern buffer_t *	runtime_read_efi_application(const char *partition, const char *application);
+extern buffer_t *	runtime_read_shim_vendor_cert(void);
 extern const tpm_evdigest_t *runtime_digest_efi_file(const tpm_algo_info_t *algo, const char *path);
 extern const tpm_evdigest_t *runtime_digest_rootfs_file(const tpm_algo_info_t *algo, const char *path);
 extern char *		runtime_disk_for_partition(const char *part_dev);
@@ -48,6 +56,44 @@ extern void		runtime_blockdev_close(block_dev_io_t *);
 
 extern unsigned int	runtime_blockdev_bytes_to_sectors(const block_dev_io_t *, unsigned int size);
 
+/*
+ * Input tracking. While a set is installed, the local runtime provider
+ * records every file and EFI variable it consults, along with a fingerprint
+ * that is cheap to recompute later: file metadata for files, and a digest of
+ * the contents for EFI variables. Inputs that cannot be fingerprinted
+ * cheaply (such as raw block device reads) mark the whole set as opaque.
+ */
+enum {
+	RUNTIME_INPUT_EFI_VARIABLE,
+	RUNTIME_INPUT_EFI_FILE,			/* path relative to the ESP */
+	RUNTIME_INPUT_EFI_APPLICATION,		/* "(partition)path" */
+	RUNTIME_INPUT_ROOTFS_FILE,
+
+	__RUNTIME_INPUT_MAX
+};
+
+typedef struct runtime_input {
+	int		kind;
+	char *		name;
+	char *		fingerprint;
+} runtime_input_t;
+
+typedef struct runtime_input_set {
+	bool		opaque;
+	unsigned int	count;
+	runtime_input_t *inputs;
+} runtime_input_set_t;
+
+extern runtime_input_set_t *runtime_track_inputs(runtime_input_set_t *);
+extern void		runtime_track_efi_application(const char *partition, const char *application);
+extern char *		runtime_input_fingerprint(int kind, const char *name);
+extern const char *	runtime_input_local_path(int kind, const char *name);
+extern const char *	runtime_input_kind_name(int kind);
+extern int		runtime_input_kind_by_name(const char *name);
+extern void		runtime_input_set_add(runtime_input_set_t *, int kind, const char *name, const char *fingerprint);
+extern const runtime_input_t *runtime_input_set_find(const runtime_input_set_t *, int kind, const char *name);
+extern void		runtime_input_set_destroy(runtime_input_set_t *);
+
 extern void		runtime_record_testcase(testcase_t *);
 extern void		runtime_replay_testcase(testcase_t *);
 extern testcase_t *	runtime_get_replay_testcase(void);
@@ -30,6 +30,7 @@
 #include <json_object.h>
 
 #include "sd-boot.h"
+#include "bufparser.h"
 #include "util.h"
 
 static const char *
@@ -215,6 +216,21 @@ done:
 	return result;
 }
 
+/*
+ * Get all boot entries installed for this machine, most recent first
+ */
+uapi_boot_entry_t **
+sdb_get_boot_entries(unsigned int *count_ret)
+{
+	const char *machine_id;
+
+	*count_ret = 0;
+	if ((machine_id = read_machine_id()) == NULL)
+		return NULL;
+
+	return uapi_find_boot_entries(get_valid_kernel_entry_tokens(), machine_id, count_ret);
+}
+
 /*
  * Update the systemd json file
  */
@@ -263,14 +279,11 @@ sdb_policy_entry_set_pcr_mask(struct json_object *entry, unsigned int pcr_mask)
 }
 
 static struct json_object *
-sdb_policy_find_or_create_entry(struct json_object *bank_obj, const void *policy, unsigned int policy_len)
+sdb_policy_find_entry(struct json_object *bank_obj, const char *formatted_policy)
 {
-	char formatted_policy[2 * policy_len + 1];
 	struct json_object *entry;
 	unsigned int i, count;
 
-	print_hex_string_buffer(policy, policy_len, formatted_policy, sizeof(formatted_policy));
-
 	count = json_object_array_length(bank_obj);
 	for (i = 0; i < count; ++i) {
 		struct json_object *child;
@@ -288,6 +301,20 @@ sdb_policy_find_or_create_entry(struct json_object *bank_obj, const void *policy
 			return entry;
 	}
 
+	return NULL;
+}
+
+static struct json_object *
+sdb_policy_find_or_create_entry(struct json_object *bank_obj, const void *policy, unsigned int policy_len)
+{
+	char formatted_policy[2 * policy_len + 1];
+	struct json_object *entry;
+
+	print_hex_string_buffer(policy, policy_len, formatted_policy, sizeof(formatted_policy));
+
+	if ((entry = sdb_policy_find_entry(bank_obj, formatted_policy)) != NULL)
+		return entry;
+
 	entry = json_object_new_object();
 	json_object_array_add(bank_obj, entry);
 
@@ -295,47 +322,75 @@ sdb_policy_find_or_create_entry(struct json_object *bank_obj, const void *policy
 	return entry;
 }
 
-bool
-sdb_policy_file_add_entry(const char *filename, const char *policy_name, const char *algo_name, unsigned int pcr_mask,
-				const void *fingerprint, unsigned int fingerprint_len,
-				const void *policy, unsigned int policy_len,
-				const void *signature, unsigned int signature_len)
+struct sdb_policy_file {
+	char *			filename;
+	struct json_object *	doc;
+};
+
+/*
+ * Load the systemd policy file, or start a new one if it does not exist yet.
+ */
+sdb_policy_file_t *
+sdb_policy_file_open(const char *filename)
 {
+	sdb_policy_file_t *file;
 	struct json_object *doc = NULL;
-	struct json_object *bank_obj = NULL;
-	struct json_object *entry = NULL;
-	bool ok = false;
 
 	if (access(filename, R_OK) == 0) {
 		doc = json_object_from_file(filename);
 		if (doc == NULL) {
 			error("%s: unable to read json file: %s\n", filename, json_util_get_last_err());
-			goto out;
+			return NULL;
 		}
 
 		if (!json_object_is_type(doc, json_type_object)) {
 			error("%s: not a valid json file\n", filename);
-			goto out;
+			json_object_put(doc);
+			return NULL;
 		}
 	} else if (errno == ENOENT) {
 		doc = json_object_new_object();
 	} else {
 		error("Cannot update %s: %m\n", filename);
-		goto out;
+		return NULL;
 	}
 
-	bank_obj = json_object_object_get(doc, algo_name);
+	file = calloc(1, sizeof(*file));
+	file->filename = strdup(filename);
+	file->doc = doc;
+	return file;
+}
+
+void
+sdb_policy_file_free(sdb_policy_file_t *file)
+{
+	if (file->doc)
+		json_object_put(file->doc);
+	drop_string(&file->filename);
+	free(file);
+}
+
+bool
+sdb_policy_file_add(sdb_policy_file_t *file, const char *policy_name, const char *algo_name, unsigned int pcr_mask,
+				const void *fingerprint, unsigned int fingerprint_len,
+				const void *policy, unsigned int policy_len,
+				const void *signature, unsigned int signature_len)
+{
+	struct json_object *bank_obj = NULL;
+	struct json_object *entry = NULL;
+
+	bank_obj = json_object_object_get(file->doc, algo_name);
 	if (bank_obj == NULL) {
 		bank_obj = json_object_new_array();
-		json_object_object_add(doc, algo_name, bank_obj);
+		json_object_object_add(file->doc, algo_name, bank_obj);
 	} else if (!json_object_is_type(bank_obj, json_type_array)) {
-		error("%s: unexpected type for %s\n", filename, algo_name);
-		goto out;
+		error("%s: unexpected type for %s\n", file->filename, algo_name);
+		return false;
 	}
 
 	entry = sdb_policy_find_or_create_entry(bank_obj, policy, policy_len);
 	if (entry == NULL)
-		goto out;
+		return false;
 
 	sdb_policy_entry_set_pcr_mask(entry, pcr_mask);
 	json_object_object_add(entry, "pkfp",
@@ -343,16 +398,90 @@ sdb_policy_file_add_entry(const char *filename, const char *policy_name, const c
 	json_object_object_add(entry, "sig",
 			json_object_new_string(print_base64_value(signature, signature_len)));
 
-	if (json_object_to_file_ext(filename, doc, JSON_C_TO_STRING_PRETTY)) {
-		error("%s: unable to write json file: %s\n", filename, json_util_get_last_err());
-		goto out;
+	return true;
+}
+
+/*
+ * Check whether the policy file already has a signed entry for this policy,
+ * using the same PCRs and the same signing key.
+ */
+bool
+sdb_policy_file_has_entry(const sdb_policy_file_t *file, const char *algo_name, unsigned int pcr_mask,
+				const void *fingerprint, unsigned int fingerprint_len,
+				const void *policy, unsigned int policy_len)
+{
+	char formatted_policy[2 * policy_len + 1];
+	struct json_object *bank_obj, *entry, *child;
+	const char *value;
+	unsigned int entry_mask;
+
+	if (!(bank_obj = json_object_object_get(file->doc, algo_name))
+	 || !json_object_is_type(bank_obj, json_type_array))
+		return false;
+
+	print_hex_string_buffer(policy, policy_len, formatted_policy, sizeof(formatted_policy));
+	if (!(entry = sdb_policy_find_entry(bank_obj, formatted_policy)))
+		return false;
+
+	if (!sdb_policy_entry_get_pcr_mask(entry, &entry_mask) || entry_mask != pcr_mask)
+		return false;
+
+	if (!(child = json_object_object_get(entry, "pkfp"))
+	 || !(value = json_object_get_string(child))
+	 || strcasecmp(value, print_hex_string(fingerprint, fingerprint_len)))
+		return false;
+
+	if (!(child = json_object_object_get(entry, "sig"))
+	 || !(value = json_object_get_string(child))
+	 || *value == '\0')
+		return false;
+
+	return true;
+}
+
+/*
+ * Write the updated policy file in one go, replacing the old file atomically.
+ */
+bool
+sdb_policy_file_commit(sdb_policy_file_t *file)
+{
+	const char *json;
+	buffer_t *bp;
+	bool ok;
+
+	if (!(json = json_object_to_json_string_ext(file->doc, JSON_C_TO_STRING_PRETTY))) {
+		error("%s: unable to format json file\n", file->filename);
+		return false;
 	}
 
-	ok = true;
+	bp = buffer_alloc_write(strlen(json) + 1);
+	buffer_put(bp, json, strlen(json));
+	buffer_put(bp, "\n", 1);
+
+	ok = buffer_write_file_atomic(file->filename, bp);
+	buffer_free(bp);
+
+	return ok;
+}
+
+bool
+sdb_policy_file_add_entry(const char *filename, const char *policy_name, const char *algo_name, unsigned int pcr_mask,
+				const void *fingerprint, unsigned int fingerprint_len,
+				const void *policy, unsigned int policy_len,
+				const void *signature, unsigned int signature_len)
+{
+	sdb_policy_file_t *file;
+	bool ok;
+
+	if (!(file = sdb_policy_file_open(filename)))
+		return false;
 
-out:
-	if (doc)
-		json_object_put(doc);
+	ok = sdb_policy_file_add(file, policy_name, algo_name, pcr_mask,
+			fingerprint, fingerprint_len,
+			policy, policy_len,
+			signature, signature_len)
+	  && sdb_policy_file_commit(file);
 
+	sdb_policy_file_free(file);
 	return ok;
 }
@@ -43,10 +43,29 @@ typedef struct sdb_entry_list {
 } sdb_entry_list_t;
 
 extern uapi_boot_entry_t *	sdb_identify_boot_entry(const char *id);
+extern uapi_boot_entry_t **	sdb_get_boot_entries(unsigned int *count_ret);
 extern bool			sdb_is_boot_entry(const char *application);
 extern bool			sdb_is_kernel(const char *application);
 extern bool			sdb_is_initrd(const char *application);
 
+typedef struct sdb_policy_file sdb_policy_file_t;
+
+extern sdb_policy_file_t *	sdb_policy_file_open(const char *filename);
+extern bool			sdb_policy_file_add(sdb_policy_file_t *,
+						const char *policy_name,
+						const char *algo_name,
+						unsigned int pcr_mask,
+						const void *fingerprint, unsigned int fingerprint_len,
+						const void *policy, unsigned int policy_len,
+						const void *signature, unsigned int signature_len);
+extern bool			sdb_policy_file_has_entry(const sdb_policy_file_t *,
+						const char *algo_name,
+						unsigned int pcr_mask,
+						const void *fingerprint, unsigned int fingerprint_len,
+						const void *policy, unsigned int policy_len);
+extern bool			sdb_policy_file_commit(sdb_policy_file_t *);
+extern void			sdb_policy_file_free(sdb_policy_file_t *);
+
 /* This will have to update the systemd json file, and add a new entry. */
 extern bool			sdb_policy_file_add_entry(const char *filename,
 						const char *policy_name,
@@ -0,0 +1,873 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/un.h>
+
+#include "util.h"
+#include "bufparser.h"
+#include "predictor.h"
+#include "compdb.h"
+#include "runtime.h"
+#include "workers.h"
+#include "serve.h"
+
+struct serve_frame {
+	char			tag[SERVE_FRAME_TAG_LEN + 1];
+	buffer_t *		data;
+};
+
+struct serve_message {
+	unsigned int		count;
+	struct serve_frame	frame[SERVE_MESSAGE_FRAMES_MAX];
+};
+
+static volatile int		serve_terminate = 0;
+
+serve_message_t *
+serve_message_new(void)
+{
+	return calloc(1, sizeof(serve_message_t));
+}
+
+void
+serve_message_free(serve_message_t *msg)
+{
+	unsigned int i;
+
+	for (i = 0; i < msg->count; ++i)
+		buffer_free(msg->frame[i].data);
+	free(msg);
+}
+
+bool
+serve_message_add(serve_message_t *msg, const char *tag, const void *data, unsigned int len)
+{
+	struct serve_frame *frame;
+
+	if (strlen(tag) != SERVE_FRAME_TAG_LEN || len > SERVE_FRAME_SIZE_MAX)
+		return false;
+
+	if (msg->count >= SERVE_MESSAGE_FRAMES_MAX) {
+		error("Too many frames in message\n");
+		return false;
+	}
+
+	frame = &msg->frame[msg->count++];
+	strcpy(frame->tag, tag);
+
+	/* Always NUL terminate the payload, so that we can hand out strings */
+	frame->data = buffer_alloc_write(len + 1);
+	buffer_put(frame->data, data, len);
+	frame->data->data[len] = '\0';
+	return true;
+}
+
+bool
+serve_message_add_string(serve_message_t *msg, const char *tag, const char *value)
+{
+	return serve_message_add(msg, tag, value, strlen(value));
+}
+
+bool
+serve_message_add_buffer(serve_message_t *msg, const char *tag, const buffer_t *bp)
+{
+	return serve_message_add(msg, tag, buffer_read_pointer(bp), buffer_available(bp));
+}
+
+const buffer_t *
+serve_message_get(const serve_message_t *msg, const char *tag, unsigned int nth)
+{
+	unsigned int i;
+
+	for (i = 0; i < msg->count; ++i) {
+		if (!strcmp(msg->frame[i].tag, tag) && nth-- == 0)
+			return msg->frame[i].data;
+	}
+	return NULL;
+}
+
+const char *
+serve_message_get_string(const serve_message_t *msg, const char *tag, unsigned int nth)
+{
+	const buffer_t *bp;
+
+	if (!(bp = serve_message_get(msg, tag, nth)))
+		return NULL;
+
+	return (const char *) buffer_read_pointer(bp);
+}
+
+static bool
+__serve_read(int fd, void *data, unsigned int len, bool eof_okay)
+{
+	unsigned char *p = data;
+	unsigned int done = 0;
+
+	while (done < len) {
+		ssize_t n;
+
+		n = read(fd, p + done, len - done);
+		if (n < 0) {
+			/* Don't wait for a client that takes its time when
+			 * we're told to terminate */
+			if (errno == EINTR && !serve_terminate)
+				continue;
+			error("serve: read error: %m\n");
+			return false;
+		}
+		if (n == 0) {
+			if (!eof_okay || done != 0)
+				error("serve: unexpected end of message\n");
+			return false;
+		}
+		done += n;
+	}
+	return true;
+}
+
+static bool
+__serve_write(int fd, const void *data, unsigned int len)
+{
+	const unsigned char *p = data;
+	unsigned int done = 0;
+
+	while (done < len) {
+		ssize_t n;
+
+		n = write(fd, p + done, len - done);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			error("serve: write error: %m\n");
+			return false;
+		}
+		done += n;
+	}
+	return true;
+}
+
+static serve_message_t *
+__serve_message_recv(int fd, bool *eof_ret)
+{
+	serve_message_t *msg;
+	bool first = true;
+
+	*eof_ret = false;
+
+	msg = serve_message_new();
+	while (true) {
+		unsigned char header[SERVE_FRAME_TAG_LEN + 4];
+		char tag[SERVE_FRAME_TAG_LEN + 1];
+		buffer_t hbuf, *payload;
+		uint32_t len;
+
+		if (!__serve_read(fd, header, sizeof(header), first)) {
+			*eof_ret = first;
+			goto failed;
+		}
+		first = false;
+
+		buffer_init_read(&hbuf, header, sizeof(header));
+		buffer_get(&hbuf, tag, SERVE_FRAME_TAG_LEN);
+		tag[SERVE_FRAME_TAG_LEN] = '\0';
+		buffer_get_u32le(&hbuf, &len);
+
+		if (!strcmp(tag, SERVE_TAG_DONE))
+			break;
+
+		if (len > SERVE_FRAME_SIZE_MAX) {
+			error("serve: frame %s too large (%u bytes)\n", tag, len);
+			goto failed;
+		}
+
+		payload = buffer_alloc_write(len);
+		if (!__serve_read(fd, buffer_write_pointer(payload), len, false)) {
+			buffer_free(payload);
+			goto failed;
+		}
+		payload->wpos = len;
+
+		if (!serve_message_add_buffer(msg, tag, payload)) {
+			buffer_free(payload);
+			goto failed;
+		}
+		buffer_free(payload);
+	}
+
+	return msg;
+
+failed:
+	serve_message_free(msg);
+	return NULL;
+}
+
+/*
+ * Receive a message. Returns NULL on error, or if the peer closed
+ * the connection.
+ */
+serve_message_t *
+serve_message_recv(int fd)
+{
+	bool eof;
+
+	return __serve_message_recv(fd, &eof);
+}
+
+static bool
+__serve_send_frame(int fd, const char *tag, const void *data, unsigned int len)
+{
+	unsigned char header[SERVE_FRAME_TAG_LEN + 4];
+	buffer_t hbuf;
+
+	buffer_init_write(&hbuf, header, sizeof(header));
+	buffer_put(&hbuf, tag, SERVE_FRAME_TAG_LEN);
+	buffer_put_u32le(&hbuf, len);
+
+	return __serve_write(fd, header, sizeof(header))
+	    && __serve_write(fd, data, len);
+}
+
+bool
+serve_message_send(int fd, const serve_message_t *msg)
+{
+	unsigned int i;
+
+	for (i = 0; i < msg->count; ++i) {
+		const struct serve_frame *frame = &msg->frame[i];
+
+		if (!__serve_send_frame(fd, frame->tag,
+					buffer_read_pointer(frame->data),
+					buffer_available(frame->data)))
+			return false;
+	}
+
+	return __serve_send_frame(fd, SERVE_TAG_DONE, NULL, 0);
+}
+
+static serve_message_t *
+serve_error_response(const char *message)
+{
+	serve_message_t *response;
+
+	response = serve_message_new();
+	serve_message_add_string(response, SERVE_TAG_STATUS, "error");
+	serve_message_add_string(response, SERVE_TAG_MESSAGE, message);
+	return response;
+}
+
+static buffer_t *
+serve_read_capture(FILE *fp)
+{
+	buffer_t *bp;
+	long size;
+
+	fflush(fp);
+	if ((size = ftell(fp)) < 0)
+		return NULL;
+
+	rewind(fp);
+	bp = buffer_alloc_write(size);
+	if (size && fread(buffer_write_pointer(bp), size, 1, fp) != 1) {
+		buffer_free(bp);
+		return NULL;
+	}
+	bp->wpos = size;
+	return bp;
+}
+
+/*
+ * fatal() jumps back to serve_call_handler while a request is being handled.
+ * Other threads (such as the PKCS#11 signers) cannot do that, so fatal()
+ * exits the worker as usual there.
+ */
+static sigjmp_buf		serve_fatal_env;
+static pthread_t		serve_fatal_thread;
+
+/* Set when a request failed fatally */
+static bool			serve_worker_tainted = false;
+
+static void
+serve_fatal_handler(void)
+{
+	if (pthread_equal(pthread_self(), serve_fatal_thread))
+		siglongjmp(serve_fatal_env, 1);
+}
+
+/*
+ * Handle one request. The event log parser and large parts of the
+ * prediction code bail out via fatal() when they encounter input they
+ * cannot handle. That must not take down the connection without a
+ * response, and it should not cost us a process for every request
+ * either. So rather than exiting, fatal() returns here, and the reset
+ * callback releases whatever the request left behind.
+ *
+ * Anything written to stderr, including the message from fatal(), is
+ * returned to the client as a MESG frame.
+ */
+static serve_message_t *
+serve_call_handler(const serve_message_t *request, serve_handler_fn_t *handler,
+		serve_reset_fn_t *reset, void *user_data)
+{
+	serve_message_t *response = NULL;
+	buffer_t *messages = NULL;
+	FILE *err_fp;
+	int saved_stderr;
+
+	if (!(err_fp = tmpfile())) {
+		error("Unable to create temporary file: %m\n");
+		return serve_error_response("Unable to create temporary file\n");
+	}
+
+	fflush(stderr);
+	saved_stderr = dup(2);
+	dup2(fileno(err_fp), 2);
+
+	serve_fatal_thread = pthread_self();
+	if (sigsetjmp(serve_fatal_env, 1) == 0) {
+		fatal_handler = serve_fatal_handler;
+		response = handler(request, user_data);
+	} else {
+		/* We release what we know about, but a failed request may
+		 * have left behind state we cannot clean up. */
+		if (reset)
+			reset(user_data);
+		serve_worker_tainted = true;
+		response = NULL;
+	}
+	fatal_handler = NULL;
+
+	fflush(stderr);
+	dup2(saved_stderr, 2);
+	close(saved_stderr);
+
+	if (response == NULL) {
+		response = serve_message_new();
+		serve_message_add_string(response, SERVE_TAG_STATUS, "error");
+	}
+
+	messages = serve_read_capture(err_fp);
+	if (messages && buffer_available(messages))
+		serve_message_add_buffer(response, SERVE_TAG_MESSAGE, messages);
+
+	buffer_free(messages);
+	fclose(err_fp);
+	return response;
+}
+
+/*
+ * Handle all requests on one connection.
+ */
+static void
+serve_connection(int fd, serve_handler_fn_t *handler, serve_reset_fn_t *reset, void *user_data)
+{
+	serve_message_t *request, *response;
+	bool eof;
+
+	while (true) {
+		if (!(request = __serve_message_recv(fd, &eof))) {
+			/* We cannot find the start of the next request after a
+			 * malformed one. Tell the client, and hang up. */
+			if (!eof && !serve_terminate) {
+				response = serve_error_response("Malformed request\n");
+				(void) serve_message_send(fd, response);
+				serve_message_free(response);
+			}
+			break;
+		}
+
+		response = serve_call_handler(request, handler, reset, user_data);
+		serve_message_free(request);
+
+		if (!serve_message_send(fd, response)) {
+			serve_message_free(response);
+			break;
+		}
+		serve_message_free(response);
+	}
+}
+
+/*
+ * Workers stay around for as long as the server runs, and accept one
+ * connection after the other. So everything a worker caches, such as
+ * digests or PKCS#11 sessions, is reused by all requests it handles.
+ * A worker that had a request fail fatally is replaced once it is done
+ * with the current connection.
+ */
+static void
+serve_worker(int sock, serve_handler_fn_t *handler, serve_reset_fn_t *reset, void *user_data)
+{
+	while (!serve_terminate && !serve_worker_tainted) {
+		int fd;
+
+		if ((fd = accept(sock, NULL, NULL)) < 0) {
+			if (errno != EINTR && errno != ECONNABORTED) {
+				error("accept: %m\n");
+				sleep(1);
+			}
+			continue;
+		}
+
+		serve_connection(fd, handler, reset, user_data);
+		close(fd);
+	}
+}
+
+static bool			serve_worker_failed = false;
+
+static void
+serve_worker_done(void *data, int wstatus)
+{
+	if (WIFSIGNALED(wstatus))
+		error("serve: worker killed by signal %d\n", WTERMSIG(wstatus));
+	else if (WIFEXITED(wstatus) && WEXITSTATUS(wstatus) != 0)
+		error("serve: worker exited with status %d\n", WEXITSTATUS(wstatus));
+	else
+		return;
+
+	serve_worker_failed = true;
+}
+
+static void
+serve_signal_handler(int sig)
+{
+	serve_terminate = 1;
+}
+
+/*
+ * Listen on a UNIX socket, and start max_jobs workers that accept and
+ * handle connections. Any state set up before calling this function
+ * (such as loaded keys) is inherited by the workers, so it only needs
+ * to be set up once.
+ */
+bool
+serve_unix_socket(const char *path, unsigned int max_jobs,
+		serve_handler_fn_t *handler, serve_reset_fn_t *reset, void *user_data)
+{
+	struct sockaddr_un sun;
+	struct sigaction sa;
+	struct stat stb;
+	worker_pool_t *pool = NULL;
+	bool okay = false;
+	mode_t omask;
+	int sock, rv;
+
+	if (strlen(path) >= sizeof(sun.sun_path)) {
+		error("Socket path %s too long\n", path);
+		return false;
+	}
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strcpy(sun.sun_path, path);
+
+	if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+		error("Unable to create socket: %m\n");
+		return false;
+	}
+
+	/* Remove a stale socket left behind by a previous instance, but
+	 * nothing else that happens to live at this path */
+	if (lstat(path, &stb) == 0 && S_ISSOCK(stb.st_mode))
+		(void) unlink(path);
+
+	/* Only root should be able to request signed policies. Create the
+	 * socket with the right mode, rather than fixing it up after the fact,
+	 * when somebody else may already have connected. */
+	omask = umask(0177);
+	rv = bind(sock, (struct sockaddr *) &sun, sizeof(sun));
+	umask(omask);
+
+	if (rv < 0) {
+		error("Unable to bind to %s: %m\n", path);
+		close(sock);
+		return false;
+	}
+
+	if (listen(sock, 128) < 0) {
+		error("Unable to listen on %s: %m\n", path);
+		goto out;
+	}
+
+	/* No SA_RESTART, so that blocking calls return when we're told
+	 * to terminate. The workers inherit this. */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = serve_signal_handler;
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	infomsg("Listening on %s\n", path);
+	pool = worker_pool_new(max_jobs);
+	while (!serve_terminate) {
+		pid_t pid;
+
+		/* Start workers until the pool is full, and replace
+		 * workers as they exit */
+		if (!worker_pool_wait_slot(pool)) {
+			if (errno == EINTR)
+				continue;
+			goto out;
+		}
+
+		/* Do not keep restarting workers that fail right away */
+		if (serve_worker_failed) {
+			serve_worker_failed = false;
+			sleep(1);
+		}
+
+		if (serve_terminate)
+			break;
+
+		if ((pid = worker_pool_fork(pool, serve_worker_done, NULL)) < 0) {
+			sleep(1);
+			continue;
+		}
+
+		if (pid == 0) {
+			serve_worker(sock, handler, reset, user_data);
+			_exit(0);
+		}
+	}
+
+	infomsg("Shutting down\n");
+	okay = true;
+
+out:
+	close(sock);
+	(void) unlink(path);
+
+	if (pool) {
+		worker_pool_signal(pool, SIGTERM);
+		worker_pool_free(pool);
+	}
+	return okay;
+}
+
+/*
+ * Serve prediction and signing requests on a UNIX socket.
+ *
+ * The signing key is loaded once before we start listening, so workers
+ * inherit it without having to parse it again.
+ *
+ * Everything a request allocates or changes is recorded in struct
+ * serve_request, so that it can be released even if the request fails
+ * fatally halfway through.
+ */
+#define SERVE_TMPDIR_TEMPLATE	"/tmp/pcr-oracle.XXXXXX"
+
+struct serve_request {
+	char			tmpdir[sizeof(SERVE_TMPDIR_TEMPLATE)];
+	bool			have_tmpdir;
+
+	/* Captures the predicted PCR values written to stdout */
+	FILE *			out_fp;
+	int			saved_stdout;
+
+	tpm_pcr_selection_t *	pcr_selection;
+	runtime_provider_t *	saved_provider;
+	compdb_t *		component_db;
+	compdb_t *		saved_component_db;
+	struct predictor *	pred;
+};
+
+struct serve_context {
+	const target_platform_t *target;
+	pcr_policy_batch_t *	signer;
+
+	struct serve_request	request;
+};
+
+static bool
+serve_tmpdir_path(const char *dir, const char *name, char *path, size_t size)
+{
+	if (snprintf(path, size, "%s/%s", dir, name) >= (int) size) {
+		error("Path name too long: %s/%s\n", dir, name);
+		return false;
+	}
+	return true;
+}
+
+static bool
+serve_write_file(const char *dir, const char *name, const buffer_t *data, char *path, size_t size)
+{
+	buffer_t copy = *data;
+
+	if (!serve_tmpdir_path(dir, name, path, size))
+		return false;
+	return buffer_write_file(path, &copy);
+}
+
+static void
+serve_cleanup_tmpdir(const char *dir)
+{
+	static const char *names[] = { "eventlog", "policy", "components.db", NULL };
+	char path[PATH_MAX];
+	unsigned int i;
+
+	for (i = 0; names[i]; ++i) {
+		if (serve_tmpdir_path(dir, names[i], path, sizeof(path)))
+			(void) unlink(path);
+	}
+	(void) rmdir(dir);
+}
+
+static void
+serve_request_release(struct serve_request *req)
+{
+	/* This also closes the event log reader */
+	if (req->pred) {
+		predictor_free(req->pred);
+		req->pred = NULL;
+	}
+
+	if (req->saved_provider) {
+		runtime_provider_free(runtime_set_provider(req->saved_provider));
+		req->saved_provider = NULL;
+	}
+
+	if (req->component_db) {
+		predictor_set_component_db(req->saved_component_db);
+		compdb_close(req->component_db);
+		req->component_db = NULL;
+		req->saved_component_db = NULL;
+	}
+
+	if (req->pcr_selection) {
+		pcr_selection_free(req->pcr_selection);
+		req->pcr_selection = NULL;
+	}
+
+	if (req->saved_stdout >= 0) {
+		fflush(stdout);
+		dup2(req->saved_stdout, 1);
+		close(req->saved_stdout);
+		req->saved_stdout = -1;
+	}
+
+	if (req->out_fp) {
+		fclose(req->out_fp);
+		req->out_fp = NULL;
+	}
+
+	if (req->have_tmpdir) {
+		serve_cleanup_tmpdir(req->tmpdir);
+		req->have_tmpdir = false;
+	}
+}
+
+static void
+serve_reset_request(void *user_data)
+{
+	struct serve_context *ctx = user_data;
+
+	serve_request_release(&ctx->request);
+}
+
+/*
+ * The client sends the digests of its components as a manifest in the
+ * format used by the component-db action. For this request, they are
+ * used instead of any database the server was started with.
+ */
+static bool
+serve_load_components(struct serve_request *req, const buffer_t *manifest)
+{
+	char db_path[PATH_MAX];
+	compdb_builder_t *builder;
+	FILE *fp;
+	bool okay;
+
+	if (!serve_tmpdir_path(req->tmpdir, "components.db", db_path, sizeof(db_path)))
+		return false;
+
+	if (buffer_available(manifest) == 0) {
+		error("Empty component manifest\n");
+		return false;
+	}
+
+	if (!(fp = fmemopen((void *) buffer_read_pointer(manifest), buffer_available(manifest), "r"))) {
+		error("Unable to read component manifest: %m\n");
+		return false;
+	}
+
+	builder = compdb_builder_new();
+	okay = compdb_builder_parse_manifest(builder, fp, "component manifest")
+	    && compdb_builder_write(builder, db_path);
+	compdb_builder_free(builder);
+	fclose(fp);
+
+	if (!okay || !(req->component_db = compdb_open(db_path)))
+		return false;
+
+	req->saved_component_db = predictor_set_component_db(req->component_db);
+	return true;
+}
+
+static bool
+serve_predict_and_sign(const serve_message_t *request, struct serve_context *ctx,
+		buffer_t **policy_ret, bool *unchanged_ret)
+{
+	struct serve_request *req = &ctx->request;
+	const char *pcrs, *algo, *stop_event;
+	const buffer_t *eventlog, *components, *input;
+	char eventlog_path[PATH_MAX], policy_path[PATH_MAX];
+	unsigned int i;
+
+	if (!(pcrs = serve_message_get_string(request, SERVE_TAG_PCRS, 0))) {
+		error("Request does not specify any PCRs\n");
+		return false;
+	}
+
+	if (!(algo = serve_message_get_string(request, SERVE_TAG_ALGO, 0)))
+		algo = "sha256";
+
+	if (!(req->pcr_selection = pcr_selection_new(algo, pcrs)))
+		return false;
+
+	if (!(eventlog = serve_message_get(request, SERVE_TAG_EVENTLOG, 0))) {
+		error("Request does not contain an event log\n");
+		return false;
+	}
+
+	if (!serve_write_file(req->tmpdir, "eventlog", eventlog, eventlog_path, sizeof(eventlog_path)))
+		return false;
+
+	if ((components = serve_message_get(request, SERVE_TAG_COMPONENTS, 0)) != NULL
+	 && !serve_load_components(req, components))
+		return false;
+
+	if (serve_message_get(request, SERVE_TAG_STOP_EVENT, PREDICTOR_STOP_EVENTS_MAX) != NULL) {
+		error("Too many stop events\n");
+		return false;
+	}
+
+	/* Nothing about the local system is used when predicting for a node */
+	req->saved_provider = runtime_set_provider(runtime_provider_remote_new(NULL));
+
+	req->pred = predictor_new(req->pcr_selection, "eventlog", eventlog_path, "plain", NULL);
+	for (i = 0; (stop_event = serve_message_get_string(request, SERVE_TAG_STOP_EVENT, i)) != NULL; ++i)
+		predictor_add_stop_event(req->pred, stop_event, false);
+
+	if (!predictor_update_all(req->pred, 0, NULL))
+		return false;
+
+	predictor_report(req->pred);
+
+	if (!serve_message_get(request, SERVE_TAG_SIGN, 0))
+		return true;
+
+	if (ctx->signer == NULL) {
+		error("Server has no signing key\n");
+		return false;
+	}
+
+	/* Update the policy file we've been given, or create a new one */
+	if (!serve_tmpdir_path(req->tmpdir, "policy", policy_path, sizeof(policy_path)))
+		return false;
+	if ((input = serve_message_get(request, SERVE_TAG_INPUT, 0)) != NULL
+	 && !serve_write_file(req->tmpdir, "policy", input, policy_path, sizeof(policy_path)))
+		return false;
+
+	pcr_policy_batch_clear(ctx->signer);
+	if (!pcr_policy_batch_add(ctx->signer, predictor_get_prediction(req->pred),
+				serve_message_get_string(request, SERVE_TAG_POLICY_NAME, 0),
+				policy_path)
+	 || !pcr_policy_batch_write(ctx->signer, NULL))
+		return false;
+
+	if (!(*policy_ret = buffer_read_file(policy_path, 0)))
+		return false;
+
+	*unchanged_ret = pcr_policy_batch_unchanged(ctx->signer);
+	return true;
+}
+
+static serve_message_t *
+serve_handle_request(const serve_message_t *request, void *user_data)
+{
+	struct serve_context *ctx = user_data;
+	struct serve_request *req = &ctx->request;
+	serve_message_t *response = NULL;
+	buffer_t *output = NULL, *policy = NULL;
+	bool okay = false, unchanged = false;
+
+	strcpy(req->tmpdir, SERVE_TMPDIR_TEMPLATE);
+	if (mkdtemp(req->tmpdir) == NULL) {
+		error("Unable to create temporary directory: %m\n");
+		goto out;
+	}
+	req->have_tmpdir = true;
+
+	/* Capture the predicted PCR values */
+	if (!(req->out_fp = tmpfile())) {
+		error("Unable to create temporary file: %m\n");
+		goto out;
+	}
+
+	fflush(stdout);
+	req->saved_stdout = dup(1);
+	dup2(fileno(req->out_fp), 1);
+
+	okay = serve_predict_and_sign(request, ctx, &policy, &unchanged);
+
+	fflush(stdout);
+	output = serve_read_capture(req->out_fp);
+
+	response = serve_message_new();
+	serve_message_add_string(response, SERVE_TAG_STATUS,
+			!okay? "error" : unchanged? "unchanged" : "ok");
+	if (okay && output)
+		serve_message_add_buffer(response, SERVE_TAG_PCR_VALUES, output);
+	if (okay && policy)
+		serve_message_add_buffer(response, SERVE_TAG_SIGNED_POLICY, policy);
+
+out:
+	buffer_free(output);
+	buffer_free(policy);
+	serve_request_release(req);
+	return response;
+}
+
+int
+serve_predictor(const target_platform_t *target, const stored_key_t *private_key_file,
+		const char *socket_path, unsigned int max_jobs)
+{
+	struct serve_context ctx = {
+		.target = target,
+		.request.saved_stdout = -1,
+	};
+
+	if (private_key_file && !(ctx.signer = pcr_policy_batch_new(target, private_key_file)))
+		return 1;
+
+	if (!serve_unix_socket(socket_path, max_jobs, serve_handle_request, serve_reset_request, &ctx))
+		return 1;
+
+	if (ctx.signer)
+		pcr_policy_batch_free(ctx.signer);
+	return 0;
+}
@@ -0,0 +1,82 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef SERVE_H
+#define SERVE_H
+
+#include "types.h"
+
+#define SERVE_DEFAULT_SOCKET		"/run/pcr-oracle.sock"
+
+/*
+ * Messages exchanged over the serve socket consist of a sequence of
+ * frames. Each frame starts with a 4 character tag and a 32bit little
+ * endian length, followed by the payload. A message is terminated by
+ * a frame with tag "DONE" and no payload.
+ */
+#define SERVE_FRAME_TAG_LEN		4
+#define SERVE_FRAME_SIZE_MAX		(16 * 1024 * 1024)
+#define SERVE_MESSAGE_FRAMES_MAX	64
+
+/* Request frames */
+#define SERVE_TAG_PCRS			"PCRS"	/* PCR index list, eg "0,2,4,7" */
+#define SERVE_TAG_ALGO			"ALGO"	/* hash algorithm, defaults to sha256 */
+#define SERVE_TAG_EVENTLOG		"ELOG"	/* binary TPM event log */
+#define SERVE_TAG_COMPONENTS		"COMP"	/* component manifest, as used by component-db */
+#define SERVE_TAG_STOP_EVENT		"STOP"	/* stop event, as with --stop-event */
+#define SERVE_TAG_POLICY_NAME		"NAME"	/* policy name when signing */
+#define SERVE_TAG_INPUT			"INPT"	/* existing policy file to update when signing */
+#define SERVE_TAG_SIGN			"SIGN"	/* request a signed policy */
+
+/* Response frames */
+#define SERVE_TAG_STATUS		"STAT"	/* "ok", "unchanged" or "error" */
+#define SERVE_TAG_MESSAGE		"MESG"	/* diagnostic output */
+#define SERVE_TAG_PCR_VALUES		"PCRV"	/* predicted PCR values */
+#define SERVE_TAG_SIGNED_POLICY		"SPOL"	/* signed policy file */
+
+#define SERVE_TAG_DONE			"DONE"
+
+typedef struct serve_message	serve_message_t;
+
+typedef serve_message_t *	serve_handler_fn_t(const serve_message_t *request, void *user_data);
+/* Called when a request failed fatally, to release what it left behind */
+typedef void			serve_reset_fn_t(void *user_data);
+
+extern serve_message_t *	serve_message_new(void);
+extern void			serve_message_free(serve_message_t *);
+extern bool			serve_message_add(serve_message_t *, const char *tag,
+					const void *data, unsigned int len);
+extern bool			serve_message_add_string(serve_message_t *, const char *tag,
+					const char *value);
+extern bool			serve_message_add_buffer(serve_message_t *, const char *tag,
+					const buffer_t *bp);
+extern const buffer_t *		serve_message_get(const serve_message_t *, const char *tag,
+					unsigned int nth);
+extern const char *		serve_message_get_string(const serve_message_t *, const char *tag,
+					unsigned int nth);
+
+extern serve_message_t *	serve_message_recv(int fd);
+extern bool			serve_message_send(int fd, const serve_message_t *);
+
+extern bool			serve_unix_socket(const char *path, unsigned int max_jobs,
+					serve_handler_fn_t *handler, serve_reset_fn_t *reset,
+					void *user_data);
+extern int			serve_predictor(const target_platform_t *, const stored_key_t *private_key_file,
+					const char *socket_path, unsigned int max_jobs);
+
+#endif /* SERVE_H */
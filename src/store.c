@@ -23,6 +23,7 @@
 #include "store.h"
 #include "util.h"
 #include "tpm.h"
+#include "pkcs11.h"
 
 /* We do not have automatic conversion of TPM2B_PUBLIC to RSA yet (and so far we haven't needed it) */
 #undef WITH_NATIVE_TO_RSA_CONVERSTION
@@ -33,6 +34,9 @@ stored_key_read_rsa_private(const stored_key_t *sk)
 	switch (sk->format) {
 	case STORED_KEY_FMT_PEM:
 		return tpm_rsa_key_read_private(sk->path);
+
+	case STORED_KEY_FMT_PKCS11:
+		return tpm_rsa_key_open_pkcs11(sk->path);
 	}
 
 	error("Unable to read RSA private key from file \"%s\": unsupported format\n", sk->path);
@@ -71,6 +75,9 @@ stored_key_read_rsa_public(const stored_key_t *sk)
 	case STORED_KEY_FMT_PEM:
 		return tpm_rsa_key_read_public(sk->path);
 
+	case STORED_KEY_FMT_PKCS11:
+		return tpm_rsa_key_open_pkcs11(sk->path);
+
 	case STORED_KEY_FMT_NATIVE:
 		error("Unable to read RSA public key from native file \"%s\": automatic conversion not implemented\n", sk->path);
 		return NULL;
@@ -121,6 +128,7 @@ stored_key_read_native_public(const stored_key_t *sk)
 		return tss_read_public_key(sk->path);
 
 	case STORED_KEY_FMT_PEM:
+	case STORED_KEY_FMT_PKCS11:
 		{
 			tpm_rsa_key_t *rsa_key;
 			TPM2B_PUBLIC *native_key;
@@ -169,6 +177,8 @@ stored_key_format_to_name(int fmt)
 		return "PEM";
 	case STORED_KEY_FMT_NATIVE:
 		return "native";
+	case STORED_KEY_FMT_PKCS11:
+		return "PKCS#11";
 	}
 
 	return "<unknown>";
@@ -192,6 +202,10 @@ stored_key_set_path(stored_key_t *sk, const char *pathname)
 	if (pathname == NULL)
 		fatal("%s: pathname is NULL\n", __func__);
 
+	/* The URI is passed to the PKCS#11 code as a whole */
+	if (pkcs11_is_uri(pathname)) {
+		stored_key_set_format(sk, STORED_KEY_FMT_PKCS11);
+	} else
 	if (!strncasecmp(pathname, "pem:", 4)) {
 		stored_key_set_format(sk, STORED_KEY_FMT_PEM);
 		pathname += 4;
@@ -30,6 +30,7 @@
 enum {
 	STORED_KEY_FMT_PEM		= 1,
 	STORED_KEY_FMT_NATIVE	= 2,	/* TSS marshaled */
+	STORED_KEY_FMT_PKCS11	= 3,	/* pkcs11: URI of a key on a token */
 };
 
 struct stored_key {
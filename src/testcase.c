@@ -107,12 +107,24 @@ testcase_mkdir_p(char *path)
 	return false;
 }
 
+/*
+ * Build directory/name in the given buffer. Truncating a path would make us
+ * read or write the wrong file.
+ */
+static const char *
+testcase_path(char *buf, size_t size, const char *directory, const char *name)
+{
+	if (snprintf(buf, size, "%s/%s", directory, name) >= (int) size)
+		fatal("Path name too long: %s/%s\n", directory, name);
+	return buf;
+}
+
 static inline char *
 testcase_make_subdir(testcase_t *tc, const char *relative)
 {
 	char path[PATH_MAX];
 
-	snprintf(path, sizeof(path), "%s/%s", tc->base_directory, relative);
+	testcase_path(path, sizeof(path), tc->base_directory, relative);
 	if (!testcase_mkdir_p(path))
 		fatal("Unable to create directory %s\n", path);
 
@@ -124,7 +136,7 @@ testcase_make_file(testcase_t *tc, const char *relative)
 {
 	char path[PATH_MAX];
 
-	snprintf(path, sizeof(path), "%s/%s", tc->base_directory, relative);
+	testcase_path(path, sizeof(path), tc->base_directory, relative);
 	return strdup(path);
 }
 
@@ -134,7 +146,7 @@ testcase_create_file(const char *directory, const char *name)
 	char path[PATH_MAX];
 	int fd;
 
-	snprintf(path, sizeof(path), "%s/%s", directory, name);
+	testcase_path(path, sizeof(path), directory, name);
 	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
 	if (fd < 0 && errno == ENOENT) {
 		char *s;
@@ -160,7 +172,7 @@ testcase_open_file(const char *directory, const char *name)
 	char path[PATH_MAX];
 	int fd;
 
-	snprintf(path, sizeof(path), "%s/%s", directory, name);
+	testcase_path(path, sizeof(path), directory, name);
 	fd = open(path, O_RDONLY);
 	if (fd < 0)
 		fatal("Unable to open %s: %m\n", path);
@@ -173,7 +185,7 @@ testcase_create_symlink(const char *directory, const char *name, const char *tar
 {
 	char path[PATH_MAX];
 
-	snprintf(path, sizeof(path), "%s/%s", directory, name);
+	testcase_path(path, sizeof(path), directory, name);
 	(void) unlink(path);
 	if (symlink(target, path) < 0)
 		fatal("Cannot create symlink %s -> %s: %m\n", path, target);
@@ -183,13 +195,15 @@ static char *
 testcase_read_symlink(const char *directory, const char *name, const char *default_dir)
 {
 	char path[PATH_MAX], target[PATH_MAX], result[PATH_MAX];
+	ssize_t len;
 
-	snprintf(path, sizeof(path), "%s/%s", directory, name);
-	if (readlink(path, target, sizeof(target)) < 0)
+	testcase_path(path, sizeof(path), directory, name);
+	if ((len = readlink(path, target, sizeof(target) - 1)) < 0)
 		fatal("Cannot read symlink %s: %m\n", path);
+	target[len] = '\0';
 
 	if (target[0] != '/' && default_dir) {
-		snprintf(result, sizeof(result), "%s/%s", default_dir, target);
+		testcase_path(result, sizeof(result), default_dir, target);
 		return strdup(result);
 	}
 
@@ -228,7 +242,7 @@ __testcase_read_file(const char *directory, const char *name, int flags)
 {
 	char path[PATH_MAX];
 
-	snprintf(path, sizeof(path), "%s/%s", directory, name);
+	testcase_path(path, sizeof(path), directory, name);
 	return runtime_read_file(path, flags);
 }
 
@@ -259,6 +273,42 @@ testcase_alloc(const char *dirpath)
 	return tc;
 }
 
+static char *
+testcase_subdir(testcase_t *tc, const char *relative)
+{
+	char path[PATH_MAX];
+
+	testcase_path(path, sizeof(path), tc->base_directory, relative);
+	return strdup(path);
+}
+
+/*
+ * Open an existing testcase for playback only. Unlike testcase_alloc(),
+ * this does not create any directories, so it can be used on read-only
+ * input bundles.
+ */
+testcase_t *
+testcase_open(const char *dirpath)
+{
+	testcase_t *tc;
+	struct stat stb;
+
+	if (stat(dirpath, &stb) < 0 || !S_ISDIR(stb.st_mode))
+		fatal("%s: not a directory\n", dirpath);
+
+	tc = calloc(1, sizeof(*tc));
+	assign_string(&tc->base_directory, dirpath);
+
+	tc->efi_directory = testcase_subdir(tc, "efivars");
+	tc->bsa_directory = testcase_subdir(tc, "images");
+	tc->gpt_directory = testcase_subdir(tc, "gpts");
+	tc->partition_directory = testcase_subdir(tc, "partitions");
+	tc->disk_directory = testcase_subdir(tc, "disks");
+	tc->hash_log = testcase_make_file(tc, "hash.log");
+
+	return tc;
+}
+
 void
 testcase_free(testcase_t *tc)
 {
@@ -335,7 +385,7 @@ testcase_record_efi_application(testcase_t *tc, const char *partition, const cha
 
 	partition = get_basename(partition);
 
-	snprintf(path, sizeof path, "%s/%s", partition, application);
+	testcase_path(path, sizeof(path), partition, application);
 	testcase_write_file(tc->bsa_directory, path, data);
 }
 
@@ -346,7 +396,7 @@ testcase_playback_efi_application(testcase_t *tc, const char *partition, const c
 
 	partition = get_basename(partition);
 
-	snprintf(path, sizeof path, "%s/%s", partition, application);
+	testcase_path(path, sizeof(path), partition, application);
 	return testcase_read_file(tc->bsa_directory, path);
 }
 
@@ -380,6 +430,19 @@ testcase_playback_partition_disk(testcase_t *tc, const char *dev_path)
 	return testcase_read_symlink(tc->disk_directory, dev_path, "/dev");
 }
 
+void
+testcase_record_shim_vendor_cert(testcase_t *tc, const buffer_t *data)
+{
+	testcase_write_file(tc->base_directory, "shim-vendor-cert.der", data);
+}
+
+buffer_t *
+testcase_playback_shim_vendor_cert(testcase_t *tc)
+{
+	return __testcase_read_file(tc->base_directory, "shim-vendor-cert.der",
+				    RUNTIME_MISSING_FILE_OKAY);
+}
+
 testcase_block_dev_t *
 testcase_record_block_dev(testcase_t *tc, const char *dev_path)
 {
@@ -26,6 +26,7 @@
 typedef struct testcase_block_dev testcase_block_dev_t;
 
 extern testcase_t *		testcase_alloc(const char *dirpath);
+extern testcase_t *		testcase_open(const char *dirpath);
 extern void			testcase_free(testcase_t *);
 extern void			testcase_record_sysfs_file(testcase_t *tc, const char *, const char *);
 extern void			testcase_record_efi_variable(testcase_t *, const char *name, const buffer_t *);
@@ -42,6 +43,8 @@ extern buffer_t *		testcase_playback_efi_application(testcase_t *, const char *p
 extern char *			testcase_playback_partition_uuid(testcase_t *, const char *uuid);
 extern char *			testcase_playback_partition_disk(testcase_t *, const char *dev_name);
 extern int			testcase_playback_block_dev(testcase_t *, const char *dev_path);
+extern void			testcase_record_shim_vendor_cert(testcase_t *, const buffer_t *);
+extern buffer_t *		testcase_playback_shim_vendor_cert(testcase_t *);
 
 extern void			testcase_record_rootfs_digest(testcase_t *, const char *path, const tpm_evdigest_t *md);
 extern const tpm_evdigest_t *	testcase_playback_rootfs_digest(testcase_t *, const char *path, const tpm_algo_info_t *algo);
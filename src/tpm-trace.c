@@ -0,0 +1,456 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <tss2_tcti.h>
+
+#include "tpm-trace.h"
+#include "util.h"
+
+#define TPM_TRACE_TCTI_MAGIC	0x7063726f74726163ULL
+
+/* Size of the TPM command and response header: tag, size, code */
+#define TPM_HEADER_SIZE		10
+
+enum {
+	TPM_TRACE_SUMMARY,
+	TPM_TRACE_JSON,
+};
+
+struct tpm_trace_record {
+	TPM2_CC			cc;
+	unsigned int		cmd_size;
+	unsigned int		rsp_size;
+	double			start;
+	double			latency;
+	TSS2_RC			rc;
+};
+
+struct tpm_trace_stats {
+	TPM2_CC			cc;
+	unsigned int		count;
+	unsigned int		errors;
+	double			total;
+	double			min;
+	double			max;
+	unsigned long		cmd_bytes;
+	unsigned long		rsp_bytes;
+};
+
+struct tpm_trace_tcti {
+	TSS2_TCTI_CONTEXT_COMMON_V2 common;
+	TSS2_TCTI_CONTEXT *	real;
+
+	/* The command currently in flight */
+	bool			pending;
+	TPM2_CC			cc;
+	unsigned int		cmd_size;
+	double			start;
+};
+
+static struct tpm_trace {
+	bool			enabled;
+	int			format;
+	const char *		path;
+	double			start;
+
+	unsigned int		count;
+	struct tpm_trace_record *records;
+} tpm_trace;
+
+static const struct {
+	TPM2_CC			cc;
+	const char *		name;
+} tpm_command_names[] = {
+#define CC(name)	{ TPM2_CC_##name, #name }
+	CC(EvictControl),
+	CC(CreatePrimary),
+	CC(SelfTest),
+	CC(Startup),
+	CC(NV_Read),
+	CC(PolicySecret),
+	CC(Create),
+	CC(Import),
+	CC(Load),
+	CC(Sign),
+	CC(Unseal),
+	CC(PolicySigned),
+	CC(ContextLoad),
+	CC(ContextSave),
+	CC(FlushContext),
+	CC(LoadExternal),
+	CC(PolicyAuthorize),
+	CC(PolicyAuthValue),
+	CC(PolicyOR),
+	CC(ReadPublic),
+	CC(StartAuthSession),
+	CC(VerifySignature),
+	CC(GetCapability),
+	CC(GetRandom),
+	CC(Hash),
+	CC(PCR_Read),
+	CC(PolicyPCR),
+	CC(PolicyRestart),
+	CC(PCR_Extend),
+	CC(PolicyGetDigest),
+	CC(TestParms),
+	CC(PolicyPassword),
+	CC(CreateLoaded),
+#undef CC
+};
+
+const char *
+tpm_command_name(TPM2_CC cc)
+{
+	static char namebuf[16];
+	unsigned int i;
+
+	for (i = 0; i < sizeof(tpm_command_names) / sizeof(tpm_command_names[0]); ++i) {
+		if (tpm_command_names[i].cc == cc)
+			return tpm_command_names[i].name;
+	}
+
+	snprintf(namebuf, sizeof(namebuf), "0x%x", cc);
+	return namebuf;
+}
+
+static uint32_t
+tpm_header_get_u32(const uint8_t *hdr, unsigned int offset)
+{
+	return ((uint32_t) hdr[offset] << 24) | (hdr[offset + 1] << 16) | (hdr[offset + 2] << 8) | hdr[offset + 3];
+}
+
+static void
+tpm_trace_record(TPM2_CC cc, unsigned int cmd_size, unsigned int rsp_size, double start, TSS2_RC rc)
+{
+	struct tpm_trace_record *rec;
+
+	if ((tpm_trace.count % 64) == 0) {
+		tpm_trace.records = realloc(tpm_trace.records,
+				(tpm_trace.count + 64) * sizeof(tpm_trace.records[0]));
+		if (tpm_trace.records == NULL)
+			fatal("Out of memory\n");
+	}
+
+	rec = &tpm_trace.records[tpm_trace.count++];
+	rec->cc = cc;
+	rec->cmd_size = cmd_size;
+	rec->rsp_size = rsp_size;
+	rec->start = start - tpm_trace.start;
+	rec->latency = timing_since(start);
+	rec->rc = rc;
+}
+
+/*
+ * The TCTI wrapper
+ */
+static inline struct tpm_trace_tcti *
+tpm_trace_tcti(TSS2_TCTI_CONTEXT *tcti)
+{
+	return (struct tpm_trace_tcti *) tcti;
+}
+
+static TSS2_RC
+tpm_trace_transmit(TSS2_TCTI_CONTEXT *tcti, size_t size, uint8_t const *command)
+{
+	struct tpm_trace_tcti *trace = tpm_trace_tcti(tcti);
+	TSS2_RC rc;
+
+	trace->cc = 0;
+	if (size >= TPM_HEADER_SIZE)
+		trace->cc = tpm_header_get_u32(command, 6);
+	trace->cmd_size = size;
+	trace->start = timing_begin();
+
+	rc = Tss2_Tcti_Transmit(trace->real, size, command);
+	if (rc != TSS2_RC_SUCCESS) {
+		tpm_trace_record(trace->cc, size, 0, trace->start, rc);
+		trace->pending = false;
+	} else {
+		trace->pending = true;
+	}
+	return rc;
+}
+
+static TSS2_RC
+tpm_trace_receive(TSS2_TCTI_CONTEXT *tcti, size_t *size, uint8_t *response, int32_t timeout)
+{
+	struct tpm_trace_tcti *trace = tpm_trace_tcti(tcti);
+	TSS2_RC rc;
+
+	rc = Tss2_Tcti_Receive(trace->real, size, response, timeout);
+
+	/* Callers may query the response size first, or poll with a timeout */
+	if (!trace->pending || response == NULL || rc == TSS2_TCTI_RC_TRY_AGAIN)
+		return rc;
+
+	if (rc == TSS2_RC_SUCCESS && *size >= TPM_HEADER_SIZE)
+		tpm_trace_record(trace->cc, trace->cmd_size, *size, trace->start,
+				tpm_header_get_u32(response, 6));
+	else
+		tpm_trace_record(trace->cc, trace->cmd_size, 0, trace->start, rc);
+	trace->pending = false;
+	return rc;
+}
+
+static void
+tpm_trace_finalize(TSS2_TCTI_CONTEXT *tcti)
+{
+	struct tpm_trace_tcti *trace = tpm_trace_tcti(tcti);
+
+	Tss2_Tcti_Finalize(trace->real);
+}
+
+static TSS2_RC
+tpm_trace_cancel(TSS2_TCTI_CONTEXT *tcti)
+{
+	return Tss2_Tcti_Cancel(tpm_trace_tcti(tcti)->real);
+}
+
+static TSS2_RC
+tpm_trace_get_poll_handles(TSS2_TCTI_CONTEXT *tcti, TSS2_TCTI_POLL_HANDLE *handles, size_t *num_handles)
+{
+	return Tss2_Tcti_GetPollHandles(tpm_trace_tcti(tcti)->real, handles, num_handles);
+}
+
+static TSS2_RC
+tpm_trace_set_locality(TSS2_TCTI_CONTEXT *tcti, uint8_t locality)
+{
+	return Tss2_Tcti_SetLocality(tpm_trace_tcti(tcti)->real, locality);
+}
+
+static TSS2_RC
+tpm_trace_make_sticky(TSS2_TCTI_CONTEXT *tcti, TPM2_HANDLE *handle, uint8_t sticky)
+{
+	return Tss2_Tcti_MakeSticky(tpm_trace_tcti(tcti)->real, handle, sticky);
+}
+
+TSS2_TCTI_CONTEXT *
+tpm_trace_wrap_tcti(TSS2_TCTI_CONTEXT *real)
+{
+	struct tpm_trace_tcti *trace;
+
+	trace = calloc(1, sizeof(*trace));
+	if (trace == NULL)
+		fatal("Out of memory\n");
+
+	trace->common.v1.magic = TPM_TRACE_TCTI_MAGIC;
+	trace->common.v1.version = 2;
+	trace->common.v1.transmit = tpm_trace_transmit;
+	trace->common.v1.receive = tpm_trace_receive;
+	trace->common.v1.finalize = tpm_trace_finalize;
+	trace->common.v1.cancel = tpm_trace_cancel;
+	trace->common.v1.getPollHandles = tpm_trace_get_poll_handles;
+	trace->common.v1.setLocality = tpm_trace_set_locality;
+	trace->common.makeSticky = tpm_trace_make_sticky;
+	trace->real = real;
+
+	return (TSS2_TCTI_CONTEXT *) trace;
+}
+
+/*
+ * Reporting
+ */
+static int
+tpm_trace_stats_compare(const void *a, const void *b)
+{
+	const struct tpm_trace_stats *sa = a, *sb = b;
+
+	if (sa->total > sb->total)
+		return -1;
+	if (sa->total < sb->total)
+		return 1;
+	return 0;
+}
+
+static unsigned int
+tpm_trace_build_stats(struct tpm_trace_stats *stats, double *total_time)
+{
+	unsigned int i, j, num_stats = 0;
+
+	*total_time = 0;
+	for (i = 0; i < tpm_trace.count; ++i) {
+		const struct tpm_trace_record *rec = &tpm_trace.records[i];
+		struct tpm_trace_stats *st = NULL;
+
+		for (j = 0; j < num_stats && st == NULL; ++j) {
+			if (stats[j].cc == rec->cc)
+				st = &stats[j];
+		}
+
+		if (st == NULL) {
+			st = &stats[num_stats++];
+			memset(st, 0, sizeof(*st));
+			st->cc = rec->cc;
+			st->min = rec->latency;
+		}
+
+		st->count++;
+		if (rec->rc != TSS2_RC_SUCCESS)
+			st->errors++;
+		st->total += rec->latency;
+		if (rec->latency < st->min)
+			st->min = rec->latency;
+		if (rec->latency > st->max)
+			st->max = rec->latency;
+		st->cmd_bytes += rec->cmd_size;
+		st->rsp_bytes += rec->rsp_size;
+
+		*total_time += rec->latency;
+	}
+
+	qsort(stats, num_stats, sizeof(stats[0]), tpm_trace_stats_compare);
+	return num_stats;
+}
+
+static void
+tpm_trace_write_summary(FILE *fp, const struct tpm_trace_stats *stats, unsigned int num_stats,
+		double total_time, double run_time)
+{
+	unsigned int i;
+
+	fprintf(fp, "TPM command trace: %u commands, %.3f ms in TPM, %.3f ms total run time\n",
+			tpm_trace.count, 1e3 * total_time, 1e3 * run_time);
+	fprintf(fp, "%-20s %6s %10s %9s %9s %9s %9s %9s %6s\n",
+			"Command", "Count", "Total ms", "Avg ms", "Min ms", "Max ms",
+			"Cmd bytes", "Rsp bytes", "Errors");
+
+	for (i = 0; i < num_stats; ++i) {
+		const struct tpm_trace_stats *st = &stats[i];
+
+		fprintf(fp, "%-20s %6u %10.3f %9.3f %9.3f %9.3f %9lu %9lu %6u\n",
+				tpm_command_name(st->cc), st->count,
+				1e3 * st->total, 1e3 * st->total / st->count,
+				1e3 * st->min, 1e3 * st->max,
+				st->cmd_bytes, st->rsp_bytes, st->errors);
+	}
+}
+
+static void
+tpm_trace_write_json(FILE *fp, const struct tpm_trace_stats *stats, unsigned int num_stats,
+		double total_time, double run_time)
+{
+	unsigned int i;
+
+	fprintf(fp, "{\n");
+	fprintf(fp, "  \"run_time_ms\": %.3f,\n", 1e3 * run_time);
+	fprintf(fp, "  \"tpm_time_ms\": %.3f,\n", 1e3 * total_time);
+
+	fprintf(fp, "  \"commands\": [");
+	for (i = 0; i < tpm_trace.count; ++i) {
+		const struct tpm_trace_record *rec = &tpm_trace.records[i];
+
+		fprintf(fp, "%s\n    { \"seq\": %u, \"command\": \"%s\", \"code\": \"0x%x\", "
+				"\"command_size\": %u, \"response_size\": %u, "
+				"\"start_ms\": %.3f, \"latency_ms\": %.3f, \"rc\": \"0x%x\" }",
+				i? "," : "", i, tpm_command_name(rec->cc), rec->cc,
+				rec->cmd_size, rec->rsp_size,
+				1e3 * rec->start, 1e3 * rec->latency, rec->rc);
+	}
+	fprintf(fp, "\n  ],\n");
+
+	fprintf(fp, "  \"summary\": [");
+	for (i = 0; i < num_stats; ++i) {
+		const struct tpm_trace_stats *st = &stats[i];
+
+		fprintf(fp, "%s\n    { \"command\": \"%s\", \"count\": %u, \"total_ms\": %.3f, "
+				"\"min_ms\": %.3f, \"max_ms\": %.3f, "
+				"\"command_bytes\": %lu, \"response_bytes\": %lu, \"errors\": %u }",
+				i? "," : "", tpm_command_name(st->cc), st->count, 1e3 * st->total,
+				1e3 * st->min, 1e3 * st->max,
+				st->cmd_bytes, st->rsp_bytes, st->errors);
+	}
+	fprintf(fp, "\n  ]\n");
+	fprintf(fp, "}\n");
+}
+
+static void
+tpm_trace_report(void)
+{
+	struct tpm_trace_stats *stats;
+	unsigned int num_stats;
+	double total_time, run_time;
+	FILE *fp = stderr;
+
+	if (tpm_trace.path) {
+		if (!(fp = fopen(tpm_trace.path, "w"))) {
+			error("Unable to open %s for writing: %m\n", tpm_trace.path);
+			return;
+		}
+	}
+
+	run_time = timing_since(tpm_trace.start);
+
+	stats = calloc(tpm_trace.count + 1, sizeof(stats[0]));
+	num_stats = tpm_trace_build_stats(stats, &total_time);
+
+	if (tpm_trace.format == TPM_TRACE_JSON)
+		tpm_trace_write_json(fp, stats, num_stats, total_time, run_time);
+	else
+		tpm_trace_write_summary(fp, stats, num_stats, total_time, run_time);
+
+	free(stats);
+
+	if (fp != stderr)
+		fclose(fp);
+}
+
+/*
+ * Enable tracing. The spec is the output format ("summary" or "json"),
+ * optionally followed by a colon and the path of the file to write the
+ * report to. By default, the report goes to stderr.
+ */
+bool
+tpm_trace_enable(const char *spec)
+{
+	const char *path = NULL;
+	char *format, *s;
+
+	format = strdup(spec);
+	if ((s = strchr(format, ':')) != NULL) {
+		*s++ = '\0';
+		path = s;
+	}
+
+	if (!strcmp(format, "summary"))
+		tpm_trace.format = TPM_TRACE_SUMMARY;
+	else if (!strcmp(format, "json"))
+		tpm_trace.format = TPM_TRACE_JSON;
+	else {
+		error("Unknown TPM trace format \"%s\"\n", format);
+		free(format);
+		return false;
+	}
+
+	tpm_trace.path = path;
+	tpm_trace.start = timing_begin();
+
+	if (!tpm_trace.enabled)
+		atexit(tpm_trace_report);
+	tpm_trace.enabled = true;
+	return true;
+}
+
+bool
+tpm_trace_enabled(void)
+{
+	return tpm_trace.enabled;
+}
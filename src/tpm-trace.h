@@ -0,0 +1,36 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef TPM_TRACE_H
+#define TPM_TRACE_H
+
+#include <stdbool.h>
+#include <tss2_tcti.h>
+
+/*
+ * TPM command tracing. When enabled, the TCTI used by the ESYS context
+ * is wrapped in a TCTI that records code, size, latency and response
+ * code of every command sent to the TPM. The trace is reported when
+ * pcr-oracle exits.
+ */
+extern bool			tpm_trace_enable(const char *spec);
+extern bool			tpm_trace_enabled(void);
+extern TSS2_TCTI_CONTEXT *	tpm_trace_wrap_tcti(TSS2_TCTI_CONTEXT *real);
+extern const char *		tpm_command_name(TPM2_CC cc);
+
+#endif /* TPM_TRACE_H */
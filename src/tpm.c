@@ -33,6 +33,7 @@
 
 #include "oracle.h"
 #include "tpm.h"
+#include "tpm-trace.h"
 #include "util.h"
 #include "config.h"
 
@@ -58,18 +59,85 @@ tss_print_error(int rc, const char *msg)
 }
 
 
+/*
+ * The TCTI configuration string, as understood by Tss2_TctiLdr_Initialize,
+ * eg "device:/dev/tpmrm0", "tabrmd" or "swtpm:host=localhost,port=2321".
+ * If not set, we use the PCR_ORACLE_TCTI environment variable, and
+ * fall back to the tss2 default.
+ */
+static const char *	tss_tcti_conf;
+
+static struct {
+	ESYS_CONTEXT *	esys_ctx;
+	TSS2_TCTI_CONTEXT *tcti;
+	pid_t		owner;
+} tss_connection;
+
+void
+tpm_set_tcti(const char *conf)
+{
+	if (tss_connection.esys_ctx != NULL)
+		fatal("%s: TPM connection already established\n", __func__);
+	tss_tcti_conf = conf;
+}
+
+static void
+tss_esys_finalize(void)
+{
+	/* Do not close a connection inherited from our parent process */
+	if (tss_connection.esys_ctx == NULL || tss_connection.owner != getpid())
+		return;
+
+	Esys_Finalize(&tss_connection.esys_ctx);
+	if (tss_connection.tcti)
+		Tss2_TctiLdr_Finalize(&tss_connection.tcti);
+}
+
+/*
+ * All TPM operations of one run share a single ESYS context, and hence a
+ * single connection to the TPM. A worker process forked off by "serve"
+ * must not use the connection of its parent, so it gets its own.
+ */
 ESYS_CONTEXT *
 tss_esys_context(void)
 {
-	static ESYS_CONTEXT  *esys_ctx;
+	static bool cleanup_registered = false;
+	ESYS_CONTEXT *esys_ctx = tss_connection.esys_ctx;
+
+	if (esys_ctx != NULL && tss_connection.owner != getpid())
+		esys_ctx = NULL;
 
 	if (esys_ctx == NULL) {
+		const char *tcti_conf = tss_tcti_conf;
+		TSS2_TCTI_CONTEXT *tcti = NULL;
 		TSS2_RC rc;
 
-		rc = Esys_Initialize(&esys_ctx, NULL, NULL);
+		if (tcti_conf == NULL)
+			tcti_conf = getenv("PCR_ORACLE_TCTI");
+
+		if (tcti_conf != NULL || tpm_trace_enabled()) {
+			debug("Using TCTI %s\n", tcti_conf? : "default");
+			rc = Tss2_TctiLdr_Initialize(tcti_conf, &tcti);
+			if (!tss_check_error(rc, "Unable to initialize TCTI"))
+				fatal("Aborting.\n");
+		}
+
+		tss_connection.tcti = tcti;
+		if (tcti && tpm_trace_enabled())
+			tcti = tpm_trace_wrap_tcti(tcti);
+
+		rc = Esys_Initialize(&esys_ctx, tcti, NULL);
 		if (!tss_check_error(rc, "Unable to initialize TSS2 ESAPI context"))
 			fatal("Aborting.\n");
 
+		tss_connection.esys_ctx = esys_ctx;
+		tss_connection.owner = getpid();
+
+		if (!cleanup_registered) {
+			atexit(tss_esys_finalize);
+			cleanup_registered = true;
+		}
+
 		/* There's no way to query the library version programmatically, so
 		 * we need to check it in configure. */
 		if (version_string_compare(LIBTSS2_VERSION, "3.1") > 0) {
@@ -65,77 +65,153 @@ tpm2key_basekey(TSSPRIVKEY **tpm2key, const TPM2_HANDLE parent,
 	return true;
 }
 
-static bool
-__policy_add_policypcr(STACK_OF(TSSOPTPOLICY) *policy_seq, const TPML_PCR_SELECTION *pcr_sel)
+/*
+ * For sealed objects created in software (see import.c), the private
+ * part is a duplication blob, and the secret field holds the encrypted
+ * seed that the TPM needs for TPM2_Import.
+ */
+bool
+tpm2key_set_import_secret(TSSPRIVKEY *tpm2key, const TPM2B_ENCRYPTED_SECRET *seed)
+{
+	if (tpm2key->secret == NULL)
+		tpm2key->secret = ASN1_OCTET_STRING_new();
+	return ASN1_STRING_set(tpm2key->secret, seed->secret, seed->size) == 1;
+}
+
+bool
+tpm2key_get_import_secret(const TSSPRIVKEY *tpm2key, TPM2B_ENCRYPTED_SECRET *seed)
+{
+	if (tpm2key->secret == NULL)
+		return false;
+
+	if (tpm2key->secret->length > sizeof(seed->secret))
+		return false;
+
+	seed->size = tpm2key->secret->length;
+	memcpy(seed->secret, tpm2key->secret->data, seed->size);
+	return true;
+}
+
+static buffer_t *
+__policypcr_marshal(const TPML_PCR_SELECTION *pcr_sel)
 {
-	TSSOPTPOLICY *policy;
 	TPM2B_DIGEST pcr_digest = {.size = 0};
 	buffer_t *bp;
 	TPM2_RC rc;
 
-	policy = TSSOPTPOLICY_new();
-	if (policy == NULL)
-		return false;
-
 	bp = buffer_alloc_write(sizeof(pcr_digest) + sizeof(*pcr_sel));
 	if (bp == NULL)
-		return false;
+		return NULL;
 
-	rc = Tss2_MU_TPM2B_DIGEST_Marshal(&pcr_digest, bp->data, sizeof(pcr_digest), &bp->wpos);
+	rc = Tss2_MU_TPM2B_DIGEST_Marshal(&pcr_digest, bp->data, bp->size, &bp->wpos);
 	if (rc != TSS2_RC_SUCCESS)
-		return false;
+		goto failed;
 
-	rc = Tss2_MU_TPML_PCR_SELECTION_Marshal(pcr_sel, bp->data, sizeof(*pcr_sel), &bp->wpos);
+	rc = Tss2_MU_TPML_PCR_SELECTION_Marshal(pcr_sel, bp->data, bp->size, &bp->wpos);
 	if (rc != TSS2_RC_SUCCESS)
-		return false;
+		goto failed;
 
-	ASN1_INTEGER_set(policy->CommandCode, TPM2_CC_PolicyPCR);
-	ASN1_STRING_set(policy->CommandPolicy, bp->data, buffer_available(bp));
+	return bp;
 
-	sk_TSSOPTPOLICY_push(policy_seq, policy);
-
-	return true;
+failed:
+	buffer_free(bp);
+	return NULL;
 }
 
-static bool
-__policy_add_policyauthorize(STACK_OF(TSSOPTPOLICY) *policy_seq,
-			     const TPM2B_PUBLIC *pub_key,
-			     const TPMT_SIGNATURE *signature)
+/*
+ * Marshal the arguments of PolicyAuthorize. If signature is NULL, this
+ * produces the part that precedes the signature only.
+ */
+static buffer_t *
+__policyauthorize_marshal(const TPM2B_PUBLIC *pub_key, const TPMT_SIGNATURE *signature)
 {
-	TSSOPTPOLICY *policy;
 	TPM2B_DIGEST policy_ref = {.size = 0};
 	buffer_t *bp;
 	TPM2_RC rc;
 
-	policy = TSSOPTPOLICY_new();
-	if (policy == NULL)
-		return false;
-
 	bp = buffer_alloc_write(sizeof(*pub_key) + sizeof(policy_ref) +
-				sizeof(*signature));
+				sizeof(TPMT_SIGNATURE));
 	if (bp == NULL)
-		return false;
+		return NULL;
 
 	rc = Tss2_MU_TPM2B_PUBLIC_Marshal(pub_key, bp->data, bp->size, &bp->wpos);
 	if (rc != TSS2_RC_SUCCESS)
-		return false;
+		goto failed;
 
 	rc = Tss2_MU_TPM2B_DIGEST_Marshal(&policy_ref, bp->data, bp->size, &bp->wpos);
 	if (rc != TSS2_RC_SUCCESS)
+		goto failed;
+
+	if (signature) {
+		rc = Tss2_MU_TPMT_SIGNATURE_Marshal(signature, bp->data, bp->size, &bp->wpos);
+		if (rc != TSS2_RC_SUCCESS)
+			goto failed;
+	}
+
+	return bp;
+
+failed:
+	buffer_free(bp);
+	return NULL;
+}
+
+static bool
+__policy_add(STACK_OF(TSSOPTPOLICY) *policy_seq, int code, buffer_t *bp)
+{
+	TSSOPTPOLICY *policy;
+
+	if (bp == NULL)
 		return false;
 
-	rc = Tss2_MU_TPMT_SIGNATURE_Marshal(signature, bp->data, bp->size, &bp->wpos);
-	if (rc != TSS2_RC_SUCCESS)
+	policy = TSSOPTPOLICY_new();
+	if (policy == NULL) {
+		buffer_free(bp);
 		return false;
+	}
 
-	ASN1_INTEGER_set(policy->CommandCode, TPM2_CC_PolicyAuthorize);
+	ASN1_INTEGER_set(policy->CommandCode, code);
 	ASN1_STRING_set(policy->CommandPolicy, bp->data, buffer_available(bp));
+	buffer_free(bp);
 
 	sk_TSSOPTPOLICY_push(policy_seq, policy);
 
 	return true;
 }
 
+static bool
+__policy_add_policypcr(STACK_OF(TSSOPTPOLICY) *policy_seq, const TPML_PCR_SELECTION *pcr_sel)
+{
+	return __policy_add(policy_seq, TPM2_CC_PolicyPCR, __policypcr_marshal(pcr_sel));
+}
+
+static bool
+__policy_add_policyauthorize(STACK_OF(TSSOPTPOLICY) *policy_seq,
+			     const TPM2B_PUBLIC *pub_key,
+			     const TPMT_SIGNATURE *signature)
+{
+	return __policy_add(policy_seq, TPM2_CC_PolicyAuthorize,
+			__policyauthorize_marshal(pub_key, signature));
+}
+
+/*
+ * Check whether a policy command has the given code, and its argument
+ * starts with the content of bp.
+ */
+static bool
+__policy_match(const TSSOPTPOLICY *policy, int code, const buffer_t *bp, bool prefix)
+{
+	unsigned int len = buffer_available(bp);
+
+	if (ASN1_INTEGER_get(policy->CommandCode) != code)
+		return false;
+
+	if (policy->CommandPolicy->length < len
+	 || (!prefix && policy->CommandPolicy->length != len))
+		return false;
+
+	return !memcmp(policy->CommandPolicy->data, bp->data, len);
+}
+
 bool
 tpm2key_add_policy_policypcr(TSSPRIVKEY *tpm2key, const TPML_PCR_SELECTION *pcr_sel)
 {
@@ -144,6 +220,27 @@ tpm2key_add_policy_policypcr(TSSPRIVKEY *tpm2key, const TPML_PCR_SELECTION *pcr_
 	return __policy_add_policypcr(tpm2key->policy, pcr_sel);
 }
 
+bool
+tpm2key_add_policy_policyor(TSSPRIVKEY *tpm2key, const TPML_DIGEST *digests)
+{
+	buffer_t *bp;
+	TPM2_RC rc;
+
+	if (tpm2key->policy == NULL)
+		tpm2key->policy = sk_TSSOPTPOLICY_new_null();
+
+	if (!(bp = buffer_alloc_write(sizeof(*digests))))
+		return false;
+
+	rc = Tss2_MU_TPML_DIGEST_Marshal(digests, bp->data, bp->size, &bp->wpos);
+	if (rc != TSS2_RC_SUCCESS) {
+		buffer_free(bp);
+		return false;
+	}
+
+	return __policy_add(tpm2key->policy, TPM2_CC_PolicyOR, bp);
+}
+
 bool
 tpm2key_add_authpolicy_policyauthorize(TSSPRIVKEY *tpm2key,
 				       const char *name,
@@ -187,6 +284,64 @@ cleanup:
 	return false;
 }
 
+/*
+ * Find the first authPolicy of the given name that authorizes a PolicyPCR
+ * with this PCR selection using this public key, and return its signature.
+ */
+bool
+tpm2key_find_authpolicy_policyauthorize(const TSSPRIVKEY *tpm2key,
+				       const char *name,
+				       const TPML_PCR_SELECTION *pcr_sel,
+				       const TPM2B_PUBLIC *pub_key,
+				       TPMT_SIGNATURE *signature)
+{
+	buffer_t *pcr_bp = NULL, *auth_bp = NULL;
+	int i, num_policies;
+	bool found = false;
+
+	if (tpm2key->authPolicy == NULL)
+		return false;
+
+	if (!(pcr_bp = __policypcr_marshal(pcr_sel))
+	 || !(auth_bp = __policyauthorize_marshal(pub_key, NULL)))
+		goto out;
+
+	num_policies = sk_TSSAUTHPOLICY_num(tpm2key->authPolicy);
+	for (i = 0; i < num_policies && !found; i++) {
+		TSSAUTHPOLICY *ap = sk_TSSAUTHPOLICY_value(tpm2key->authPolicy, i);
+		TSSOPTPOLICY *policy;
+		size_t offset;
+
+		if (ap->name == NULL
+		 || (size_t) ap->name->length != strlen(name)
+		 || memcmp(ap->name->data, name, ap->name->length))
+			continue;
+
+		/* Policies with the same name are tried in order, so only
+		 * the first one counts */
+		if (sk_TSSOPTPOLICY_num(ap->policy) != 2
+		 || !__policy_match(sk_TSSOPTPOLICY_value(ap->policy, 0), TPM2_CC_PolicyPCR, pcr_bp, false)
+		 || !__policy_match((policy = sk_TSSOPTPOLICY_value(ap->policy, 1)), TPM2_CC_PolicyAuthorize, auth_bp, true))
+			break;
+
+		offset = buffer_available(auth_bp);
+		memset(signature, 0, sizeof(*signature));
+		if (Tss2_MU_TPMT_SIGNATURE_Unmarshal(policy->CommandPolicy->data,
+					policy->CommandPolicy->length,
+					&offset, signature) == TSS2_RC_SUCCESS
+		 && offset == (size_t) policy->CommandPolicy->length)
+			found = true;
+		break;
+	}
+
+out:
+	if (pcr_bp)
+		buffer_free(pcr_bp);
+	if (auth_bp)
+		buffer_free(auth_bp);
+	return found;
+}
+
 bool
 tpm2key_read_file(const char *path, TSSPRIVKEY **tpm2key)
 {
@@ -26,9 +26,18 @@ bool	tpm2key_basekey(TSSPRIVKEY **tpm2key, const TPM2_HANDLE parent,
 			const TPM2B_PUBLIC *sealed_pub,
 			const TPM2B_PRIVATE *sealed_priv);
 
+bool	tpm2key_set_import_secret(TSSPRIVKEY *tpm2key,
+			const TPM2B_ENCRYPTED_SECRET *seed);
+
+bool	tpm2key_get_import_secret(const TSSPRIVKEY *tpm2key,
+			TPM2B_ENCRYPTED_SECRET *seed);
+
 bool	tpm2key_add_policy_policypcr(TSSPRIVKEY *tpm2key,
 			const TPML_PCR_SELECTION *pcr_sel);
 
+bool	tpm2key_add_policy_policyor(TSSPRIVKEY *tpm2key,
+			const TPML_DIGEST *digests);
+
 bool	tpm2key_add_authpolicy_policyauthorize(TSSPRIVKEY *tpm2key,
 			const char *name,
 			const TPML_PCR_SELECTION *pcr_sel,
@@ -36,6 +45,12 @@ bool	tpm2key_add_authpolicy_policyauthorize(TSSPRIVKEY *tpm2key,
 			const TPMT_SIGNATURE *signature,
 			bool append);
 
+bool	tpm2key_find_authpolicy_policyauthorize(const TSSPRIVKEY *tpm2key,
+			const char *name,
+			const TPML_PCR_SELECTION *pcr_sel,
+			const TPM2B_PUBLIC *pub_key,
+			TPMT_SIGNATURE *signature);
+
 bool	tpm2key_read_file(const char *path, TSSPRIVKEY **tpm2key);
 
 bool	tpm2key_write_file(const char *path, const TSSPRIVKEY *tpm2key);
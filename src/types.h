@@ -35,7 +35,9 @@ typedef struct pecoff_image_info pecoff_image_info_t;
 typedef struct testcase		testcase_t;
 typedef struct stored_key	stored_key_t;
 typedef struct target_platform	target_platform_t;
+typedef struct pcr_policy_batch	pcr_policy_batch_t;
 typedef struct uapi_boot_entry	uapi_boot_entry_t;
+typedef struct compdb		compdb_t;
 
 #endif /* TYPES_H */
 
@@ -60,6 +60,7 @@ uapi_boot_entry_load(const char *path)
 {
 	uapi_boot_entry_t *result = NULL;
 	char line[UAPI_LINE_MAX];
+	const char *basename;
 	FILE *fp;
 
 	if (!(fp = fopen(path, "r"))) {
@@ -68,6 +69,15 @@ uapi_boot_entry_load(const char *path)
 	}
 
 	result = uapi_boot_entry_new();
+
+	/* The entry ID is the file name, minus the .conf suffix */
+	if ((basename = strrchr(path, '/')) != NULL)
+		basename++;
+	else
+		basename = path;
+	result->id = strdup(basename);
+	if (path_has_file_extension(result->id, ".conf"))
+		result->id[strlen(result->id) - 5] = '\0';
 	while (fgets(line, sizeof(line), fp)) {
 		char *key, *value;
 		unsigned int i;
@@ -220,6 +230,98 @@ uapi_get_boot_entry(const char *id)
 	return uapi_boot_entry_load(path);
 }
 
+static int
+uapi_boot_entry_compare(const void *a, const void *b)
+{
+	const uapi_boot_entry_t *entry_a = *(const uapi_boot_entry_t **) a;
+	const uapi_boot_entry_t *entry_b = *(const uapi_boot_entry_t **) b;
+
+	if (uapi_boot_entry_more_recent(entry_a, entry_b))
+		return -1;
+	if (uapi_boot_entry_more_recent(entry_b, entry_a))
+		return 1;
+	return strcmp(entry_a->id, entry_b->id);
+}
+
+/*
+ * Return all boot entries that match, most recent first.
+ */
+uapi_boot_entry_t **
+uapi_find_boot_entries(const uapi_kernel_entry_tokens_t *match, const char *machine_id, unsigned int *count_ret)
+{
+	uapi_boot_entry_t **result = NULL;
+	unsigned int count = 0;
+	const char *architecture = NULL;
+	struct utsname uts;
+	struct dirent *d;
+	DIR *dir;
+
+	*count_ret = 0;
+
+	if (uname(&uts) >= 0)
+		architecture = uts.machine;
+
+	if (!(dir = opendir(UAPI_BOOT_DIRECTORY))) {
+		if (errno != ENOENT)
+			error("Cannot open %s for reading: %m\n", UAPI_BOOT_DIRECTORY);
+		return NULL;
+	}
+
+	while ((d = readdir(dir)) != NULL) {
+		char config_path[PATH_MAX];
+		uapi_boot_entry_t *entry;
+
+		if (d->d_type != DT_REG)
+			continue;
+
+		if (match && !uapi_kernel_entry_tokens_match_filename(match, d->d_name))
+			continue;
+
+		if (snprintf(config_path, sizeof(config_path), "%s/%s", UAPI_BOOT_DIRECTORY, d->d_name) >= (int) sizeof(config_path)) {
+			warning("Ignoring UAPI boot entry \"%s\": path name too long\n", d->d_name);
+			continue;
+		}
+
+		if (!(entry = uapi_boot_entry_load(config_path))) {
+			warning("Unable to process UAPI boot entry file at \"%s\"\n", config_path);
+			continue;
+		}
+
+		if (!uapi_boot_entry_applies(entry, machine_id, architecture)) {
+			drop_boot_entry(&entry);
+			continue;
+		}
+
+		if ((count % 8) == 0) {
+			uapi_boot_entry_t **tmp;
+
+			tmp = realloc(result, (count + 8) * sizeof(result[0]));
+			if (tmp == NULL) {
+				error("Out of memory while reading boot entries\n");
+				drop_boot_entry(&entry);
+				goto failed;
+			}
+			result = tmp;
+		}
+		result[count++] = entry;
+	}
+
+	closedir(dir);
+
+	if (count)
+		qsort(result, count, sizeof(result[0]), uapi_boot_entry_compare);
+
+	*count_ret = count;
+	return result;
+
+failed:
+	closedir(dir);
+	while (count)
+		uapi_boot_entry_free(result[--count]);
+	free(result);
+	return NULL;
+}
+
 uapi_boot_entry_t *
 uapi_find_boot_entry(const uapi_kernel_entry_tokens_t *match, const char *machine_id)
 {
@@ -238,7 +340,9 @@ uapi_find_boot_entry(const uapi_kernel_entry_tokens_t *match, const char *machin
 void
 uapi_boot_entry_free(uapi_boot_entry_t *ube)
 {
+	drop_string(&ube->id);
 	drop_string(&ube->title);
+	drop_string(&ube->sort_key);
 	drop_string(&ube->version);
 	drop_string(&ube->machine_id);
 	drop_string(&ube->image_path);
@@ -24,6 +24,7 @@
 #include "types.h"
 
 struct uapi_boot_entry {
+	char *		id;
 	char *		title;
 	bool		efi;
 	char *		sort_key;
@@ -46,6 +47,8 @@ typedef struct uapi_kernel_entry_tokens {
 
 extern uapi_boot_entry_t *	uapi_get_boot_entry(const char *id);
 extern uapi_boot_entry_t *	uapi_find_boot_entry(const uapi_kernel_entry_tokens_t *match, const char *machine_id);
+extern uapi_boot_entry_t **	uapi_find_boot_entries(const uapi_kernel_entry_tokens_t *match, const char *machine_id,
+					unsigned int *count_ret);
 extern void			uapi_boot_entry_free(uapi_boot_entry_t *);
 extern void			uapi_kernel_entry_tokens_add(uapi_kernel_entry_tokens_t *, const char *);
 extern void			uapi_kernel_entry_tokens_destroy(uapi_kernel_entry_tokens_t *);
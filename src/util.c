@@ -27,6 +27,8 @@
 #include "util.h"
 #include "digest.h"
 
+void			(*fatal_handler)(void) = NULL;
+
 bool
 parse_pcr_index(const char *word, unsigned int *ret)
 {
@@ -30,6 +30,12 @@
 
 extern unsigned int	opt_debug;
 
+/*
+ * If set, fatal() calls this before exiting. A handler that does not
+ * return (by jumping back to a known good state) keeps the process alive.
+ */
+extern void		(*fatal_handler)(void);
+
 static inline void
 debug(const char *fmt, ...)
 {
@@ -98,6 +104,8 @@ fatal(const char *fmt, ...)
 	vfprintf(stderr, fmt, ap);
 	va_end(ap);
 
+	if (fatal_handler)
+		fatal_handler();
 	exit(2);
 }
 
@@ -0,0 +1,347 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <sys/inotify.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+
+#include "watch.h"
+#include "rehash-state.h"
+#include "runtime.h"
+#include "uapi.h"
+#include "workers.h"
+#include "util.h"
+
+#define WATCH_EVENTS	(IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+			 IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+
+struct watch_dir {
+	int			wd;
+	char *			path;
+
+	/* If true, any change in this directory counts. Otherwise, only
+	 * changes to the names listed below. */
+	bool			any;
+	unsigned int		num_names;
+	char **			names;
+};
+
+struct watch_set {
+	int			fd;
+
+	unsigned int		count;
+	struct watch_dir *	dirs;
+};
+
+watch_set_t *
+watch_set_new(void)
+{
+	watch_set_t *set;
+	int fd;
+
+	if ((fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK)) < 0) {
+		error("Unable to create inotify instance: %m\n");
+		return NULL;
+	}
+
+	set = calloc(1, sizeof(*set));
+	set->fd = fd;
+	return set;
+}
+
+void
+watch_set_free(watch_set_t *set)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < set->count; ++i) {
+		struct watch_dir *dir = &set->dirs[i];
+
+		for (j = 0; j < dir->num_names; ++j)
+			free(dir->names[j]);
+		if (dir->names)
+			free(dir->names);
+		free(dir->path);
+	}
+	if (set->dirs)
+		free(set->dirs);
+
+	close(set->fd);
+	free(set);
+}
+
+static struct watch_dir *
+__watch_set_get_dir(watch_set_t *set, const char *path)
+{
+	struct watch_dir *dir;
+	unsigned int i;
+	int wd;
+
+	for (i = 0; i < set->count; ++i) {
+		if (!strcmp(set->dirs[i].path, path))
+			return &set->dirs[i];
+	}
+
+	if ((wd = inotify_add_watch(set->fd, path, WATCH_EVENTS | IN_ONLYDIR)) < 0) {
+		debug("Cannot watch %s: %m\n", path);
+		return NULL;
+	}
+
+	/* Different paths may refer to the same directory */
+	for (i = 0; i < set->count; ++i) {
+		if (set->dirs[i].wd == wd)
+			return &set->dirs[i];
+	}
+
+	if ((set->count % 8) == 0)
+		set->dirs = realloc(set->dirs, (set->count + 8) * sizeof(set->dirs[0]));
+
+	dir = &set->dirs[set->count++];
+	memset(dir, 0, sizeof(*dir));
+	dir->wd = wd;
+	dir->path = strdup(path);
+
+	debug("Watching directory %s\n", path);
+	return dir;
+}
+
+bool
+watch_set_add_directory(watch_set_t *set, const char *path)
+{
+	struct watch_dir *dir;
+
+	if (!(dir = __watch_set_get_dir(set, path)))
+		return false;
+
+	dir->any = true;
+	return true;
+}
+
+bool
+watch_set_add_file(watch_set_t *set, const char *path)
+{
+	char dirname[PATH_MAX];
+	struct watch_dir *dir;
+	const char *name;
+	unsigned int i;
+
+	if (!(name = strrchr(path, '/')) || name[1] == '\0') {
+		error("Cannot watch %s: not an absolute file name\n", path);
+		return false;
+	}
+
+	snprintf(dirname, sizeof(dirname), "%.*s", (int) (name - path), path);
+	if (dirname[0] == '\0')
+		strcpy(dirname, "/");
+	name++;
+
+	if (!(dir = __watch_set_get_dir(set, dirname)))
+		return false;
+
+	for (i = 0; i < dir->num_names; ++i) {
+		if (!strcmp(dir->names[i], name))
+			return true;
+	}
+
+	if ((dir->num_names % 8) == 0)
+		dir->names = realloc(dir->names, (dir->num_names + 8) * sizeof(dir->names[0]));
+	dir->names[dir->num_names++] = strdup(name);
+	return true;
+}
+
+/*
+ * Check whether an inotify event concerns anything we care about.
+ * The EFI system partition is case insensitive, and the event log
+ * does not necessarily use the same case as the file system.
+ */
+static const struct watch_dir *
+__watch_set_match(const watch_set_t *set, const struct inotify_event *ev)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < set->count; ++i) {
+		const struct watch_dir *dir = &set->dirs[i];
+
+		if (dir->wd != ev->wd)
+			continue;
+
+		if (dir->any || (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)))
+			return dir;
+
+		if (ev->len == 0)
+			return NULL;
+
+		for (j = 0; j < dir->num_names; ++j) {
+			if (!strcasecmp(dir->names[j], ev->name))
+				return dir;
+		}
+		return NULL;
+	}
+
+	return NULL;
+}
+
+static long
+__watch_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Wait until something we watch changes, and then until there have been no
+ * further changes for settle_time seconds. Updates usually touch several
+ * files in quick succession, and we want to act once, after the last one.
+ */
+bool
+watch_set_wait(watch_set_t *set, unsigned int settle_time)
+{
+	char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	struct pollfd pfd = { .fd = set->fd, .events = POLLIN };
+	long deadline = -1;
+
+	while (true) {
+		int timeout = -1;
+		ssize_t n;
+		char *pos;
+
+		if (deadline >= 0) {
+			timeout = deadline - __watch_now();
+			if (timeout <= 0)
+				return true;
+		}
+
+		if (poll(&pfd, 1, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			error("poll: %m\n");
+			return false;
+		}
+
+		while ((n = read(set->fd, buffer, sizeof(buffer))) > 0) {
+			for (pos = buffer; pos < buffer + n; ) {
+				const struct inotify_event *ev = (const struct inotify_event *) pos;
+				const struct watch_dir *dir;
+
+				pos += sizeof(*ev) + ev->len;
+
+				if (ev->mask & IN_Q_OVERFLOW) {
+					debug("inotify queue overflow, assuming a change\n");
+				} else
+				if ((dir = __watch_set_match(set, ev)) != NULL) {
+					if (deadline < 0)
+						infomsg("%s/%s changed, waiting for updates to settle\n",
+								dir->path, ev->len? ev->name : "");
+				} else {
+					continue;
+				}
+
+				deadline = __watch_now() + settle_time * 1000L;
+			}
+		}
+
+		if (n < 0 && errno != EAGAIN && errno != EINTR) {
+			error("Unable to read inotify events: %m\n");
+			return false;
+		}
+	}
+}
+
+bool
+watch_set_settle_time(const char *string, unsigned int *settle_time)
+{
+	unsigned long value;
+	char *end;
+
+	value = strtoul(string, &end, 0);
+	if (*end || value > 3600) {
+		error("Invalid settle time \"%s\"\n", string);
+		return false;
+	}
+
+	*settle_time = value;
+	return true;
+}
+
+/*
+ * Watch mode. Every prediction runs in a child process, which returns from
+ * here and signs or seals as usual. The parent then watches the inputs the
+ * child used, as recorded in the state file, plus /boot and the boot entries,
+ * and starts another child once any of them changed and things settled down.
+ * Thanks to the state file, the child only re-hashes what actually changed.
+ */
+int
+watch_run(const tpm_algo_info_t *algo, const char *state_file, const char *context,
+		unsigned int settle_time)
+{
+	while (true) {
+		runtime_input_set_t inputs = { .count = 0 };
+		rehash_state_t *state;
+		watch_set_t *set;
+		unsigned int i;
+		int status;
+		pid_t pid;
+
+		if ((pid = worker_fork()) < 0)
+			return 1;
+		if (pid == 0)
+			return -1;
+
+		if (!worker_wait(pid, &status))
+			return 1;
+
+		/* Exit status 2 is what --exit-code uses for "nothing to do" */
+		if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0 && WEXITSTATUS(status) != 2))
+			error("Prediction failed, will try again when something changes\n");
+
+		if (!(set = watch_set_new()))
+			return 1;
+
+		watch_set_add_directory(set, "/boot");
+		watch_set_add_directory(set, UAPI_BOOT_DIRECTORY);
+
+		state = rehash_state_load(state_file, algo, context);
+		rehash_state_get_inputs(state, &inputs);
+		rehash_state_free(state);
+
+		for (i = 0; i < inputs.count; ++i) {
+			const runtime_input_t *input = &inputs.inputs[i];
+			const char *path;
+
+			if ((path = runtime_input_local_path(input->kind, input->name)) != NULL)
+				watch_set_add_file(set, path);
+		}
+		runtime_input_set_destroy(&inputs);
+
+		infomsg("Watching for changes\n");
+		if (!watch_set_wait(set, settle_time)) {
+			watch_set_free(set);
+			return 1;
+		}
+		watch_set_free(set);
+	}
+}
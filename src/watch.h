@@ -0,0 +1,44 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stdbool.h>
+#include "types.h"
+
+/*
+ * A set of files and directories watched via inotify. Files are watched
+ * through their parent directory, because package managers and boot loader
+ * tools usually replace files by renaming a new copy over the old one.
+ */
+typedef struct watch_set	watch_set_t;
+
+#define WATCH_DEFAULT_SETTLE_TIME	5
+
+extern watch_set_t *		watch_set_new(void);
+extern void			watch_set_free(watch_set_t *);
+extern bool			watch_set_add_directory(watch_set_t *, const char *path);
+extern bool			watch_set_add_file(watch_set_t *, const char *path);
+extern bool			watch_set_wait(watch_set_t *, unsigned int settle_time);
+extern bool			watch_set_settle_time(const char *string, unsigned int *settle_time);
+
+extern int			watch_run(const tpm_algo_info_t *algo, const char *state_file,
+					const char *context, unsigned int settle_time);
+
+#endif /* WATCH_H */
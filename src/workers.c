@@ -0,0 +1,276 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "workers.h"
+#include "util.h"
+
+struct worker {
+	pid_t			pid;
+	int			fd;
+	worker_done_fn_t *	done;
+	void *			data;
+};
+
+struct worker_pool {
+	unsigned int		max_workers;
+	unsigned int		running;
+	struct worker *		workers;
+	struct pollfd *		pollfds;
+};
+
+/*
+ * Fork a child. Flush stdio first, so that buffered output does not get
+ * written twice.
+ */
+pid_t
+worker_fork(void)
+{
+	pid_t pid;
+
+	fflush(stdout);
+	fflush(stderr);
+
+	if ((pid = fork()) < 0)
+		error("Unable to fork: %m\n");
+	return pid;
+}
+
+bool
+worker_wait(pid_t pid, int *wstatus)
+{
+	while (waitpid(pid, wstatus, 0) < 0) {
+		if (errno != EINTR) {
+			error("waitpid: %m\n");
+			return false;
+		}
+	}
+	return true;
+}
+
+worker_pool_t *
+worker_pool_new(unsigned int max_workers)
+{
+	worker_pool_t *pool;
+
+	if (max_workers == 0)
+		max_workers = 1;
+
+	pool = calloc(1, sizeof(*pool));
+	pool->max_workers = max_workers;
+	pool->workers = calloc(max_workers, sizeof(pool->workers[0]));
+	pool->pollfds = calloc(max_workers, sizeof(pool->pollfds[0]));
+	return pool;
+}
+
+void
+worker_pool_free(worker_pool_t *pool)
+{
+	if (!worker_pool_wait_all(pool))
+		error("Lost track of %u workers\n", pool->running);
+	free(pool->workers);
+	free(pool->pollfds);
+	free(pool);
+}
+
+static bool
+__worker_pool_complete(worker_pool_t *pool, struct worker *w)
+{
+	int wstatus;
+	bool okay;
+
+	okay = worker_wait(w->pid, &wstatus);
+
+	close(w->fd);
+	w->fd = -1;
+	w->pid = 0;
+	pool->running--;
+
+	if (okay && w->done)
+		w->done(w->data, wstatus);
+	return okay;
+}
+
+/*
+ * Reap the workers that have exited. We only ever wait for our own workers;
+ * other children of this process are somebody else's business. So rather
+ * than using waitpid(-1), every worker holds the write end of a pipe, which
+ * gets closed when it exits.
+ *
+ * Returns the number of workers reaped, 0 if interrupted by a signal (or
+ * if nothing happened when not blocking), and -1 on error.
+ */
+static int
+__worker_pool_reap(worker_pool_t *pool, bool block)
+{
+	struct worker *slot[pool->max_workers];
+	unsigned int i, nfds = 0;
+	int n, reaped = 0;
+
+	if (pool->running == 0)
+		return 0;
+
+	for (i = 0; i < pool->max_workers; ++i) {
+		struct worker *w = &pool->workers[i];
+
+		if (w->pid == 0)
+			continue;
+
+		pool->pollfds[nfds].fd = w->fd;
+		pool->pollfds[nfds].events = POLLIN;
+		pool->pollfds[nfds].revents = 0;
+		slot[nfds++] = w;
+	}
+
+	if ((n = poll(pool->pollfds, nfds, block? -1 : 0)) < 0) {
+		if (errno == EINTR)
+			return 0;
+		error("poll: %m\n");
+		return -1;
+	}
+
+	for (i = 0; i < nfds && n > 0; ++i) {
+		if (pool->pollfds[i].revents == 0)
+			continue;
+		n--;
+
+		if (!__worker_pool_complete(pool, slot[i]))
+			return -1;
+		reaped++;
+	}
+
+	return reaped;
+}
+
+/*
+ * Wait until a worker slot is free. Returns false if interrupted by a
+ * signal, or on error.
+ */
+bool
+worker_pool_wait_slot(worker_pool_t *pool)
+{
+	worker_pool_reap(pool);
+	while (pool->running >= pool->max_workers) {
+		if (__worker_pool_reap(pool, true) <= 0)
+			return false;
+	}
+	return true;
+}
+
+/* Reap all workers that have exited, without blocking */
+void
+worker_pool_reap(worker_pool_t *pool)
+{
+	(void) __worker_pool_reap(pool, false);
+}
+
+bool
+worker_pool_wait_all(worker_pool_t *pool)
+{
+	while (pool->running) {
+		if (__worker_pool_reap(pool, true) < 0)
+			return false;
+	}
+	return true;
+}
+
+/* Send a signal to all running workers */
+void
+worker_pool_signal(worker_pool_t *pool, int sig)
+{
+	unsigned int i;
+
+	for (i = 0; i < pool->max_workers; ++i) {
+		if (pool->workers[i].pid)
+			(void) kill(pool->workers[i].pid, sig);
+	}
+}
+
+unsigned int
+worker_pool_running(const worker_pool_t *pool)
+{
+	return pool->running;
+}
+
+/*
+ * Start a worker, waiting for a free slot first. Like fork(), this returns
+ * 0 in the child, and the child's pid (or -1 on error) in the parent.
+ * When the worker exits, the done callback is invoked with the data given.
+ */
+pid_t
+worker_pool_fork(worker_pool_t *pool, worker_done_fn_t *done, void *data)
+{
+	struct worker *w = NULL;
+	unsigned int i;
+	int pfd[2];
+	pid_t pid;
+
+	while (!worker_pool_wait_slot(pool)) {
+		if (errno != EINTR)
+			return -1;
+	}
+
+	for (i = 0; i < pool->max_workers && w == NULL; ++i) {
+		if (pool->workers[i].pid == 0)
+			w = &pool->workers[i];
+	}
+
+	if (pipe(pfd) < 0) {
+		error("Unable to create pipe: %m\n");
+		return -1;
+	}
+	fcntl(pfd[0], F_SETFD, FD_CLOEXEC);
+	fcntl(pfd[1], F_SETFD, FD_CLOEXEC);
+
+	if ((pid = worker_fork()) < 0) {
+		close(pfd[0]);
+		close(pfd[1]);
+		return -1;
+	}
+
+	if (pid == 0) {
+		/* The child only keeps the write end of its own pipe. It is
+		 * not a parent of any of the other workers. */
+		for (i = 0; i < pool->max_workers; ++i) {
+			if (pool->workers[i].pid) {
+				close(pool->workers[i].fd);
+				pool->workers[i].pid = 0;
+			}
+		}
+		pool->running = 0;
+		close(pfd[0]);
+		return 0;
+	}
+
+	close(pfd[1]);
+	w->pid = pid;
+	w->fd = pfd[0];
+	w->done = done;
+	w->data = data;
+
+	pool->running++;
+	return pid;
+}
@@ -0,0 +1,48 @@
+/*
+ *   Copyright (C) 2023 SUSE LLC
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <sys/types.h>
+#include <stdbool.h>
+
+/*
+ * Forked worker processes. The event log parsing and rehashing code uses
+ * static result buffers and bails out via fatal() when it encounters
+ * something it cannot handle, so anything that predicts several times, or
+ * must survive a bad input, does so in a child process.
+ */
+typedef struct worker_pool	worker_pool_t;
+
+/* Called in the parent when a worker exits */
+typedef void			worker_done_fn_t(void *data, int wstatus);
+
+extern pid_t			worker_fork(void);
+extern bool			worker_wait(pid_t pid, int *wstatus);
+
+extern worker_pool_t *		worker_pool_new(unsigned int max_workers);
+extern void			worker_pool_free(worker_pool_t *);
+extern pid_t			worker_pool_fork(worker_pool_t *, worker_done_fn_t *done, void *data);
+extern bool			worker_pool_wait_slot(worker_pool_t *);
+extern void			worker_pool_reap(worker_pool_t *);
+extern bool			worker_pool_wait_all(worker_pool_t *);
+extern void			worker_pool_signal(worker_pool_t *, int sig);
+extern unsigned int		worker_pool_running(const worker_pool_t *);
+
+#endif /* WORKERS_H */
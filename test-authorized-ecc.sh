@@ -0,0 +1,82 @@
+#!/bin/bash
+#
+# This script needs to be run with root privilege
+#
+
+# TESTDIR=policy.test
+PCR_MASK=0,2,4,12
+
+pcr_oracle=pcr-oracle
+if [ -x pcr-oracle ]; then
+	pcr_oracle=$PWD/pcr-oracle
+fi
+
+function call_oracle {
+
+	echo "****************"
+	echo "pcr-oracle $*"
+	$pcr_oracle --target-platform tpm2.0 -d "$@"
+}
+
+if [ -z "$TESTDIR" ]; then
+	tmpdir=$(mktemp -d /tmp/pcrtestXXXXXX)
+	trap "cd / && rm -rf $tmpdir" 0 1 2 10 11 15
+
+	TESTDIR=$tmpdir
+fi
+
+trap "echo 'FAIL: command exited with error'; exit 1" ERR
+
+echo "This is super secret" >$TESTDIR/secret
+
+set -e
+cd $TESTDIR
+
+for key_type in ecc-p256 ecc-p384; do
+	echo "Authorize the policy with an $key_type signing key"
+	rm -f policy-key.pem policy-pubkey authorized.policy sealed sealed-signed recovered
+
+	call_oracle \
+		--generate-key \
+		--signing-key-type $key_type \
+		--private-key policy-key.pem \
+		--auth authorized.policy \
+		create-authorized-policy $PCR_MASK
+
+	call_oracle \
+		--private-key policy-key.pem \
+		--public-key policy-pubkey \
+		store-public-key
+
+	call_oracle \
+		--auth authorized.policy \
+		--input secret \
+		--output sealed \
+		seal-secret
+
+	echo "Sign the set of PCRs we want to authorize"
+	call_oracle \
+		--policy-name "authorized-policy-test" \
+		--private-key policy-key.pem \
+		--from current \
+		--input sealed \
+		--output sealed-signed \
+		sign $PCR_MASK
+
+	echo "Unseal the secret with the $key_type signed policy"
+	call_oracle \
+		--input sealed-signed \
+		--output recovered \
+		unseal-secret
+
+	if ! cmp secret recovered; then
+		echo "BAD: Unable to recover original secret"
+		echo "Secret:"
+		od -tx1c secret
+		echo "Recovered:"
+		od -tx1c recovered
+		exit 1
+	else
+		echo "NICE: we were able to recover the original secret using an $key_type key"
+	fi
+done
@@ -0,0 +1,145 @@
+#!/bin/bash
+#
+# This script needs to be run with root privilege
+#
+
+# TESTDIR=policy.test
+PCR_MASK=0,2,4,12
+
+pcr_oracle=pcr-oracle
+if [ -x pcr-oracle ]; then
+	pcr_oracle=$PWD/pcr-oracle
+fi
+
+function call_oracle {
+
+	echo "****************"
+	echo "pcr-oracle $*"
+	$pcr_oracle --target-platform oldgrub -d "$@"
+}
+
+function compare_secret {
+
+	if ! cmp secret-$1 recovered-$1; then
+		echo "BAD: Unable to recover original secret $1"
+		echo "Secret:"
+		od -tx1c secret-$1
+		echo "Recovered:"
+		od -tx1c recovered-$1
+		exit 1
+	else
+		echo "NICE: we were able to recover the original secret $1"
+	fi
+}
+
+if [ -z "$TESTDIR" ]; then
+	tmpdir=$(mktemp -d /tmp/pcrtestXXXXXX)
+	trap "cd / && rm -rf $tmpdir" 0 1 2 10 11 15
+
+	TESTDIR=$tmpdir
+fi
+
+trap "echo 'FAIL: command exited with error'; exit 1" ERR
+
+for name in root home recovery; do
+	echo "This is the super secret key for $name" >$TESTDIR/secret-$name
+done
+
+set -e
+cd $TESTDIR
+
+echo "Seal several secrets with the same PCR policy"
+for name in root home recovery; do
+	call_oracle \
+		--from current \
+		--input secret-$name \
+		--output sealed-$name \
+		seal-secret $PCR_MASK
+done
+
+echo "Unseal all of them at once"
+rm -f recovered-*
+call_oracle \
+	--input sealed-root --output recovered-root \
+	--input sealed-home --output recovered-home \
+	--input sealed-recovery --output recovered-recovery \
+	unseal-secret $PCR_MASK
+
+for name in root home recovery; do
+	compare_secret $name
+done
+
+echo "Seal several secrets with the same authorized policy"
+call_oracle \
+	--rsa-generate-key \
+	--private-key policy-key.pem \
+	--auth authorized.policy \
+	create-authorized-policy $PCR_MASK
+
+call_oracle \
+	--private-key policy-key.pem \
+	--public-key policy-pubkey \
+	store-public-key
+
+for name in root home recovery; do
+	call_oracle \
+		--auth authorized.policy \
+		--input secret-$name \
+		--output sealed-$name \
+		seal-secret
+done
+
+call_oracle \
+	--private-key policy-key.pem \
+	--from current \
+	--output signed.policy \
+	sign $PCR_MASK
+
+echo "Unseal all of them at once, verifying the signed policy only once"
+rm -f recovered-*
+call_oracle \
+	--input sealed-root --output recovered-root \
+	--input sealed-home --output recovered-home \
+	--input sealed-recovery --output recovered-recovery \
+	--public-key policy-pubkey \
+	--pcr-policy signed.policy \
+	unseal-secret $PCR_MASK
+
+for name in root home recovery; do
+	compare_secret $name
+done
+
+echo "Seal one secret with a policy authorized by a different key"
+call_oracle \
+	--rsa-generate-key \
+	--private-key other-key.pem \
+	--auth other.policy \
+	create-authorized-policy $PCR_MASK
+
+call_oracle \
+	--auth other.policy \
+	--input secret-home \
+	--output sealed-home \
+	seal-secret
+
+echo "Unseal all of them at once. Only the odd one out should fail"
+rm -f recovered-*
+if call_oracle \
+	--input sealed-root --output recovered-root \
+	--input sealed-home --output recovered-home \
+	--input sealed-recovery --output recovered-recovery \
+	--public-key policy-pubkey \
+	--pcr-policy signed.policy \
+	unseal-secret $PCR_MASK; then
+	echo "BAD: Unsealing a secret with the wrong policy did not fail"
+	exit 1
+fi
+
+if [ -s recovered-home ]; then
+	echo "BAD: We were able to recover a secret sealed with a different policy"
+	exit 1
+fi
+
+compare_secret root
+compare_secret recovery
+echo "GOOD: A secret that cannot be unsealed does not stop the others"
@@ -0,0 +1,116 @@
+#!/bin/bash
+#
+# This script needs to be run with root privilege, on a system that
+# uses UAPI boot entries (such as systemd-boot).
+#
+
+# TESTDIR=policy.test
+#
+# These PCRs do not depend on the boot entry, so the policy signed for
+# any of the boot entries can be used to unseal the secret right now.
+PCR_MASK=0,2,7
+
+pcr_oracle=pcr-oracle
+if [ -x pcr-oracle ]; then
+	pcr_oracle=$PWD/pcr-oracle
+fi
+
+function call_oracle {
+
+	echo "****************"
+	echo "pcr-oracle $*"
+	$pcr_oracle --target-platform tpm2.0 -d "$@"
+}
+
+function unseal_and_compare {
+
+	rm -f recovered
+	call_oracle \
+		--input $1 \
+		--output recovered \
+		unseal-secret
+
+	if ! cmp secret recovered; then
+		echo "BAD: Unable to recover original secret from $1"
+		echo "Secret:"
+		od -tx1c secret
+		echo "Recovered:"
+		od -tx1c recovered
+		exit 1
+	else
+		echo "NICE: we were able to recover the original secret from $1"
+	fi
+}
+
+if [ -z "$TESTDIR" ]; then
+	tmpdir=$(mktemp -d /tmp/pcrtestXXXXXX)
+	trap "cd / && rm -rf $tmpdir" 0 1 2 10 11 15
+
+	TESTDIR=$tmpdir
+fi
+
+trap "echo 'FAIL: command exited with error'; exit 1" ERR
+
+echo "This is super secret" >$TESTDIR/secret
+
+set -e
+cd $TESTDIR
+
+entries=$($pcr_oracle --from eventlog --boot-entry all predict $PCR_MASK | sed -n 's/^# //p')
+if [ -z "$entries" ]; then
+	echo "SKIP: no boot entries found"
+	exit 0
+fi
+echo "Boot entries:" $entries
+
+call_oracle \
+	--rsa-generate-key \
+	--private-key policy-key.pem \
+	--auth authorized.policy \
+	create-authorized-policy $PCR_MASK
+
+call_oracle \
+	--auth authorized.policy \
+	--input secret \
+	--output sealed \
+	seal-secret
+
+echo "Sign one policy per boot entry, each into a file of its own"
+call_oracle \
+	--policy-name "boot-entry-test" \
+	--private-key policy-key.pem \
+	--from eventlog \
+	--boot-entry all \
+	--input sealed \
+	--output "sealed-%s" \
+	sign $PCR_MASK
+
+for id in $entries; do
+	if [ ! -s "sealed-$id" ]; then
+		echo "BAD: No sealed key was written for boot entry $id"
+		exit 1
+	fi
+	unseal_and_compare "sealed-$id"
+done
+
+echo "Sign all policies into one key, which is both input and output"
+cp sealed sealed-shared
+call_oracle \
+	--policy-name "boot-entry-test" \
+	--private-key policy-key.pem \
+	--from eventlog \
+	--boot-entry all \
+	--input sealed-shared \
+	--output sealed-shared \
+	sign $PCR_MASK
+
+openssl asn1parse -inform PEM -in sealed-shared >asn1.dump
+for id in $entries; do
+	if ! grep -q ":boot-entry-test-$id\$" asn1.dump; then
+		echo "BAD: The shared key holds no policy for boot entry $id"
+		exit 1
+	fi
+done
+echo "GOOD: The shared key holds one policy per boot entry"
+
+unseal_and_compare sealed-shared
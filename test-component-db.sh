@@ -0,0 +1,96 @@
+#!/bin/bash
+#
+# This script needs to be run with root privilege, with the ESP
+# mounted on /boot/efi.
+#
+
+# TESTDIR=policy.test
+PCR_MASK=4
+ESP=/boot/efi
+
+pcr_oracle=pcr-oracle
+if [ -x pcr-oracle ]; then
+	pcr_oracle=$PWD/pcr-oracle
+fi
+
+function call_oracle {
+
+	echo "****************" >&2
+	echo "pcr-oracle $*" >&2
+	$pcr_oracle -d "$@"
+}
+
+if [ -z "$TESTDIR" ]; then
+	tmpdir=$(mktemp -d /tmp/pcrtestXXXXXX)
+	trap "cd / && rm -rf $tmpdir" 0 1 2 10 11 15
+
+	TESTDIR=$tmpdir
+fi
+
+trap "echo 'FAIL: command exited with error'; exit 1" ERR
+
+set -e
+cd $TESTDIR
+
+echo "Predict PCR $PCR_MASK from the boot loaders on the ESP"
+call_oracle \
+	--from eventlog \
+	predict $PCR_MASK >expected
+
+echo "Record the boot loaders on the ESP in a manifest"
+call_oracle \
+	-A sha256 \
+	--component-version test \
+	--output manifest.txt \
+	authenticode-hash $ESP
+
+if [ ! -s manifest.txt ]; then
+	echo "BAD: No EFI applications found below $ESP"
+	exit 1
+fi
+cat manifest.txt
+
+call_oracle \
+	--input manifest.txt \
+	--output components.db \
+	component-db
+
+echo "Predict PCR $PCR_MASK from the component database"
+call_oracle \
+	--component-db components.db \
+	--from eventlog \
+	predict $PCR_MASK >predicted 2>log
+
+if ! grep -q "from component database" log; then
+	echo "BAD: The component database was not used"
+	cat log
+	exit 1
+fi
+
+if ! cmp expected predicted; then
+	echo "BAD: Prediction from the component database differs"
+	diff -u expected predicted
+	exit 1
+else
+	echo "NICE: Prediction from the component database matches"
+fi
+
+echo "Replace all digests in the manifest. The prediction should change"
+sed 's/ [0-9a-f]*$/ '$(printf '0%.0s' $(seq 64))'/' manifest.txt >bogus.txt
+
+call_oracle \
+	--input bogus.txt \
+	--output bogus.db \
+	component-db
+
+call_oracle \
+	--component-db bogus.db \
+	--from eventlog \
+	predict $PCR_MASK >predicted
+
+if cmp -s expected predicted; then
+	echo "BAD: Digests from the component database were ignored"
+	exit 1
+else
+	echo "GOOD: Digests are taken from the component database"
+fi
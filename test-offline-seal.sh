@@ -0,0 +1,89 @@
+#!/bin/bash
+#
+# This script needs to be run with root privilege, or against a
+# software TPM such as swtpm.
+#
+# It seals a secret without using the TPM, given just the public
+# portion of the SRK, and verifies that the TPM can unseal it.
+#
+
+# TESTDIR=policy.test
+PCR_MASK=0,2,4,12
+
+pcr_oracle=pcr-oracle
+if [ -x pcr-oracle ]; then
+	pcr_oracle=$PWD/pcr-oracle
+fi
+
+function call_oracle {
+
+	echo "****************"
+	echo "pcr-oracle $*"
+	$pcr_oracle --target-platform tpm2.0 -d "$@"
+}
+
+if [ -z "$TESTDIR" ]; then
+	tmpdir=$(mktemp -d /tmp/pcrtestXXXXXX)
+	trap "cd / && rm -rf $tmpdir" 0 1 2 10 11 15
+
+	TESTDIR=$tmpdir
+fi
+
+trap "echo 'FAIL: command exited with error'; exit 1" ERR
+
+echo "This is super secret" >$TESTDIR/secret
+
+set -e
+cd $TESTDIR
+
+echo "Export the public portion of the SRK"
+tpm2_createprimary -Q -C o -g sha256 -G rsa2048:aes128cfb \
+	-a "restricted|decrypt|fixedtpm|fixedparent|sensitivedataorigin|userwithauth|noda" \
+	-c srk.ctx
+tpm2_readpublic -Q -c srk.ctx -o srk.pub
+tpm2_flushcontext srk.ctx
+
+call_oracle \
+	--rsa-generate-key \
+	--private-key policy-key.pem \
+	--auth authorized.policy \
+	create-authorized-policy $PCR_MASK
+
+call_oracle \
+	--private-key policy-key.pem \
+	--public-key policy-pubkey \
+	store-public-key
+
+echo "Seal the secret offline"
+call_oracle \
+	--srk-public srk.pub \
+	--auth authorized.policy \
+	--input secret \
+	--output sealed \
+	seal-secret
+
+echo "Sign the set of PCRs we want to authorize"
+call_oracle \
+	--policy-name "offline-seal-test" \
+	--private-key policy-key.pem \
+	--from current \
+	--input sealed \
+	--output sealed-signed \
+	sign $PCR_MASK
+
+echo "Unseal the secret"
+call_oracle \
+	--input sealed-signed \
+	--output recovered \
+	unseal-secret
+
+if ! cmp secret recovered; then
+	echo "BAD: Unable to recover original secret"
+	echo "Secret:"
+	od -tx1c secret
+	echo "Recovered:"
+	od -tx1c recovered
+	exit 1
+else
+	echo "NICE: we were able to recover the original secret"
+fi
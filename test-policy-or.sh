@@ -0,0 +1,97 @@
+#!/bin/bash
+#
+# This script needs to be run with root privilege, on a system that
+# uses UAPI boot entries (such as systemd-boot), with at least two
+# boot entries whose kernels differ, one of them the one running now.
+#
+
+# TESTDIR=policy.test
+PCR_MASK=0,2,4
+
+pcr_oracle=pcr-oracle
+if [ -x pcr-oracle ]; then
+	pcr_oracle=$PWD/pcr-oracle
+fi
+
+function call_oracle {
+
+	echo "****************"
+	echo "pcr-oracle $*"
+	$pcr_oracle -d "$@"
+}
+
+function unseal_and_compare {
+
+	# Only oldgrub needs to be told which PCRs the policy covers
+	pcr_arg=
+	if [ "$1" = "oldgrub" ]; then
+		pcr_arg=$PCR_MASK
+	fi
+
+	rm -f recovered
+	call_oracle \
+		--target-platform $1 \
+		--input $2 \
+		--output recovered \
+		unseal-secret $pcr_arg
+
+	if ! cmp secret recovered; then
+		echo "BAD: Unable to recover original secret from $2"
+		echo "Secret:"
+		od -tx1c secret
+		echo "Recovered:"
+		od -tx1c recovered
+		exit 1
+	else
+		echo "NICE: we were able to recover the original secret from $2"
+	fi
+}
+
+if [ -z "$TESTDIR" ]; then
+	tmpdir=$(mktemp -d /tmp/pcrtestXXXXXX)
+	trap "cd / && rm -rf $tmpdir" 0 1 2 10 11 15
+
+	TESTDIR=$tmpdir
+fi
+
+trap "echo 'FAIL: command exited with error'; exit 1" ERR
+
+echo "This is super secret" >$TESTDIR/secret
+
+set -e
+cd $TESTDIR
+
+# PCR 4 differs between boot entries with different kernels
+$pcr_oracle --from eventlog --boot-entry all predict 4 | grep -v '^#' | sort -u >states
+$pcr_oracle --from current predict 4 >current
+
+if [ $(wc -l <states) -lt 2 ]; then
+	echo "SKIP: need at least two boot entries with different kernels"
+	exit 0
+fi
+if ! grep -qxf current states; then
+	echo "SKIP: none of the boot entries matches the current boot"
+	exit 0
+fi
+echo "Predicted $(wc -l <states) distinct states for PCR 4"
+
+for target in tpm2.0 oldgrub; do
+	echo "Seal the secret against all boot entries at once, for $target"
+	call_oracle \
+		--target-platform $target \
+		--from eventlog \
+		--boot-entry all \
+		--input secret \
+		--output sealed-$target \
+		seal-secret $PCR_MASK
+
+	unseal_and_compare $target sealed-$target
+done
+
+# The policy sequence of the tpm2.0 key holds a PolicyOR command (0x171)
+openssl asn1parse -inform PEM -in sealed-tpm2.0 >asn1.dump
+if ! grep -Eq "INTEGER +:0*171\$" asn1.dump; then
+	echo "BAD: The sealed key does not contain a PolicyOR command"
+	exit 1
+fi
+echo "GOOD: The sealed key contains a PolicyOR command"
@@ -0,0 +1,72 @@
+#!/bin/bash
+#
+# This script needs to be run with root privilege
+#
+
+# TESTDIR=policy.test
+PCR_MASK=0,2,4,7
+
+pcr_oracle=pcr-oracle
+if [ -x pcr-oracle ]; then
+	pcr_oracle=$PWD/pcr-oracle
+fi
+
+function call_oracle {
+
+	echo "****************"
+	echo "pcr-oracle $*"
+	$pcr_oracle -d "$@"
+}
+
+if [ -z "$TESTDIR" ]; then
+	tmpdir=$(mktemp -d /tmp/pcrtestXXXXXX)
+	trap "cd / && rm -rf $tmpdir" 0 1 2 10 11 15
+
+	TESTDIR=$tmpdir
+fi
+
+trap "echo 'FAIL: command exited with error'; exit 1" ERR
+
+set -e
+cd $TESTDIR
+mkdir corpus
+
+for name in first second third; do
+	echo "Record test case $name"
+	call_oracle \
+		--from eventlog \
+		--verify current \
+		--create-testcase corpus/$name \
+		predict $PCR_MASK
+done
+
+# Anything without a recorded event log is not a test case
+mkdir corpus/not-a-testcase
+
+echo "Replay the corpus"
+call_oracle \
+	--jobs 2 \
+	replay-corpus $PCR_MASK corpus | tee summary
+
+if ! grep -q "^3 testcases: 3 OK, 0 MISMATCH, 0 FAILED" summary; then
+	echo "BAD: Not all test cases replayed successfully"
+	exit 1
+else
+	echo "NICE: all test cases replayed successfully"
+fi
+
+echo "Change the recorded value of PCR 4 in one test case"
+sed -i 's/^04 \([^ ]*\) .*/04 \1 0000000000000000000000000000000000000000000000000000000000000000/' \
+	corpus/second/current-pcrs
+
+call_oracle \
+	--jobs 2 \
+	replay-corpus $PCR_MASK corpus | tee summary || true
+
+if ! grep -q "^3 testcases: 2 OK, 1 MISMATCH, 0 FAILED" summary ||
+   ! grep -q "^second  *MISMATCH" summary; then
+	echo "BAD: The modified test case was not reported as a mismatch"
+	exit 1
+else
+	echo "GOOD: The modified test case was reported as a mismatch"
+fi
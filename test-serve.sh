@@ -0,0 +1,139 @@
+#!/bin/bash
+#
+# Check that the serve action answers malformed requests with an
+# error response, rather than silently dropping the connection, and
+# that requests are handled by long-lived workers.
+#
+
+pcr_oracle=pcr-oracle
+if [ -x pcr-oracle ]; then
+	pcr_oracle=$PWD/pcr-oracle
+fi
+
+if [ -z "$TESTDIR" ]; then
+	tmpdir=$(mktemp -d /tmp/pcrtestXXXXXX)
+	trap "cd / && rm -rf $tmpdir" 0 1 2 10 11 15
+
+	TESTDIR=$tmpdir
+fi
+
+set -e
+cd $TESTDIR
+
+echo "****************"
+echo "pcr-oracle --socket $TESTDIR/serve.sock serve"
+$pcr_oracle --socket $TESTDIR/serve.sock --jobs 2 serve &
+server=$!
+trap "kill $server 2>/dev/null; cd / && rm -rf $TESTDIR" 0 1 2 10 11 15
+
+for i in $(seq 1 50); do
+	test -S serve.sock && break
+	sleep 0.1
+done
+
+if [ "$(stat -c %a serve.sock)" != 600 ]; then
+	echo "FAIL: serve socket has mode $(stat -c %a serve.sock), expected 600"
+	exit 1
+fi
+
+cat >client.py <<'PYTHON'
+import socket, struct, sys
+
+def frame(tag, data = b''):
+	return tag.encode() + struct.pack('<I', len(data)) + data
+
+def recv_exact(sock, count):
+	data = b''
+	while len(data) < count:
+		chunk = sock.recv(count - len(data))
+		if not chunk:
+			raise EOFError("connection closed")
+		data += chunk
+	return data
+
+def recv_message(sock):
+	msg = {}
+	while True:
+		header = recv_exact(sock, 8)
+		tag = header[:4].decode()
+		length = struct.unpack('<I', header[4:])[0]
+		if tag == 'DONE':
+			return msg
+		msg[tag] = recv_exact(sock, length)
+
+def expect_error(msg, what, text):
+	if msg.get('STAT') != b'error' or text not in msg.get('MESG', b''):
+		print("FAIL: %s: unexpected response %s" % (what, msg))
+		sys.exit(1)
+	print("%s: %s" % (what, msg['MESG'].decode().strip()))
+
+def connect():
+	sock = socket.socket(socket.AF_UNIX)
+	sock.connect(sys.argv[1])
+	return sock
+PYTHON
+
+function workers {
+	pgrep -P $server | sort | tr '\n' ' '
+}
+
+# Give the server a moment to start its workers
+sleep 1
+before=$(workers)
+
+python3 - $TESTDIR/serve.sock <<'PYTHON'
+exec(open('client.py').read())
+
+# Requests that fail without calling fatal(), each on a connection of its own
+sock = connect()
+sock.sendall(frame('PCRS', b'4') + frame('DONE'))
+expect_error(recv_message(sock), "missing event log", b'does not contain an event log')
+sock.close()
+
+sock = connect()
+sock.sendall(frame('PCRS', b'4') + frame('ELOG', b'garbage') + frame('COMP', b'shimx64.efi 15.7') + frame('DONE'))
+expect_error(recv_message(sock), "bad component manifest", b'component manifest:1: wrong number of fields')
+sock.close()
+PYTHON
+
+after=$(workers)
+if [ "$before" != "$after" ]; then
+	echo "FAIL: workers changed from $before to $after while handling requests"
+	exit 1
+fi
+echo "Requests were handled by the same workers: $after"
+
+python3 - $TESTDIR/serve.sock <<'PYTHON'
+exec(open('client.py').read())
+
+sock = connect()
+
+# A stop event the predictor cannot parse makes it call fatal()
+bad_stop = frame('PCRS', b'4') + frame('ELOG', b'garbage') + frame('STOP', b'no-such-event=x') + frame('DONE')
+
+sock.sendall(bad_stop)
+expect_error(recv_message(sock), "invalid stop event", b'Fatal:')
+
+# The connection must survive this
+sock.sendall(bad_stop)
+expect_error(recv_message(sock), "invalid stop event, again", b'Fatal:')
+
+# An oversized frame cannot be skipped; the server responds and hangs up
+sock.sendall(b'PCRS' + struct.pack('<I', 0x7fffffff))
+expect_error(recv_message(sock), "malformed frame", b'Malformed request')
+
+if sock.recv(1) != b'':
+	print("FAIL: connection not closed after malformed frame")
+	sys.exit(1)
+PYTHON
+
+# The worker that had a request fail fatally is replaced
+sleep 1
+replaced=$(workers)
+if [ "$replaced" = "$after" -o $(echo $replaced | wc -w) != 2 ]; then
+	echo "FAIL: expected a new worker after a fatal error, have $replaced (was $after)"
+	exit 1
+fi
+echo "Worker was replaced after a fatal error: $replaced"
+
+echo "PASS: serve handles malformed requests, using long-lived workers"